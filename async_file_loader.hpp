@@ -0,0 +1,687 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef WIN32
+#include <Windows.h>
+#endif
+#ifdef __unix__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) &&           \
+    defined(__NR_io_uring_register)
+#define VULKAN_HELPER_HAS_IO_URING 1
+#endif
+#endif
+
+namespace vulkan_helper {
+
+struct async_file_loader_options {
+  // reads larger than this are split, so that one big file does not hold
+  // back the small ones queued after it.
+  uint64_t chunk_size = 1 << 20;
+  // bytes read but not completed yet, further chunks wait in a queue.
+  uint64_t max_bytes_in_flight = 64 << 20;
+  // chunks in flight at once, the size of the submission queue.
+  uint32_t queue_depth = 64;
+  // threads of the fallback when io_uring is not available.
+  uint32_t thread_count = 4;
+  bool use_io_uring = true;
+};
+
+#ifdef VULKAN_HELPER_HAS_IO_URING
+namespace io_uring_helper {
+
+// The submission and completion rings of one io_uring, set up with the raw
+// system calls so that liburing is not needed.
+class ring {
+public:
+  // returns std::nullopt when the kernel has no io_uring or does not allow
+  // it, e.g. inside a sandbox.
+  static std::optional<ring> create(uint32_t entries) {
+    io_uring_params params{};
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+      return std::nullopt;
+    }
+    ring r{};
+    r.m_fd = fd;
+    r.m_sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    r.m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      r.m_sq_size = r.m_cq_size = std::max(r.m_sq_size, r.m_cq_size);
+    }
+    r.m_sq = mmap(NULL, r.m_sq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r.m_sq == MAP_FAILED) {
+      r.m_sq = nullptr;
+      return std::nullopt;
+    }
+    if (single_mmap) {
+      r.m_cq = r.m_sq;
+    } else {
+      r.m_cq = mmap(NULL, r.m_cq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (r.m_cq == MAP_FAILED) {
+        r.m_cq = nullptr;
+        return std::nullopt;
+      }
+    }
+    r.m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(NULL, r.m_sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      return std::nullopt;
+    }
+    r.m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    auto sq = static_cast<char *>(r.m_sq);
+    r.m_sq_tail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+    r.m_sq_mask = *reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+    r.m_sq_array = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+    r.m_sq_entries = params.sq_entries;
+    auto cq = static_cast<char *>(r.m_cq);
+    r.m_cq_head = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+    r.m_cq_tail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+    r.m_cq_mask = *reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+    r.m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    if (!r.supports_read()) {
+      r.m_iovecs.resize(params.sq_entries);
+    }
+    return r;
+  }
+  ring(const ring &) = delete;
+  ring(ring &&other) noexcept { swap(other); }
+  ~ring() { destroy(); }
+  ring &operator=(const ring &) = delete;
+  ring &operator=(ring &&other) noexcept {
+    if (this != &other) {
+      destroy();
+      swap(other);
+    }
+    return *this;
+  }
+
+  uint32_t get_entry_count() const { return m_sq_entries; }
+  bool uses_readv() const { return !m_iovecs.empty(); }
+
+  // queues a read, the kernel sees it after submit(). No more reads than
+  // entries may be in flight.
+  void prepare_read(int fd, void *data, uint32_t size, uint64_t offset,
+                    uint64_t user_data) {
+    // only this thread writes the tail.
+    uint32_t tail = *m_sq_tail;
+    uint32_t index = tail & m_sq_mask;
+    auto &sqe = m_sqes[index];
+    sqe = io_uring_sqe{};
+    if (uses_readv()) {
+      // the iovec of an entry is reused once the ring wrapped, by then the
+      // read that used it completed.
+      m_iovecs[index] = iovec{data, size};
+      sqe.opcode = IORING_OP_READV;
+      sqe.addr = reinterpret_cast<uintptr_t>(&m_iovecs[index]);
+      sqe.len = 1;
+    } else {
+      sqe.opcode = IORING_OP_READ;
+      sqe.addr = reinterpret_cast<uintptr_t>(data);
+      sqe.len = size;
+    }
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.user_data = user_data;
+    m_sq_array[index] = index;
+    std::atomic_ref{*m_sq_tail}.store(tail + 1, std::memory_order_release);
+    m_unsubmitted++;
+  }
+  // hands the prepared reads to the kernel and optionally waits for one
+  // completion.
+  void submit(bool wait_for_completion = false) {
+    while (m_unsubmitted > 0 || wait_for_completion) {
+      uint32_t flags = wait_for_completion ? IORING_ENTER_GETEVENTS : 0;
+      int res = syscall(__NR_io_uring_enter, m_fd, m_unsubmitted,
+                        wait_for_completion ? 1 : 0, flags, NULL, 0);
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EBUSY) {
+          // the completion queue is full, reap before submitting more.
+          return;
+        }
+        throw std::runtime_error{"failed to submit to io_uring"};
+      }
+      m_unsubmitted -= std::min<uint32_t>(res, m_unsubmitted);
+      wait_for_completion = false;
+    }
+  }
+  template <class F> uint32_t for_each_completion(F &&f) {
+    uint32_t head = *m_cq_head;
+    uint32_t tail = std::atomic_ref{*m_cq_tail}.load(std::memory_order_acquire);
+    uint32_t count = tail - head;
+    for (; head != tail; head++) {
+      auto &cqe = m_cqes[head & m_cq_mask];
+      f(cqe.user_data, cqe.res);
+    }
+    std::atomic_ref{*m_cq_head}.store(head, std::memory_order_release);
+    return count;
+  }
+
+private:
+  ring() = default;
+  // IORING_OP_READ and the probe need Linux 5.6, IORING_OP_READV works since
+  // io_uring exists.
+  bool supports_read() const {
+    alignas(io_uring_probe) std::byte
+        buffer[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)]{};
+    auto probe = reinterpret_cast<io_uring_probe *>(buffer);
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe,
+                256) < 0) {
+      return false;
+    }
+    return probe->last_op >= IORING_OP_READ &&
+           (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+  }
+  void swap(ring &other) noexcept {
+    std::swap(m_fd, other.m_fd);
+    std::swap(m_sq, other.m_sq);
+    std::swap(m_cq, other.m_cq);
+    std::swap(m_sqes, other.m_sqes);
+    std::swap(m_sq_size, other.m_sq_size);
+    std::swap(m_cq_size, other.m_cq_size);
+    std::swap(m_sqes_size, other.m_sqes_size);
+    std::swap(m_sq_tail, other.m_sq_tail);
+    std::swap(m_sq_array, other.m_sq_array);
+    std::swap(m_sq_mask, other.m_sq_mask);
+    std::swap(m_sq_entries, other.m_sq_entries);
+    std::swap(m_cq_head, other.m_cq_head);
+    std::swap(m_cq_tail, other.m_cq_tail);
+    std::swap(m_cq_mask, other.m_cq_mask);
+    std::swap(m_cqes, other.m_cqes);
+    std::swap(m_unsubmitted, other.m_unsubmitted);
+    std::swap(m_iovecs, other.m_iovecs);
+  }
+  void destroy() {
+    if (m_sqes != nullptr) {
+      munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq != nullptr && m_cq != m_sq) {
+      munmap(m_cq, m_cq_size);
+    }
+    if (m_sq != nullptr) {
+      munmap(m_sq, m_sq_size);
+    }
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+    m_fd = -1;
+    m_sq = m_cq = nullptr;
+    m_sqes = nullptr;
+  }
+
+  int m_fd = -1;
+  void *m_sq = nullptr;
+  void *m_cq = nullptr;
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sq_size = 0;
+  size_t m_cq_size = 0;
+  size_t m_sqes_size = 0;
+  uint32_t *m_sq_tail = nullptr;
+  uint32_t *m_sq_array = nullptr;
+  uint32_t m_sq_mask = 0;
+  uint32_t m_sq_entries = 0;
+  uint32_t *m_cq_head = nullptr;
+  uint32_t *m_cq_tail = nullptr;
+  uint32_t m_cq_mask = 0;
+  io_uring_cqe *m_cqes = nullptr;
+  uint32_t m_unsubmitted = 0;
+  // one per entry when the kernel only has IORING_OP_READV.
+  std::vector<iovec> m_iovecs;
+};
+
+} // namespace io_uring_helper
+#endif
+
+class async_file_loader;
+
+// A load started by async_file_loader::load(). The loader must be polled
+// for it to make progress, wait() does that itself.
+class async_file_load {
+public:
+  async_file_load() = default;
+
+  bool valid() const { return m_future.valid(); }
+  bool is_ready() const {
+    return m_future.wait_for(std::chrono::seconds{0}) ==
+           std::future_status::ready;
+  }
+  // Polls the loader until this load is complete, returns the bytes read.
+  // A failed read is rethrown here.
+  uint64_t wait();
+  // For other threads, the future only becomes ready when the loading
+  // thread polls.
+  std::shared_future<uint64_t> get_future() const { return m_future; }
+
+private:
+  friend class async_file_loader;
+  async_file_load(async_file_loader *loader,
+                  std::shared_future<uint64_t> future)
+      : m_loader{loader}, m_future{std::move(future)} {}
+
+  async_file_loader *m_loader = nullptr;
+  std::shared_future<uint64_t> m_future;
+};
+
+// Reads files into memory the caller owns, usually the persistently mapped
+// memory of a staging buffer, without blocking the calling thread. Reads go
+// through io_uring on Linux and through pread on a few worker threads
+// elsewhere. The loader is used from one thread: completion callbacks run
+// inside poll() on that thread, so they can record and submit the copy out of
+// the staging buffer directly.
+class async_file_loader {
+public:
+  using completion_callback = std::function<void(std::span<std::byte>)>;
+
+  explicit async_file_loader(async_file_loader_options options = {})
+      : m_options{options}, m_bytes_in_flight{0} {
+    m_options.chunk_size = std::max<uint64_t>(m_options.chunk_size, 4096);
+    m_options.queue_depth = std::max(m_options.queue_depth, 1u);
+#ifdef VULKAN_HELPER_HAS_IO_URING
+    if (m_options.use_io_uring) {
+      m_ring = io_uring_helper::ring::create(m_options.queue_depth);
+      if (m_ring) {
+        // the kernel may round the depth up.
+        m_options.queue_depth =
+            std::min(m_options.queue_depth, m_ring->get_entry_count());
+      }
+    }
+    if (!m_ring)
+#endif
+    {
+      m_thread_pool = std::make_unique<thread_pool>(m_options.thread_count);
+    }
+    m_slots.resize(m_options.queue_depth);
+    m_free_slots.reserve(m_options.queue_depth);
+    for (uint32_t i = m_options.queue_depth; i > 0; i--) {
+      m_free_slots.push_back(i - 1);
+    }
+  }
+  async_file_loader(const async_file_loader &) = delete;
+  async_file_loader(async_file_loader &&) = delete;
+  // the reads in flight write to the destinations, so they are waited for.
+  ~async_file_loader() {
+    while (get_chunks_in_flight() > 0) {
+      wait_for_completion();
+    }
+  }
+  async_file_loader &operator=(const async_file_loader &) = delete;
+  async_file_loader &operator=(async_file_loader &&) = delete;
+
+  bool uses_io_uring() const {
+#ifdef VULKAN_HELPER_HAS_IO_URING
+    return m_ring.has_value();
+#else
+    return false;
+#endif
+  }
+
+  // An open file, closed when the last load reading it completes.
+  struct file_handle {
+    file_handle(const std::filesystem::path &path) {
+#ifdef WIN32
+      m_handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                             NULL);
+      if (m_handle == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error{"failed to open file: " + path.string()};
+      }
+      LARGE_INTEGER size{};
+      if (!GetFileSizeEx(m_handle, &size)) {
+        CloseHandle(m_handle);
+        throw std::runtime_error{"failed to get file size: " + path.string()};
+      }
+      m_size = size.QuadPart;
+#endif
+#ifdef __unix__
+      m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (m_fd == -1) {
+        throw std::runtime_error{"failed to open file: " + path.string()};
+      }
+      struct stat status {};
+      if (fstat(m_fd, &status) == -1) {
+        close(m_fd);
+        throw std::runtime_error{"failed to get file size: " + path.string()};
+      }
+      m_size = status.st_size;
+#endif
+    }
+    file_handle(const file_handle &) = delete;
+    ~file_handle() {
+#ifdef WIN32
+      CloseHandle(m_handle);
+#endif
+#ifdef __unix__
+      close(m_fd);
+#endif
+    }
+    file_handle &operator=(const file_handle &) = delete;
+
+    uint64_t size() const { return m_size; }
+    // blocking positional read, returns the bytes read or a negative error.
+    int64_t read(void *data, uint64_t size, uint64_t offset) const {
+#ifdef WIN32
+      OVERLAPPED overlapped{};
+      overlapped.Offset = static_cast<DWORD>(offset);
+      overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD read_size = 0;
+      if (!ReadFile(m_handle, data,
+                    static_cast<DWORD>(std::min<uint64_t>(size, 1u << 30)),
+                    &read_size, &overlapped)) {
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+      }
+      return read_size;
+#endif
+#ifdef __unix__
+      ssize_t res = pread(m_fd, data, size, offset);
+      return res < 0 ? -errno : res;
+#endif
+    }
+#ifdef __unix__
+    int get_fd() const { return m_fd; }
+#endif
+
+  private:
+#ifdef WIN32
+    HANDLE m_handle;
+#endif
+#ifdef __unix__
+    int m_fd;
+#endif
+    uint64_t m_size;
+  };
+  // opens path once for several loads, e.g. the chunks of a file streamed
+  // through a small buffer.
+  static std::shared_ptr<const file_handle>
+  open_file(const std::filesystem::path &path) {
+    return std::make_shared<const file_handle>(path);
+  }
+
+  // Reads the file from file_offset into destination, up to the end of the
+  // file or of the destination. The destination must stay valid until the
+  // load completes. on_complete receives the filled part of the destination.
+  async_file_load load(const std::filesystem::path &path,
+                       std::span<std::byte> destination,
+                       completion_callback on_complete = {},
+                       uint64_t file_offset = 0) {
+    return load(open_file(path), destination, std::move(on_complete),
+                file_offset);
+  }
+  async_file_load load(std::shared_ptr<const file_handle> file,
+                       std::span<std::byte> destination,
+                       completion_callback on_complete = {},
+                       uint64_t file_offset = 0) {
+    auto state = std::make_shared<load_state>(std::move(file));
+    uint64_t file_size = state->file->size();
+    uint64_t size =
+        file_offset < file_size
+            ? std::min<uint64_t>(destination.size(), file_size - file_offset)
+            : 0;
+    state->destination = destination.first(size);
+    state->on_complete = std::move(on_complete);
+    async_file_load handle{this, state->promise.get_future().share()};
+
+    if (size == 0) {
+      m_finished.push_back(std::move(state));
+      return handle;
+    }
+    state->remaining_chunks =
+        (size + m_options.chunk_size - 1) / m_options.chunk_size;
+    for (uint64_t offset = 0; offset < size; offset += m_options.chunk_size) {
+      m_pending.push_back(chunk{
+          .load = state,
+          .file_offset = file_offset + offset,
+          .data = destination.data() + offset,
+          .size = std::min(m_options.chunk_size, size - offset),
+      });
+    }
+    submit_pending();
+    return handle;
+  }
+
+  // Handles the completed reads and starts queued ones, returns the number of
+  // loads completed. Never blocks.
+  uint32_t poll() {
+    uint32_t completed = complete_finished();
+#ifdef VULKAN_HELPER_HAS_IO_URING
+    if (m_ring) {
+      m_ring->for_each_completion([this, &completed](uint64_t slot, int res) {
+        completed += complete_chunk(slot, res);
+      });
+    } else
+#endif
+    {
+      std::vector<std::pair<uint32_t, int64_t>> results;
+      {
+        std::lock_guard lock{m_results_mutex};
+        results.swap(m_results);
+      }
+      for (auto [slot, res] : results) {
+        completed += complete_chunk(slot, res);
+      }
+    }
+    submit_pending();
+    completed += complete_finished();
+    return completed;
+  }
+  // Blocks until at least one read completes, then polls.
+  uint32_t wait_for_completion() {
+    uint32_t completed = poll();
+    if (completed > 0 || get_chunks_in_flight() == 0) {
+      return completed;
+    }
+#ifdef VULKAN_HELPER_HAS_IO_URING
+    if (m_ring) {
+      m_ring->submit(true);
+    } else
+#endif
+    {
+      std::unique_lock lock{m_results_mutex};
+      m_result_available.wait(lock, [this]() { return !m_results.empty(); });
+    }
+    return poll();
+  }
+  void wait_idle() {
+    while (get_chunks_in_flight() > 0 || !m_pending.empty() ||
+           !m_finished.empty()) {
+      wait_for_completion();
+    }
+  }
+
+  uint64_t get_bytes_in_flight() const { return m_bytes_in_flight; }
+  uint32_t get_chunks_in_flight() const {
+    return m_slots.size() - m_free_slots.size();
+  }
+  size_t get_pending_chunk_count() const { return m_pending.size(); }
+
+private:
+  struct load_state {
+    load_state(std::shared_ptr<const file_handle> file)
+        : file{std::move(file)}, remaining_chunks{0}, failed{false} {}
+
+    std::shared_ptr<const file_handle> file;
+    std::span<std::byte> destination;
+    completion_callback on_complete;
+    std::promise<uint64_t> promise;
+    uint64_t remaining_chunks;
+    bool failed;
+  };
+  struct chunk {
+    std::shared_ptr<load_state> load;
+    uint64_t file_offset;
+    std::byte *data;
+    uint64_t size;
+  };
+
+  // starts queued chunks while the slots and the byte budget allow it. One
+  // chunk is always allowed, so that a chunk larger than the budget still
+  // makes progress.
+  void submit_pending() {
+    while (!m_pending.empty() && !m_free_slots.empty()) {
+      auto &next = m_pending.front();
+      if (next.load->failed) {
+        // the rest of a failed load is not read.
+        auto load = std::move(next.load);
+        m_pending.pop_front();
+        finish_chunk(std::move(load));
+        continue;
+      }
+      if (m_bytes_in_flight > 0 &&
+          m_bytes_in_flight + next.size > m_options.max_bytes_in_flight) {
+        break;
+      }
+      uint32_t slot = m_free_slots.back();
+      m_free_slots.pop_back();
+      m_bytes_in_flight += next.size;
+      m_slots[slot] = std::move(next);
+      m_pending.pop_front();
+      start_read(slot);
+    }
+#ifdef VULKAN_HELPER_HAS_IO_URING
+    if (m_ring) {
+      m_ring->submit();
+    }
+#endif
+  }
+  void start_read(uint32_t slot) {
+    auto &c = *m_slots[slot];
+#ifdef VULKAN_HELPER_HAS_IO_URING
+    if (m_ring) {
+      // a read returns at most 1 GiB, the rest is read after the short read.
+      m_ring->prepare_read(c.load->file->get_fd(), c.data,
+                           std::min<uint64_t>(c.size, 1u << 30), c.file_offset,
+                           slot);
+      return;
+    }
+#endif
+    m_thread_pool->submit([this, slot, load = c.load.get(), data = c.data,
+                           size = c.size, offset = c.file_offset]() {
+      int64_t res = load->file->read(data, size, offset);
+      {
+        std::lock_guard lock{m_results_mutex};
+        m_results.emplace_back(slot, res);
+      }
+      m_result_available.notify_one();
+    });
+  }
+  // returns the number of loads completed by this chunk.
+  uint32_t complete_chunk(uint32_t slot, int64_t res) {
+    auto &c = *m_slots[slot];
+#ifdef __unix__
+    if (res == -EINTR || res == -EAGAIN) {
+      start_read(slot);
+      return 0;
+    }
+#endif
+    if (res > 0 && static_cast<uint64_t>(res) < c.size) {
+      // a short read, continue with the rest in the same slot.
+      m_bytes_in_flight -= res;
+      c.file_offset += res;
+      c.data += res;
+      c.size -= res;
+      start_read(slot);
+      return 0;
+    }
+    if (res <= 0) {
+      // the file shrank or the read failed.
+      c.load->failed = true;
+    }
+    m_bytes_in_flight -= c.size;
+    auto load = std::move(c.load);
+    m_slots[slot].reset();
+    m_free_slots.push_back(slot);
+    return finish_chunk(std::move(load));
+  }
+  uint32_t finish_chunk(std::shared_ptr<load_state> load) {
+    if (--load->remaining_chunks > 0) {
+      return 0;
+    }
+    complete_load(*load);
+    return 1;
+  }
+  uint32_t complete_finished() {
+    uint32_t completed = 0;
+    while (!m_finished.empty()) {
+      auto load = std::move(m_finished.front());
+      m_finished.pop_front();
+      complete_load(*load);
+      completed++;
+    }
+    return completed;
+  }
+  void complete_load(load_state &load) {
+    if (load.failed) {
+      load.promise.set_exception(std::make_exception_ptr(
+          std::runtime_error{"failed to read file"}));
+      return;
+    }
+    try {
+      if (load.on_complete) {
+        load.on_complete(load.destination);
+      }
+      load.promise.set_value(load.destination.size());
+    } catch (...) {
+      load.promise.set_exception(std::current_exception());
+    }
+  }
+
+  async_file_loader_options m_options;
+  std::deque<chunk> m_pending;
+  std::deque<std::shared_ptr<load_state>> m_finished;
+  std::vector<std::optional<chunk>> m_slots;
+  std::vector<uint32_t> m_free_slots;
+  uint64_t m_bytes_in_flight;
+#ifdef VULKAN_HELPER_HAS_IO_URING
+  std::optional<io_uring_helper::ring> m_ring;
+#endif
+  // fallback, the workers report (slot, result) pairs.
+  std::mutex m_results_mutex;
+  std::condition_variable m_result_available;
+  std::vector<std::pair<uint32_t, int64_t>> m_results;
+  std::unique_ptr<thread_pool> m_thread_pool;
+};
+
+inline uint64_t async_file_load::wait() {
+  while (!is_ready()) {
+    m_loader->wait_for_completion();
+  }
+  return m_future.get();
+}
+
+} // namespace vulkan_helper
@@ -0,0 +1,331 @@
+#pragma once
+
+#include "vulkan_helper.hpp"
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <vector>
+
+namespace vulkan_helper {
+
+struct workgroup_size {
+  uint32_t x = 1;
+  uint32_t y = 1;
+  uint32_t z = 1;
+  // 0 leaves the subgroup size to the driver.
+  uint32_t subgroup_size = 0;
+};
+
+// Tuned workgroup sizes on disk, one "key x y z subgroup_size" line each.
+class workgroup_size_table {
+public:
+  explicit workgroup_size_table(std::filesystem::path path)
+      : m_path{std::move(path)} {
+    auto file = std::ifstream{m_path};
+    std::string line;
+    while (std::getline(file, line)) {
+      auto stream = std::istringstream{line};
+      uint64_t key;
+      workgroup_size size;
+      if (stream >> std::hex >> key >> std::dec >> size.x >> size.y >>
+          size.z >> size.subgroup_size) {
+        m_sizes[key] = size;
+      }
+    }
+  }
+
+  std::optional<workgroup_size> find(uint64_t key) const {
+    auto it = m_sizes.find(key);
+    if (it == m_sizes.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+  void set(uint64_t key, workgroup_size size) { m_sizes[key] = size; }
+  void save() const {
+    auto stream = std::ostringstream{};
+    for (auto &[key, size] : m_sizes) {
+      stream << std::hex << key << std::dec << ' ' << size.x << ' ' << size.y
+             << ' ' << size.z << ' ' << size.subgroup_size << '\n';
+    }
+    auto data = stream.str();
+    vulkan_hpp_helper::write_file_atomically(m_path, data);
+  }
+
+private:
+  std::filesystem::path m_path;
+  std::map<uint64_t, workgroup_size> m_sizes;
+};
+
+// A compute shader and one representative dispatch of it. The shader takes
+// its local size from the constants in local_size_ids, as declared with
+// layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in.
+// invocations is the total thread count of the dispatch per dimension.
+struct compute_tuning_problem {
+  std::span<const uint32_t> code;
+  const char *entry_name = "main";
+  VkPipelineLayout pipeline_layout;
+  VkDescriptorSet descriptor_set;
+  std::array<uint32_t, 3> invocations;
+  std::array<uint32_t, 3> local_size_ids{0, 1, 2};
+  vulkan_hpp_helper::specialization_constants specialization;
+  uint32_t repetitions = 8;
+  // needs device_create_info::enable_subgroup_size_control().
+  bool tune_subgroup_size = false;
+};
+
+// Times every candidate workgroup size of a problem with GPU timestamps and
+// remembers the fastest per device, driver and shader in a
+// workgroup_size_table, which is saved on destruction. create_pipeline() uses
+// the stored size, and tunes first if there is none.
+//
+// D is a device stack with add_device_wrapper_functions and
+// add_physical_device_wrapper_functions, CommandBuffer is a command_buffer
+// in the initial state whenever the autotuner records into it.
+template <class D, class CommandBuffer> class compute_autotuner {
+public:
+  compute_autotuner(D &device, CommandBuffer &command_buffer, VkQueue queue,
+                    std::filesystem::path table_path)
+      : m_device{device}, m_command_buffer{command_buffer}, m_queue{queue},
+        m_table{std::move(table_path)}, m_fence{device.create_fence()} {
+    auto properties = device.get_physical_device_properties();
+    m_limits = properties.limits;
+    auto id_properties = device.get_physical_device_id_properties();
+    m_device_key = vulkan_helper::hash_combine(
+        vulkan_helper::hash_bytes(id_properties.deviceUUID, VK_UUID_SIZE),
+        properties.driverVersion);
+    if (device.supports_subgroup_size_control()) {
+      m_subgroup_properties = device.get_subgroup_size_control_properties();
+    }
+  }
+  compute_autotuner(const compute_autotuner &) = delete;
+  compute_autotuner(compute_autotuner &&) = delete;
+  ~compute_autotuner() {
+    try {
+      save();
+    } catch (...) {
+    }
+    m_device.destroy_fence(m_fence);
+  }
+  compute_autotuner &operator=(const compute_autotuner &) = delete;
+  compute_autotuner &operator=(compute_autotuner &&) = delete;
+
+  uint64_t get_key(const compute_tuning_problem &problem) const {
+    auto key = vulkan_helper::hash_combine(m_device_key,
+                                           vulkan_helper::hash_spirv(problem.code));
+    key = vulkan_helper::hash_combine(
+        key, vulkan_helper::hash_bytes(problem.entry_name,
+                                       std::strlen(problem.entry_name)));
+    for (auto count : problem.invocations) {
+      key = vulkan_helper::hash_combine(key, count);
+    }
+    auto specialization_info = problem.specialization.get_info();
+    return vulkan_helper::hash_combine(
+        key, vulkan_helper::hash_bytes(specialization_info.pData,
+                                       specialization_info.dataSize));
+  }
+
+  std::vector<workgroup_size>
+  get_candidates(const compute_tuning_problem &problem) const {
+    std::vector<uint32_t> subgroup_sizes{0};
+    if (problem.tune_subgroup_size &&
+        (m_subgroup_properties.requiredSubgroupSizeStages &
+         VK_SHADER_STAGE_COMPUTE_BIT)) {
+      for (uint32_t size = m_subgroup_properties.minSubgroupSize;
+           size <= m_subgroup_properties.maxSubgroupSize; size *= 2) {
+        subgroup_sizes.push_back(size);
+      }
+    }
+    // powers of two per used dimension, not larger than the dispatch needs.
+    std::array<std::vector<uint32_t>, 3> dimension_sizes;
+    for (uint32_t d = 0; d < 3; d++) {
+      dimension_sizes[d].push_back(1);
+      if (problem.invocations[d] <= 1) {
+        continue;
+      }
+      for (uint32_t size = 2; size <= m_limits.maxComputeWorkGroupSize[d] &&
+                              size / 2 < problem.invocations[d];
+           size *= 2) {
+        dimension_sizes[d].push_back(size);
+      }
+    }
+    uint32_t max_invocations = m_limits.maxComputeWorkGroupInvocations;
+    std::vector<workgroup_size> candidates;
+    for (auto x : dimension_sizes[0]) {
+      for (auto y : dimension_sizes[1]) {
+        for (auto z : dimension_sizes[2]) {
+          uint32_t count = x * y * z;
+          // tiny groups leave most lanes of a subgroup idle.
+          if (count > max_invocations ||
+              (count < 32 && !is_whole_dispatch(problem, x, y, z))) {
+            continue;
+          }
+          for (auto subgroup_size : subgroup_sizes) {
+            if (subgroup_size != 0 &&
+                count > subgroup_size *
+                            m_subgroup_properties.maxComputeWorkgroupSubgroups) {
+              continue;
+            }
+            candidates.push_back(workgroup_size{x, y, z, subgroup_size});
+          }
+        }
+      }
+    }
+    return candidates;
+  }
+
+  // Measures all candidates and stores the fastest in the table.
+  workgroup_size tune(const compute_tuning_problem &problem) {
+    auto candidates = get_candidates(problem);
+    if (candidates.empty()) {
+      throw std::runtime_error{"no workgroup size candidates"};
+    }
+    VkShaderModule shader_module = m_device.create_shader_module(problem.code);
+    std::vector<VkPipeline> pipelines;
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    try {
+      for (auto &candidate : candidates) {
+        pipelines.push_back(create_pipeline(shader_module, problem, candidate));
+      }
+      query_pool =
+          m_device.create_query_pool(VK_QUERY_TYPE_TIMESTAMP, 2 * candidates.size());
+      record(problem, candidates, pipelines, query_pool);
+      submit_and_wait();
+      auto timestamps =
+          m_device.get_query_pool_results(query_pool, 0, 2 * candidates.size());
+      uint32_t best = 0;
+      for (uint32_t i = 1; i < candidates.size(); i++) {
+        if (timestamps[2 * i + 1] - timestamps[2 * i] <
+            timestamps[2 * best + 1] - timestamps[2 * best]) {
+          best = i;
+        }
+      }
+      m_table.set(get_key(problem), candidates[best]);
+      release(shader_module, pipelines, query_pool);
+      return candidates[best];
+    } catch (...) {
+      release(shader_module, pipelines, query_pool);
+      throw;
+    }
+  }
+  workgroup_size get_workgroup_size(const compute_tuning_problem &problem) {
+    if (auto size = m_table.find(get_key(problem))) {
+      return *size;
+    }
+    return tune(problem);
+  }
+  VkPipeline create_pipeline(VkShaderModule shader_module,
+                             const compute_tuning_problem &problem) {
+    return create_pipeline(shader_module, problem, get_workgroup_size(problem));
+  }
+  VkPipeline create_pipeline(VkShaderModule shader_module,
+                             const compute_tuning_problem &problem,
+                             const workgroup_size &size) {
+    auto specialization = problem.specialization;
+    specialization.set(problem.local_size_ids[0], size.x)
+        .set(problem.local_size_ids[1], size.y)
+        .set(problem.local_size_ids[2], size.z);
+    auto specialization_info = specialization.get_info();
+
+    VkPipelineShaderStageRequiredSubgroupSizeCreateInfo subgroup_size_info{};
+    subgroup_size_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO;
+    subgroup_size_info.requiredSubgroupSize = size.subgroup_size;
+
+    VkComputePipelineCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    create_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    create_info.stage.pNext =
+        size.subgroup_size != 0 ? &subgroup_size_info : nullptr;
+    create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    create_info.stage.module = shader_module;
+    create_info.stage.pName = problem.entry_name;
+    create_info.stage.pSpecializationInfo = &specialization_info;
+    create_info.layout = problem.pipeline_layout;
+    return m_device.create_compute_pipeline(create_info);
+  }
+  void save() const { m_table.save(); }
+
+private:
+  static bool is_whole_dispatch(const compute_tuning_problem &problem,
+                                uint32_t x, uint32_t y, uint32_t z) {
+    return x >= problem.invocations[0] && y >= problem.invocations[1] &&
+           z >= problem.invocations[2];
+  }
+  static uint32_t group_count(uint32_t invocations, uint32_t size) {
+    return std::max((invocations + size - 1) / size, 1u);
+  }
+  // one warm up dispatch per candidate, then the timed repetitions between a
+  // pair of timestamps. the barriers keep repetitions from overlapping.
+  void record(const compute_tuning_problem &problem,
+              const std::vector<workgroup_size> &candidates,
+              const std::vector<VkPipeline> &pipelines, VkQueryPool query_pool) {
+    auto &cb = m_command_buffer;
+    cb.begin();
+    cb.reset_query_pool(query_pool, 0, 2 * candidates.size());
+    cb.bind_descriptor_sets(VK_PIPELINE_BIND_POINT_COMPUTE,
+                            problem.pipeline_layout, problem.descriptor_set);
+    for (uint32_t i = 0; i < candidates.size(); i++) {
+      auto &size = candidates[i];
+      cb.bind_pipeline(VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[i]);
+      for (uint32_t r = 0; r <= problem.repetitions; r++) {
+        if (r == 1) {
+          cb.write_timestamp(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, query_pool,
+                             2 * i);
+        }
+        cb.memory_barrier(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                          VK_ACCESS_2_SHADER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                          VK_ACCESS_2_SHADER_READ_BIT |
+                              VK_ACCESS_2_SHADER_WRITE_BIT);
+        cb.dispatch(group_count(problem.invocations[0], size.x),
+                    group_count(problem.invocations[1], size.y),
+                    group_count(problem.invocations[2], size.z));
+      }
+      cb.write_timestamp(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, query_pool,
+                         2 * i + 1);
+    }
+    cb.end();
+  }
+  void submit_and_wait() {
+    VkCommandBuffer command_buffer = m_command_buffer.get_command_buffer();
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    m_device.reset_fence(m_fence);
+    auto res = vkQueueSubmit(m_queue, 1, &submit_info, m_fence);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to submit to queue"};
+    }
+    m_device.wait_for_fence(m_fence);
+  }
+  void release(VkShaderModule shader_module,
+               const std::vector<VkPipeline> &pipelines,
+               VkQueryPool query_pool) {
+    for (auto pipeline : pipelines) {
+      m_device.destroy_pipeline(pipeline);
+    }
+    if (query_pool != VK_NULL_HANDLE) {
+      m_device.destroy_query_pool(query_pool);
+    }
+    m_device.destroy_shader_module(shader_module);
+  }
+
+  D &m_device;
+  CommandBuffer &m_command_buffer;
+  VkQueue m_queue;
+  workgroup_size_table m_table;
+  VkFence m_fence;
+  VkPhysicalDeviceLimits m_limits;
+  VkPhysicalDeviceSubgroupSizeControlProperties m_subgroup_properties{};
+  uint64_t m_device_key;
+};
+
+} // namespace vulkan_helper
@@ -0,0 +1,63 @@
+# Writes the words of a SPIR-V file as a constexpr std::array header.
+#   cmake -DNAME=<name> -DSPIRV=<spv> -DOUTPUT=<header> [-DEMBED=ON]
+#         -P embed_spirv.cmake
+# With EMBED the header reads the file with #embed instead of listing the
+# words, the compiler then has to support it.
+get_filename_component(SPIRV ${SPIRV} ABSOLUTE)
+file(SIZE ${SPIRV} size)
+math(EXPR remainder "${size} % 4")
+if (NOT remainder EQUAL 0)
+  message(FATAL_ERROR "spirv size is not a multiple of 4: ${SPIRV}")
+endif()
+math(EXPR word_count "${size} / 4")
+
+set(content "// generated from ${SPIRV} by embed_spirv.cmake, do not edit.
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+")
+if (EMBED)
+  string(APPEND content
+"inline constexpr std::array<uint32_t, ${word_count}> ${NAME} = []() {
+  constexpr unsigned char bytes[] = {
+#embed \"${SPIRV}\"
+  };
+  std::array<uint32_t, ${word_count}> code{};
+  for (size_t i = 0; i < code.size(); i++) {
+    code[i] = uint32_t{bytes[4 * i]} | uint32_t{bytes[4 * i + 1]} << 8 |
+              uint32_t{bytes[4 * i + 2]} << 16 |
+              uint32_t{bytes[4 * i + 3]} << 24;
+  }
+  return code;
+}();
+")
+else()
+  file(READ ${SPIRV} hex HEX)
+  string(REGEX MATCHALL "........" hex_words "${hex}")
+  set(words "")
+  set(index 0)
+  foreach(hex_word ${hex_words})
+    if (index GREATER 0)
+      math(EXPR column "${index} % 6")
+      if (column EQUAL 0)
+        string(APPEND words "\n    ")
+      else()
+        string(APPEND words " ")
+      endif()
+    endif()
+    # SPIR-V words are little endian in the file.
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u," word
+           ${hex_word})
+    string(APPEND words ${word})
+    math(EXPR index "${index} + 1")
+  endforeach()
+  string(APPEND content
+"inline constexpr std::array<uint32_t, ${word_count}> ${NAME}{
+    ${words}
+};
+")
+endif()
+file(WRITE ${OUTPUT} "${content}")
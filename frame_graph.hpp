@@ -0,0 +1,724 @@
+#pragma once
+
+#include "vulkan_helper.hpp"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace vulkan_helper {
+
+enum class frame_graph_queue {
+  graphics,
+  compute,
+};
+
+struct frame_graph_buffer_info {
+  VkDeviceSize size;
+  VkBufferUsageFlags usage;
+};
+struct frame_graph_image_info {
+  VkImageType image_type;
+  VkFormat format;
+  VkExtent3D extent;
+  uint32_t mip_levels = 1;
+  uint32_t array_layers = 1;
+  VkImageUsageFlags usage;
+  VkImageAspectFlags aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+// A run of passes recorded into one command buffer and submitted to one queue.
+// wait_batches are earlier batches on the other queue that have to signal a
+// semaphore this batch waits on. The barriers of a batch only cover earlier
+// uses on the same queue, so the wait has to be for every stage of the batch,
+// for example VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT.
+struct frame_graph_batch {
+  frame_graph_queue queue;
+  std::vector<uint32_t> passes;
+  std::vector<uint32_t> wait_batches;
+};
+
+// Passes declare which buffers and images they read and write. compile()
+// culls passes that do not contribute to an output, groups independent passes
+// into levels so that each level needs a single barrier batch, places
+// transient resources that are not used in the same step in the same memory,
+// and
+// optionally moves compute passes to a second queue. execute() records the
+// barriers through command_buffer and calls every pass with it. Resource state
+// is tracked per queue, a resource moving to the other queue relies on the
+// semaphore between the batches and only gets its layout transition there.
+// Imported images keep the layout the last execute() left them in.
+//
+// D is a device stack with add_device_wrapper_functions and
+// add_physical_device_wrapper_functions, CommandBuffer is a command_buffer.
+template <class D, class CommandBuffer> class frame_graph {
+public:
+  using resource = uint32_t;
+
+  class pass_builder {
+  public:
+    void read_buffer(resource res, VkPipelineStageFlags2 stages,
+                     VkAccessFlags2 access) {
+      add_access(res, false, stages, access, VK_IMAGE_LAYOUT_UNDEFINED, false);
+    }
+    void write_buffer(resource res, VkPipelineStageFlags2 stages,
+                      VkAccessFlags2 access) {
+      add_access(res, false, stages, access, VK_IMAGE_LAYOUT_UNDEFINED, true);
+    }
+    void read_image(resource res, const image_use &use) {
+      add_access(res, true, use.stages, use.access, use.layout, false);
+    }
+    void write_image(resource res, const image_use &use) {
+      add_access(res, true, use.stages, use.access, use.layout, true);
+    }
+    // keep this pass even if nothing reads what it writes.
+    void set_side_effect() { m_graph.m_passes[m_pass_index].side_effect = true; }
+
+  private:
+    friend class frame_graph;
+    pass_builder(frame_graph &graph, uint32_t pass_index)
+        : m_graph{graph}, m_pass_index{pass_index} {}
+    void add_access(resource res, bool image, VkPipelineStageFlags2 stages,
+                    VkAccessFlags2 access, VkImageLayout layout, bool write) {
+      if (res >= m_graph.m_resources.size()) {
+        throw std::runtime_error{"frame graph resource does not exist"};
+      }
+      if (m_graph.m_resources[res].is_image != image) {
+        throw std::runtime_error{"frame graph resource type mismatch"};
+      }
+      m_graph.m_passes[m_pass_index].accesses.emplace_back(res, stages, access,
+                                                           layout, write);
+    }
+    frame_graph &m_graph;
+    uint32_t m_pass_index;
+  };
+
+  frame_graph(D &device, uint32_t graphics_queue_family_index,
+              uint32_t compute_queue_family_index = VK_QUEUE_FAMILY_IGNORED)
+      : m_device{device},
+        m_graphics_queue_family_index{graphics_queue_family_index},
+        m_compute_queue_family_index{compute_queue_family_index} {}
+  frame_graph(const frame_graph &) = delete;
+  frame_graph(frame_graph &&) = delete;
+  ~frame_graph() { release(); }
+  frame_graph &operator=(const frame_graph &) = delete;
+  frame_graph &operator=(frame_graph &&) = delete;
+
+  resource create_buffer(std::string name, const frame_graph_buffer_info &info) {
+    auto &node = m_resources.emplace_back();
+    node.name = std::move(name);
+    node.buffer_info = info;
+    return m_resources.size() - 1;
+  }
+  resource create_image(std::string name, const frame_graph_image_info &info) {
+    auto &node = m_resources.emplace_back();
+    node.name = std::move(name);
+    node.is_image = true;
+    node.image_info = info;
+    return m_resources.size() - 1;
+  }
+  // imported resources are owned by the caller and count as outputs.
+  resource import_buffer(std::string name, VkBuffer buffer) {
+    auto &node = m_resources.emplace_back();
+    node.name = std::move(name);
+    node.imported = true;
+    node.output = true;
+    node.buffer = buffer;
+    return m_resources.size() - 1;
+  }
+  resource import_image(std::string name, VkImage image,
+                        const frame_graph_image_info &info,
+                        VkImageLayout layout) {
+    auto &node = m_resources.emplace_back();
+    node.name = std::move(name);
+    node.is_image = true;
+    node.imported = true;
+    node.output = true;
+    node.image_info = info;
+    node.image = image;
+    node.layout = layout;
+    return m_resources.size() - 1;
+  }
+  // the layout an imported image is in at the next execute(), when something
+  // outside of the graph changed it, for example a present.
+  void set_image_layout(resource res, VkImageLayout layout) {
+    auto &node = m_resources.at(res);
+    if (!node.is_image || !node.imported) {
+      throw std::runtime_error{"frame graph resource is not an imported image"};
+    }
+    node.layout = layout;
+  }
+  void mark_output(resource res) { m_resources.at(res).output = true; }
+
+  uint32_t add_pass(std::string name, frame_graph_queue queue,
+                    std::invocable<pass_builder &> auto &&setup,
+                    std::function<void(CommandBuffer &)> execute) {
+    auto &pass = m_passes.emplace_back();
+    pass.name = std::move(name);
+    pass.queue = queue;
+    pass.execute = std::move(execute);
+    uint32_t index = m_passes.size() - 1;
+    auto builder = pass_builder{*this, index};
+    setup(builder);
+    return index;
+  }
+
+  void compile(bool async_compute = false) {
+    release();
+    m_async_compute =
+        async_compute && m_compute_queue_family_index != VK_QUEUE_FAMILY_IGNORED;
+    cull_passes();
+    build_dependencies();
+    schedule_passes();
+    build_batches();
+    create_resources();
+    alias_memory();
+  }
+
+  const std::vector<frame_graph_batch> &get_batches() const {
+    return m_batches;
+  }
+  bool is_pass_culled(uint32_t pass) const { return m_passes.at(pass).culled; }
+  VkBuffer get_buffer(resource res) const { return m_resources.at(res).buffer; }
+  VkImage get_image(resource res) const { return m_resources.at(res).image; }
+  // layout of an imported image after the last execute().
+  VkImageLayout get_final_layout(resource res) const {
+    return m_resources.at(res).layout;
+  }
+  VkDeviceSize get_transient_memory_size() const {
+    VkDeviceSize size = 0;
+    for (auto &heap : m_heaps) {
+      size += heap.size;
+    }
+    return size;
+  }
+
+  // record every batch into the same command buffer.
+  void execute(CommandBuffer &command_buffer) {
+    execute([&command_buffer](const frame_graph_batch &) -> CommandBuffer & {
+      return command_buffer;
+    });
+  }
+  // get_command_buffer returns the command buffer to record a batch into,
+  // submitting them in batch order is left to the caller.
+  void execute(std::invocable<const frame_graph_batch &> auto &&get_command_buffer) {
+    reset_states();
+    for (auto &batch : m_batches) {
+      CommandBuffer &command_buffer = get_command_buffer(batch);
+      auto begin = batch.passes.begin();
+      while (begin != batch.passes.end()) {
+        uint32_t level = m_passes[*begin].level;
+        auto end = std::find_if(begin, batch.passes.end(),
+                                [this, level](uint32_t pass) {
+                                  return m_passes[pass].level != level;
+                                });
+        // declare every use of the level first, so its barriers go out as one
+        // batch before the first pass records an action command.
+        for (auto it = begin; it != end; ++it) {
+          declare_uses(command_buffer, *it);
+        }
+        for (auto it = begin; it != end; ++it) {
+          if (m_passes[*it].execute) {
+            m_passes[*it].execute(command_buffer);
+          }
+        }
+        begin = end;
+      }
+    }
+    for (auto &node : m_resources) {
+      if (node.is_image && node.imported && node.executed_queue) {
+        node.layout =
+            get_tracker(*node.executed_queue).get_layout(node.image, 0, 0);
+      }
+    }
+  }
+
+private:
+  struct resource_access {
+    resource res;
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+    bool write;
+  };
+  struct pass_node {
+    std::string name;
+    frame_graph_queue queue;
+    std::vector<resource_access> accesses;
+    std::function<void(CommandBuffer &)> execute;
+    bool side_effect = false;
+    bool culled = false;
+    uint32_t level = 0;
+    uint32_t position = 0;
+    uint32_t batch = 0;
+    // the passes of a level in a batch are recorded together after one
+    // barrier batch, they are one step.
+    uint32_t step = 0;
+    std::vector<uint32_t> dependencies;
+  };
+  struct resource_node {
+    std::string name;
+    bool is_image = false;
+    bool imported = false;
+    bool output = false;
+    frame_graph_buffer_info buffer_info{};
+    frame_graph_image_info image_info{};
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkImage image = VK_NULL_HANDLE;
+    // of an imported image at the start of the next execute().
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // queue of the last use in the current execute().
+    std::optional<frame_graph_queue> executed_queue;
+    // compile results, positions are indices into m_schedule.
+    bool used = false;
+    uint32_t first_use = 0;
+    uint32_t last_use = 0;
+    uint32_t first_step = 0;
+    uint32_t last_step = 0;
+    VkMemoryRequirements requirements{};
+    uint32_t heap = 0;
+    VkDeviceSize offset = 0;
+    // last uses of resources that occupied the same memory before.
+    VkPipelineStageFlags2 alias_src_stages = 0;
+    VkAccessFlags2 alias_src_access = 0;
+  };
+  struct buffer_state {
+    VkPipelineStageFlags2 write_stages;
+    VkAccessFlags2 write_access;
+    VkPipelineStageFlags2 read_stages;
+    VkPipelineStageFlags2 visible_stages;
+    VkAccessFlags2 visible_access;
+  };
+  struct heap {
+    uint32_t memory_type_index;
+    VkDeviceSize size;
+    VkDeviceMemory memory;
+  };
+
+  void cull_passes() {
+    std::vector<bool> needed(m_resources.size());
+    for (uint32_t i = 0; i < m_resources.size(); i++) {
+      needed[i] = m_resources[i].output;
+    }
+    for (auto it = m_passes.rbegin(); it != m_passes.rend(); ++it) {
+      auto &pass = *it;
+      pass.culled = !pass.side_effect &&
+                    std::ranges::none_of(pass.accesses, [&needed](auto &access) {
+                      return access.write && needed[access.res];
+                    });
+      if (pass.culled) {
+        continue;
+      }
+      for (auto &access : pass.accesses) {
+        if (!access.write) {
+          needed[access.res] = true;
+        }
+      }
+    }
+  }
+  void build_dependencies() {
+    struct version {
+      int64_t writer = -1;
+      std::vector<uint32_t> readers;
+      VkImageLayout read_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+    std::vector<version> versions(m_resources.size());
+    for (uint32_t p = 0; p < m_passes.size(); p++) {
+      auto &pass = m_passes[p];
+      pass.dependencies.clear();
+      if (pass.culled) {
+        continue;
+      }
+      auto depend_on = [&pass, p](int64_t other) {
+        if (other >= 0 && other != p) {
+          pass.dependencies.push_back(other);
+        }
+      };
+      for (auto &access : pass.accesses) {
+        if (access.write) {
+          continue;
+        }
+        auto &v = versions[access.res];
+        depend_on(v.writer);
+        // readers in another layout need a transition between them.
+        if (m_resources[access.res].is_image && !v.readers.empty() &&
+            v.read_layout != access.layout) {
+          std::ranges::for_each(v.readers, depend_on);
+          v.readers.clear();
+        }
+        v.readers.push_back(p);
+        v.read_layout = access.layout;
+      }
+      for (auto &access : pass.accesses) {
+        if (!access.write) {
+          continue;
+        }
+        auto &v = versions[access.res];
+        depend_on(v.writer);
+        std::ranges::for_each(v.readers, depend_on);
+        v.writer = p;
+        v.readers.clear();
+      }
+      std::ranges::sort(pass.dependencies);
+      auto [first, last] = std::ranges::unique(pass.dependencies);
+      pass.dependencies.erase(first, last);
+      pass.level = 0;
+      for (auto dependency : pass.dependencies) {
+        pass.level = std::max(pass.level, m_passes[dependency].level + 1);
+      }
+    }
+  }
+  frame_graph_queue get_pass_queue(const pass_node &pass) const {
+    return m_async_compute ? pass.queue : frame_graph_queue::graphics;
+  }
+  // passes of a level do not depend on each other, so a whole level shares
+  // one barrier batch.
+  void schedule_passes() {
+    m_schedule.clear();
+    for (uint32_t p = 0; p < m_passes.size(); p++) {
+      if (!m_passes[p].culled) {
+        m_schedule.push_back(p);
+      }
+    }
+    std::ranges::stable_sort(m_schedule, [this](uint32_t lhs, uint32_t rhs) {
+      auto &l = m_passes[lhs];
+      auto &r = m_passes[rhs];
+      if (l.level != r.level) {
+        return l.level < r.level;
+      }
+      return get_pass_queue(l) < get_pass_queue(r);
+    });
+    for (uint32_t position = 0; position < m_schedule.size(); position++) {
+      m_passes[m_schedule[position]].position = position;
+    }
+  }
+  void build_batches() {
+    m_batches.clear();
+    const pass_node *previous = nullptr;
+    for (auto p : m_schedule) {
+      auto &pass = m_passes[p];
+      auto queue = get_pass_queue(pass);
+      if (m_batches.empty() || m_batches.back().queue != queue) {
+        m_batches.emplace_back(queue);
+      }
+      m_batches.back().passes.push_back(p);
+      pass.batch = m_batches.size() - 1;
+      pass.step = 0;
+      if (previous) {
+        pass.step = previous->step + (previous->batch != pass.batch ||
+                                      previous->level != pass.level);
+      }
+      previous = &pass;
+      for (auto dependency : pass.dependencies) {
+        add_batch_wait(pass.batch, m_passes[dependency].batch);
+      }
+    }
+  }
+  void add_batch_wait(uint32_t batch, uint32_t wait_batch) {
+    if (batch == wait_batch ||
+        m_batches[batch].queue == m_batches[wait_batch].queue) {
+      return;
+    }
+    auto &waits = m_batches[batch].wait_batches;
+    if (std::ranges::find(waits, wait_batch) == waits.end()) {
+      waits.push_back(wait_batch);
+    }
+  }
+  void create_resources() {
+    for (auto &node : m_resources) {
+      node.used = false;
+    }
+    for (uint32_t position = 0; position < m_schedule.size(); position++) {
+      auto &pass = m_passes[m_schedule[position]];
+      for (auto &access : pass.accesses) {
+        auto &node = m_resources[access.res];
+        if (!node.used) {
+          node.used = true;
+          node.first_use = position;
+          node.first_step = pass.step;
+        }
+        node.last_use = position;
+        node.last_step = pass.step;
+      }
+    }
+    std::vector<uint32_t> queue_family_indices{m_graphics_queue_family_index};
+    if (m_async_compute &&
+        m_compute_queue_family_index != m_graphics_queue_family_index) {
+      queue_family_indices.push_back(m_compute_queue_family_index);
+    }
+    auto sharing_mode = queue_family_indices.size() > 1
+                            ? VK_SHARING_MODE_CONCURRENT
+                            : VK_SHARING_MODE_EXCLUSIVE;
+    for (auto &node : m_resources) {
+      if (node.imported || !node.used) {
+        continue;
+      }
+      if (node.is_image) {
+        auto &info = node.image_info;
+        VkImageCreateInfo create_info{};
+        create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        create_info.flags = VK_IMAGE_CREATE_ALIAS_BIT;
+        create_info.imageType = info.image_type;
+        create_info.format = info.format;
+        create_info.extent = info.extent;
+        create_info.mipLevels = info.mip_levels;
+        create_info.arrayLayers = info.array_layers;
+        create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        create_info.usage = info.usage;
+        create_info.sharingMode = sharing_mode;
+        create_info.queueFamilyIndexCount = queue_family_indices.size();
+        create_info.pQueueFamilyIndices = queue_family_indices.data();
+        create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        node.image = m_device.create_image(&create_info);
+        node.requirements = m_device.get_image_memory_requirements(node.image);
+      } else {
+        VkBufferCreateInfo create_info{};
+        create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        create_info.size = node.buffer_info.size;
+        create_info.usage = node.buffer_info.usage;
+        create_info.sharingMode = sharing_mode;
+        create_info.queueFamilyIndexCount = queue_family_indices.size();
+        create_info.pQueueFamilyIndices = queue_family_indices.data();
+        node.buffer = m_device.create_buffer(&create_info);
+        node.requirements = m_device.get_buffer_memory_requirements(node.buffer);
+      }
+    }
+  }
+  // Greedy interval placement: largest resources first, each at the lowest
+  // offset that does not overlap a placed resource with an overlapping
+  // lifetime. Lifetimes are in steps, not positions, since the passes of a
+  // step run after one barrier batch and would race on shared memory.
+  // bufferImageGranularity is applied to every resource since
+  // buffers and optimal images share the heaps.
+  void alias_memory() {
+    auto memory_properties = m_device.get_memory_properties();
+    VkDeviceSize granularity =
+        m_device.get_physical_device_properties().limits.bufferImageGranularity;
+    std::vector<uint32_t> transients;
+    for (uint32_t i = 0; i < m_resources.size(); i++) {
+      auto &node = m_resources[i];
+      if (node.imported || !node.used) {
+        continue;
+      }
+      uint32_t memory_type_index =
+          findProperties(memory_properties, node.requirements.memoryTypeBits,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      auto it = std::ranges::find(m_heaps, memory_type_index,
+                                  &heap::memory_type_index);
+      if (it == m_heaps.end()) {
+        m_heaps.emplace_back(memory_type_index, 0, VK_NULL_HANDLE);
+        it = m_heaps.end() - 1;
+      }
+      node.heap = it - m_heaps.begin();
+      transients.push_back(i);
+    }
+    std::ranges::stable_sort(transients, [this](uint32_t lhs, uint32_t rhs) {
+      return m_resources[lhs].requirements.size >
+             m_resources[rhs].requirements.size;
+    });
+    std::vector<uint32_t> placed;
+    for (auto i : transients) {
+      auto &node = m_resources[i];
+      VkDeviceSize alignment =
+          std::max(node.requirements.alignment, granularity);
+      std::vector<std::pair<VkDeviceSize, VkDeviceSize>> occupied;
+      for (auto other_index : placed) {
+        auto &other = m_resources[other_index];
+        if (other.heap == node.heap && other.first_step <= node.last_step &&
+            node.first_step <= other.last_step) {
+          occupied.emplace_back(other.offset,
+                                other.offset + other.requirements.size);
+        }
+      }
+      std::ranges::sort(occupied);
+      VkDeviceSize offset = 0;
+      for (auto [begin, end] : occupied) {
+        if (offset + node.requirements.size <= begin) {
+          break;
+        }
+        offset = std::max(offset, (end + alignment - 1) / alignment * alignment);
+      }
+      node.offset = offset;
+      auto &heap = m_heaps[node.heap];
+      heap.size = std::max(heap.size, offset + node.requirements.size);
+      placed.push_back(i);
+    }
+    for (auto &heap : m_heaps) {
+      heap.memory =
+          m_device.allocate_device_memory(heap.size, heap.memory_type_index);
+    }
+    for (auto i : transients) {
+      auto &node = m_resources[i];
+      auto memory = m_heaps[node.heap].memory;
+      if (node.is_image) {
+        m_device.bind_image_memory(node.image, memory, node.offset);
+      } else {
+        m_device.bind_buffer_memory(node.buffer, memory, node.offset);
+      }
+    }
+    // the first use of an aliased resource waits for the last uses of every
+    // resource that occupied its memory before.
+    for (auto i : transients) {
+      auto &node = m_resources[i];
+      for (auto other_index : transients) {
+        auto &other = m_resources[other_index];
+        if (other_index == i || other.heap != node.heap ||
+            other.last_step >= node.first_step ||
+            other.offset >= node.offset + node.requirements.size ||
+            node.offset >= other.offset + other.requirements.size) {
+          continue;
+        }
+        auto &first_pass = m_passes[m_schedule[node.first_use]];
+        auto &last_pass = m_passes[m_schedule[other.last_use]];
+        add_batch_wait(first_pass.batch, last_pass.batch);
+        // a last use on the other queue is covered by the semaphore.
+        if (get_pass_queue(first_pass) != get_pass_queue(last_pass)) {
+          continue;
+        }
+        for (auto &access : last_pass.accesses) {
+          if (access.res == other_index) {
+            node.alias_src_stages |= access.stages;
+            node.alias_src_access |= access.access & write_access_flags;
+          }
+        }
+      }
+    }
+  }
+  image_state_tracker &get_tracker(frame_graph_queue queue) {
+    return m_trackers[static_cast<size_t>(queue)];
+  }
+  std::vector<buffer_state> &get_buffer_states(frame_graph_queue queue) {
+    return m_buffer_states[static_cast<size_t>(queue)];
+  }
+  void reset_states() {
+    for (auto &states : m_buffer_states) {
+      states.assign(m_resources.size(), buffer_state{});
+    }
+    for (auto &node : m_resources) {
+      node.executed_queue.reset();
+      if (!node.is_image || node.image == VK_NULL_HANDLE) {
+        continue;
+      }
+      for (auto &tracker : m_trackers) {
+        tracker.add_image(
+            node.image, node.image_info.aspect_mask, node.image_info.mip_levels,
+            node.image_info.array_layers,
+            node.imported ? node.layout : VK_IMAGE_LAYOUT_UNDEFINED);
+      }
+    }
+  }
+  // the semaphore between the batches orders the uses on the previous queue
+  // before this one, so only a layout change made there is carried over. The
+  // state of this queue stays, its own earlier uses still need barriers. The
+  // next transition starts from the stages of the wait, see frame_graph_batch.
+  void move_to_queue(resource res, frame_graph_queue queue) {
+    auto &node = m_resources[res];
+    if (node.is_image && node.executed_queue &&
+        *node.executed_queue != queue) {
+      auto layout =
+          get_tracker(*node.executed_queue).get_layout(node.image, 0, 0);
+      get_tracker(queue).set_layout(node.image, get_full_range(node), layout,
+                                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+    }
+    node.executed_queue = queue;
+  }
+  static VkImageSubresourceRange get_full_range(const resource_node &node) {
+    return VkImageSubresourceRange{node.image_info.aspect_mask, 0,
+                                   VK_REMAINING_MIP_LEVELS, 0,
+                                   VK_REMAINING_ARRAY_LAYERS};
+  }
+  void declare_uses(CommandBuffer &command_buffer, uint32_t pass_index) {
+    auto &pass = m_passes[pass_index];
+    auto queue = get_pass_queue(pass);
+    for (auto &access : pass.accesses) {
+      move_to_queue(access.res, queue);
+    }
+    for (auto &access : pass.accesses) {
+      auto &node = m_resources[access.res];
+      bool first_use = !node.imported && node.first_use == pass.position;
+      if (first_use && node.alias_src_stages != 0) {
+        command_buffer.memory_barrier(node.alias_src_stages,
+                                      node.alias_src_access, access.stages,
+                                      access.access);
+      }
+      if (node.is_image) {
+        get_tracker(queue).use(
+            command_buffer, node.image, get_full_range(node),
+            image_use{access.stages, access.access, access.layout}, first_use);
+      } else {
+        declare_buffer_use(command_buffer, queue, access);
+      }
+    }
+  }
+  void declare_buffer_use(CommandBuffer &command_buffer, frame_graph_queue queue,
+                          const resource_access &access) {
+    auto &state = get_buffer_states(queue)[access.res];
+    auto buffer = m_resources[access.res].buffer;
+    if (access.write || is_write_access(access.access)) {
+      auto src_stages = state.write_stages | state.read_stages;
+      if (src_stages != 0) {
+        command_buffer.buffer_barrier(buffer, 0, VK_WHOLE_SIZE, src_stages,
+                                      state.write_access, access.stages,
+                                      access.access);
+      }
+      state = buffer_state{access.stages, access.access & write_access_flags,
+                           0, access.stages, access.access};
+      return;
+    }
+    state.read_stages |= access.stages;
+    if (state.write_stages == 0 ||
+        ((access.stages & ~state.visible_stages) == 0 &&
+         (access.access & ~state.visible_access) == 0)) {
+      return;
+    }
+    command_buffer.buffer_barrier(buffer, 0, VK_WHOLE_SIZE, state.write_stages,
+                                  state.write_access, access.stages,
+                                  access.access);
+    state.visible_stages |= access.stages;
+    state.visible_access |= access.access;
+  }
+  void release() {
+    for (auto &node : m_resources) {
+      if (node.imported) {
+        continue;
+      }
+      if (node.image != VK_NULL_HANDLE) {
+        for (auto &tracker : m_trackers) {
+          tracker.remove_image(node.image);
+        }
+        m_device.destroy_image(node.image);
+        node.image = VK_NULL_HANDLE;
+      }
+      if (node.buffer != VK_NULL_HANDLE) {
+        m_device.destroy_buffer(node.buffer);
+        node.buffer = VK_NULL_HANDLE;
+      }
+      node.alias_src_stages = 0;
+      node.alias_src_access = 0;
+    }
+    for (auto &heap : m_heaps) {
+      if (heap.memory != VK_NULL_HANDLE) {
+        m_device.free_device_memory(heap.memory);
+      }
+    }
+    m_heaps.clear();
+  }
+
+  D &m_device;
+  uint32_t m_graphics_queue_family_index;
+  uint32_t m_compute_queue_family_index;
+  bool m_async_compute = false;
+  std::vector<resource_node> m_resources;
+  std::vector<pass_node> m_passes;
+  std::vector<uint32_t> m_schedule;
+  std::vector<frame_graph_batch> m_batches;
+  std::vector<heap> m_heaps;
+  // per frame_graph_queue.
+  std::array<image_state_tracker, 2> m_trackers;
+  std::array<std::vector<buffer_state>, 2> m_buffer_states;
+};
+} // namespace vulkan_helper
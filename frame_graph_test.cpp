@@ -0,0 +1,304 @@
+// Checks the barriers and batches frame_graph records, with a device and
+// command buffer that only record calls, so no Vulkan device is needed.
+#include "frame_graph.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+void check(bool condition, const char *message) {
+  if (!condition) {
+    std::cerr << "failed: " << message << '\n';
+    failures++;
+  }
+}
+
+template <class Handle> Handle make_handle(uint64_t value) {
+  if constexpr (std::is_pointer_v<Handle>) {
+    return reinterpret_cast<Handle>(static_cast<uintptr_t>(value));
+  } else {
+    return Handle{value};
+  }
+}
+
+class recording_device {
+public:
+  VkImage create_image(const VkImageCreateInfo *) {
+    return make_handle<VkImage>(m_next_handle++);
+  }
+  VkBuffer create_buffer(const VkBufferCreateInfo *) {
+    return make_handle<VkBuffer>(m_next_handle++);
+  }
+  void destroy_image(VkImage) {}
+  void destroy_buffer(VkBuffer) {}
+  VkMemoryRequirements get_image_memory_requirements(VkImage) {
+    return VkMemoryRequirements{1024, 256, 1};
+  }
+  VkMemoryRequirements get_buffer_memory_requirements(VkBuffer) {
+    return VkMemoryRequirements{1024, 256, 1};
+  }
+  VkPhysicalDeviceMemoryProperties get_memory_properties() {
+    VkPhysicalDeviceMemoryProperties properties{};
+    properties.memoryTypeCount = 1;
+    properties.memoryTypes[0].propertyFlags =
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    return properties;
+  }
+  VkPhysicalDeviceProperties get_physical_device_properties() {
+    VkPhysicalDeviceProperties properties{};
+    properties.limits.bufferImageGranularity = 1;
+    return properties;
+  }
+  VkDeviceMemory allocate_device_memory(VkDeviceSize, uint32_t) {
+    return make_handle<VkDeviceMemory>(m_next_handle++);
+  }
+  void free_device_memory(VkDeviceMemory) {}
+  void bind_image_memory(VkImage, VkDeviceMemory, VkDeviceSize) {}
+  void bind_buffer_memory(VkBuffer, VkDeviceMemory, VkDeviceSize) {}
+
+private:
+  uint64_t m_next_handle = 0x1000;
+};
+
+class recording_command_buffer {
+public:
+  void memory_barrier(VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2,
+                      VkPipelineStageFlags2, VkAccessFlags2) {
+    src_stages |= src_stage_mask;
+    memory_barriers++;
+  }
+  void buffer_barrier(VkBuffer, VkDeviceSize, VkDeviceSize,
+                      VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2,
+                      VkPipelineStageFlags2, VkAccessFlags2) {
+    src_stages |= src_stage_mask;
+    buffer_barriers++;
+  }
+  void image_barrier(const VkImageMemoryBarrier2 &barrier) {
+    src_stages |= barrier.srcStageMask;
+    image_barriers.push_back(barrier);
+  }
+  void clear() { *this = recording_command_buffer{}; }
+
+  VkPipelineStageFlags2 src_stages = 0;
+  uint32_t memory_barriers = 0;
+  uint32_t buffer_barriers = 0;
+  std::vector<VkImageMemoryBarrier2> image_barriers;
+};
+
+using graph = vulkan_helper::frame_graph<recording_device,
+                                         recording_command_buffer>;
+
+constexpr vulkan_helper::frame_graph_image_info image_info{
+    .image_type = VK_IMAGE_TYPE_2D,
+    .format = VK_FORMAT_R8G8B8A8_UNORM,
+    .extent = {16, 16, 1},
+    .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+};
+constexpr vulkan_helper::image_use color_write{
+    VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+constexpr vulkan_helper::image_use compute_sample{
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+// graphics renders a transient image, compute samples it and writes a buffer,
+// graphics reads the buffer and renders into the imported image.
+void test_async_compute() {
+  recording_device device;
+  graph frame{device, 0, 1};
+  auto target = frame.import_image("target", make_handle<VkImage>(1),
+                                   image_info, VK_IMAGE_LAYOUT_UNDEFINED);
+  auto scene = frame.create_image("scene", image_info);
+  auto histogram = frame.create_buffer(
+      "histogram", {256, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT});
+  frame.add_pass(
+      "scene", vulkan_helper::frame_graph_queue::graphics,
+      [&](auto &builder) { builder.write_image(scene, color_write); }, {});
+  frame.add_pass(
+      "histogram", vulkan_helper::frame_graph_queue::compute,
+      [&](auto &builder) {
+        builder.read_image(scene, compute_sample);
+        builder.write_buffer(histogram, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                             VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+      },
+      {});
+  frame.add_pass(
+      "tonemap", vulkan_helper::frame_graph_queue::graphics,
+      [&](auto &builder) {
+        builder.read_buffer(histogram, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                            VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+        builder.write_image(target, color_write);
+      },
+      {});
+  auto unused = frame.create_buffer(
+      "unused", {16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT});
+  frame.add_pass(
+      "unused", vulkan_helper::frame_graph_queue::compute,
+      [&](auto &builder) {
+        builder.read_image(scene, compute_sample);
+        builder.write_buffer(unused, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                             VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+      },
+      {});
+  frame.compile(true);
+  check(frame.is_pass_culled(3), "a pass without outputs is culled");
+
+  auto &batches = frame.get_batches();
+  check(batches.size() == 3, "graphics, compute, graphics batches");
+  std::vector<recording_command_buffer> command_buffers(batches.size());
+  auto record = [&]() {
+    for (auto &command_buffer : command_buffers) {
+      command_buffer.clear();
+    }
+    frame.execute([&](const vulkan_helper::frame_graph_batch &batch)
+                      -> recording_command_buffer & {
+      return command_buffers[&batch - batches.data()];
+    });
+  };
+  record();
+  check(batches[1].wait_batches == std::vector<uint32_t>{0},
+        "compute waits for the scene");
+  check(batches[2].wait_batches == std::vector<uint32_t>{1},
+        "tonemap waits for the histogram");
+  constexpr VkPipelineStageFlags2 graphics_stages =
+      VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT |
+      VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+      VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+  check((command_buffers[1].src_stages & graphics_stages) == 0,
+        "compute barriers have no graphics source stages");
+  check(command_buffers[2].buffer_barriers == 0,
+        "the semaphore covers the histogram write");
+  check(command_buffers[1].image_barriers.size() == 1 &&
+            command_buffers[1].image_barriers[0].oldLayout ==
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        "compute transitions the scene from the layout graphics left");
+  check(command_buffers[1].image_barriers.size() == 1 &&
+            command_buffers[1].image_barriers[0].srcStageMask ==
+                VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        "the scene transition chains with the semaphore wait");
+  check(frame.get_final_layout(target) ==
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        "final layout of the target");
+
+  // the target is already in its layout, so the second frame needs no
+  // transition of it.
+  record();
+  check(command_buffers[2].image_barriers.empty(),
+        "the target layout carries over to the next frame");
+
+  frame.set_image_layout(target, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+  record();
+  check(command_buffers[2].image_barriers.size() == 1 &&
+            command_buffers[2].image_barriers[0].oldLayout ==
+                VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        "the target is transitioned from the layout set after present");
+}
+
+// two transient images with disjoint lifetimes share one memory range, the
+// second one waits for the last use of the first.
+void test_aliasing() {
+  recording_device device;
+  graph frame{device, 0};
+  auto target = frame.import_image("target", make_handle<VkImage>(1),
+                                   image_info, VK_IMAGE_LAYOUT_UNDEFINED);
+  auto first = frame.create_image("first", image_info);
+  auto second = frame.create_image("second", image_info);
+  auto third = frame.create_image("third", image_info);
+  auto sample = vulkan_helper::image_use{
+      VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  frame.add_pass(
+      "first", vulkan_helper::frame_graph_queue::graphics,
+      [&](auto &builder) { builder.write_image(first, color_write); }, {});
+  frame.add_pass(
+      "second", vulkan_helper::frame_graph_queue::graphics,
+      [&](auto &builder) {
+        builder.read_image(first, sample);
+        builder.write_image(second, color_write);
+      },
+      {});
+  frame.add_pass(
+      "third", vulkan_helper::frame_graph_queue::graphics,
+      [&](auto &builder) {
+        builder.read_image(second, sample);
+        builder.write_image(third, color_write);
+      },
+      {});
+  frame.add_pass(
+      "target", vulkan_helper::frame_graph_queue::graphics,
+      [&](auto &builder) {
+        builder.read_image(third, sample);
+        builder.write_image(target, color_write);
+      },
+      {});
+  frame.compile();
+  check(frame.get_transient_memory_size() == 2 * 1024,
+        "first and third share memory");
+  recording_command_buffer command_buffer;
+  frame.execute(command_buffer);
+  check(command_buffer.memory_barriers == 1,
+        "third waits for the last use of first");
+}
+
+// two independent passes of one level run after one barrier batch, so their
+// scratch images must not share memory although no pass uses both.
+void test_same_level_scratch() {
+  recording_device device;
+  graph frame{device, 0};
+  auto target = frame.import_image("target", make_handle<VkImage>(1),
+                                   image_info, VK_IMAGE_LAYOUT_UNDEFINED);
+  auto sample = vulkan_helper::image_use{
+      VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  std::vector<graph::resource> results;
+  for (auto name : {"left", "right"}) {
+    auto scratch =
+        frame.create_image(std::string{name} + " scratch", image_info);
+    auto result = frame.create_image(name, image_info);
+    frame.add_pass(
+        name, vulkan_helper::frame_graph_queue::graphics,
+        [&](auto &builder) {
+          builder.write_image(scratch, color_write);
+          builder.write_image(result, color_write);
+        },
+        {});
+    results.push_back(result);
+  }
+  frame.add_pass(
+      "target", vulkan_helper::frame_graph_queue::graphics,
+      [&](auto &builder) {
+        for (auto result : results) {
+          builder.read_image(result, sample);
+        }
+        builder.write_image(target, color_write);
+      },
+      {});
+  frame.compile();
+  check(frame.get_transient_memory_size() == 4 * 1024,
+        "scratch images of one level do not share memory");
+  recording_command_buffer command_buffer;
+  frame.execute(command_buffer);
+  check(command_buffer.memory_barriers == 0,
+        "no aliasing barrier between passes of one level");
+}
+
+} // namespace
+
+int main() {
+  test_async_compute();
+  test_aliasing();
+  test_same_level_scratch();
+  if (failures != 0) {
+    std::cerr << failures << " checks failed\n";
+    return 1;
+  }
+  return 0;
+}
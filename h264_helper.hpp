@@ -0,0 +1,1163 @@
+#pragma once
+
+#include <vk_video/vulkan_video_codec_h264std_decode.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VULKAN_HELPER_H264_SSE2 1
+#endif
+
+namespace vulkan_helper {
+
+enum class h264_nal_unit_type : uint8_t {
+  slice = 1,
+  slice_data_partition_a = 2,
+  slice_data_partition_b = 3,
+  slice_data_partition_c = 4,
+  idr_slice = 5,
+  sei = 6,
+  sps = 7,
+  pps = 8,
+  access_unit_delimiter = 9,
+  end_of_sequence = 10,
+  end_of_stream = 11,
+  filler = 12,
+  sps_extension = 13,
+  prefix = 14,
+  subset_sps = 15,
+  slice_extension = 20,
+};
+
+// One NAL unit of an Annex B stream, a view into the stream starting at the
+// NAL header. The payload still has its emulation prevention bytes.
+struct h264_nal_unit {
+  std::span<const std::byte> data;
+
+  uint8_t get_nal_ref_idc() const {
+    return (static_cast<uint8_t>(data[0]) >> 5) & 0x3;
+  }
+  h264_nal_unit_type get_type() const {
+    return static_cast<h264_nal_unit_type>(static_cast<uint8_t>(data[0]) &
+                                           0x1f);
+  }
+  bool is_slice() const {
+    return get_type() == h264_nal_unit_type::slice ||
+           get_type() == h264_nal_unit_type::idr_slice;
+  }
+};
+
+// Returns the offset of the first 00 00 01 at or after offset, or
+// data.size() if there is none.
+inline size_t find_h264_start_code(std::span<const std::byte> data,
+                                   size_t offset = 0) {
+  auto bytes = reinterpret_cast<const uint8_t *>(data.data());
+  size_t size = data.size();
+#ifdef VULKAN_HELPER_H264_SSE2
+  // tests 16 positions at once: a zero, a zero after it and a one after that.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  while (offset + 18 <= size) {
+    auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + offset));
+    auto b1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + offset + 1));
+    auto b2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + offset + 2));
+    auto match = _mm_and_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+        _mm_cmpeq_epi8(b2, one));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+    if (mask != 0) {
+      return offset + std::countr_zero(mask);
+    }
+    offset += 16;
+  }
+#endif
+  // look for the one with memchr, then check the two zeros before it.
+  while (offset + 3 <= size) {
+    auto one = static_cast<const uint8_t *>(
+        std::memchr(bytes + offset + 2, 1, size - offset - 2));
+    if (one == nullptr) {
+      break;
+    }
+    size_t position = one - bytes;
+    if (one[-1] == 0 && one[-2] == 0) {
+      return position - 2;
+    }
+    offset = position - 1;
+  }
+  return size;
+}
+
+// Splits an Annex B stream into NAL units without copying, e.g. over the
+// memory of map_file_mapping. Leading zeros of four byte start codes and
+// trailing zeros are not part of the units.
+class h264_nal_scanner {
+public:
+  explicit h264_nal_scanner(std::span<const std::byte> stream)
+      : m_stream{stream}, m_offset{find_h264_start_code(stream)} {}
+
+  std::optional<h264_nal_unit> next() {
+    while (m_offset < m_stream.size()) {
+      size_t begin = m_offset + 3;
+      size_t end = find_h264_start_code(m_stream, begin);
+      m_offset = end;
+      // a NAL unit ends in its stop bit, so trailing zeros are padding.
+      while (end > begin && m_stream[end - 1] == std::byte{0}) {
+        end--;
+      }
+      if (end > begin) {
+        return h264_nal_unit{m_stream.subspan(begin, end - begin)};
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  std::span<const std::byte> m_stream;
+  size_t m_offset;
+};
+
+namespace h264_helper {
+
+// Reads the RBSP of a NAL unit, emulation prevention bytes are dropped while
+// reading so the unit is not copied.
+class bit_reader {
+public:
+  explicit bit_reader(std::span<const std::byte> data)
+      : m_data{data}, m_offset{0}, m_zero_count{0}, m_byte{0}, m_bit_count{0} {
+    // the last set bit is the stop bit of rbsp_trailing_bits().
+    size_t last = data.size();
+    while (last > 0 && data[last - 1] == std::byte{0}) {
+      last--;
+    }
+    m_stop_bit = last == 0 ? 0
+                           : (last - 1) * 8 + 7 -
+                                 std::countr_zero(
+                                     static_cast<uint8_t>(data[last - 1]));
+  }
+
+  uint32_t read_bits(uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      if (m_bit_count == 0) {
+        load_byte();
+      }
+      m_bit_count--;
+      value = (value << 1) | ((m_byte >> m_bit_count) & 1);
+    }
+    return value;
+  }
+  bool read_flag() { return read_bits(1) != 0; }
+  // ue(v)
+  uint32_t read_ue() {
+    uint32_t leading_zeros = 0;
+    while (read_bits(1) == 0) {
+      if (++leading_zeros > 31) {
+        throw std::runtime_error{"invalid exp-golomb code in h264 nal unit"};
+      }
+    }
+    if (leading_zeros == 0) {
+      return 0;
+    }
+    return ((1u << leading_zeros) - 1) + read_bits(leading_zeros);
+  }
+  // se(v)
+  int32_t read_se() {
+    uint32_t value = read_ue();
+    auto magnitude = static_cast<int32_t>((value + 1) / 2);
+    return value % 2 == 1 ? magnitude : -magnitude;
+  }
+  // more_rbsp_data()
+  bool has_more_data() const {
+    return m_offset * 8 - m_bit_count < m_stop_bit;
+  }
+
+private:
+  void load_byte() {
+    if (m_offset >= m_data.size()) {
+      throw std::runtime_error{"truncated h264 nal unit"};
+    }
+    auto byte = static_cast<uint8_t>(m_data[m_offset++]);
+    if (m_zero_count >= 2 && byte == 3) {
+      m_zero_count = 0;
+      if (m_offset >= m_data.size()) {
+        throw std::runtime_error{"truncated h264 nal unit"};
+      }
+      byte = static_cast<uint8_t>(m_data[m_offset++]);
+    }
+    m_zero_count = byte == 0 ? m_zero_count + 1 : 0;
+    m_byte = byte;
+    m_bit_count = 8;
+  }
+
+  std::span<const std::byte> m_data;
+  size_t m_offset;
+  uint32_t m_zero_count;
+  uint8_t m_byte;
+  uint32_t m_bit_count;
+  size_t m_stop_bit;
+};
+
+// scaling_list(), lists not present stay zero.
+inline void read_scaling_list(bit_reader &reader, uint8_t *list, uint32_t size,
+                              bool &use_default) {
+  int32_t last_scale = 8;
+  int32_t next_scale = 8;
+  use_default = false;
+  for (uint32_t j = 0; j < size; j++) {
+    if (next_scale != 0) {
+      int32_t delta_scale = reader.read_se();
+      next_scale = (last_scale + delta_scale + 256) % 256;
+      use_default = j == 0 && next_scale == 0;
+    }
+    list[j] = next_scale == 0 ? last_scale : next_scale;
+    last_scale = list[j];
+  }
+}
+inline void read_scaling_lists(bit_reader &reader, uint32_t list_count,
+                               StdVideoH264ScalingLists &lists) {
+  lists = StdVideoH264ScalingLists{};
+  for (uint32_t i = 0; i < list_count; i++) {
+    if (!reader.read_flag()) {
+      continue;
+    }
+    lists.scaling_list_present_mask |= 1u << i;
+    bool use_default = false;
+    if (i < 6) {
+      read_scaling_list(reader, lists.ScalingList4x4[i],
+                        STD_VIDEO_H264_SCALING_LIST_4X4_NUM_ELEMENTS,
+                        use_default);
+    } else {
+      read_scaling_list(reader, lists.ScalingList8x8[i - 6],
+                        STD_VIDEO_H264_SCALING_LIST_8X8_NUM_ELEMENTS,
+                        use_default);
+    }
+    if (use_default) {
+      lists.use_default_scaling_matrix_mask |= 1u << i;
+    }
+  }
+}
+inline void read_hrd_parameters(bit_reader &reader,
+                                StdVideoH264HrdParameters &hrd) {
+  hrd = StdVideoH264HrdParameters{};
+  uint32_t cpb_cnt_minus1 = reader.read_ue();
+  if (cpb_cnt_minus1 >= STD_VIDEO_H264_CPB_CNT_LIST_SIZE) {
+    throw std::runtime_error{"invalid h264 hrd parameters"};
+  }
+  hrd.cpb_cnt_minus1 = cpb_cnt_minus1;
+  hrd.bit_rate_scale = reader.read_bits(4);
+  hrd.cpb_size_scale = reader.read_bits(4);
+  for (uint32_t i = 0; i <= cpb_cnt_minus1; i++) {
+    hrd.bit_rate_value_minus1[i] = reader.read_ue();
+    hrd.cpb_size_value_minus1[i] = reader.read_ue();
+    hrd.cbr_flag[i] = reader.read_flag();
+  }
+  hrd.initial_cpb_removal_delay_length_minus1 = reader.read_bits(5);
+  hrd.cpb_removal_delay_length_minus1 = reader.read_bits(5);
+  hrd.dpb_output_delay_length_minus1 = reader.read_bits(5);
+  hrd.time_offset_length = reader.read_bits(5);
+}
+
+inline StdVideoH264LevelIdc get_level_idc(uint32_t level_idc) {
+  switch (level_idc) {
+  case 9: // level 1b, between 1.0 and 1.1
+  case 11:
+    return STD_VIDEO_H264_LEVEL_IDC_1_1;
+  case 10:
+    return STD_VIDEO_H264_LEVEL_IDC_1_0;
+  case 12:
+    return STD_VIDEO_H264_LEVEL_IDC_1_2;
+  case 13:
+    return STD_VIDEO_H264_LEVEL_IDC_1_3;
+  case 20:
+    return STD_VIDEO_H264_LEVEL_IDC_2_0;
+  case 21:
+    return STD_VIDEO_H264_LEVEL_IDC_2_1;
+  case 22:
+    return STD_VIDEO_H264_LEVEL_IDC_2_2;
+  case 30:
+    return STD_VIDEO_H264_LEVEL_IDC_3_0;
+  case 31:
+    return STD_VIDEO_H264_LEVEL_IDC_3_1;
+  case 32:
+    return STD_VIDEO_H264_LEVEL_IDC_3_2;
+  case 40:
+    return STD_VIDEO_H264_LEVEL_IDC_4_0;
+  case 41:
+    return STD_VIDEO_H264_LEVEL_IDC_4_1;
+  case 42:
+    return STD_VIDEO_H264_LEVEL_IDC_4_2;
+  case 50:
+    return STD_VIDEO_H264_LEVEL_IDC_5_0;
+  case 51:
+    return STD_VIDEO_H264_LEVEL_IDC_5_1;
+  case 52:
+    return STD_VIDEO_H264_LEVEL_IDC_5_2;
+  case 60:
+    return STD_VIDEO_H264_LEVEL_IDC_6_0;
+  case 61:
+    return STD_VIDEO_H264_LEVEL_IDC_6_1;
+  case 62:
+    return STD_VIDEO_H264_LEVEL_IDC_6_2;
+  default:
+    return STD_VIDEO_H264_LEVEL_IDC_INVALID;
+  }
+}
+inline bool has_chroma_format(uint32_t profile_idc) {
+  switch (profile_idc) {
+  case 100:
+  case 110:
+  case 122:
+  case 244:
+  case 44:
+  case 83:
+  case 86:
+  case 118:
+  case 128:
+  case 138:
+  case 139:
+  case 134:
+  case 135:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace h264_helper
+
+// A parsed SPS. The pointers of sps point into this object and are kept
+// valid by copies.
+struct h264_sps {
+  StdVideoH264SequenceParameterSet sps{};
+  StdVideoH264ScalingLists scaling_lists{};
+  StdVideoH264SequenceParameterSetVui vui{};
+  StdVideoH264HrdParameters hrd{};
+  std::array<int32_t, 255> offset_for_ref_frame{};
+
+  h264_sps() = default;
+  h264_sps(const h264_sps &other)
+      : sps{other.sps}, scaling_lists{other.scaling_lists}, vui{other.vui},
+        hrd{other.hrd}, offset_for_ref_frame{other.offset_for_ref_frame} {
+    link();
+  }
+  h264_sps &operator=(const h264_sps &other) {
+    sps = other.sps;
+    scaling_lists = other.scaling_lists;
+    vui = other.vui;
+    hrd = other.hrd;
+    offset_for_ref_frame = other.offset_for_ref_frame;
+    link();
+    return *this;
+  }
+
+  // ChromaArrayType
+  uint32_t get_chroma_array_type() const {
+    return sps.flags.separate_colour_plane_flag ? 0 : sps.chroma_format_idc;
+  }
+  void link() {
+    sps.pScalingLists =
+        sps.flags.seq_scaling_matrix_present_flag ? &scaling_lists : nullptr;
+    sps.pSequenceParameterSetVui =
+        sps.flags.vui_parameters_present_flag ? &vui : nullptr;
+    sps.pOffsetForRefFrame = sps.pic_order_cnt_type == STD_VIDEO_H264_POC_TYPE_1
+                                 ? offset_for_ref_frame.data()
+                                 : nullptr;
+    vui.pHrdParameters = vui.flags.nal_hrd_parameters_present_flag ||
+                                 vui.flags.vcl_hrd_parameters_present_flag
+                             ? &hrd
+                             : nullptr;
+  }
+};
+// A parsed PPS, same as h264_sps for the pointers.
+struct h264_pps {
+  StdVideoH264PictureParameterSet pps{};
+  StdVideoH264ScalingLists scaling_lists{};
+
+  h264_pps() = default;
+  h264_pps(const h264_pps &other)
+      : pps{other.pps}, scaling_lists{other.scaling_lists} {
+    link();
+  }
+  h264_pps &operator=(const h264_pps &other) {
+    pps = other.pps;
+    scaling_lists = other.scaling_lists;
+    link();
+    return *this;
+  }
+
+  void link() {
+    pps.pScalingLists =
+        pps.flags.pic_scaling_matrix_present_flag ? &scaling_lists : nullptr;
+  }
+};
+
+inline h264_sps parse_h264_sps(const h264_nal_unit &nal) {
+  h264_helper::bit_reader reader{nal.data.subspan(1)};
+  h264_sps result{};
+  auto &sps = result.sps;
+  uint32_t profile_idc = reader.read_bits(8);
+  sps.profile_idc = static_cast<StdVideoH264ProfileIdc>(profile_idc);
+  sps.flags.constraint_set0_flag = reader.read_flag();
+  sps.flags.constraint_set1_flag = reader.read_flag();
+  sps.flags.constraint_set2_flag = reader.read_flag();
+  sps.flags.constraint_set3_flag = reader.read_flag();
+  sps.flags.constraint_set4_flag = reader.read_flag();
+  sps.flags.constraint_set5_flag = reader.read_flag();
+  reader.read_bits(2);
+  sps.level_idc = h264_helper::get_level_idc(reader.read_bits(8));
+  uint32_t id = reader.read_ue();
+  if (id > 31) {
+    throw std::runtime_error{"invalid h264 sps id"};
+  }
+  sps.seq_parameter_set_id = id;
+
+  uint32_t chroma_format_idc = 1;
+  if (h264_helper::has_chroma_format(profile_idc)) {
+    chroma_format_idc = reader.read_ue();
+    if (chroma_format_idc > 3) {
+      throw std::runtime_error{"invalid h264 chroma format"};
+    }
+    if (chroma_format_idc == 3) {
+      sps.flags.separate_colour_plane_flag = reader.read_flag();
+    }
+    sps.bit_depth_luma_minus8 = reader.read_ue();
+    sps.bit_depth_chroma_minus8 = reader.read_ue();
+    sps.flags.qpprime_y_zero_transform_bypass_flag = reader.read_flag();
+    sps.flags.seq_scaling_matrix_present_flag = reader.read_flag();
+    if (sps.flags.seq_scaling_matrix_present_flag) {
+      h264_helper::read_scaling_lists(
+          reader, chroma_format_idc != 3 ? 8 : 12, result.scaling_lists);
+    }
+  }
+  sps.chroma_format_idc =
+      static_cast<StdVideoH264ChromaFormatIdc>(chroma_format_idc);
+
+  sps.log2_max_frame_num_minus4 = reader.read_ue();
+  uint32_t pic_order_cnt_type = reader.read_ue();
+  if (sps.log2_max_frame_num_minus4 > 12 || pic_order_cnt_type > 2) {
+    throw std::runtime_error{"invalid h264 sps"};
+  }
+  sps.pic_order_cnt_type = static_cast<StdVideoH264PocType>(pic_order_cnt_type);
+  if (pic_order_cnt_type == 0) {
+    sps.log2_max_pic_order_cnt_lsb_minus4 = reader.read_ue();
+    if (sps.log2_max_pic_order_cnt_lsb_minus4 > 12) {
+      throw std::runtime_error{"invalid h264 sps"};
+    }
+  } else if (pic_order_cnt_type == 1) {
+    sps.flags.delta_pic_order_always_zero_flag = reader.read_flag();
+    sps.offset_for_non_ref_pic = reader.read_se();
+    sps.offset_for_top_to_bottom_field = reader.read_se();
+    uint32_t cycle_length = reader.read_ue();
+    if (cycle_length > 255) {
+      throw std::runtime_error{"invalid h264 sps"};
+    }
+    sps.num_ref_frames_in_pic_order_cnt_cycle = cycle_length;
+    for (uint32_t i = 0; i < cycle_length; i++) {
+      result.offset_for_ref_frame[i] = reader.read_se();
+    }
+  }
+  sps.max_num_ref_frames = reader.read_ue();
+  sps.flags.gaps_in_frame_num_value_allowed_flag = reader.read_flag();
+  sps.pic_width_in_mbs_minus1 = reader.read_ue();
+  sps.pic_height_in_map_units_minus1 = reader.read_ue();
+  sps.flags.frame_mbs_only_flag = reader.read_flag();
+  if (!sps.flags.frame_mbs_only_flag) {
+    sps.flags.mb_adaptive_frame_field_flag = reader.read_flag();
+  }
+  sps.flags.direct_8x8_inference_flag = reader.read_flag();
+  sps.flags.frame_cropping_flag = reader.read_flag();
+  if (sps.flags.frame_cropping_flag) {
+    sps.frame_crop_left_offset = reader.read_ue();
+    sps.frame_crop_right_offset = reader.read_ue();
+    sps.frame_crop_top_offset = reader.read_ue();
+    sps.frame_crop_bottom_offset = reader.read_ue();
+  }
+
+  sps.flags.vui_parameters_present_flag = reader.read_flag();
+  if (sps.flags.vui_parameters_present_flag) {
+    auto &vui = result.vui;
+    vui.flags.aspect_ratio_info_present_flag = reader.read_flag();
+    if (vui.flags.aspect_ratio_info_present_flag) {
+      vui.aspect_ratio_idc =
+          static_cast<StdVideoH264AspectRatioIdc>(reader.read_bits(8));
+      if (vui.aspect_ratio_idc == STD_VIDEO_H264_ASPECT_RATIO_IDC_EXTENDED_SAR) {
+        vui.sar_width = reader.read_bits(16);
+        vui.sar_height = reader.read_bits(16);
+      }
+    }
+    vui.flags.overscan_info_present_flag = reader.read_flag();
+    if (vui.flags.overscan_info_present_flag) {
+      vui.flags.overscan_appropriate_flag = reader.read_flag();
+    }
+    vui.flags.video_signal_type_present_flag = reader.read_flag();
+    if (vui.flags.video_signal_type_present_flag) {
+      vui.video_format = reader.read_bits(3);
+      vui.flags.video_full_range_flag = reader.read_flag();
+      vui.flags.color_description_present_flag = reader.read_flag();
+      if (vui.flags.color_description_present_flag) {
+        vui.colour_primaries = reader.read_bits(8);
+        vui.transfer_characteristics = reader.read_bits(8);
+        vui.matrix_coefficients = reader.read_bits(8);
+      }
+    }
+    vui.flags.chroma_loc_info_present_flag = reader.read_flag();
+    if (vui.flags.chroma_loc_info_present_flag) {
+      vui.chroma_sample_loc_type_top_field = reader.read_ue();
+      vui.chroma_sample_loc_type_bottom_field = reader.read_ue();
+    }
+    vui.flags.timing_info_present_flag = reader.read_flag();
+    if (vui.flags.timing_info_present_flag) {
+      vui.num_units_in_tick = reader.read_bits(32);
+      vui.time_scale = reader.read_bits(32);
+      vui.flags.fixed_frame_rate_flag = reader.read_flag();
+    }
+    // the std structure has room for one set of hrd parameters, the nal one
+    // is kept when both are present.
+    StdVideoH264HrdParameters vcl_hrd{};
+    vui.flags.nal_hrd_parameters_present_flag = reader.read_flag();
+    if (vui.flags.nal_hrd_parameters_present_flag) {
+      h264_helper::read_hrd_parameters(reader, result.hrd);
+    }
+    vui.flags.vcl_hrd_parameters_present_flag = reader.read_flag();
+    if (vui.flags.vcl_hrd_parameters_present_flag) {
+      h264_helper::read_hrd_parameters(
+          reader, vui.flags.nal_hrd_parameters_present_flag ? vcl_hrd
+                                                            : result.hrd);
+    }
+    if (vui.flags.nal_hrd_parameters_present_flag ||
+        vui.flags.vcl_hrd_parameters_present_flag) {
+      reader.read_flag(); // low_delay_hrd_flag
+    }
+    reader.read_flag(); // pic_struct_present_flag
+    vui.flags.bitstream_restriction_flag = reader.read_flag();
+    if (vui.flags.bitstream_restriction_flag) {
+      reader.read_flag(); // motion_vectors_over_pic_boundaries_flag
+      reader.read_ue();   // max_bytes_per_pic_denom
+      reader.read_ue();   // max_bits_per_mb_denom
+      reader.read_ue();   // log2_max_mv_length_horizontal
+      reader.read_ue();   // log2_max_mv_length_vertical
+      vui.max_num_reorder_frames = reader.read_ue();
+      vui.max_dec_frame_buffering = reader.read_ue();
+    }
+  }
+  result.link();
+  return result;
+}
+
+// the chroma format of the SPS is needed for the scaling lists.
+inline h264_pps parse_h264_pps(const h264_nal_unit &nal,
+                               const std::map<uint32_t, h264_sps> &sps_list) {
+  h264_helper::bit_reader reader{nal.data.subspan(1)};
+  h264_pps result{};
+  auto &pps = result.pps;
+  uint32_t id = reader.read_ue();
+  uint32_t sps_id = reader.read_ue();
+  if (id > 255 || sps_id > 31) {
+    throw std::runtime_error{"invalid h264 pps id"};
+  }
+  pps.pic_parameter_set_id = id;
+  pps.seq_parameter_set_id = sps_id;
+  pps.flags.entropy_coding_mode_flag = reader.read_flag();
+  pps.flags.bottom_field_pic_order_in_frame_present_flag = reader.read_flag();
+  uint32_t num_slice_groups_minus1 = reader.read_ue();
+  if (num_slice_groups_minus1 > 7) {
+    throw std::runtime_error{"invalid h264 pps"};
+  }
+  if (num_slice_groups_minus1 > 0) {
+    // slice groups are not supported by video decode, they are only skipped.
+    uint32_t map_type = reader.read_ue();
+    if (map_type == 0) {
+      for (uint32_t i = 0; i <= num_slice_groups_minus1; i++) {
+        reader.read_ue(); // run_length_minus1
+      }
+    } else if (map_type == 2) {
+      for (uint32_t i = 0; i < num_slice_groups_minus1; i++) {
+        reader.read_ue(); // top_left
+        reader.read_ue(); // bottom_right
+      }
+    } else if (map_type >= 3 && map_type <= 5) {
+      reader.read_flag(); // slice_group_change_direction_flag
+      reader.read_ue();   // slice_group_change_rate_minus1
+    } else if (map_type == 6) {
+      uint32_t map_unit_count = reader.read_ue() + 1;
+      uint32_t id_bits = std::bit_width(num_slice_groups_minus1);
+      for (uint32_t i = 0; i < map_unit_count; i++) {
+        reader.read_bits(id_bits);
+      }
+    }
+  }
+  uint32_t l0 = reader.read_ue();
+  uint32_t l1 = reader.read_ue();
+  if (l0 > 31 || l1 > 31) {
+    throw std::runtime_error{"invalid h264 pps"};
+  }
+  pps.num_ref_idx_l0_default_active_minus1 = l0;
+  pps.num_ref_idx_l1_default_active_minus1 = l1;
+  pps.flags.weighted_pred_flag = reader.read_flag();
+  pps.weighted_bipred_idc =
+      static_cast<StdVideoH264WeightedBipredIdc>(reader.read_bits(2));
+  pps.pic_init_qp_minus26 = reader.read_se();
+  pps.pic_init_qs_minus26 = reader.read_se();
+  pps.chroma_qp_index_offset = reader.read_se();
+  pps.flags.deblocking_filter_control_present_flag = reader.read_flag();
+  pps.flags.constrained_intra_pred_flag = reader.read_flag();
+  pps.flags.redundant_pic_cnt_present_flag = reader.read_flag();
+  pps.second_chroma_qp_index_offset = pps.chroma_qp_index_offset;
+  if (reader.has_more_data()) {
+    pps.flags.transform_8x8_mode_flag = reader.read_flag();
+    pps.flags.pic_scaling_matrix_present_flag = reader.read_flag();
+    if (pps.flags.pic_scaling_matrix_present_flag) {
+      auto sps = sps_list.find(sps_id);
+      if (sps == sps_list.end()) {
+        throw std::runtime_error{"h264 pps refers to a missing sps"};
+      }
+      uint32_t chroma_format_idc = sps->second.sps.chroma_format_idc;
+      h264_helper::read_scaling_lists(
+          reader,
+          6 + (chroma_format_idc != 3 ? 2 : 6) *
+                  pps.flags.transform_8x8_mode_flag,
+          result.scaling_lists);
+    }
+    pps.second_chroma_qp_index_offset = reader.read_se();
+  }
+  result.link();
+  return result;
+}
+
+struct h264_memory_management_operation {
+  uint32_t memory_management_control_operation;
+  uint32_t difference_of_pic_nums_minus1;
+  uint32_t long_term_pic_num;
+  uint32_t long_term_frame_idx;
+  uint32_t max_long_term_frame_idx_plus1;
+};
+// The slice header up to dec_ref_pic_marking(), what the application needs
+// to manage the DPB. The driver parses the rest from the slice data.
+struct h264_slice_header {
+  uint8_t nal_ref_idc;
+  h264_nal_unit_type nal_unit_type;
+  uint32_t first_mb_in_slice;
+  uint32_t slice_type; // 0 P, 1 B, 2 I, 3 SP, 4 SI
+  uint8_t pic_parameter_set_id;
+  uint8_t seq_parameter_set_id;
+  uint8_t colour_plane_id;
+  uint16_t frame_num;
+  bool field_pic_flag;
+  bool bottom_field_flag;
+  uint16_t idr_pic_id;
+  uint32_t pic_order_cnt_lsb;
+  int32_t delta_pic_order_cnt_bottom;
+  std::array<int32_t, 2> delta_pic_order_cnt;
+  uint32_t redundant_pic_cnt;
+  bool direct_spatial_mv_pred_flag;
+  uint8_t num_ref_idx_l0_active_minus1;
+  uint8_t num_ref_idx_l1_active_minus1;
+  bool no_output_of_prior_pics_flag;
+  bool long_term_reference_flag;
+  bool adaptive_ref_pic_marking_mode_flag;
+  std::vector<h264_memory_management_operation> memory_management_operations;
+
+  bool is_idr() const { return nal_unit_type == h264_nal_unit_type::idr_slice; }
+  bool is_reference() const { return nal_ref_idc != 0; }
+  bool is_intra() const { return slice_type == 2 || slice_type == 4; }
+  bool is_b() const { return slice_type == 1; }
+  bool is_p() const { return slice_type == 0 || slice_type == 3; }
+  // the first slice of a picture, slices are in decoding order.
+  bool starts_picture() const { return first_mb_in_slice == 0; }
+  bool has_memory_management_reset() const {
+    return std::ranges::any_of(memory_management_operations,
+                               [](auto &operation) {
+                                 return operation
+                                            .memory_management_control_operation ==
+                                        5;
+                               });
+  }
+  // PicOrderCnt is left to h264_picture_order_count, is_intra and
+  // complementary_field_pair depend on the other slices and fields.
+  StdVideoDecodeH264PictureInfo get_picture_info() const {
+    StdVideoDecodeH264PictureInfo info{};
+    info.flags.field_pic_flag = field_pic_flag;
+    info.flags.is_intra = is_intra();
+    info.flags.IdrPicFlag = is_idr();
+    info.flags.bottom_field_flag = bottom_field_flag;
+    info.flags.is_reference = is_reference();
+    info.seq_parameter_set_id = seq_parameter_set_id;
+    info.pic_parameter_set_id = pic_parameter_set_id;
+    info.frame_num = frame_num;
+    info.idr_pic_id = idr_pic_id;
+    return info;
+  }
+};
+
+// The active SPS and PPS of a stream, in the form needed by
+// VkVideoDecodeH264SessionParametersAddInfoKHR, and the slice headers
+// parsed with them.
+class h264_parameter_sets {
+public:
+  // returns false when the unit is not a parameter set.
+  bool parse(const h264_nal_unit &nal) {
+    if (nal.get_type() == h264_nal_unit_type::sps) {
+      auto sps = parse_h264_sps(nal);
+      m_sps_list[sps.sps.seq_parameter_set_id] = sps;
+      return true;
+    }
+    if (nal.get_type() == h264_nal_unit_type::pps) {
+      auto pps = parse_h264_pps(nal, m_sps_list);
+      m_pps_list[pps.pps.pic_parameter_set_id] = pps;
+      return true;
+    }
+    return false;
+  }
+
+  const h264_sps *find_sps(uint32_t id) const {
+    auto it = m_sps_list.find(id);
+    return it != m_sps_list.end() ? &it->second : nullptr;
+  }
+  const h264_pps *find_pps(uint32_t id) const {
+    auto it = m_pps_list.find(id);
+    return it != m_pps_list.end() ? &it->second : nullptr;
+  }
+  // the pointers in the structures stay valid until the next parse().
+  std::vector<StdVideoH264SequenceParameterSet> get_std_sps_list() const {
+    std::vector<StdVideoH264SequenceParameterSet> list;
+    for (auto &[id, sps] : m_sps_list) {
+      list.push_back(sps.sps);
+    }
+    return list;
+  }
+  std::vector<StdVideoH264PictureParameterSet> get_std_pps_list() const {
+    std::vector<StdVideoH264PictureParameterSet> list;
+    for (auto &[id, pps] : m_pps_list) {
+      list.push_back(pps.pps);
+    }
+    return list;
+  }
+
+  h264_slice_header parse_slice_header(const h264_nal_unit &nal) const {
+    if (!nal.is_slice()) {
+      throw std::runtime_error{"h264 nal unit is not a slice"};
+    }
+    h264_helper::bit_reader reader{nal.data.subspan(1)};
+    h264_slice_header header{};
+    header.nal_ref_idc = nal.get_nal_ref_idc();
+    header.nal_unit_type = nal.get_type();
+    header.first_mb_in_slice = reader.read_ue();
+    header.slice_type = reader.read_ue() % 5;
+    uint32_t pps_id = reader.read_ue();
+    auto pps = find_pps(pps_id);
+    if (pps == nullptr) {
+      throw std::runtime_error{"h264 slice refers to a missing pps"};
+    }
+    auto sps = find_sps(pps->pps.seq_parameter_set_id);
+    if (sps == nullptr) {
+      throw std::runtime_error{"h264 pps refers to a missing sps"};
+    }
+    auto &sps_flags = sps->sps.flags;
+    auto &pps_flags = pps->pps.flags;
+    header.pic_parameter_set_id = pps_id;
+    header.seq_parameter_set_id = pps->pps.seq_parameter_set_id;
+    if (sps_flags.separate_colour_plane_flag) {
+      header.colour_plane_id = reader.read_bits(2);
+    }
+    header.frame_num = reader.read_bits(sps->sps.log2_max_frame_num_minus4 + 4);
+    if (!sps_flags.frame_mbs_only_flag) {
+      header.field_pic_flag = reader.read_flag();
+      if (header.field_pic_flag) {
+        header.bottom_field_flag = reader.read_flag();
+      }
+    }
+    if (header.is_idr()) {
+      header.idr_pic_id = reader.read_ue();
+    }
+    bool field_order_present =
+        pps_flags.bottom_field_pic_order_in_frame_present_flag &&
+        !header.field_pic_flag;
+    if (sps->sps.pic_order_cnt_type == STD_VIDEO_H264_POC_TYPE_0) {
+      header.pic_order_cnt_lsb =
+          reader.read_bits(sps->sps.log2_max_pic_order_cnt_lsb_minus4 + 4);
+      if (field_order_present) {
+        header.delta_pic_order_cnt_bottom = reader.read_se();
+      }
+    }
+    if (sps->sps.pic_order_cnt_type == STD_VIDEO_H264_POC_TYPE_1 &&
+        !sps_flags.delta_pic_order_always_zero_flag) {
+      header.delta_pic_order_cnt[0] = reader.read_se();
+      if (field_order_present) {
+        header.delta_pic_order_cnt[1] = reader.read_se();
+      }
+    }
+    if (pps_flags.redundant_pic_cnt_present_flag) {
+      header.redundant_pic_cnt = reader.read_ue();
+    }
+    if (header.is_b()) {
+      header.direct_spatial_mv_pred_flag = reader.read_flag();
+    }
+    uint32_t l0 = pps->pps.num_ref_idx_l0_default_active_minus1;
+    uint32_t l1 = pps->pps.num_ref_idx_l1_default_active_minus1;
+    if (header.is_p() || header.is_b()) {
+      // num_ref_idx_active_override_flag
+      if (reader.read_flag()) {
+        l0 = reader.read_ue();
+        if (header.is_b()) {
+          l1 = reader.read_ue();
+        }
+      }
+    }
+    if (l0 > 31 || l1 > 31) {
+      throw std::runtime_error{"invalid h264 slice header"};
+    }
+    header.num_ref_idx_l0_active_minus1 = l0;
+    header.num_ref_idx_l1_active_minus1 = l1;
+
+    // ref_pic_list_modification()
+    auto skip_list_modification = [&reader]() {
+      if (!reader.read_flag()) {
+        return;
+      }
+      while (true) {
+        uint32_t idc = reader.read_ue();
+        if (idc == 3) {
+          break;
+        }
+        if (idc > 5) {
+          throw std::runtime_error{"invalid h264 slice header"};
+        }
+        reader.read_ue(); // abs_diff_pic_num_minus1 or long_term_pic_num
+      }
+    };
+    if (!header.is_intra()) {
+      skip_list_modification();
+    }
+    if (header.is_b()) {
+      skip_list_modification();
+    }
+
+    // pred_weight_table()
+    if ((pps_flags.weighted_pred_flag && header.is_p()) ||
+        (pps->pps.weighted_bipred_idc == STD_VIDEO_H264_WEIGHTED_BIPRED_IDC_EXPLICIT &&
+         header.is_b())) {
+      bool has_chroma = sps->get_chroma_array_type() != 0;
+      reader.read_ue(); // luma_log2_weight_denom
+      if (has_chroma) {
+        reader.read_ue(); // chroma_log2_weight_denom
+      }
+      auto skip_weights = [&reader, has_chroma](uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+          if (reader.read_flag()) {
+            reader.read_se();
+            reader.read_se();
+          }
+          if (has_chroma && reader.read_flag()) {
+            for (uint32_t j = 0; j < 4; j++) {
+              reader.read_se();
+            }
+          }
+        }
+      };
+      skip_weights(l0 + 1);
+      if (header.is_b()) {
+        skip_weights(l1 + 1);
+      }
+    }
+
+    // dec_ref_pic_marking()
+    if (header.is_reference()) {
+      if (header.is_idr()) {
+        header.no_output_of_prior_pics_flag = reader.read_flag();
+        header.long_term_reference_flag = reader.read_flag();
+      } else {
+        header.adaptive_ref_pic_marking_mode_flag = reader.read_flag();
+        while (header.adaptive_ref_pic_marking_mode_flag) {
+          h264_memory_management_operation operation{};
+          operation.memory_management_control_operation = reader.read_ue();
+          auto op = operation.memory_management_control_operation;
+          if (op == 0) {
+            break;
+          }
+          if (op > 6) {
+            throw std::runtime_error{"invalid h264 slice header"};
+          }
+          if (op == 1 || op == 3) {
+            operation.difference_of_pic_nums_minus1 = reader.read_ue();
+          }
+          if (op == 2) {
+            operation.long_term_pic_num = reader.read_ue();
+          }
+          if (op == 3 || op == 6) {
+            operation.long_term_frame_idx = reader.read_ue();
+          }
+          if (op == 4) {
+            operation.max_long_term_frame_idx_plus1 = reader.read_ue();
+          }
+          header.memory_management_operations.push_back(operation);
+        }
+      }
+    }
+    return header;
+  }
+
+private:
+  std::map<uint32_t, h264_sps> m_sps_list;
+  std::map<uint32_t, h264_pps> m_pps_list;
+};
+
+// Derives TopFieldOrderCnt and BottomFieldOrderCnt (8.2.1) for
+// StdVideoDecodeH264PictureInfo::PicOrderCnt. Call once per picture, with
+// the header of its first slice, in decoding order.
+class h264_picture_order_count {
+public:
+  std::array<int32_t, 2> compute(const h264_slice_header &header,
+                                 const h264_sps &sps) {
+    std::array<int32_t, 2> poc{};
+    switch (sps.sps.pic_order_cnt_type) {
+    case STD_VIDEO_H264_POC_TYPE_0:
+      poc = compute_type_0(header, sps);
+      break;
+    case STD_VIDEO_H264_POC_TYPE_1:
+      poc = compute_type_1(header, sps);
+      break;
+    default:
+      poc = compute_type_2(header, sps);
+      break;
+    }
+    // after memory_management_control_operation 5 the counts of the picture
+    // are made relative to it, the returned ones are those it is decoded
+    // with.
+    bool reset = header.has_memory_management_reset();
+    if (header.is_reference()) {
+      if (reset) {
+        m_prev_msb = 0;
+        m_prev_lsb =
+            header.field_pic_flag ? 0 : poc[0] - std::min(poc[0], poc[1]);
+      } else {
+        m_prev_msb = m_msb;
+        m_prev_lsb = header.pic_order_cnt_lsb;
+      }
+    }
+    m_prev_frame_num_offset = reset ? 0 : m_frame_num_offset;
+    m_prev_frame_num = reset ? 0 : header.frame_num;
+    return poc;
+  }
+
+private:
+  std::array<int32_t, 2> compute_type_0(const h264_slice_header &header,
+                                        const h264_sps &sps) {
+    if (header.is_idr()) {
+      m_prev_msb = 0;
+      m_prev_lsb = 0;
+    }
+    int32_t max_lsb = 1 << (sps.sps.log2_max_pic_order_cnt_lsb_minus4 + 4);
+    int32_t lsb = header.pic_order_cnt_lsb;
+    if (lsb < m_prev_lsb && m_prev_lsb - lsb >= max_lsb / 2) {
+      m_msb = m_prev_msb + max_lsb;
+    } else if (lsb > m_prev_lsb && lsb - m_prev_lsb > max_lsb / 2) {
+      m_msb = m_prev_msb - max_lsb;
+    } else {
+      m_msb = m_prev_msb;
+    }
+    std::array<int32_t, 2> poc{};
+    if (!header.bottom_field_flag) {
+      poc[0] = m_msb + lsb;
+    }
+    if (!header.field_pic_flag) {
+      poc[1] = poc[0] + header.delta_pic_order_cnt_bottom;
+    } else if (header.bottom_field_flag) {
+      poc[1] = m_msb + lsb;
+    }
+    return poc;
+  }
+  void update_frame_num_offset(const h264_slice_header &header,
+                               const h264_sps &sps) {
+    int32_t max_frame_num = 1 << (sps.sps.log2_max_frame_num_minus4 + 4);
+    if (header.is_idr()) {
+      m_frame_num_offset = 0;
+    } else if (m_prev_frame_num > header.frame_num) {
+      m_frame_num_offset = m_prev_frame_num_offset + max_frame_num;
+    } else {
+      m_frame_num_offset = m_prev_frame_num_offset;
+    }
+  }
+  std::array<int32_t, 2> compute_type_1(const h264_slice_header &header,
+                                        const h264_sps &sps) {
+    update_frame_num_offset(header, sps);
+    uint32_t cycle_length = sps.sps.num_ref_frames_in_pic_order_cnt_cycle;
+    int32_t abs_frame_num =
+        cycle_length != 0 ? m_frame_num_offset + header.frame_num : 0;
+    if (!header.is_reference() && abs_frame_num > 0) {
+      abs_frame_num--;
+    }
+    int32_t expected = 0;
+    if (abs_frame_num > 0) {
+      int32_t delta_per_cycle = 0;
+      for (uint32_t i = 0; i < cycle_length; i++) {
+        delta_per_cycle += sps.offset_for_ref_frame[i];
+      }
+      int32_t cycle_count = (abs_frame_num - 1) / cycle_length;
+      int32_t frame_num_in_cycle = (abs_frame_num - 1) % cycle_length;
+      expected = cycle_count * delta_per_cycle;
+      for (int32_t i = 0; i <= frame_num_in_cycle; i++) {
+        expected += sps.offset_for_ref_frame[i];
+      }
+    }
+    if (!header.is_reference()) {
+      expected += sps.sps.offset_for_non_ref_pic;
+    }
+    std::array<int32_t, 2> poc{};
+    if (!header.field_pic_flag) {
+      poc[0] = expected + header.delta_pic_order_cnt[0];
+      poc[1] = poc[0] + sps.sps.offset_for_top_to_bottom_field +
+               header.delta_pic_order_cnt[1];
+    } else if (!header.bottom_field_flag) {
+      poc[0] = expected + header.delta_pic_order_cnt[0];
+    } else {
+      poc[1] = expected + sps.sps.offset_for_top_to_bottom_field +
+               header.delta_pic_order_cnt[0];
+    }
+    return poc;
+  }
+  std::array<int32_t, 2> compute_type_2(const h264_slice_header &header,
+                                        const h264_sps &sps) {
+    update_frame_num_offset(header, sps);
+    int32_t temp = 0;
+    if (!header.is_idr()) {
+      temp = 2 * (m_frame_num_offset + header.frame_num) -
+             (header.is_reference() ? 0 : 1);
+    }
+    std::array<int32_t, 2> poc{};
+    if (!header.field_pic_flag || !header.bottom_field_flag) {
+      poc[0] = temp;
+    }
+    if (!header.field_pic_flag || header.bottom_field_flag) {
+      poc[1] = temp;
+    }
+    return poc;
+  }
+
+  int32_t m_prev_msb = 0;
+  int32_t m_prev_lsb = 0;
+  int32_t m_msb = 0;
+  int32_t m_frame_num_offset = 0;
+  int32_t m_prev_frame_num_offset = 0;
+  int32_t m_prev_frame_num = 0;
+};
+
+// Where a picture was put in the bitstream buffer, for VkVideoDecodeInfoKHR
+// and VkVideoDecodeH264PictureInfoKHR.
+struct h264_bitstream_range {
+  uint64_t offset; // srcBufferOffset
+  uint64_t size;   // srcBufferRange
+  std::vector<uint32_t> slice_offsets; // pSliceOffsets, relative to offset
+};
+
+// Packs the slices of each picture, with start codes, into the mapped memory
+// of a bitstream buffer. Pictures are placed one after the other and wrap
+// around, aligned to minBitstreamBufferOffsetAlignment and padded to
+// minBitstreamBufferSizeAlignment of VkVideoCapabilitiesKHR. The space of a
+// picture is reused after release_oldest(), once its decode has completed.
+class h264_bitstream_ring {
+public:
+  h264_bitstream_ring(std::span<std::byte> memory, uint64_t offset_alignment,
+                      uint64_t size_alignment)
+      : m_memory{memory},
+        m_offset_alignment{std::max<uint64_t>(offset_alignment, 1)},
+        m_size_alignment{std::max<uint64_t>(size_alignment, 1)}, m_write{0} {}
+
+  // returns std::nullopt when the ring is too full, release a picture and
+  // try again.
+  std::optional<h264_bitstream_range>
+  push_picture(std::span<const h264_nal_unit> slices) {
+    if (slices.empty()) {
+      throw std::runtime_error{"h264 picture has no slices"};
+    }
+    uint64_t size = 0;
+    for (auto &slice : slices) {
+      size += sizeof(start_code) + slice.data.size();
+    }
+    uint64_t padded_size = align_up(size, m_size_alignment);
+    if (padded_size > m_memory.size()) {
+      throw std::runtime_error{"h264 picture is larger than the bitstream ring"};
+    }
+    auto offset = allocate(padded_size);
+    if (!offset) {
+      return std::nullopt;
+    }
+
+    h264_bitstream_range range{
+        .offset = *offset, .size = padded_size, .slice_offsets = {}};
+    auto out = m_memory.data() + *offset;
+    uint64_t position = 0;
+    for (auto &slice : slices) {
+      range.slice_offsets.push_back(position);
+      std::memcpy(out + position, start_code.data(), start_code.size());
+      position += start_code.size();
+      std::memcpy(out + position, slice.data.data(), slice.data.size());
+      position += slice.data.size();
+    }
+    std::memset(out + position, 0, padded_size - position);
+    return range;
+  }
+  void release_oldest() {
+    if (m_used.empty()) {
+      return;
+    }
+    m_used.pop_front();
+    if (m_used.empty()) {
+      m_write = 0;
+    }
+  }
+  size_t get_picture_count() const { return m_used.size(); }
+  uint64_t get_capacity() const { return m_memory.size(); }
+
+private:
+  static constexpr std::array<std::byte, 3> start_code{
+      std::byte{0}, std::byte{0}, std::byte{1}};
+
+  static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+  std::optional<uint64_t> allocate(uint64_t size) {
+    uint64_t begin = 0;
+    if (!m_used.empty()) {
+      uint64_t oldest = m_used.front();
+      begin = align_up(m_write, m_offset_alignment);
+      if (m_write > oldest) {
+        // the used space does not wrap, try behind it, then in front of it.
+        if (begin + size > m_memory.size()) {
+          begin = 0;
+          if (size > oldest) {
+            return std::nullopt;
+          }
+        }
+      } else if (begin + size > oldest) {
+        return std::nullopt;
+      }
+    }
+    m_used.push_back(begin);
+    m_write = begin + size;
+    return begin;
+  }
+
+  std::span<std::byte> m_memory;
+  uint64_t m_offset_alignment;
+  uint64_t m_size_alignment;
+  // start offsets of the pictures in use, oldest first.
+  std::deque<uint64_t> m_used;
+  uint64_t m_write;
+};
+
+} // namespace vulkan_helper
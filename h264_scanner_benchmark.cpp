@@ -0,0 +1,110 @@
+// Splits a generated Annex B stream into NAL units with h264_nal_scanner and
+// with a byte loop, and prints the throughput of each.
+//   h264_scanner_benchmark [stream_size_mib] [nal_size] [repetitions]
+// The payload is random with many zeros but no start codes, so the scanner
+// meets the near misses of real slice data.
+#include "h264_helper.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// whole units only, a stream cut after a start code has an empty last unit.
+std::vector<std::byte> generate_stream(size_t size, size_t nal_size) {
+  size -= size % nal_size;
+  std::mt19937 random{1};
+  std::vector<std::byte> stream(size);
+  uint32_t zero_count = 0;
+  for (size_t i = 0; i < size; i++) {
+    uint8_t byte = 0;
+    if (i % nal_size < 3) {
+      byte = i % nal_size == 2 ? 1 : 0;
+    } else if (i % nal_size == 3) {
+      byte = 0x41;
+    } else {
+      byte = random() % 8 == 0 ? 0 : random() & 0xff;
+      // what emulation prevention guarantees.
+      if (zero_count >= 2 && byte <= 3) {
+        byte = 3;
+      }
+    }
+    zero_count = byte == 0 ? zero_count + 1 : 0;
+    stream[i] = std::byte{byte};
+  }
+  return stream;
+}
+
+size_t count_naive(std::span<const std::byte> stream) {
+  size_t count = 0;
+  for (size_t i = 0; i + 3 <= stream.size(); i++) {
+    if (stream[i] == std::byte{0} && stream[i + 1] == std::byte{0} &&
+        stream[i + 2] == std::byte{1}) {
+      count++;
+      i += 2;
+    }
+  }
+  return count;
+}
+size_t count_scanner(std::span<const std::byte> stream) {
+  size_t count = 0;
+  vulkan_helper::h264_nal_scanner scanner{stream};
+  while (scanner.next()) {
+    count++;
+  }
+  return count;
+}
+
+// returns the seconds of the fastest of repetitions runs.
+double run(auto &&count, std::span<const std::byte> stream,
+           size_t expected_count, uint32_t repetitions) {
+  double best = 0;
+  for (uint32_t i = 0; i < repetitions; i++) {
+    auto start = std::chrono::steady_clock::now();
+    size_t found = count(stream);
+    auto end = std::chrono::steady_clock::now();
+    if (found != expected_count) {
+      throw std::runtime_error{"scanner found " + std::to_string(found) +
+                               " nal units, expected " +
+                               std::to_string(expected_count)};
+    }
+    double seconds = std::chrono::duration<double>(end - start).count();
+    best = i == 0 ? seconds : std::min(best, seconds);
+  }
+  return best;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t stream_size = (argc > 1 ? std::stoull(argv[1]) : 256) << 20;
+  size_t nal_size = argc > 2 ? std::stoull(argv[2]) : 16 * 1024;
+  uint32_t repetitions = argc > 3 ? std::stoul(argv[3]) : 4;
+  try {
+    if (nal_size < 4) {
+      throw std::runtime_error{"nal_size needs at least 4 bytes"};
+    }
+    auto stream = generate_stream(stream_size, nal_size);
+    size_t expected_count = count_naive(stream);
+    std::cout << (stream_size >> 20) << " MiB, " << expected_count
+              << " nal units, best of " << repetitions << '\n';
+#ifdef VULKAN_HELPER_H264_SSE2
+    std::cout << "scanner uses sse2\n";
+#endif
+    auto naive_seconds = run(count_naive, stream, expected_count, repetitions);
+    auto scanner_seconds =
+        run(count_scanner, stream, expected_count, repetitions);
+    std::cout << "byte loop: " << stream.size() / naive_seconds / 1e6
+              << " MB/s\n"
+              << "h264_nal_scanner: " << stream.size() / scanner_seconds / 1e6
+              << " MB/s\n";
+  } catch (const std::exception &e) {
+    std::cerr << argv[0] << ": " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
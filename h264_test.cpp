@@ -0,0 +1,557 @@
+// Checks the start code scanner, the parameter set and slice header parsers,
+// the picture order counts and the bitstream ring of h264_helper.hpp on
+// streams written by the test, so no Vulkan device is needed.
+#include "h264_helper.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+void check(bool condition, const char *message) {
+  if (!condition) {
+    std::cerr << "failed: " << message << '\n';
+    failures++;
+  }
+}
+
+std::span<const std::byte> as_bytes(const std::vector<uint8_t> &data) {
+  return {reinterpret_cast<const std::byte *>(data.data()), data.size()};
+}
+
+// writes the RBSP of a NAL unit, nal() adds the start code, the header and
+// the emulation prevention bytes.
+class bit_writer {
+public:
+  void write_bits(uint32_t count, uint64_t value) {
+    for (uint32_t i = count; i > 0; i--) {
+      if (m_bit_count % 8 == 0) {
+        m_bytes.push_back(0);
+      }
+      if ((value >> (i - 1)) & 1) {
+        m_bytes.back() |= 0x80 >> (m_bit_count % 8);
+      }
+      m_bit_count++;
+    }
+  }
+  void write_flag(bool value) { write_bits(1, value); }
+  void write_ue(uint32_t value) {
+    uint64_t code = uint64_t{value} + 1;
+    uint32_t length = std::bit_width(code);
+    write_bits(length - 1, 0);
+    write_bits(length, code);
+  }
+  void write_se(int32_t value) {
+    write_ue(value > 0 ? 2 * value - 1 : -2 * value);
+  }
+  std::vector<uint8_t> nal(uint8_t header) {
+    // rbsp_trailing_bits()
+    write_bits(1, 1);
+    while (m_bit_count % 8 != 0) {
+      write_bits(1, 0);
+    }
+    std::vector<uint8_t> result{0, 0, 0, 1, header};
+    uint32_t zero_count = 0;
+    for (auto byte : m_bytes) {
+      if (zero_count >= 2 && byte <= 3) {
+        result.push_back(3);
+        zero_count = 0;
+      }
+      result.push_back(byte);
+      zero_count = byte == 0 ? zero_count + 1 : 0;
+    }
+    return result;
+  }
+
+private:
+  std::vector<uint8_t> m_bytes;
+  uint32_t m_bit_count = 0;
+};
+
+size_t find_start_code_naive(const std::vector<uint8_t> &data, size_t offset) {
+  for (size_t i = offset; i + 3 <= data.size(); i++) {
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+      return i;
+    }
+  }
+  return data.size();
+}
+
+// a start code at every position of every size up to a few vector widths,
+// so that it is found by the 16 byte loop, by the memchr tail, and across
+// the point where one hands over to the other.
+void test_start_code_scanner() {
+  bool all_found = true;
+  for (size_t size = 0; size <= 64; size++) {
+    for (size_t position = 0; position + 3 <= size; position++) {
+      std::vector<uint8_t> data(size, 0xff);
+      data[position] = 0;
+      data[position + 1] = 0;
+      data[position + 2] = 1;
+      for (size_t offset = 0; offset <= size; offset++) {
+        size_t expected = offset <= position ? position : size;
+        all_found &= vulkan_helper::find_h264_start_code(as_bytes(data),
+                                                         offset) == expected;
+      }
+    }
+    std::vector<uint8_t> zeros(size, 0);
+    all_found &=
+        vulkan_helper::find_h264_start_code(as_bytes(zeros)) == zeros.size();
+  }
+  check(all_found, "a start code is found at every position");
+
+  // mostly zeros and ones, so that there are many near misses.
+  std::mt19937 random{1};
+  std::vector<uint8_t> data(100000);
+  for (auto &byte : data) {
+    byte = random() % 4 == 0 ? 0 : random() % 3;
+  }
+  bool same = true;
+  for (size_t offset = 0; offset < data.size();) {
+    size_t found = vulkan_helper::find_h264_start_code(as_bytes(data), offset);
+    same &= found == find_start_code_naive(data, offset);
+    offset = found + 1;
+  }
+  check(same, "the scanner finds what a byte loop finds");
+
+  std::vector<uint8_t> stream{0, 0, 0, 1, 0x09, 0xf0, 0, 0, 1, 0x0c, 0xff,
+                              0, 0, 0, 0, 0, 1,    0x0b, 0, 0};
+  vulkan_helper::h264_nal_scanner scanner{as_bytes(stream)};
+  auto first = scanner.next();
+  auto second = scanner.next();
+  auto third = scanner.next();
+  check(first && first->data.size() == 2 &&
+            first->get_type() ==
+                vulkan_helper::h264_nal_unit_type::access_unit_delimiter,
+        "the leading zero of a four byte start code is skipped");
+  check(second && second->data.size() == 2 &&
+            second->get_type() == vulkan_helper::h264_nal_unit_type::filler,
+        "zeros before the next start code are not part of the unit");
+  check(third && third->data.size() == 1 &&
+            third->get_type() ==
+                vulkan_helper::h264_nal_unit_type::end_of_stream,
+        "trailing zeros of the stream are not part of the unit");
+  check(!scanner.next(), "the scanner stops at the end of the stream");
+}
+
+void test_emulation_prevention() {
+  // 00 00 03 xx reads as 00 00 xx, the 03 after it is data again.
+  std::vector<uint8_t> data{0, 0, 3, 1, 0, 0, 3, 3, 0x80};
+  vulkan_helper::h264_helper::bit_reader reader{as_bytes(data)};
+  check(reader.read_bits(24) == 0x000001, "an emulation prevention byte");
+  check(reader.read_bits(24) == 0x000003, "the byte after it is data");
+  check(!reader.has_more_data(), "the stop bit ends the data");
+
+  bit_writer writer;
+  for (uint32_t i = 0; i < 16; i++) {
+    writer.write_bits(8, 0);
+  }
+  writer.write_ue(1000);
+  writer.write_se(-3);
+  auto nal = writer.nal(0x06);
+  check(nal.size() > 5 + 16 + 3, "the writer adds emulation prevention bytes");
+  vulkan_helper::h264_helper::bit_reader escaped{as_bytes(nal).subspan(5)};
+  check(escaped.read_bits(32) == 0 && escaped.read_bits(32) == 0 &&
+            escaped.read_bits(32) == 0 && escaped.read_bits(32) == 0,
+        "zeros read back through the emulation prevention bytes");
+  check(escaped.read_ue() == 1000 && escaped.read_se() == -3 &&
+            !escaped.has_more_data(),
+        "codes after the emulation prevention bytes");
+}
+
+// high profile with scaling lists, cropping, vui and hrd.
+std::vector<uint8_t> write_sps() {
+  bit_writer w;
+  w.write_bits(8, 100); // profile_idc
+  w.write_bits(8, 0);
+  w.write_bits(8, 41); // level_idc
+  w.write_ue(3);       // seq_parameter_set_id
+  w.write_ue(1);       // chroma_format_idc
+  w.write_ue(0);
+  w.write_ue(0);
+  w.write_flag(false);
+  w.write_flag(true); // seq_scaling_matrix_present_flag
+  for (uint32_t i = 0; i < 8; i++) {
+    w.write_flag(i == 0 || i == 6);
+    if (i == 0) {
+      w.write_se(-8); // next_scale 0, use the default list
+    }
+    if (i == 6) {
+      for (uint32_t j = 0; j < 64; j++) {
+        w.write_se(j == 0 ? 8 : 0);
+      }
+    }
+  }
+  w.write_ue(4); // log2_max_frame_num_minus4
+  w.write_ue(0); // pic_order_cnt_type
+  w.write_ue(4); // log2_max_pic_order_cnt_lsb_minus4
+  w.write_ue(4); // max_num_ref_frames
+  w.write_flag(false);
+  w.write_ue(119); // pic_width_in_mbs_minus1
+  w.write_ue(67);  // pic_height_in_map_units_minus1
+  w.write_flag(true);
+  w.write_flag(true);
+  w.write_flag(true); // frame_cropping_flag
+  w.write_ue(0);
+  w.write_ue(0);
+  w.write_ue(0);
+  w.write_ue(4);
+  w.write_flag(true); // vui_parameters_present_flag
+  w.write_flag(true);
+  w.write_bits(8, 255); // extended sar
+  w.write_bits(16, 4);
+  w.write_bits(16, 3);
+  w.write_flag(false);
+  w.write_flag(false);
+  w.write_flag(false);
+  w.write_flag(true); // timing_info_present_flag
+  w.write_bits(32, 1001);
+  w.write_bits(32, 60000);
+  w.write_flag(true);
+  w.write_flag(true); // nal_hrd_parameters_present_flag
+  w.write_ue(0);
+  w.write_bits(4, 2);
+  w.write_bits(4, 3);
+  w.write_ue(5000);
+  w.write_ue(6000);
+  w.write_flag(true);
+  w.write_bits(5, 23);
+  w.write_bits(5, 22);
+  w.write_bits(5, 21);
+  w.write_bits(5, 24);
+  w.write_flag(false);
+  w.write_flag(false);
+  w.write_flag(false);
+  w.write_flag(true); // bitstream_restriction_flag
+  w.write_flag(true);
+  w.write_ue(0);
+  w.write_ue(0);
+  w.write_ue(16);
+  w.write_ue(16);
+  w.write_ue(2); // max_num_reorder_frames
+  w.write_ue(4); // max_dec_frame_buffering
+  return w.nal(0x67);
+}
+std::vector<uint8_t> write_pps() {
+  bit_writer w;
+  w.write_ue(7); // pic_parameter_set_id
+  w.write_ue(3);
+  w.write_flag(true); // entropy_coding_mode_flag
+  w.write_flag(false);
+  w.write_ue(0);
+  w.write_ue(2); // num_ref_idx_l0_default_active_minus1
+  w.write_ue(0);
+  w.write_flag(true);  // weighted_pred_flag
+  w.write_bits(2, 1);  // weighted_bipred_idc
+  w.write_se(-3);      // pic_init_qp_minus26
+  w.write_se(0);
+  w.write_se(-2); // chroma_qp_index_offset
+  w.write_flag(true);
+  w.write_flag(false);
+  w.write_flag(false);
+  w.write_flag(true); // transform_8x8_mode_flag
+  w.write_flag(false);
+  w.write_se(5); // second_chroma_qp_index_offset
+  return w.nal(0x68);
+}
+// slice_type 5 P, 6 B, 7 I. The P slice overrides its reference count, P and
+// B carry a pred_weight_table, the zero slice data needs emulation
+// prevention.
+std::vector<uint8_t> write_slice(uint8_t header, uint32_t slice_type,
+                                 uint32_t frame_num, uint32_t lsb,
+                                 bool memory_management_reset) {
+  bool idr = (header & 0x1f) == 5;
+  bool reference = (header >> 5) != 0;
+  uint32_t type = slice_type % 5;
+  bit_writer w;
+  w.write_ue(0);
+  w.write_ue(slice_type);
+  w.write_ue(7);
+  w.write_bits(8, frame_num);
+  if (idr) {
+    w.write_ue(1); // idr_pic_id
+  }
+  w.write_bits(8, lsb);
+  if (type == 1) {
+    w.write_flag(true); // direct_spatial_mv_pred_flag
+  }
+  if (type == 0 || type == 1) {
+    w.write_flag(type == 0); // num_ref_idx_active_override_flag
+    if (type == 0) {
+      w.write_ue(1);
+    }
+    // ref_pic_list_modification() of l0, one entry
+    w.write_flag(true);
+    w.write_ue(0);
+    w.write_ue(0);
+    w.write_ue(3);
+  }
+  if (type == 1) {
+    w.write_flag(false);
+  }
+  if (type == 0 || type == 1) {
+    // pred_weight_table(), l0 has 2 entries in P and 3 in B, l1 has 1.
+    w.write_ue(2);
+    w.write_ue(1);
+    for (uint32_t i = 0; i < (type == 0 ? 2u : 4u); i++) {
+      w.write_flag(true);
+      w.write_se(1);
+      w.write_se(-1);
+      w.write_flag(i == 1);
+      if (i == 1) {
+        for (int32_t j = 0; j < 4; j++) {
+          w.write_se(j - 2);
+        }
+      }
+    }
+  }
+  if (reference) {
+    if (idr) {
+      w.write_flag(false);
+      w.write_flag(false);
+    } else {
+      w.write_flag(memory_management_reset);
+      if (memory_management_reset) {
+        w.write_ue(1);
+        w.write_ue(3);
+        w.write_ue(5);
+        w.write_ue(0);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < 40; i++) {
+    w.write_bits(8, 0);
+  }
+  w.write_bits(8, 0x55);
+  auto nal = w.nal(header);
+  nal.push_back(0);
+  return nal;
+}
+
+void test_parameter_sets_and_slices() {
+  std::vector<uint8_t> stream;
+  for (auto nal : {write_sps(), write_pps(), write_slice(0x65, 7, 0, 0, false),
+                   write_slice(0x41, 5, 1, 4, true),
+                   write_slice(0x01, 6, 2, 2, false)}) {
+    stream.insert(stream.end(), nal.begin(), nal.end());
+  }
+  vulkan_helper::h264_nal_scanner scanner{as_bytes(stream)};
+  vulkan_helper::h264_parameter_sets sets;
+  std::vector<vulkan_helper::h264_slice_header> headers;
+  try {
+    while (auto nal = scanner.next()) {
+      if (!sets.parse(*nal)) {
+        headers.push_back(sets.parse_slice_header(*nal));
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "failed: " << e.what() << '\n';
+    failures++;
+    return;
+  }
+  check(headers.size() == 3, "three slices");
+
+  auto sps_pointer = sets.find_sps(3);
+  check(sps_pointer != nullptr, "the sps is found by its id");
+  if (sps_pointer == nullptr || headers.size() != 3) {
+    return;
+  }
+  // a copy points at its own lists.
+  auto sps = *sps_pointer;
+  check(sps.sps.pScalingLists == &sps.scaling_lists &&
+            sps.sps.pSequenceParameterSetVui == &sps.vui &&
+            sps.vui.pHrdParameters == &sps.hrd,
+        "a copied sps points at its own members");
+  check(sps.sps.profile_idc == STD_VIDEO_H264_PROFILE_IDC_HIGH &&
+            sps.sps.level_idc == STD_VIDEO_H264_LEVEL_IDC_4_1 &&
+            sps.sps.pic_width_in_mbs_minus1 == 119 &&
+            sps.sps.pic_height_in_map_units_minus1 == 67,
+        "sps profile, level and size");
+  check(sps.scaling_lists.scaling_list_present_mask == 0x41 &&
+            sps.scaling_lists.use_default_scaling_matrix_mask == 0x1 &&
+            sps.scaling_lists.ScalingList8x8[0][63] == 16,
+        "sps scaling lists");
+  check(sps.sps.flags.frame_cropping_flag &&
+            sps.sps.frame_crop_bottom_offset == 4,
+        "sps cropping");
+  check(sps.vui.sar_width == 4 && sps.vui.sar_height == 3 &&
+            sps.vui.time_scale == 60000 && sps.vui.max_num_reorder_frames == 2 &&
+            sps.vui.max_dec_frame_buffering == 4,
+        "sps vui");
+  check(sps.hrd.bit_rate_value_minus1[0] == 5000 &&
+            sps.hrd.cpb_size_value_minus1[0] == 6000 &&
+            sps.hrd.time_offset_length == 24,
+        "sps hrd");
+
+  auto pps = sets.find_pps(7);
+  check(pps != nullptr && pps->pps.flags.entropy_coding_mode_flag &&
+            pps->pps.num_ref_idx_l0_default_active_minus1 == 2 &&
+            pps->pps.flags.weighted_pred_flag &&
+            pps->pps.weighted_bipred_idc ==
+                STD_VIDEO_H264_WEIGHTED_BIPRED_IDC_EXPLICIT &&
+            pps->pps.pic_init_qp_minus26 == -3 &&
+            pps->pps.chroma_qp_index_offset == -2 &&
+            pps->pps.flags.transform_8x8_mode_flag &&
+            pps->pps.second_chroma_qp_index_offset == 5,
+        "pps fields");
+
+  check(headers[0].is_idr() && headers[0].is_intra() &&
+            headers[0].idr_pic_id == 1 && headers[0].pic_parameter_set_id == 7 &&
+            headers[0].seq_parameter_set_id == 3,
+        "idr slice");
+  check(headers[1].is_p() && headers[1].frame_num == 1 &&
+            headers[1].pic_order_cnt_lsb == 4 &&
+            headers[1].num_ref_idx_l0_active_minus1 == 1 &&
+            headers[1].memory_management_operations.size() == 2 &&
+            headers[1].has_memory_management_reset(),
+        "p slice after its weights and list modification");
+  check(headers[2].is_b() && !headers[2].is_reference() &&
+            headers[2].direct_spatial_mv_pred_flag &&
+            headers[2].num_ref_idx_l0_active_minus1 == 2,
+        "b slice with the default reference count");
+  auto info = headers[0].get_picture_info();
+  check(info.flags.IdrPicFlag && info.flags.is_intra &&
+            info.flags.is_reference && info.pic_parameter_set_id == 7,
+        "picture info of the idr slice");
+}
+
+vulkan_helper::h264_slice_header make_header(bool idr, bool reference,
+                                             uint32_t frame_num,
+                                             uint32_t lsb = 0) {
+  vulkan_helper::h264_slice_header header{};
+  header.nal_unit_type = idr ? vulkan_helper::h264_nal_unit_type::idr_slice
+                             : vulkan_helper::h264_nal_unit_type::slice;
+  header.nal_ref_idc = reference ? 1 : 0;
+  header.frame_num = frame_num;
+  header.pic_order_cnt_lsb = lsb;
+  return header;
+}
+std::array<int32_t, 2> poc(int32_t top, int32_t bottom) {
+  return {top, bottom};
+}
+
+void test_picture_order_count() {
+  // type 0: the lsb wraps at 16, the msb follows it, a reset restarts it.
+  {
+    vulkan_helper::h264_sps sps{};
+    sps.sps.pic_order_cnt_type = STD_VIDEO_H264_POC_TYPE_0;
+    sps.sps.log2_max_pic_order_cnt_lsb_minus4 = 0;
+    vulkan_helper::h264_picture_order_count order;
+    bool same = order.compute(make_header(true, true, 0, 0), sps) == poc(0, 0);
+    same &= order.compute(make_header(false, true, 1, 8), sps) == poc(8, 8);
+    same &= order.compute(make_header(false, true, 2, 14), sps) == poc(14, 14);
+    same &= order.compute(make_header(false, true, 3, 2), sps) == poc(18, 18);
+    same &= order.compute(make_header(false, false, 4, 12), sps) ==
+            poc(12, 12);
+    auto reset = make_header(false, true, 4, 6);
+    reset.adaptive_ref_pic_marking_mode_flag = true;
+    vulkan_helper::h264_memory_management_operation operation{};
+    operation.memory_management_control_operation = 5;
+    reset.memory_management_operations.push_back(operation);
+    same &= order.compute(reset, sps) == poc(22, 22);
+    same &= order.compute(make_header(false, true, 0, 2), sps) == poc(2, 2);
+    check(same, "picture order count type 0");
+  }
+  // type 1: a cycle of two reference frames, 4 and 6 apart.
+  {
+    vulkan_helper::h264_sps sps{};
+    sps.sps.pic_order_cnt_type = STD_VIDEO_H264_POC_TYPE_1;
+    sps.sps.log2_max_frame_num_minus4 = 0;
+    sps.sps.flags.delta_pic_order_always_zero_flag = true;
+    sps.sps.offset_for_non_ref_pic = -2;
+    sps.sps.offset_for_top_to_bottom_field = 1;
+    sps.sps.num_ref_frames_in_pic_order_cnt_cycle = 2;
+    sps.offset_for_ref_frame[0] = 4;
+    sps.offset_for_ref_frame[1] = 6;
+    vulkan_helper::h264_picture_order_count order;
+    bool same = order.compute(make_header(true, true, 0), sps) == poc(0, 1);
+    same &= order.compute(make_header(false, true, 1), sps) == poc(4, 5);
+    same &= order.compute(make_header(false, true, 2), sps) == poc(10, 11);
+    same &= order.compute(make_header(false, false, 3), sps) == poc(8, 9);
+    same &= order.compute(make_header(false, true, 3), sps) == poc(14, 15);
+    check(same, "picture order count type 1");
+  }
+  // type 2: twice the frame number, which wraps at 16.
+  {
+    vulkan_helper::h264_sps sps{};
+    sps.sps.pic_order_cnt_type = STD_VIDEO_H264_POC_TYPE_2;
+    sps.sps.log2_max_frame_num_minus4 = 0;
+    vulkan_helper::h264_picture_order_count order;
+    bool same = order.compute(make_header(true, true, 0), sps) == poc(0, 0);
+    same &= order.compute(make_header(false, true, 1), sps) == poc(2, 2);
+    same &= order.compute(make_header(false, false, 2), sps) == poc(3, 3);
+    same &= order.compute(make_header(false, true, 15), sps) == poc(30, 30);
+    same &= order.compute(make_header(false, true, 0), sps) == poc(32, 32);
+    check(same, "picture order count type 2");
+  }
+}
+
+void test_bitstream_ring() {
+  std::vector<uint8_t> first(100, 0x65);
+  std::vector<uint8_t> second(20, 0x41);
+  vulkan_helper::h264_nal_unit slice{as_bytes(first)};
+  std::array slices{slice, vulkan_helper::h264_nal_unit{as_bytes(second)}};
+
+  std::vector<std::byte> memory(1000, std::byte{0xcd});
+  vulkan_helper::h264_bitstream_ring ring{memory, 256, 64};
+  auto picture = ring.push_picture(slices);
+  check(picture && picture->offset == 0 && picture->size == 128 &&
+            picture->slice_offsets == std::vector<uint32_t>{0, 103},
+        "two slices with start codes, padded to the size alignment");
+  if (picture) {
+    auto data = memory.data();
+    check(data[0] == std::byte{0} && data[2] == std::byte{1} &&
+              std::memcmp(data + 3, first.data(), first.size()) == 0 &&
+              std::memcmp(data + 106, second.data(), second.size()) == 0 &&
+              data[127] == std::byte{0} && data[128] == std::byte{0xcd},
+          "slice bytes and zero padding");
+  }
+  std::span one{&slice, 1};
+  bool placed = true;
+  for (uint64_t offset : {256, 512, 768}) {
+    auto next = ring.push_picture(one);
+    placed &= next && next->offset == offset;
+  }
+  check(placed, "pictures start at the offset alignment");
+  check(!ring.push_picture(one), "a full ring refuses a picture");
+  ring.release_oldest();
+  auto wrapped = ring.push_picture(one);
+  check(wrapped && wrapped->offset == 0,
+        "the ring wraps into the released space");
+  check(!ring.push_picture(one),
+        "a wrapped ring does not overwrite the oldest picture");
+  while (ring.get_picture_count() != 0) {
+    ring.release_oldest();
+  }
+  auto empty = ring.push_picture(one);
+  check(empty && empty->offset == 0, "an empty ring starts over");
+
+  std::vector<uint8_t> large(memory.size(), 0x65);
+  std::array too_large{vulkan_helper::h264_nal_unit{as_bytes(large)}};
+  bool thrown = false;
+  try {
+    ring.push_picture(too_large);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  check(thrown, "a picture larger than the ring throws");
+}
+
+} // namespace
+
+int main() {
+  test_start_code_scanner();
+  test_emulation_prevention();
+  test_parameter_sets_and_slices();
+  test_picture_order_count();
+  test_bitstream_ring();
+  if (failures != 0) {
+    std::cerr << failures << " checks failed\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,192 @@
+// Checks that physical_device_snapshot_cache writes snapshots, reads them
+// back, and queries again for damaged files and changed keys. The snapshots
+// are made up by the test, so no Vulkan device is needed.
+#include "vulkan_helper.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+void check(bool condition, const char *message) {
+  if (!condition) {
+    std::cerr << "failed: " << message << '\n';
+    failures++;
+  }
+}
+
+using vulkan_hpp_helper::physical_device_snapshot;
+using vulkan_hpp_helper::physical_device_snapshot_cache;
+using vulkan_hpp_helper::physical_device_snapshot_key;
+
+physical_device_snapshot_key make_key(uint8_t device) {
+  physical_device_snapshot_key key{};
+  key.vendor_id = 0x10de;
+  key.device_id = 0x2684;
+  key.driver_version = 1;
+  key.api_version = VK_API_VERSION_1_3;
+  key.device_uuid[0] = device;
+  return key;
+}
+physical_device_snapshot make_snapshot() {
+  physical_device_snapshot snapshot{};
+  auto &extension = snapshot.extension_properties.emplace_back();
+  std::ranges::copy(std::string_view{VK_KHR_SWAPCHAIN_EXTENSION_NAME},
+                    extension.extensionName.begin());
+  extension.specVersion = 70;
+  snapshot.queue_family_properties.push_back(vk::QueueFamilyProperties{
+      vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute, 16});
+  snapshot.memory_properties.memoryTypeCount = 1;
+  snapshot.memory_properties.memoryTypes[0].propertyFlags =
+      vk::MemoryPropertyFlagBits::eDeviceLocal;
+  return snapshot;
+}
+
+// counts how often the cache asks for a new snapshot.
+class counting_query {
+public:
+  physical_device_snapshot operator()() {
+    count++;
+    return make_snapshot();
+  }
+  uint32_t count = 0;
+};
+
+std::vector<char> read_file(const std::filesystem::path &path) {
+  auto file = std::ifstream{path, std::ios::binary};
+  return {std::istreambuf_iterator<char>{file},
+          std::istreambuf_iterator<char>{}};
+}
+void write_file(const std::filesystem::path &path,
+                const std::vector<char> &data) {
+  auto file = std::ofstream{path, std::ios::binary | std::ios::trunc};
+  file.write(data.data(), data.size());
+}
+
+// fills the file with a snapshot of device 1 under layers.
+void write_snapshot(const std::filesystem::path &path,
+                    const std::vector<std::string> &layers) {
+  std::filesystem::remove(path);
+  physical_device_snapshot_cache cache{path, layers};
+  counting_query query;
+  cache.get_snapshot(make_key(1), query);
+  cache.save();
+}
+
+void test_round_trip(const std::filesystem::path &path) {
+  std::vector<std::string> layers{"VK_LAYER_KHRONOS_validation 1"};
+  std::filesystem::remove(path);
+  {
+    physical_device_snapshot_cache cache{path, layers};
+    counting_query query;
+    cache.get_snapshot(make_key(1), query);
+    cache.get_snapshot(make_key(1), query);
+    check(query.count == 1, "a snapshot is queried once per key");
+    cache.save();
+  }
+  physical_device_snapshot_cache cache{path, layers};
+  counting_query query;
+  auto snapshot = cache.get_snapshot(make_key(1), query);
+  check(query.count == 0, "the snapshot is read from the file");
+  auto expected = make_snapshot();
+  check(snapshot.extension_properties == expected.extension_properties,
+        "extensions are read back");
+  check(snapshot.queue_family_properties == expected.queue_family_properties,
+        "queue families are read back");
+  check(snapshot.memory_properties == expected.memory_properties,
+        "memory properties are read back");
+}
+
+void test_damaged_files(const std::filesystem::path &path) {
+  std::vector<std::string> layers;
+  write_snapshot(path, layers);
+  auto data = read_file(path);
+
+  auto truncated = data;
+  truncated.resize(truncated.size() - 1);
+  write_file(path, truncated);
+  {
+    physical_device_snapshot_cache cache{path, layers};
+    counting_query query;
+    cache.get_snapshot(make_key(1), query);
+    check(query.count == 1, "a truncated file is queried again");
+  }
+
+  // the version follows the magic value.
+  auto wrong_version = data;
+  wrong_version[4]++;
+  write_file(path, wrong_version);
+  {
+    physical_device_snapshot_cache cache{path, layers};
+    counting_query query;
+    cache.get_snapshot(make_key(1), query);
+    check(query.count == 1, "a file of another version is queried again");
+  }
+
+  write_file(path, {data.begin(), data.begin() + 2});
+  {
+    physical_device_snapshot_cache cache{path, layers};
+    counting_query query;
+    cache.get_snapshot(make_key(1), query);
+    check(query.count == 1, "a cut header is queried again");
+  }
+}
+
+void test_stale_keys(const std::filesystem::path &path) {
+  std::vector<std::string> layers;
+  write_snapshot(path, layers);
+  {
+    // a driver update changes the key of device 1.
+    physical_device_snapshot_cache cache{path, layers};
+    counting_query query;
+    auto updated = make_key(1);
+    updated.driver_version++;
+    cache.get_snapshot(updated, query);
+    cache.get_snapshot(make_key(2), query);
+    check(query.count == 2, "a changed driver version is queried again");
+    cache.save();
+  }
+  {
+    physical_device_snapshot_cache cache{path, layers};
+    counting_query query;
+    auto updated = make_key(1);
+    updated.driver_version++;
+    cache.get_snapshot(updated, query);
+    cache.get_snapshot(make_key(2), query);
+    check(query.count == 0, "both current snapshots are kept");
+    cache.get_snapshot(make_key(1), query);
+    check(query.count == 1, "the replaced snapshot is dropped");
+  }
+
+  write_snapshot(path, {"VK_LAYER_MESA_device_select 1"});
+  {
+    std::vector<std::string> other_layers{"VK_LAYER_MESA_device_select 2"};
+    physical_device_snapshot_cache cache{path, other_layers};
+    counting_query query;
+    cache.get_snapshot(make_key(1), query);
+    check(query.count == 1, "other layers are queried again");
+  }
+}
+
+} // namespace
+
+int main() {
+  auto path = std::filesystem::temp_directory_path() /
+              "physical_device_snapshot_test.bin";
+  test_round_trip(path);
+  test_damaged_files(path);
+  test_stale_keys(path);
+  std::filesystem::remove(path);
+  if (failures != 0) {
+    std::cerr << failures << " checks failed\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Compiles the same set of compute pipelines through add_async_pipelines with
+// 1..N worker threads and prints the time to have all of them ready.
+//   pipeline_startup_benchmark [pipeline_count] [max_thread_count]
+// No pipeline cache is used, every run compiles from scratch.
+#include "vulkan_helper.hpp"
+#include "pipeline_startup_benchmark_spv.hpp"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+class benchmark_extensions {
+public:
+  auto get_extensions() { return std::vector<std::string>{}; }
+};
+using benchmark_instance = vulkan_helper::add_instance_function_wrapper<
+    vulkan_helper::instance<benchmark_extensions>>;
+
+class benchmark_physical_device_base : public benchmark_instance {
+public:
+  benchmark_physical_device_base()
+      : m_physical_device{get_first_physical_device()} {}
+  VkPhysicalDevice get_vulkan_physical_device() { return m_physical_device; }
+
+private:
+  VkPhysicalDevice m_physical_device;
+};
+using benchmark_physical_device =
+    vulkan_helper::add_physical_device_wrapper_functions<
+        benchmark_physical_device_base>;
+
+// pipelines need no queue, but a device needs one.
+class benchmark_device_base : public benchmark_physical_device {
+public:
+  benchmark_device_base()
+      : m_device{create_device(vulkan_helper::device_create_info{}.set_queue_count(
+            find_queue_family_if(
+                [](const VkQueueFamilyProperties &properties) {
+                  return (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+                }),
+            1))} {}
+  benchmark_device_base(const benchmark_device_base &) = delete;
+  ~benchmark_device_base() { vkDestroyDevice(m_device, nullptr); }
+  benchmark_device_base &operator=(const benchmark_device_base &) = delete;
+
+  VkDevice get_vulkan_device() { return m_device; }
+
+private:
+  VkDevice m_device;
+};
+using benchmark_device = vulkan_helper::add_async_pipelines<
+    vulkan_helper::add_device_wrapper_functions<benchmark_device_base>>;
+
+// returns the seconds from the first submit until every pipeline is ready.
+// first_seed keeps the seeds of separate runs apart.
+double run(uint32_t thread_count, uint32_t pipeline_count,
+           uint32_t first_seed) {
+  benchmark_device device{thread_count};
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkDescriptorSetLayoutCreateInfo set_layout_info{};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.bindingCount = 1;
+  set_layout_info.pBindings = &binding;
+  auto set_layout = device.create_descriptor_set_layout(&set_layout_info);
+  auto pipeline_layout = device.create_pipeline_layout(set_layout);
+  auto shader_module =
+      device.create_shader_module(std::span{pipeline_startup_benchmark_spv});
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<benchmark_device::pipeline_handle> pipelines;
+  pipelines.reserve(pipeline_count);
+  for (uint32_t i = 0; i < pipeline_count; i++) {
+    pipelines.push_back(device.submit_pipeline(
+        shader_module, pipeline_layout,
+        vulkan_hpp_helper::specialization_constants{}.set(0, first_seed + i)));
+  }
+  for (auto &pipeline : pipelines) {
+    pipeline.get();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  // the pipelines are destroyed with the device.
+  device.destroy_shader_module(shader_module);
+  device.destroy_pipeline_layout(pipeline_layout);
+  device.destroy_descriptor_set_layout(set_layout);
+  return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t pipeline_count = argc > 1 ? std::stoul(argv[1]) : 256;
+  uint32_t max_thread_count =
+      argc > 2 ? std::stoul(argv[2])
+               : vulkan_helper::thread_pool::default_thread_count();
+  try {
+    std::cout << pipeline_count << " compute pipelines\n";
+    for (uint32_t thread_count = 1; thread_count <= max_thread_count;
+         thread_count++) {
+      auto seconds =
+          run(thread_count, pipeline_count, thread_count * pipeline_count);
+      std::cout << thread_count << " threads: " << seconds * 1000 << " ms, "
+                << pipeline_count / seconds << " pipelines/s\n";
+    }
+  } catch (const std::exception &e) {
+    std::cerr << argv[0] << ": " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -28,74 +28,6 @@ public:
   }
 };
 
-#if defined(WIN32)
-template <class T> class map_file_mapping : public T {
-public:
-  using parent = T;
-  map_file_mapping(const configure auto& conf) : parent{conf} {
-    HANDLE mapping = parent::get_file_mapping();
-    m_memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
-    if (m_memory == INVALID_HANDLE_VALUE) {
-      throw std::runtime_error{"failed to map view of file"};
-    }
-  }
-  ~map_file_mapping() { UnmapViewOfFile(m_memory); }
-  auto get_mapped_pointer() { return m_memory; }
-
-private:
-  void *m_memory;
-};
-template <class T> class cache_file_size : public T {
-public:
-  using parent = T;
-  cache_file_size(const configure auto& conf) : parent{conf}{
-    HANDLE file = parent::get_file();
-    m_size = GetFileSize(file, NULL);
-  }
-  auto get_file_size() { return m_size; }
-
-private:
-  uint32_t m_size;
-};
-template <class T> class add_file_mapping : public T {
-public:
-  using parent = T;
-  add_file_mapping(const configure auto& conf) : parent{conf} {
-    uint64_t maximum_size{0};
-    HANDLE file = parent::get_file();
-    m_mapping = CreateFileMapping(file, nullptr, PAGE_READONLY,
-                                  static_cast<uint32_t>(maximum_size >> 32),
-                                  static_cast<uint32_t>(maximum_size), nullptr);
-    if (m_mapping == INVALID_HANDLE_VALUE) {
-      throw std::runtime_error{"failed to create file mapping"};
-    }
-  }
-  ~add_file_mapping() { CloseHandle(m_mapping); }
-  auto get_file_mapping() { return m_mapping; }
-
-private:
-  HANDLE m_mapping;
-};
-template <class T> class add_file : public T {
-public:
-  using parent = T;
-  add_file(const configure auto& conf) : parent{conf}{
-    auto path = parent::get_file_path();
-    m_file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
-                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (m_file == INVALID_HANDLE_VALUE) {
-      auto info = std::string{"failed to create file: "} + path;
-      throw std::runtime_error{info};
-    }
-  }
-  ~add_file() { CloseHandle(m_file); }
-  auto get_file() { return m_file; }
-
-private:
-  HANDLE m_file;
-};
-#endif
-
 template <class T> class add_wayland_surface_extension : public T {
 public:
   using parent = T;
@@ -115,56 +47,42 @@ public:
 #endif
 };
 
-#if linux
+// The file of get_file_path() is read through a vulkan_helper::mapped_file,
+// mapped with get_mapped_file_options() when the stack has it.
 template <class T> class map_file_mapping : public T {
 public:
   using parent = T;
-  map_file_mapping(const configure auto& conf) : parent{conf} {
-    int fd = parent::get_file_descriptor();
-    auto size = parent::get_file_size();
-    m_memory = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (m_memory == MAP_FAILED) {
-      throw std::runtime_error{"failed to map view of file"};
-    }
-  }
-  ~map_file_mapping() {
-    auto size = parent::get_file_size();
-    munmap(m_memory, size);
-  }
-  auto get_mapped_pointer() { return m_memory; }
-
-private:
-  void *m_memory;
+  map_file_mapping(const configure auto& conf) : parent{conf} {}
+  auto get_mapped_pointer() { return parent::get_file().data(); }
 };
 template <class T> class cache_file_size : public T {
 public:
   using parent = T;
-  cache_file_size(const configure auto& conf) : parent{conf}{
-    auto fd = parent::get_file_descriptor();
-    m_size = lseek(fd, 0, SEEK_END);
-  }
+  cache_file_size(const configure auto& conf)
+      : parent{conf}, m_size{parent::get_file().size()} {}
   auto get_file_size() { return m_size; }
 
 private:
-  uint32_t m_size;
+  uint64_t m_size;
 };
 template <class T> class add_file_mapping : public T {};
 template <class T> class add_file : public T {
 public:
   using parent = T;
-  add_file(const configure auto& conf) : parent{conf}{
+  add_file(const configure auto& conf) : parent{conf}, m_file{open_file()} {}
+  auto &get_file() { return m_file; }
+
+private:
+  vulkan_helper::mapped_file open_file() {
     auto path = parent::get_file_path();
-    m_file_descriptor = open(path.c_str(), O_RDONLY);
-    if (m_file_descriptor == -1) {
-      auto info = std::string{"failed to create file: "} + path;
-      throw std::runtime_error{info};
+    if constexpr (requires { parent::get_mapped_file_options(); }) {
+      return vulkan_helper::mapped_file{path,
+                                        parent::get_mapped_file_options()};
+    } else {
+      return vulkan_helper::mapped_file{path};
     }
   }
-  ~add_file() { close(m_file_descriptor); }
-  auto get_file_descriptor() { return m_file_descriptor; }
 
-private:
-  int m_file_descriptor;
+  vulkan_helper::mapped_file m_file;
 };
-#endif
 }
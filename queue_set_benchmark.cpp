@@ -0,0 +1,225 @@
+// Submits the same independent compute jobs through a queue_set of 1..N
+// queues of one family and prints the time per queue count and selection.
+//   queue_set_benchmark [job_count] [repetitions]
+#include "vulkan_helper.hpp"
+#include "queue_set_benchmark_spv.hpp"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t local_size = 64;
+constexpr uint32_t invocation_count = 64 * 1024;
+
+class benchmark_extensions {
+public:
+  auto get_extensions() { return std::vector<std::string>{}; }
+};
+using benchmark_instance = vulkan_helper::add_instance_function_wrapper<
+    vulkan_helper::instance<benchmark_extensions>>;
+
+class benchmark_physical_device_base : public benchmark_instance {
+public:
+  benchmark_physical_device_base()
+      : m_physical_device{get_first_physical_device()} {}
+  VkPhysicalDevice get_vulkan_physical_device() { return m_physical_device; }
+
+private:
+  VkPhysicalDevice m_physical_device;
+};
+using benchmark_physical_device =
+    vulkan_helper::add_physical_device_wrapper_functions<
+        benchmark_physical_device_base>;
+
+// a compute family without graphics usually has the most queues.
+uint32_t find_compute_queue_family(benchmark_physical_device &physical_device) {
+  try {
+    return physical_device.find_queue_family_if(
+        [](const VkQueueFamilyProperties &properties) {
+          return (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+                 !(properties.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+        });
+  } catch (const std::runtime_error &) {
+    return physical_device.find_queue_family_if(
+        [](const VkQueueFamilyProperties &properties) {
+          return (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+        });
+  }
+}
+
+// creates every queue of the compute family, queue_set uses the first
+// queue_count of them.
+class benchmark_device_base : public benchmark_physical_device {
+public:
+  benchmark_device_base()
+      : m_queue_family_index{find_compute_queue_family(*this)},
+        m_device{create_device(vulkan_helper::device_create_info{}.set_queue_count(
+            m_queue_family_index,
+            get_queue_family_queue_count(m_queue_family_index)))} {}
+  benchmark_device_base(const benchmark_device_base &) = delete;
+  ~benchmark_device_base() { vkDestroyDevice(m_device, nullptr); }
+  benchmark_device_base &operator=(const benchmark_device_base &) = delete;
+
+  uint32_t get_queue_family_index() const { return m_queue_family_index; }
+  VkDevice get_vulkan_device() { return m_device; }
+
+private:
+  uint32_t m_queue_family_index;
+  VkDevice m_device;
+};
+using benchmark_device = vulkan_helper::queue_set<
+    vulkan_helper::add_device_wrapper_functions<benchmark_device_base>>;
+
+struct compute_job {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  VkDescriptorSet descriptor_set;
+  VkCommandBuffer command_buffer;
+  VkFence fence;
+};
+
+// returns the seconds taken to run every job repetitions times.
+double run(benchmark_device &device, uint32_t job_count,
+           uint32_t repetitions) {
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkDescriptorSetLayoutCreateInfo set_layout_info{};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.bindingCount = 1;
+  set_layout_info.pBindings = &binding;
+  auto set_layout = device.create_descriptor_set_layout(&set_layout_info);
+  auto pipeline_layout = device.create_pipeline_layout(set_layout);
+  auto shader_module =
+      device.create_shader_module(std::span{queue_set_benchmark_spv});
+  auto pipeline = device.create_pipeline(shader_module, pipeline_layout);
+
+  VkDescriptorPoolSize pool_size{};
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = job_count;
+  VkDescriptorPoolCreateInfo pool_info{};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = job_count;
+  pool_info.poolSizeCount = 1;
+  pool_info.pPoolSizes = &pool_size;
+  auto descriptor_pool = device.create_descriptor_pool(&pool_info);
+  auto command_pool =
+      device.create_command_pool(device.get_queue_family_index());
+
+  std::vector<compute_job> jobs(job_count);
+  for (auto &job : jobs) {
+    job.buffer = device.create_buffer(device.get_queue_family_index(),
+                                      invocation_count * sizeof(uint32_t),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    job.memory =
+        device.alloc_device_memory(device.get_memory_properties(), job.buffer,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    job.descriptor_set =
+        device.allocate_descriptor_set(descriptor_pool, set_layout);
+    VkDescriptorBufferInfo buffer_info{};
+    buffer_info.buffer = job.buffer;
+    buffer_info.range = VK_WHOLE_SIZE;
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = job.descriptor_set;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+    device.update_descriptor_set(write);
+
+    job.command_buffer = device.allocate_command_buffer(command_pool);
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    if (vkBeginCommandBuffer(job.command_buffer, &begin_info) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to begin command buffer"};
+    }
+    vkCmdBindPipeline(job.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      pipeline);
+    vkCmdBindDescriptorSets(job.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout, 0, 1, &job.descriptor_set, 0,
+                            nullptr);
+    vkCmdDispatch(job.command_buffer, invocation_count / local_size, 1, 1);
+    if (vkEndCommandBuffer(job.command_buffer) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to end command buffer"};
+    }
+    job.fence = device.create_fence();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < repetitions; i++) {
+    for (auto &job : jobs) {
+      VkSubmitInfo submit_info{};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.commandBufferCount = 1;
+      submit_info.pCommandBuffers = &job.command_buffer;
+      device.submit(1, &submit_info, job.fence);
+    }
+    for (auto &job : jobs) {
+      device.wait_for_fence(job.fence);
+    }
+    // let the queue set retire the signaled fences before they are reused.
+    for (uint32_t queue = 0; queue < device.get_queue_count(); queue++) {
+      device.get_outstanding_work(queue);
+    }
+    for (auto &job : jobs) {
+      device.reset_fence(job.fence);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  for (auto &job : jobs) {
+    device.destroy_fence(job.fence);
+    device.destroy_buffer(job.buffer);
+    device.free_device_memory(job.memory);
+  }
+  device.destroy_command_pool(command_pool);
+  device.destroy_descriptor_pool(descriptor_pool);
+  device.destroy_pipeline(pipeline);
+  device.destroy_shader_module(shader_module);
+  device.destroy_pipeline_layout(pipeline_layout);
+  device.destroy_descriptor_set_layout(set_layout);
+  return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t job_count = argc > 1 ? std::stoul(argv[1]) : 64;
+  uint32_t repetitions = argc > 2 ? std::stoul(argv[2]) : 16;
+  try {
+    uint32_t queue_family_index = 0;
+    uint32_t max_queue_count = 0;
+    {
+      benchmark_physical_device physical_device;
+      queue_family_index = find_compute_queue_family(physical_device);
+      max_queue_count =
+          physical_device.get_queue_family_queue_count(queue_family_index);
+    }
+    std::cout << "queue family " << queue_family_index << ", " << job_count
+              << " jobs x " << repetitions << '\n';
+    for (auto selection : {vulkan_helper::queue_selection::round_robin,
+                           vulkan_helper::queue_selection::least_outstanding_work}) {
+      for (uint32_t queue_count = 1; queue_count <= max_queue_count;
+           queue_count++) {
+        benchmark_device device{queue_family_index, queue_count, selection};
+        auto seconds = run(device, job_count, repetitions);
+        std::cout << (selection == vulkan_helper::queue_selection::round_robin
+                          ? "round robin"
+                          : "least outstanding work")
+                  << ", " << queue_count << " queues: " << seconds * 1000
+                  << " ms, " << job_count * repetitions / seconds
+                  << " jobs/s\n";
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << argv[0] << ": " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "spirv_helper.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace vulkan_helper {
+
+// Many SPIR-V modules in one file, so that loading all shaders of an
+// application costs one open and one mapping. The file starts with a header
+// and an open addressing hash table of the names, followed by the 4 byte
+// aligned code of each module:
+//   spirv_archive_header
+//   spirv_archive_entry[bucket_count]  empty buckets have offset 0
+//   code
+// All values are little endian.
+struct spirv_archive_header {
+  static constexpr uint32_t magic_value = 0x41565053; // "SPVA"
+  static constexpr uint32_t current_version = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t bucket_count; // power of two
+  uint32_t entry_count;
+};
+struct spirv_archive_entry {
+  uint64_t name_hash;
+  uint64_t content_hash; // hash_spirv() of the code
+  uint64_t offset;       // in bytes from the start of the archive
+  uint64_t size;         // in bytes
+};
+static_assert(std::endian::native == std::endian::little,
+              "spirv archives are read in place");
+
+inline uint64_t hash_spirv_archive_name(std::string_view name) {
+  return hash_bytes(name.data(), name.size());
+}
+
+class spirv_archive {
+public:
+  spirv_archive(std::filesystem::path path)
+      : m_file{path}, m_header{}, m_entries{} {
+    auto bytes = get_bytes();
+    if (bytes.size() < sizeof(spirv_archive_header)) {
+      throw std::runtime_error{"failed to read spirv archive header"};
+    }
+    std::memcpy(&m_header, bytes.data(), sizeof(m_header));
+    if (m_header.magic != spirv_archive_header::magic_value ||
+        m_header.version != spirv_archive_header::current_version ||
+        !std::has_single_bit(m_header.bucket_count)) {
+      throw std::runtime_error{"invalid spirv archive header"};
+    }
+    auto table_size =
+        static_cast<size_t>(m_header.bucket_count) * sizeof(spirv_archive_entry);
+    if (bytes.size() - sizeof(spirv_archive_header) < table_size) {
+      throw std::runtime_error{"truncated spirv archive index"};
+    }
+    // the header is 16 bytes and the mapping page aligned, so the table is
+    // aligned for its 64 bit members.
+    m_entries = std::span{reinterpret_cast<const spirv_archive_entry *>(
+                              bytes.data() + sizeof(spirv_archive_header)),
+                          m_header.bucket_count};
+  }
+
+  std::optional<spirv_archive_entry> find_entry(std::string_view name) const {
+    auto name_hash = hash_spirv_archive_name(name);
+    auto mask = m_header.bucket_count - 1;
+    for (uint32_t i = 0; i < m_header.bucket_count; i++) {
+      auto &entry = m_entries[(name_hash + i) & mask];
+      if (entry.offset == 0) {
+        return std::nullopt;
+      }
+      if (entry.name_hash == name_hash) {
+        return entry;
+      }
+    }
+    return std::nullopt;
+  }
+  std::optional<std::span<const uint32_t>> find(std::string_view name) const {
+    auto entry = find_entry(name);
+    if (!entry) {
+      return std::nullopt;
+    }
+    auto bytes = get_bytes();
+    if (entry->offset % 4 != 0 || entry->size % 4 != 0 ||
+        entry->offset > bytes.size() ||
+        entry->size > bytes.size() - entry->offset) {
+      throw std::runtime_error{"invalid spirv archive entry"};
+    }
+    return std::span{reinterpret_cast<const uint32_t *>(bytes.data() +
+                                                        entry->offset),
+                     entry->size / 4};
+  }
+  std::span<const uint32_t> get(std::string_view name) const {
+    auto code = find(name);
+    if (!code) {
+      throw std::runtime_error{"failed to find shader in spirv archive"};
+    }
+    return *code;
+  }
+  uint32_t size() const { return m_header.entry_count; }
+
+private:
+  std::span<const char> get_bytes() const {
+    return std::span{static_cast<const char *>(m_file.data()),
+                     static_cast<size_t>(m_file.size())};
+  }
+
+  mapped_file m_file;
+  spirv_archive_header m_header;
+  std::span<const spirv_archive_entry> m_entries;
+};
+
+// Collects modules and writes them as an archive, used by spirv_pack.
+class spirv_archive_writer {
+public:
+  void add(std::string_view name, std::span<const uint32_t> code) {
+    auto name_hash = hash_spirv_archive_name(name);
+    for (auto &packed : m_modules) {
+      if (packed.name_hash == name_hash) {
+        throw std::runtime_error{"duplicate shader name in spirv archive"};
+      }
+    }
+    m_modules.emplace_back(packed_module{
+        .name_hash = name_hash,
+        .code = std::vector<uint32_t>{code.begin(), code.end()},
+    });
+  }
+  void save(const std::filesystem::path &path) const {
+    auto bucket_count = std::bit_ceil(
+        std::max<uint32_t>(static_cast<uint32_t>(m_modules.size()) * 2, 1));
+    auto header = spirv_archive_header{
+        .magic = spirv_archive_header::magic_value,
+        .version = spirv_archive_header::current_version,
+        .bucket_count = bucket_count,
+        .entry_count = static_cast<uint32_t>(m_modules.size()),
+    };
+    std::vector<spirv_archive_entry> entries(bucket_count);
+    uint64_t offset = sizeof(spirv_archive_header) +
+                      bucket_count * sizeof(spirv_archive_entry);
+    for (auto &packed : m_modules) {
+      auto mask = bucket_count - 1;
+      auto bucket = packed.name_hash & mask;
+      while (entries[bucket].offset != 0) {
+        bucket = (bucket + 1) & mask;
+      }
+      entries[bucket] = spirv_archive_entry{
+          .name_hash = packed.name_hash,
+          .content_hash = hash_spirv(packed.code),
+          .offset = offset,
+          .size = packed.code.size() * sizeof(uint32_t),
+      };
+      offset += entries[bucket].size;
+    }
+
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()),
+               entries.size() * sizeof(spirv_archive_entry));
+    for (auto &packed : m_modules) {
+      file.write(reinterpret_cast<const char *>(packed.code.data()),
+                 packed.code.size() * sizeof(uint32_t));
+    }
+    if (!file) {
+      throw std::runtime_error{"failed to write spirv archive"};
+    }
+  }
+
+private:
+  struct packed_module {
+    uint64_t name_hash;
+    std::vector<uint32_t> code;
+  };
+  std::vector<packed_module> m_modules;
+};
+
+} // namespace vulkan_helper
@@ -1,7 +1,20 @@
 #pragma once
 
-#include <cassert>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #ifdef WIN32
@@ -10,64 +23,1177 @@
 #ifdef __unix__
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
 namespace vulkan_helper {
 
-class spirv_file {
+// 64 bit non-cryptographic hashing, used to key caches of shader code and
+// pipeline state.
+inline uint64_t hash_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+inline uint64_t hash_combine(uint64_t seed, uint64_t value) {
+  return hash_mix(seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) +
+                          (seed >> 2)));
+}
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0) {
+  auto bytes = static_cast<const unsigned char *>(data);
+  uint64_t hash = seed ^ (size * 0x9e3779b97f4a7c15ull);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    hash = std::rotl(hash ^ (word * 0x87c37b91114253d5ull), 31) *
+           0x4cf5ad432745937full;
+  }
+  uint64_t tail = 0;
+  if (i < size) {
+    std::memcpy(&tail, bytes + i, size - i);
+  }
+  return hash_mix(hash ^ tail);
+}
+inline uint64_t hash_spirv(std::span<const uint32_t> code) {
+  return hash_bytes(code.data(), code.size_bytes());
+}
+
+// Access hints for mapped_file. Hints the system does not support are
+// ignored.
+struct mapped_file_options {
+  // read the whole file into the page cache and map it before returning
+  // (MAP_POPULATE), so later accesses do not fault.
+  bool populate = false;
+  // the file is mostly read front to back (MADV_SEQUENTIAL).
+  bool sequential = false;
+  // start reading the whole file in the background (MADV_WILLNEED).
+  bool will_need = false;
+  // map at a 2 MiB boundary and ask for transparent huge pages
+  // (MADV_HUGEPAGE), which cuts page faults and TLB misses of large files on
+  // file systems that support them. Linux only.
+  bool huge_pages = false;
+};
+
+// Read only mapping of a whole file. Sizes are 64 bit, errors throw, and an
+// empty file maps to an empty range.
+class mapped_file {
 public:
-  spirv_file(std::filesystem::path path) {
+  mapped_file() = default;
+  explicit mapped_file(const std::filesystem::path &path,
+                       mapped_file_options options = {}) {
 #ifdef WIN32
-    hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
-                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    assert(hFile != INVALID_HANDLE_VALUE);
-    hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
-    assert(hFile != INVALID_HANDLE_VALUE);
-    mmaped_ptr = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
-    assert(mmaped_ptr != nullptr);
-    m_size = GetFileSize(hFile, NULL);
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error{"failed to open file: " + path.string()};
+    }
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size)) {
+      CloseHandle(file);
+      throw std::runtime_error{"failed to get file size: " + path.string()};
+    }
+    m_size = size.QuadPart;
+    if (m_size > 0) {
+      HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mapping != NULL) {
+        m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        // the view keeps the mapping alive.
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+    if (m_size > 0 && m_data == nullptr) {
+      throw std::runtime_error{"failed to map file: " + path.string()};
+    }
+    if (options.populate || options.will_need) {
+      prefetch(0, m_size);
+    }
 #endif
 #ifdef __unix__
-    m_file_descriptor = open(path.c_str(), O_RDONLY);
-    m_size = lseek(m_file_descriptor, 0, SEEK_END);
-    mmaped_ptr =
-        mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_file_descriptor, 0);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      throw std::runtime_error{"failed to open file: " + path.string()};
+    }
+    struct stat status {};
+    if (fstat(fd, &status) == -1) {
+      close(fd);
+      throw std::runtime_error{"failed to get file size: " + path.string()};
+    }
+    m_size = status.st_size;
+    if (m_size > 0) {
+      m_data = map(fd, options);
+    }
+    // the mapping keeps the file alive.
+    close(fd);
+    if (m_size > 0 && m_data == nullptr) {
+      throw std::runtime_error{"failed to map file: " + path.string()};
+    }
+    if (options.sequential) {
+      madvise(m_data, m_size, MADV_SEQUENTIAL);
+    }
+    if (options.will_need) {
+      madvise(m_data, m_size, MADV_WILLNEED);
+    }
 #endif
   }
-  spirv_file(const spirv_file &file) = delete;
-  spirv_file(spirv_file &&file) = delete;
-  ~spirv_file() {
+  mapped_file(const mapped_file &) = delete;
+  mapped_file(mapped_file &&other) noexcept
+      : m_data{std::exchange(other.m_data, nullptr)},
+        m_size{std::exchange(other.m_size, 0)} {}
+  ~mapped_file() { unmap(); }
+  mapped_file &operator=(const mapped_file &) = delete;
+  mapped_file &operator=(mapped_file &&other) noexcept {
+    if (this != &other) {
+      unmap();
+      m_data = std::exchange(other.m_data, nullptr);
+      m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+  }
+
+  const void *data() const { return m_data; }
+  // in bytes.
+  uint64_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  std::span<const std::byte> bytes() const {
+    return {static_cast<const std::byte *>(m_data),
+            static_cast<size_t>(m_size)};
+  }
+
+  // Starts reading [offset, offset + size) into memory without waiting for
+  // it, e.g. the next chunk of a data set before it is used.
+  void prefetch(uint64_t offset, uint64_t size) const {
+    if (offset >= m_size) {
+      return;
+    }
+    size = std::min(size, m_size - offset);
 #ifdef WIN32
-    UnmapViewOfFile(mmaped_ptr);
-    CloseHandle(hMapping);
-    CloseHandle(hFile);
+    WIN32_MEMORY_RANGE_ENTRY range{
+        .VirtualAddress = static_cast<char *>(m_data) + offset,
+        .NumberOfBytes = static_cast<SIZE_T>(size),
+    };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
 #endif
 #ifdef __unix__
-    munmap(mmaped_ptr, m_size);
-    close(m_file_descriptor);
+    // madvise wants a page aligned start.
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    auto begin = offset / page_size * page_size;
+    madvise(static_cast<char *>(m_data) + begin, offset + size - begin,
+            MADV_WILLNEED);
 #endif
   }
-  spirv_file &operator=(const spirv_file &file) = delete;
-  spirv_file &operator=(spirv_file &&file) = delete;
-
-  const uint32_t *data() const {
-    return static_cast<const uint32_t *>(mmaped_ptr);
-  }
-  // count of spirv code, that is uint32_t.
-  size_t size() const { return m_size; }
 
 private:
+#ifdef __unix__
+  void *map(int fd, const mapped_file_options &options) {
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (options.populate) {
+      flags |= MAP_POPULATE;
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (options.huge_pages) {
+      // reserve enough address space to place the file at a huge page
+      // boundary, then map it over the reservation.
+      constexpr uint64_t huge_page_size = 2 << 20;
+      auto reserved_size = m_size + huge_page_size;
+      void *reserved = mmap(NULL, reserved_size, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (reserved == MAP_FAILED) {
+        return nullptr;
+      }
+      auto reserved_begin = reinterpret_cast<uintptr_t>(reserved);
+      auto begin = (reserved_begin + huge_page_size - 1) / huge_page_size *
+                   huge_page_size;
+      void *data = mmap(reinterpret_cast<void *>(begin), m_size, PROT_READ,
+                        flags | MAP_FIXED, fd, 0);
+      if (data == MAP_FAILED) {
+        munmap(reserved, reserved_size);
+        return nullptr;
+      }
+      // give back the reservation around the file.
+      uint64_t page_size = sysconf(_SC_PAGESIZE);
+      auto end = (begin + m_size + page_size - 1) / page_size * page_size;
+      if (begin > reserved_begin) {
+        munmap(reserved, begin - reserved_begin);
+      }
+      if (reserved_begin + reserved_size > end) {
+        munmap(reinterpret_cast<void *>(end),
+               reserved_begin + reserved_size - end);
+      }
+      madvise(data, m_size, MADV_HUGEPAGE);
+      return data;
+    }
+#endif
+    void *data = mmap(NULL, m_size, PROT_READ, flags, fd, 0);
+    return data == MAP_FAILED ? nullptr : data;
+  }
+#endif
+  void unmap() {
+    if (m_data == nullptr) {
+      return;
+    }
 #ifdef WIN32
-  HANDLE hFile;
-  HANDLE hMapping;
-  void *mmaped_ptr;
-  size_t m_size; // count of byte
+    UnmapViewOfFile(m_data);
 #endif
 #ifdef __unix__
-  int m_file_descriptor;
-  void *mmaped_ptr;
-  size_t m_size; // count of byte
+    munmap(m_data, m_size);
 #endif
+    m_data = nullptr;
+    m_size = 0;
+  }
+
+  void *m_data = nullptr;
+  uint64_t m_size = 0;
 };
+
+// A SPIR-V module read from a file.
+class spirv_file {
+public:
+  spirv_file(const std::filesystem::path &path,
+             mapped_file_options options = {})
+      : m_file{path, options} {
+    if (m_file.size() % 4 != 0) {
+      throw std::runtime_error{"spirv size is not a multiple of 4: " +
+                               path.string()};
+    }
+  }
+
+  const uint32_t *data() const {
+    return static_cast<const uint32_t *>(m_file.data());
+  }
+  // count of byte.
+  size_t size() const { return m_file.size(); }
+  std::span<const uint32_t> get_code() const {
+    return {data(), size() / 4};
+  }
+
+private:
+  mapped_file m_file;
+};
+
+// Descriptor types as the shader declares them, see reflect_spirv().
+enum class spirv_descriptor_type {
+  sampler,
+  combined_image_sampler,
+  sampled_image,
+  storage_image,
+  uniform_texel_buffer,
+  storage_texel_buffer,
+  uniform_buffer,
+  storage_buffer,
+  input_attachment,
+  acceleration_structure,
+};
+struct spirv_descriptor_binding {
+  uint32_t set;
+  uint32_t binding;
+  spirv_descriptor_type type;
+  uint32_t count; // 0 for runtime arrays
+
+  bool operator==(const spirv_descriptor_binding &) const = default;
+};
+struct spirv_push_constant_block {
+  uint32_t offset; // of the first member
+  uint32_t size;   // from offset to the end of the last member
+
+  bool operator==(const spirv_push_constant_block &) const = default;
+};
+struct spirv_specialization_constant {
+  uint32_t constant_id;
+  uint32_t size; // in bytes
+
+  bool operator==(const spirv_specialization_constant &) const = default;
+};
+struct spirv_entry_point {
+  uint32_t execution_model; // SPIR-V ExecutionModel
+  std::string name;
+
+  bool operator==(const spirv_entry_point &) const = default;
+};
+// The interface of a module that pipeline layouts depend on.
+struct spirv_reflection {
+  std::vector<spirv_entry_point> entry_points;
+  std::vector<spirv_descriptor_binding> descriptor_bindings; // by set, binding
+  std::optional<spirv_push_constant_block> push_constants;
+  std::array<uint32_t, 3> workgroup_size; // 0 when not a compute shader
+  // specialization constants the workgroup size is taken from.
+  std::array<std::optional<uint32_t>, 3> workgroup_size_constant_ids;
+  std::vector<spirv_specialization_constant> specialization_constants;
+
+  bool operator==(const spirv_reflection &) const = default;
+};
+
+// Changes whenever reflect_spirv() returns something else for the same code,
+// so reflections stored by an older version are not reused.
+inline constexpr uint32_t spirv_reflection_version = 2;
+// Parses the declarations of a module, throws on malformed code. Variables of
+// every entry point are included.
+inline spirv_reflection reflect_spirv(std::span<const uint32_t> code) {
+  // opcodes, decorations and enumerants of the SPIR-V specification.
+  enum : uint32_t {
+    op_entry_point = 15,
+    op_execution_mode = 16,
+    op_type_bool = 20,
+    op_type_int = 21,
+    op_type_float = 22,
+    op_type_vector = 23,
+    op_type_matrix = 24,
+    op_type_image = 25,
+    op_type_sampler = 26,
+    op_type_sampled_image = 27,
+    op_type_array = 28,
+    op_type_runtime_array = 29,
+    op_type_struct = 30,
+    op_type_pointer = 32,
+    op_constant_true = 41,
+    op_constant_false = 42,
+    op_constant = 43,
+    op_constant_composite = 44,
+    op_spec_constant_true = 48,
+    op_spec_constant_false = 49,
+    op_spec_constant = 50,
+    op_spec_constant_composite = 51,
+    op_variable = 59,
+    op_decorate = 71,
+    op_member_decorate = 72,
+    op_execution_mode_id = 331,
+    op_type_acceleration_structure = 5341,
+
+    decoration_spec_id = 1,
+    decoration_block = 2,
+    decoration_buffer_block = 3,
+    decoration_array_stride = 6,
+    decoration_matrix_stride = 7,
+    decoration_built_in = 11,
+    decoration_binding = 33,
+    decoration_descriptor_set = 34,
+    decoration_offset = 35,
+
+    built_in_workgroup_size = 25,
+    execution_mode_local_size = 17,
+    execution_mode_local_size_id = 38,
+    storage_class_uniform_constant = 0,
+    storage_class_uniform = 2,
+    storage_class_push_constant = 9,
+    storage_class_storage_buffer = 12,
+    storage_class_physical_storage_buffer = 5349,
+    dim_buffer = 5,
+    dim_subpass_data = 6,
+  };
+  constexpr uint32_t magic_number = 0x07230203;
+  constexpr size_t header_size = 5;
+  if (code.size() < header_size || code[0] != magic_number) {
+    throw std::runtime_error{"invalid spirv header"};
+  }
+  // what is known about each id. Decorations come before the declarations
+  // they apply to.
+  struct id_info {
+    uint32_t opcode = 0;
+    uint32_t type = 0; // result type of constants and variables
+    std::span<const uint32_t> operands;
+    std::optional<uint32_t> set, binding, spec_id, array_stride;
+    bool block = false, buffer_block = false, workgroup_size = false;
+    std::map<uint32_t, uint32_t> member_offsets, member_matrix_strides;
+  };
+  std::vector<id_info> ids(code[3]);
+  auto get_id = [&ids](uint32_t id) -> id_info & {
+    if (id >= ids.size()) {
+      throw std::runtime_error{"spirv id out of bound"};
+    }
+    return ids[id];
+  };
+  auto need = [](std::span<const uint32_t> operands, size_t count) {
+    if (operands.size() < count) {
+      throw std::runtime_error{"invalid spirv instruction operands"};
+    }
+  };
+  std::vector<uint32_t> variables;
+  spirv_reflection reflection{};
+  std::optional<std::array<uint32_t, 3>> local_size_ids;
+
+  for (size_t i = header_size; i < code.size();) {
+    uint32_t word_count = code[i] >> 16;
+    uint32_t opcode = code[i] & 0xffff;
+    if (word_count == 0 || word_count > code.size() - i) {
+      throw std::runtime_error{"invalid spirv instruction"};
+    }
+    auto operands = code.subspan(i + 1, word_count - 1);
+    i += word_count;
+    switch (opcode) {
+    case op_entry_point: {
+      need(operands, 3);
+      auto name_words = operands.subspan(2);
+      std::string name{reinterpret_cast<const char *>(name_words.data()),
+                       name_words.size_bytes()};
+      name.resize(std::min(name.find('\0'), name.size()));
+      reflection.entry_points.emplace_back(spirv_entry_point{
+          .execution_model = operands[0],
+          .name = std::move(name),
+      });
+      break;
+    }
+    case op_execution_mode:
+    case op_execution_mode_id:
+      need(operands, 2);
+      if (operands[1] == execution_mode_local_size) {
+        need(operands, 5);
+        std::copy_n(operands.begin() + 2, 3,
+                    reflection.workgroup_size.begin());
+      } else if (operands[1] == execution_mode_local_size_id) {
+        need(operands, 5);
+        local_size_ids.emplace();
+        std::copy_n(operands.begin() + 2, 3, local_size_ids->begin());
+      }
+      break;
+    case op_decorate: {
+      need(operands, 2);
+      auto &info = get_id(operands[0]);
+      auto literal = [&]() {
+        need(operands, 3);
+        return operands[2];
+      };
+      switch (operands[1]) {
+      case decoration_descriptor_set:
+        info.set = literal();
+        break;
+      case decoration_binding:
+        info.binding = literal();
+        break;
+      case decoration_spec_id:
+        info.spec_id = literal();
+        break;
+      case decoration_array_stride:
+        info.array_stride = literal();
+        break;
+      case decoration_block:
+        info.block = true;
+        break;
+      case decoration_buffer_block:
+        info.buffer_block = true;
+        break;
+      case decoration_built_in:
+        info.workgroup_size = literal() == built_in_workgroup_size;
+        break;
+      }
+      break;
+    }
+    case op_member_decorate: {
+      need(operands, 4);
+      auto &info = get_id(operands[0]);
+      if (operands[2] == decoration_offset) {
+        info.member_offsets[operands[1]] = operands[3];
+      } else if (operands[2] == decoration_matrix_stride) {
+        info.member_matrix_strides[operands[1]] = operands[3];
+      }
+      break;
+    }
+    case op_type_bool:
+    case op_type_int:
+    case op_type_float:
+    case op_type_vector:
+    case op_type_matrix:
+    case op_type_image:
+    case op_type_sampler:
+    case op_type_sampled_image:
+    case op_type_array:
+    case op_type_runtime_array:
+    case op_type_struct:
+    case op_type_pointer:
+    case op_type_acceleration_structure: {
+      need(operands, 1);
+      auto &info = get_id(operands[0]);
+      info.opcode = opcode;
+      info.operands = operands.subspan(1);
+      break;
+    }
+    case op_constant_true:
+    case op_constant_false:
+    case op_constant:
+    case op_constant_composite:
+    case op_spec_constant_true:
+    case op_spec_constant_false:
+    case op_spec_constant:
+    case op_spec_constant_composite:
+    case op_variable: {
+      need(operands, 2);
+      auto &info = get_id(operands[1]);
+      info.opcode = opcode;
+      info.type = operands[0];
+      info.operands = operands.subspan(2);
+      if (opcode == op_variable) {
+        need(operands, 3);
+        variables.push_back(operands[1]);
+      }
+      break;
+    }
+    }
+  }
+
+  auto get_constant = [&](uint32_t id) -> uint32_t {
+    auto &info = get_id(id);
+    switch (info.opcode) {
+    case op_constant_true:
+    case op_spec_constant_true:
+      return 1;
+    case op_constant_false:
+    case op_spec_constant_false:
+      return 0;
+    case op_constant:
+    case op_spec_constant:
+      need(info.operands, 1);
+      return info.operands[0];
+    }
+    throw std::runtime_error{"spirv id is not a scalar constant"};
+  };
+  // size in bytes of a type in an explicitly laid out block.
+  std::function<uint32_t(uint32_t, std::optional<uint32_t>)> get_size =
+      [&](uint32_t id, std::optional<uint32_t> matrix_stride) -> uint32_t {
+    auto &info = get_id(id);
+    switch (info.opcode) {
+    case op_type_bool:
+      return 4;
+    case op_type_int:
+    case op_type_float:
+      need(info.operands, 1);
+      return info.operands[0] / 8;
+    case op_type_vector:
+      need(info.operands, 2);
+      return info.operands[1] * get_size(info.operands[0], std::nullopt);
+    case op_type_matrix:
+      need(info.operands, 2);
+      return info.operands[1] *
+             matrix_stride.value_or(get_size(info.operands[0], std::nullopt));
+    case op_type_array:
+      need(info.operands, 2);
+      return get_constant(info.operands[1]) *
+             info.array_stride.value_or(
+                 get_size(info.operands[0], matrix_stride));
+    case op_type_runtime_array:
+      return 0;
+    case op_type_pointer:
+      // a buffer device address, other pointers are not laid out.
+      need(info.operands, 1);
+      if (info.operands[0] == storage_class_physical_storage_buffer) {
+        return 8;
+      }
+      break;
+    case op_type_struct: {
+      uint32_t size = 0;
+      for (uint32_t member = 0; member < info.operands.size(); member++) {
+        auto offset = info.member_offsets.contains(member)
+                          ? info.member_offsets.at(member)
+                          : size;
+        auto stride = info.member_matrix_strides.contains(member)
+                          ? std::optional{info.member_matrix_strides.at(member)}
+                          : std::nullopt;
+        size = std::max(size, offset + get_size(info.operands[member], stride));
+      }
+      return size;
+    }
+    }
+    throw std::runtime_error{"spirv type has no size"};
+  };
+
+  for (auto variable : variables) {
+    auto &info = get_id(variable);
+    auto storage_class = info.operands[0];
+    auto &pointer = get_id(info.type);
+    if (pointer.opcode != op_type_pointer) {
+      throw std::runtime_error{"spirv variable is not a pointer"};
+    }
+    need(pointer.operands, 2);
+    auto type_id = pointer.operands[1];
+
+    if (storage_class == storage_class_push_constant) {
+      auto &type = get_id(type_id);
+      uint32_t begin = UINT32_MAX;
+      for (auto &[member, offset] : type.member_offsets) {
+        begin = std::min(begin, offset);
+      }
+      if (begin == UINT32_MAX) {
+        begin = 0;
+      }
+      uint32_t end = get_size(type_id, std::nullopt);
+      if (auto &block = reflection.push_constants) {
+        auto block_end = std::max(block->offset + block->size, end);
+        block->offset = std::min(block->offset, begin);
+        block->size = block_end - block->offset;
+      } else {
+        block = spirv_push_constant_block{.offset = begin, .size = end - begin};
+      }
+      continue;
+    }
+    if (storage_class != storage_class_uniform_constant &&
+        storage_class != storage_class_uniform &&
+        storage_class != storage_class_storage_buffer) {
+      continue;
+    }
+    if (!info.set || !info.binding) {
+      continue;
+    }
+    uint32_t count = 1;
+    auto *type = &get_id(type_id);
+    while (type->opcode == op_type_array ||
+           type->opcode == op_type_runtime_array) {
+      need(type->operands, type->opcode == op_type_array ? 2 : 1);
+      count = type->opcode == op_type_array
+                  ? count * get_constant(type->operands[1])
+                  : 0;
+      type = &get_id(type->operands[0]);
+    }
+    spirv_descriptor_type descriptor_type;
+    switch (type->opcode) {
+    case op_type_sampler:
+      descriptor_type = spirv_descriptor_type::sampler;
+      break;
+    case op_type_sampled_image:
+      descriptor_type = spirv_descriptor_type::combined_image_sampler;
+      break;
+    case op_type_image: {
+      // sampled type, dim, depth, arrayed, multisampled, sampled
+      need(type->operands, 6);
+      auto dim = type->operands[1];
+      auto sampled = type->operands[5];
+      if (dim == dim_subpass_data) {
+        descriptor_type = spirv_descriptor_type::input_attachment;
+      } else if (dim == dim_buffer) {
+        descriptor_type = sampled == 2
+                              ? spirv_descriptor_type::storage_texel_buffer
+                              : spirv_descriptor_type::uniform_texel_buffer;
+      } else {
+        descriptor_type = sampled == 2 ? spirv_descriptor_type::storage_image
+                                       : spirv_descriptor_type::sampled_image;
+      }
+      break;
+    }
+    case op_type_acceleration_structure:
+      descriptor_type = spirv_descriptor_type::acceleration_structure;
+      break;
+    case op_type_struct:
+      descriptor_type = storage_class == storage_class_storage_buffer ||
+                                type->buffer_block
+                            ? spirv_descriptor_type::storage_buffer
+                            : spirv_descriptor_type::uniform_buffer;
+      break;
+    default:
+      throw std::runtime_error{"unknown spirv descriptor type"};
+    }
+    reflection.descriptor_bindings.emplace_back(spirv_descriptor_binding{
+        .set = *info.set,
+        .binding = *info.binding,
+        .type = descriptor_type,
+        .count = count,
+    });
+  }
+  std::ranges::sort(reflection.descriptor_bindings, {},
+                    [](auto &binding) {
+                      return std::pair{binding.set, binding.binding};
+                    });
+  // entry points of one module may use the same variable.
+  auto duplicates = std::ranges::unique(
+      reflection.descriptor_bindings, {}, [](auto &binding) {
+        return std::pair{binding.set, binding.binding};
+      });
+  reflection.descriptor_bindings.erase(duplicates.begin(), duplicates.end());
+
+  for (uint32_t id = 0; id < ids.size(); id++) {
+    auto &info = ids[id];
+    if (info.spec_id && (info.opcode == op_spec_constant ||
+                         info.opcode == op_spec_constant_true ||
+                         info.opcode == op_spec_constant_false)) {
+      reflection.specialization_constants.emplace_back(
+          spirv_specialization_constant{
+              .constant_id = *info.spec_id,
+              .size = get_size(info.type, std::nullopt),
+          });
+    }
+  }
+
+  // the WorkgroupSize built-in takes precedence over the execution modes.
+  std::optional<std::span<const uint32_t>> workgroup_size_constants;
+  for (auto &info : ids) {
+    if (info.workgroup_size && (info.opcode == op_constant_composite ||
+                                info.opcode == op_spec_constant_composite)) {
+      workgroup_size_constants = info.operands;
+    }
+  }
+  if (!workgroup_size_constants && local_size_ids) {
+    workgroup_size_constants = *local_size_ids;
+  }
+  if (workgroup_size_constants) {
+    need(*workgroup_size_constants, 3);
+    for (size_t i = 0; i < 3; i++) {
+      auto id = (*workgroup_size_constants)[i];
+      reflection.workgroup_size[i] = get_constant(id);
+      reflection.workgroup_size_constant_ids[i] = get_id(id).spec_id;
+    }
+  }
+  return reflection;
+}
+
+namespace spirv_grammar_helper {
+// How the operands of an instruction are laid out, one character per
+// operand:
+//   t result type id, r result id, i id, l literal, s literal string,
+//   I the rest are ids, L the rest are literals,
+//   M the rest are memory operands, G the rest are optional image operands.
+// Debug instructions are included, although strip_spirv() removes them.
+// nullptr for instructions spirv_for_each_id() does not know.
+inline const char *get_spirv_operand_pattern(uint32_t opcode) {
+  switch (opcode) {
+  case 0:    // OpNop
+  case 56:   // OpFunctionEnd
+  case 218:  // OpEmitVertex
+  case 219:  // OpEndPrimitive
+  case 252:  // OpKill
+  case 253:  // OpReturn
+  case 255:  // OpUnreachable
+  case 317:  // OpNoLine
+  case 4416: // OpTerminateInvocation
+  case 5380: // OpDemoteToHelperInvocation
+    return "";
+  case 2: // OpSourceContinued
+  case 10: // OpExtension
+  case 330: // OpModuleProcessed
+    return "s";
+  case 4: // OpSourceExtension
+    return "s";
+  case 5: // OpName
+    return "is";
+  case 6: // OpMemberName
+    return "ils";
+  case 7: // OpString
+    return "rs";
+  case 8: // OpLine
+    return "ill";
+  case 11: // OpExtInstImport
+    return "rs";
+  case 14: // OpMemoryModel
+  case 17: // OpCapability
+    return "L";
+  case 15: // OpEntryPoint
+    return "lisI";
+  case 16: // OpExecutionMode
+    return "iL";
+  case 19: // OpTypeVoid
+  case 20: // OpTypeBool
+  case 26: // OpTypeSampler
+  case 73: // OpDecorationGroup
+  case 248: // OpLabel
+  case 4472: // OpTypeRayQueryKHR
+  case 5341: // OpTypeAccelerationStructureKHR
+    return "r";
+  case 21: // OpTypeInt
+  case 22: // OpTypeFloat
+    return "rL";
+  case 23: // OpTypeVector
+  case 24: // OpTypeMatrix
+  case 25: // OpTypeImage
+    return "riL";
+  case 27: // OpTypeSampledImage
+  case 29: // OpTypeRuntimeArray
+    return "ri";
+  case 28: // OpTypeArray
+    return "rii";
+  case 30: // OpTypeStruct
+  case 33: // OpTypeFunction
+    return "rI";
+  case 32: // OpTypePointer
+    return "rli";
+  case 39: // OpTypeForwardPointer
+    return "il";
+  case 1:  // OpUndef
+  case 41: // OpConstantTrue
+  case 42: // OpConstantFalse
+  case 46: // OpConstantNull
+  case 48: // OpSpecConstantTrue
+  case 49: // OpSpecConstantFalse
+  case 55: // OpFunctionParameter
+    return "tr";
+  case 333: // OpGroupNonUniformElect
+    return "tri";
+  case 43: // OpConstant
+  case 45: // OpConstantSampler
+  case 50: // OpSpecConstant
+    return "trL";
+  case 54: // OpFunction
+    return "trli";
+  case 59: // OpVariable
+    return "trlI";
+  case 61: // OpLoad
+    return "triM";
+  case 62: // OpStore
+    return "iiM";
+  case 63: // OpCopyMemory
+    return "iiM";
+  case 64: // OpCopyMemorySized
+    return "iiiM";
+  case 68: // OpArrayLength
+    return "tril";
+  case 71: // OpDecorate
+    return "iL";
+  case 72: // OpMemberDecorate
+    return "ilL";
+  case 331: // OpExecutionModeId
+  case 332: // OpDecorateId
+    return "ilI";
+  case 5632: // OpDecorateString
+    return "iL";
+  case 5633: // OpMemberDecorateString
+    return "ilL";
+  case 74: // OpGroupDecorate
+    return "iI";
+  case 79: // OpVectorShuffle
+  case 82: // OpCompositeInsert
+    return "triiL";
+  case 81: // OpCompositeExtract
+    return "triL";
+  case 87: // OpImageSampleImplicitLod
+  case 88: // OpImageSampleExplicitLod
+  case 91: // OpImageSampleProjImplicitLod
+  case 92: // OpImageSampleProjExplicitLod
+  case 95: // OpImageFetch
+  case 98: // OpImageRead
+    return "triiG";
+  case 89: // OpImageSampleDrefImplicitLod
+  case 90: // OpImageSampleDrefExplicitLod
+  case 93: // OpImageSampleProjDrefImplicitLod
+  case 94: // OpImageSampleProjDrefExplicitLod
+  case 96: // OpImageGather
+  case 97: // OpImageDrefGather
+    return "triiiG";
+  case 99: // OpImageWrite
+    return "iiiG";
+  case 342: // OpGroupNonUniformBallotBitCount
+    return "trili";
+  case 246: // OpLoopMerge
+    return "iiL";
+  case 247: // OpSelectionMerge
+    return "il";
+  case 249: // OpBranch
+  case 254: // OpReturnValue
+  case 220: // OpEmitStreamVertex
+  case 221: // OpEndStreamPrimitive
+    return "i";
+  case 250: // OpBranchConditional
+    return "iiiL";
+  case 224: // OpControlBarrier
+  case 225: // OpMemoryBarrier
+    return "I";
+  case 256: // OpLifetimeStart
+  case 257: // OpLifetimeStop
+    return "il";
+  case 228: // OpAtomicStore
+    return "I";
+  }
+  // instructions with a result whose operands are all ids.
+  auto in = [opcode](uint32_t first, uint32_t last) {
+    return opcode >= first && opcode <= last;
+  };
+  if (in(44, 44) ||   // OpConstantComposite
+      in(51, 51) ||   // OpSpecConstantComposite
+      in(57, 57) ||   // OpFunctionCall
+      in(60, 60) ||   // OpImageTexelPointer
+      in(65, 67) ||   // access chains
+      in(77, 78) ||   // dynamic vector extract and insert
+      in(80, 80) ||   // OpCompositeConstruct
+      in(83, 84) ||   // OpCopyObject, OpTranspose
+      in(86, 86) ||   // OpSampledImage
+      in(100, 107) || // OpImage and image queries
+      in(109, 122) || // conversions
+      in(124, 124) || // OpBitcast
+      in(126, 152) || // arithmetic
+      in(154, 205) || // relational, logical and bit instructions
+      in(207, 215) || // derivatives
+      in(227, 227) || // OpAtomicLoad
+      in(229, 242) || // atomics
+      in(245, 245) || // OpPhi
+      in(334, 341) || // non uniform votes, broadcasts and ballots
+      in(343, 348) || // non uniform ballot scans and shuffles
+      in(365, 366) || // non uniform quad operations
+      in(400, 403)) { // pointer comparisons and OpCopyLogical
+    return "trI";
+  }
+  if (in(349, 364)) { // non uniform arithmetic, the group operation is literal
+    return "trilI";
+  }
+  return nullptr;
+}
+} // namespace spirv_grammar_helper
+
+// Calls f with a reference to every id operand of the instruction, results
+// included. Returns false for instructions it does not know the operands of,
+// in which case f may have been called for some of them.
+// id_types maps result ids to their types and int_widths the OpTypeInt ids to
+// their width, both only needed for OpSwitch. ext_inst_sets are the
+// OpExtInstImport ids of GLSL.std.450, whose operands are all ids.
+inline bool spirv_for_each_id(std::span<uint32_t> operands, uint32_t opcode,
+                              const std::map<uint32_t, uint32_t> &id_types,
+                              const std::map<uint32_t, uint32_t> &int_widths,
+                              const std::vector<uint32_t> &ext_inst_sets,
+                              auto &&f) {
+  size_t i = 0;
+  auto id = [&]() {
+    if (i >= operands.size()) {
+      return false;
+    }
+    f(operands[i++]);
+    return true;
+  };
+  auto string = [&]() {
+    while (i < operands.size()) {
+      auto word = operands[i++];
+      if ((word & 0xff000000) == 0 || (word & 0x00ff0000) == 0 ||
+          (word & 0x0000ff00) == 0 || (word & 0x000000ff) == 0) {
+        return true;
+      }
+    }
+    return false;
+  };
+  switch (opcode) {
+  case 12: { // OpExtInst
+    if (operands.size() < 4 ||
+        std::ranges::find(ext_inst_sets, operands[2]) == ext_inst_sets.end()) {
+      return false;
+    }
+    id();
+    id();
+    id();
+    i++;
+    while (i < operands.size()) {
+      id();
+    }
+    return true;
+  }
+  case 52: { // OpSpecConstantOp
+    if (operands.size() < 3) {
+      return false;
+    }
+    id();
+    id();
+    auto spec_opcode = operands[i++];
+    std::string_view rest = spec_opcode == 79 || spec_opcode == 82 ? "iiL"
+                            : spec_opcode == 81                   ? "iL"
+                                                                  : "I";
+    for (auto c : rest) {
+      if (c == 'i') {
+        id();
+      }
+    }
+    while (rest.ends_with('I') && i < operands.size()) {
+      id();
+    }
+    return true;
+  }
+  case 251: { // OpSwitch
+    if (operands.size() < 2) {
+      return false;
+    }
+    auto type = id_types.find(operands[0]);
+    if (type == id_types.end() || !int_widths.contains(type->second)) {
+      return false;
+    }
+    auto literal_words = int_widths.at(type->second) > 32 ? 2 : 1;
+    id();
+    id();
+    while (i < operands.size()) {
+      i += literal_words;
+      if (!id()) {
+        return false;
+      }
+    }
+    return true;
+  }
+  }
+  auto pattern = spirv_grammar_helper::get_spirv_operand_pattern(opcode);
+  if (pattern == nullptr) {
+    return false;
+  }
+  for (auto c = pattern; *c != '\0'; c++) {
+    switch (*c) {
+    case 't':
+    case 'r':
+    case 'i':
+      if (!id()) {
+        return false;
+      }
+      break;
+    case 'l':
+      if (i++ >= operands.size()) {
+        return false;
+      }
+      break;
+    case 's':
+      if (!string()) {
+        return false;
+      }
+      break;
+    case 'I':
+      while (i < operands.size()) {
+        id();
+      }
+      break;
+      case 'L':
+      i = operands.size();
+      break;
+    case 'M':
+      // mask, then an alignment literal and the availability and visibility
+      // scope ids in the order of their bits.
+      while (i < operands.size()) {
+        auto mask = operands[i++];
+        if (mask & 0x2) {
+          i++;
+        }
+        if (mask & 0x8 && !id()) {
+          return false;
+        }
+        if (mask & 0x10 && !id()) {
+          return false;
+        }
+      }
+      break;
+    case 'G':
+      // all image operands following the mask are ids.
+      if (i < operands.size()) {
+        i++;
+        while (i < operands.size()) {
+          id();
+        }
+      }
+      break;
+    }
+  }
+  return i == operands.size();
+}
+
+// Removes debug and non-semantic instructions: OpSource*, OpName,
+// OpMemberName, OpString, OpLine, OpNoLine, OpModuleProcessed and the
+// NonSemantic.* extended instruction sets. With renumber_ids the remaining
+// ids are numbered densely in order of appearance, which lowers the id bound
+// drivers size their tables by. Renumbering is skipped for modules with
+// instructions spirv_for_each_id() does not know. Throws on malformed code.
+inline std::vector<uint32_t> strip_spirv(std::span<const uint32_t> code,
+                                         bool renumber_ids = true) {
+  constexpr size_t header_size = 5;
+  if (code.size() < header_size || code[0] != 0x07230203) {
+    throw std::runtime_error{"invalid spirv header"};
+  }
+  auto get_string = [](std::span<const uint32_t> words) {
+    std::string s{reinterpret_cast<const char *>(words.data()),
+                  words.size_bytes()};
+    s.resize(std::min(s.find('\0'), s.size()));
+    return s;
+  };
+  struct instruction {
+    size_t offset;
+    uint32_t word_count;
+    uint32_t opcode;
+  };
+  std::vector<instruction> instructions;
+  std::vector<uint32_t> non_semantic_sets;
+  for (size_t i = header_size; i < code.size();) {
+    uint32_t word_count = code[i] >> 16;
+    uint32_t opcode = code[i] & 0xffff;
+    if (word_count == 0 || word_count > code.size() - i) {
+      throw std::runtime_error{"invalid spirv instruction"};
+    }
+    instructions.push_back({i, word_count, opcode});
+    // OpExtInstImport
+    if (opcode == 11 && word_count > 2 &&
+        get_string(code.subspan(i + 2, word_count - 2))
+            .starts_with("NonSemantic.")) {
+      non_semantic_sets.push_back(code[i + 1]);
+    }
+    i += word_count;
+  }
+  auto is_stripped = [&](const instruction &inst) {
+    switch (inst.opcode) {
+    case 2:   // OpSourceContinued
+    case 3:   // OpSource
+    case 4:   // OpSourceExtension
+    case 5:   // OpName
+    case 6:   // OpMemberName
+    case 7:   // OpString
+    case 8:   // OpLine
+    case 317: // OpNoLine
+    case 330: // OpModuleProcessed
+      return true;
+    case 10: // OpExtension
+      return !non_semantic_sets.empty() &&
+             get_string(code.subspan(inst.offset + 1, inst.word_count - 1)) ==
+                 "SPV_KHR_non_semantic_info";
+    case 11: // OpExtInstImport
+      return std::ranges::find(non_semantic_sets, code[inst.offset + 1]) !=
+             non_semantic_sets.end();
+    case 12: // OpExtInst
+      return inst.word_count > 3 &&
+             std::ranges::find(non_semantic_sets, code[inst.offset + 3]) !=
+                 non_semantic_sets.end();
+    }
+    return false;
+  };
+
+  std::vector<uint32_t> result(code.begin(), code.begin() + header_size);
+  std::vector<instruction> kept;
+  for (auto &inst : instructions) {
+    if (!is_stripped(inst)) {
+      kept.push_back({result.size(), inst.word_count, inst.opcode});
+      result.insert(result.end(), code.begin() + inst.offset,
+                    code.begin() + inst.offset + inst.word_count);
+    }
+  }
+  if (!renumber_ids) {
+    return result;
+  }
+
+  std::map<uint32_t, uint32_t> id_types, int_widths;
+  std::vector<uint32_t> ext_inst_sets;
+  for (auto &inst : kept) {
+    auto operands = std::span{result}.subspan(inst.offset + 1,
+                                              inst.word_count - 1);
+    if (inst.opcode == 11 && get_string(operands.subspan(1)) == "GLSL.std.450") {
+      ext_inst_sets.push_back(operands[0]);
+    }
+    if (inst.opcode == 21 && operands.size() >= 2) { // OpTypeInt
+      int_widths[operands[0]] = operands[1];
+    }
+    auto pattern = spirv_grammar_helper::get_spirv_operand_pattern(inst.opcode);
+    if (inst.opcode == 12 || inst.opcode == 52 ||
+        (pattern != nullptr && std::string_view{pattern}.starts_with("tr"))) {
+      if (operands.size() >= 2) {
+        id_types[operands[1]] = operands[0];
+      }
+    }
+  }
+  // ids in order of first appearance, 0 is not a valid id.
+  std::vector<uint32_t> new_ids(code[3], 0);
+  uint32_t next_id = 1;
+  auto renumber = [&](uint32_t &id) {
+    if (id >= new_ids.size()) {
+      throw std::runtime_error{"spirv id out of bound"};
+    }
+    if (new_ids[id] == 0) {
+      new_ids[id] = next_id++;
+    }
+    id = new_ids[id];
+  };
+  auto renumbered = result;
+  for (auto &inst : kept) {
+    auto operands = std::span{renumbered}.subspan(inst.offset + 1,
+                                                  inst.word_count - 1);
+    if (!spirv_for_each_id(operands, inst.opcode, id_types, int_widths,
+                           ext_inst_sets, renumber)) {
+      return result;
+    }
+  }
+  renumbered[3] = next_id;
+  return renumbered;
+}
 } // namespace vulkan_helper
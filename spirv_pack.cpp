@@ -0,0 +1,34 @@
+// Packs compiled shaders into a spirv archive.
+//   spirv_pack <archive> <shader>...
+// A shader is given as name=path, or as path and named by its file name.
+#include "spirv_archive.hpp"
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <archive> [name=]<shader>...\n";
+    return 1;
+  }
+  try {
+    vulkan_helper::spirv_archive_writer writer;
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      auto separator = arg.find('=');
+      std::filesystem::path path =
+          separator == std::string::npos ? arg : arg.substr(separator + 1);
+      std::string name = separator == std::string::npos
+                             ? path.filename().string()
+                             : arg.substr(0, separator);
+      vulkan_helper::spirv_file file{path};
+      writer.add(name, std::span{file.data(), file.size() / 4});
+    }
+    writer.save(argv[1]);
+  } catch (const std::exception &e) {
+    std::cerr << argv[0] << ": " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
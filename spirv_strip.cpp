@@ -0,0 +1,48 @@
+// Strips debug and non-semantic instructions from a SPIR-V module and
+// renumbers its ids, see vulkan_helper::strip_spirv().
+//   spirv_strip [--verify] <input> <output>
+// --verify fails unless the stripped module has the same interface as the
+// input and stripping it again changes nothing.
+#include "spirv_helper.hpp"
+
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+int main(int argc, char **argv) {
+  bool verify = argc > 1 && std::string_view{argv[1]} == "--verify";
+  if (argc != 3 + verify) {
+    std::cerr << "usage: " << argv[0] << " [--verify] <input> <output>\n";
+    return 1;
+  }
+  std::filesystem::path input = argv[1 + verify];
+  std::filesystem::path output = argv[2 + verify];
+  try {
+    vulkan_helper::spirv_file file{input};
+    auto code = std::span{file.data(), file.size() / 4};
+    auto stripped = vulkan_helper::strip_spirv(code);
+    if (verify) {
+      if (vulkan_helper::reflect_spirv(code) !=
+          vulkan_helper::reflect_spirv(stripped)) {
+        throw std::runtime_error{"stripping changed the module interface"};
+      }
+      if (vulkan_helper::strip_spirv(stripped) != stripped) {
+        throw std::runtime_error{"stripping is not idempotent"};
+      }
+      std::cout << input.string() << ": " << code.size_bytes() << " -> "
+                << stripped.size() * 4 << " bytes, id bound " << code[3]
+                << " -> " << stripped[3] << '\n';
+    }
+    std::ofstream out{output, std::ios::binary | std::ios::trunc};
+    out.write(reinterpret_cast<const char *>(stripped.data()),
+              stripped.size() * sizeof(uint32_t));
+    if (!out) {
+      throw std::runtime_error{"failed to write " + output.string()};
+    }
+  } catch (const std::exception &e) {
+    std::cerr << argv[0] << ": " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,295 @@
+// Checks reflect_spirv() and strip_spirv() of spirv_helper.hpp on modules
+// assembled by the test, so neither a shader compiler nor a Vulkan device is
+// needed.
+#include "spirv_helper.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+void check(bool condition, const char *message) {
+  if (!condition) {
+    std::cerr << "failed: " << message << '\n';
+    failures++;
+  }
+}
+
+// opcodes and enumerants of the SPIR-V specification the modules use.
+enum : uint32_t {
+  op_source = 3,
+  op_name = 5,
+  op_member_name = 6,
+  op_string = 7,
+  op_line = 8,
+  op_memory_model = 14,
+  op_entry_point = 15,
+  op_execution_mode = 16,
+  op_capability = 17,
+  op_type_void = 19,
+  op_type_int = 21,
+  op_type_vector = 23,
+  op_type_runtime_array = 29,
+  op_type_struct = 30,
+  op_type_pointer = 32,
+  op_type_function = 33,
+  op_spec_constant = 50,
+  op_function = 54,
+  op_function_end = 56,
+  op_variable = 59,
+  op_decorate = 71,
+  op_member_decorate = 72,
+  op_label = 248,
+  op_return = 253,
+  op_module_processed = 330,
+
+  decoration_spec_id = 1,
+  decoration_block = 2,
+  decoration_array_stride = 6,
+  decoration_built_in = 11,
+  decoration_binding = 33,
+  decoration_descriptor_set = 34,
+  decoration_offset = 35,
+
+  storage_class_input = 1,
+  storage_class_push_constant = 9,
+  storage_class_storage_buffer = 12,
+  storage_class_physical_storage_buffer = 5349,
+  execution_model_gl_compute = 5,
+  execution_mode_local_size = 17,
+};
+
+class module_builder {
+public:
+  uint32_t id() { return m_next_id++; }
+  void add(uint32_t opcode, std::vector<uint32_t> operands) {
+    m_words.push_back(static_cast<uint32_t>(operands.size() + 1) << 16 |
+                      opcode);
+    m_words.insert(m_words.end(), operands.begin(), operands.end());
+  }
+  // a literal string, nul terminated and padded to whole words.
+  static std::vector<uint32_t> string(std::string_view s,
+                                      std::vector<uint32_t> prefix = {}) {
+    std::vector<uint32_t> words(s.size() / 4 + 1);
+    std::memcpy(words.data(), s.data(), s.size());
+    prefix.insert(prefix.end(), words.begin(), words.end());
+    return prefix;
+  }
+  std::vector<uint32_t> get_code() const {
+    auto code = m_words;
+    code[3] = m_next_id;
+    return code;
+  }
+
+private:
+  std::vector<uint32_t> m_words{0x07230203, 0x00010600, 0, 0, 0};
+  uint32_t m_next_id = 1;
+};
+
+// what glslang makes of a compute shader scaling a storage buffer, with its
+// debug instructions:
+//   layout(local_size_x = 64) in;
+//   layout(binding = 0) buffer values_block { uint values[]; };
+//   layout(push_constant) uniform parameters { uint count; uint scale; };
+std::vector<uint32_t> make_compute_module(bool debug) {
+  module_builder b;
+  uint32_t main = b.id(), global_id = b.id(), void_type = b.id(),
+           function_type = b.id(), uint_type = b.id(), uvec3 = b.id(),
+           input_pointer = b.id(), runtime_array = b.id(), block = b.id(),
+           block_pointer = b.id(), values = b.id(), parameters = b.id(),
+           parameters_pointer = b.id(), parameters_variable = b.id(),
+           label = b.id(), file = b.id();
+  b.add(op_capability, {1});
+  b.add(op_memory_model, {0, 1});
+  auto entry_point =
+      module_builder::string("main", {execution_model_gl_compute, main});
+  entry_point.insert(entry_point.end(),
+                     {global_id, values, parameters_variable});
+  b.add(op_entry_point, entry_point);
+  b.add(op_execution_mode, {main, execution_mode_local_size, 64, 1, 1});
+  if (debug) {
+    b.add(op_string, module_builder::string("test.comp", {file}));
+    b.add(op_source, {2, 450, file});
+    b.add(op_name, module_builder::string("main", {main}));
+    b.add(op_name, module_builder::string("values_block", {block}));
+    b.add(op_member_name, module_builder::string("count", {parameters, 0}));
+    b.add(op_module_processed, module_builder::string("client vulkan100"));
+  }
+  b.add(op_decorate, {global_id, decoration_built_in, 28});
+  b.add(op_decorate, {runtime_array, decoration_array_stride, 4});
+  b.add(op_member_decorate, {block, 0, decoration_offset, 0});
+  b.add(op_decorate, {block, decoration_block});
+  b.add(op_decorate, {values, decoration_descriptor_set, 0});
+  b.add(op_decorate, {values, decoration_binding, 0});
+  b.add(op_member_decorate, {parameters, 0, decoration_offset, 0});
+  b.add(op_member_decorate, {parameters, 1, decoration_offset, 4});
+  b.add(op_decorate, {parameters, decoration_block});
+  b.add(op_type_void, {void_type});
+  b.add(op_type_function, {function_type, void_type});
+  b.add(op_type_int, {uint_type, 32, 0});
+  b.add(op_type_vector, {uvec3, uint_type, 3});
+  b.add(op_type_pointer, {input_pointer, storage_class_input, uvec3});
+  b.add(op_variable, {input_pointer, global_id, storage_class_input});
+  b.add(op_type_runtime_array, {runtime_array, uint_type});
+  b.add(op_type_struct, {block, runtime_array});
+  b.add(op_type_pointer, {block_pointer, storage_class_storage_buffer, block});
+  b.add(op_variable, {block_pointer, values, storage_class_storage_buffer});
+  b.add(op_type_struct, {parameters, uint_type, uint_type});
+  b.add(op_type_pointer,
+        {parameters_pointer, storage_class_push_constant, parameters});
+  b.add(op_variable,
+        {parameters_pointer, parameters_variable, storage_class_push_constant});
+  b.add(op_function, {void_type, main, 0, function_type});
+  b.add(op_label, {label});
+  if (debug) {
+    b.add(op_line, {file, 14, 1});
+  }
+  b.add(op_return, {});
+  b.add(op_function_end, {});
+  return b.get_code();
+}
+
+void test_reflect_compute() {
+  auto reflection = vulkan_helper::reflect_spirv(make_compute_module(true));
+  check(reflection.entry_points ==
+            std::vector{vulkan_helper::spirv_entry_point{
+                execution_model_gl_compute, "main"}},
+        "one compute entry point named main");
+  check(reflection.descriptor_bindings ==
+            std::vector{vulkan_helper::spirv_descriptor_binding{
+                0, 0, vulkan_helper::spirv_descriptor_type::storage_buffer,
+                1}},
+        "the storage buffer at set 0, binding 0");
+  check(reflection.push_constants ==
+            vulkan_helper::spirv_push_constant_block{0, 8},
+        "push constants of two uints");
+  check(reflection.workgroup_size == std::array<uint32_t, 3>{64, 1, 1},
+        "workgroup size from the execution mode");
+  check(reflection.specialization_constants.empty(),
+        "no specialization constants");
+}
+
+// push constants holding a buffer reference and a specialization constant:
+//   layout(buffer_reference) buffer values_block { uint values[]; };
+//   layout(push_constant) uniform parameters { values_block v; uint count; };
+//   layout(constant_id = 3) const uint scale = 2;
+void test_reflect_buffer_reference() {
+  module_builder b;
+  uint32_t main = b.id(), void_type = b.id(), function_type = b.id(),
+           uint_type = b.id(), runtime_array = b.id(), block = b.id(),
+           block_pointer = b.id(), parameters = b.id(),
+           parameters_pointer = b.id(), parameters_variable = b.id(),
+           scale = b.id(), label = b.id();
+  b.add(op_capability, {1});
+  b.add(op_capability, {5347}); // PhysicalStorageBufferAddresses
+  b.add(op_memory_model, {5348, 1});
+  b.add(op_entry_point,
+        module_builder::string("main", {execution_model_gl_compute, main}));
+  b.add(op_execution_mode, {main, execution_mode_local_size, 1, 1, 1});
+  b.add(op_decorate, {runtime_array, decoration_array_stride, 4});
+  b.add(op_member_decorate, {block, 0, decoration_offset, 0});
+  b.add(op_decorate, {block, decoration_block});
+  b.add(op_member_decorate, {parameters, 0, decoration_offset, 0});
+  b.add(op_member_decorate, {parameters, 1, decoration_offset, 8});
+  b.add(op_decorate, {parameters, decoration_block});
+  b.add(op_decorate, {scale, decoration_spec_id, 3});
+  b.add(op_type_void, {void_type});
+  b.add(op_type_function, {function_type, void_type});
+  b.add(op_type_int, {uint_type, 32, 0});
+  b.add(op_type_runtime_array, {runtime_array, uint_type});
+  b.add(op_type_struct, {block, runtime_array});
+  b.add(op_type_pointer,
+        {block_pointer, storage_class_physical_storage_buffer, block});
+  b.add(op_type_struct, {parameters, block_pointer, uint_type});
+  b.add(op_type_pointer,
+        {parameters_pointer, storage_class_push_constant, parameters});
+  b.add(op_variable,
+        {parameters_pointer, parameters_variable, storage_class_push_constant});
+  b.add(op_spec_constant, {uint_type, scale, 2});
+  b.add(op_function, {void_type, main, 0, function_type});
+  b.add(op_label, {label});
+  b.add(op_return, {});
+  b.add(op_function_end, {});
+
+  auto reflection = vulkan_helper::reflect_spirv(b.get_code());
+  check(reflection.push_constants ==
+            vulkan_helper::spirv_push_constant_block{0, 12},
+        "a buffer reference is 8 bytes");
+  check(reflection.specialization_constants ==
+            std::vector{vulkan_helper::spirv_specialization_constant{3, 4}},
+        "the specialization constant with id 3");
+  check(reflection.descriptor_bindings.empty(), "no descriptors");
+}
+
+void test_reflect_malformed() {
+  auto throws = [](std::vector<uint32_t> code) {
+    try {
+      vulkan_helper::reflect_spirv(code);
+    } catch (const std::runtime_error &) {
+      return true;
+    }
+    return false;
+  };
+  auto code = make_compute_module(false);
+  check(throws({code.begin(), code.begin() + 4}), "a cut header throws");
+  auto bad_magic = code;
+  bad_magic[0] = 0;
+  check(throws(bad_magic), "a wrong magic number throws");
+  auto past_end = code;
+  past_end.back() = 2 << 16 | (past_end.back() & 0xffff);
+  check(throws(past_end), "an instruction past the end throws");
+  auto bad_bound = code;
+  bad_bound[3] = 2;
+  check(throws(bad_bound), "an id over the bound throws");
+}
+
+void test_strip() {
+  auto code = make_compute_module(true);
+  auto stripped = vulkan_helper::strip_spirv(code);
+  check(stripped.size() < code.size(), "stripping makes the module smaller");
+  check(stripped[3] < code[3], "renumbering lowers the id bound");
+  bool debug_left = false;
+  for (size_t i = 5; i < stripped.size(); i += stripped[i] >> 16) {
+    switch (stripped[i] & 0xffff) {
+    case op_source:
+    case op_name:
+    case op_member_name:
+    case op_string:
+    case op_line:
+    case op_module_processed:
+      debug_left = true;
+    }
+  }
+  check(!debug_left, "no debug instructions are left");
+  check(vulkan_helper::reflect_spirv(stripped) ==
+            vulkan_helper::reflect_spirv(code),
+        "stripping keeps the interface");
+  check(vulkan_helper::strip_spirv(stripped) == stripped,
+        "stripping is idempotent");
+  check(stripped == vulkan_helper::strip_spirv(make_compute_module(false)),
+        "the stripped module equals the one built without debug info");
+
+  auto kept_ids = vulkan_helper::strip_spirv(code, false);
+  check(kept_ids[3] == code[3], "without renumbering the id bound stays");
+  check(vulkan_helper::reflect_spirv(kept_ids) ==
+            vulkan_helper::reflect_spirv(code),
+        "stripping without renumbering keeps the interface");
+}
+
+} // namespace
+
+int main() {
+  test_reflect_compute();
+  test_reflect_buffer_reference();
+  test_reflect_malformed();
+  test_strip();
+  if (failures != 0) {
+    std::cerr << failures << " checks failed\n";
+    return 1;
+  }
+  return 0;
+}
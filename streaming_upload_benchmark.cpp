@@ -0,0 +1,153 @@
+// Uploads files of 1 MiB doubling up to max_file_size_mib into a device local
+// buffer through streaming_uploader with several slot counts and sizes, and
+// prints the throughput of each next to the upload of the same bytes from
+// memory.
+//   streaming_upload_benchmark [max_file_size_mib] [repetitions]
+// The file is written first and stays in the page cache, so the file numbers
+// are the overlap of reads and copies, not the speed of the disk.
+#include "vulkan_helper.hpp"
+
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+class benchmark_extensions {
+public:
+  auto get_extensions() { return std::vector<std::string>{}; }
+};
+using benchmark_instance = vulkan_helper::add_instance_function_wrapper<
+    vulkan_helper::instance<benchmark_extensions>>;
+
+class benchmark_physical_device_base : public benchmark_instance {
+public:
+  benchmark_physical_device_base()
+      : m_physical_device{get_first_physical_device()} {}
+  VkPhysicalDevice get_vulkan_physical_device() { return m_physical_device; }
+
+private:
+  VkPhysicalDevice m_physical_device;
+};
+using benchmark_physical_device =
+    vulkan_helper::add_physical_device_wrapper_functions<
+        benchmark_physical_device_base>;
+
+// a transfer only family is usually the copy engine.
+uint32_t find_transfer_queue_family(benchmark_physical_device &physical_device) {
+  try {
+    return physical_device.find_queue_family_if(
+        [](const VkQueueFamilyProperties &properties) {
+          return (properties.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+                 !(properties.queueFlags &
+                   (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+        });
+  } catch (const std::runtime_error &) {
+    return physical_device.find_queue_family_if(
+        [](const VkQueueFamilyProperties &properties) {
+          return (properties.queueFlags &
+                  (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT |
+                   VK_QUEUE_COMPUTE_BIT)) != 0;
+        });
+  }
+}
+
+class benchmark_device_base : public benchmark_physical_device {
+public:
+  benchmark_device_base()
+      : m_queue_family_index{find_transfer_queue_family(*this)},
+        m_device{create_device(vulkan_helper::device_create_info{}
+                                   .set_queue_family_index(
+                                       m_queue_family_index))} {}
+  benchmark_device_base(const benchmark_device_base &) = delete;
+  ~benchmark_device_base() { vkDestroyDevice(m_device, nullptr); }
+  benchmark_device_base &operator=(const benchmark_device_base &) = delete;
+
+  uint32_t get_queue_family_index() const { return m_queue_family_index; }
+  VkDevice get_vulkan_device() { return m_device; }
+
+private:
+  uint32_t m_queue_family_index;
+  VkDevice m_device;
+};
+using benchmark_uploader = vulkan_helper::streaming_uploader<
+    vulkan_helper::add_device_wrapper_functions<benchmark_device_base>>;
+
+// returns the seconds of the fastest of repetitions uploads.
+double run(benchmark_uploader &uploader, auto &&upload, uint32_t repetitions) {
+  double best = 0;
+  for (uint32_t i = 0; i < repetitions; i++) {
+    auto start = std::chrono::steady_clock::now();
+    upload();
+    uploader.wait_idle();
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    best = i == 0 ? seconds : std::min(best, seconds);
+  }
+  return best;
+}
+
+// writes a file of file_size and uploads it with every slot layout.
+void run_file_size(uint64_t file_size, const std::filesystem::path &path,
+                   uint32_t repetitions) {
+  std::vector<std::byte> data(file_size);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<std::byte>(i * 2654435761u >> 24);
+  }
+  {
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    if (!file) {
+      throw std::runtime_error{"failed to write " + path.string()};
+    }
+  }
+  std::cout << (file_size >> 20) << " MiB, best of " << repetitions << '\n';
+  for (uint32_t slot_count : {2u, 4u, 8u}) {
+    for (VkDeviceSize slot_size : {1ull << 20, 4ull << 20, 16ull << 20}) {
+      benchmark_uploader uploader{slot_count, slot_size};
+      auto dst = uploader.create_buffer(uploader.get_queue_family_index(),
+                                        file_size,
+                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+      auto memory = uploader.alloc_device_memory(
+          uploader.get_memory_properties(), dst,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      auto file_seconds = run(
+          uploader, [&]() { uploader.upload(path, dst); }, repetitions);
+      auto memory_seconds = run(
+          uploader, [&]() { uploader.upload(std::span{data}, dst); },
+          repetitions);
+      uploader.free_device_memory(memory);
+      uploader.destroy_buffer(dst);
+      std::cout << "  " << slot_count << " x " << (slot_size >> 20)
+                << " MiB slots: file " << file_size / file_seconds / 1e6
+                << " MB/s, memory " << file_size / memory_seconds / 1e6
+                << " MB/s\n";
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uint64_t max_file_size = (argc > 1 ? std::stoull(argv[1]) : 256) << 20;
+  uint32_t repetitions = argc > 2 ? std::stoul(argv[2]) : 4;
+  auto path = std::filesystem::temp_directory_path() /
+              "streaming_upload_benchmark.bin";
+  try {
+    // files smaller than a slot up to many slots, doubling each time.
+    for (uint64_t file_size = 1ull << 20; file_size <= max_file_size;
+         file_size *= 2) {
+      run_file_size(file_size, path, repetitions);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << argv[0] << ": " << e.what() << '\n';
+    std::filesystem::remove(path);
+    return 1;
+  }
+  std::filesystem::remove(path);
+  return 0;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace vulkan_helper {
+
+// Fixed set of worker threads running submitted jobs in FIFO order. submit()
+// returns a future of the job result, an exception thrown by the job is
+// rethrown by the future. The destructor finishes the queued jobs first.
+class thread_pool {
+public:
+  explicit thread_pool(uint32_t thread_count = default_thread_count())
+      : m_running_count{0}, m_stopping{false} {
+    thread_count = std::max(thread_count, 1u);
+    m_threads.reserve(thread_count);
+    for (uint32_t i = 0; i < thread_count; i++) {
+      m_threads.emplace_back([this]() { run(); });
+    }
+  }
+  thread_pool(const thread_pool &) = delete;
+  thread_pool(thread_pool &&) = delete;
+  ~thread_pool() {
+    {
+      std::lock_guard lock{m_mutex};
+      m_stopping = true;
+    }
+    m_job_available.notify_all();
+    m_threads.clear();
+  }
+  thread_pool &operator=(const thread_pool &) = delete;
+  thread_pool &operator=(thread_pool &&) = delete;
+
+  static uint32_t default_thread_count() {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  uint32_t get_thread_count() const { return m_threads.size(); }
+  // true on the workers of this pool. A worker that waits for a job queued
+  // on its own pool can deadlock, e.g. when the pool has one thread.
+  bool is_worker_thread() const {
+    return std::ranges::any_of(m_threads, [](const std::jthread &thread) {
+      return thread.get_id() == std::this_thread::get_id();
+    });
+  }
+
+  template <std::invocable<> F>
+  std::future<std::invoke_result_t<F>> submit(F &&f) {
+    // std::function needs a copyable target, so the task is shared.
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(
+        std::forward<F>(f));
+    auto future = task->get_future();
+    {
+      std::lock_guard lock{m_mutex};
+      m_jobs.emplace_back([task]() { (*task)(); });
+    }
+    m_job_available.notify_one();
+    return future;
+  }
+  // Blocks until the queue is empty and no job is running.
+  void wait_idle() {
+    std::unique_lock lock{m_mutex};
+    m_idle.wait(lock, [this]() { return m_jobs.empty() && m_running_count == 0; });
+  }
+
+private:
+  void run() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock lock{m_mutex};
+        m_job_available.wait(lock,
+                             [this]() { return m_stopping || !m_jobs.empty(); });
+        if (m_jobs.empty()) {
+          return;
+        }
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        m_running_count++;
+      }
+      job();
+      {
+        std::lock_guard lock{m_mutex};
+        m_running_count--;
+        if (m_jobs.empty() && m_running_count == 0) {
+          m_idle.notify_all();
+        }
+      }
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_job_available;
+  std::condition_variable m_idle;
+  std::deque<std::function<void()>> m_jobs;
+  uint32_t m_running_count;
+  bool m_stopping;
+  std::vector<std::jthread> m_threads;
+};
+
+} // namespace vulkan_helper
@@ -3,11 +3,29 @@
 #include <vulkan/vulkan.hpp>
 
 #include "spirv_helper.hpp"
+#include "spirv_archive.hpp"
+#include "thread_pool.hpp"
+#include "async_file_loader.hpp"
 #include "cpp_helper.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
 #include <concepts>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
+#include <set>
+#include <sstream>
 #include <string>
 #include <cassert>
 
@@ -45,6 +63,9 @@ class empty_class {
 public:
     empty_class(const configure auto& conf) {}
 };
+template <typename T>
+concept instance_layers_gettable = requires(T t) { t.get_instance_layers(); };
+// enables the layers of get_instance_layers() if the stack has it.
 template <concept_helper::instance_helper::get_extensions T>
 class add_instance : public T {
 public:
@@ -55,8 +76,16 @@ public:
     std::vector<const char *> ext_ptrs(exts.size());
     std::ranges::transform(exts, ext_ptrs.begin(),
                            [](auto &str) { return str.c_str(); });
+    std::vector<std::string> layers;
+    if constexpr (instance_layers_gettable<parent>) {
+      layers = parent::get_instance_layers();
+    }
+    std::vector<const char *> layer_ptrs(layers.size());
+    std::ranges::transform(layers, layer_ptrs.begin(),
+                           [](auto &str) { return str.c_str(); });
     auto create_info = vk::InstanceCreateInfo{}
                            .setPApplicationInfo(&app_info)
+                           .setPEnabledLayerNames(layer_ptrs)
                            .setPEnabledExtensionNames(ext_ptrs);
     m_instance = vk::createInstance(create_info);
   }
@@ -169,6 +198,9 @@ template<class T>
 concept with_get_physical_devices = requires (T t) {
     t.get_physical_devices();
 };
+template <typename T>
+concept physical_device_snapshot_cache_gettable =
+    requires(T t) { t.get_physical_device_snapshot_cache(); };
 
 template <class T>
     requires (with_get_physical_devices<add_get_physical_devices_with_check_size<T>>)
@@ -195,7 +227,7 @@ public:
         auto required_extension = GET_EXTENSION{}();
         bool find_extension = false;
         for (auto physical_device : physical_devices) {
-            auto extension_properties = physical_device.enumerateDeviceExtensionProperties();
+            auto extension_properties = get_extension_properties(physical_device);
             if (extension_properties.end() != std::find_if(
                         extension_properties.begin(),
                         extension_properties.end(),
@@ -213,6 +245,15 @@ public:
     }
     auto get_physical_device() { return m_physical_device; }
 private:
+  auto get_extension_properties(vk::PhysicalDevice physical_device) {
+    if constexpr (physical_device_snapshot_cache_gettable<parent>) {
+      return parent::get_physical_device_snapshot_cache()
+          .get_extension_properties(physical_device);
+    } else {
+      return physical_device.enumerateDeviceExtensionProperties();
+    }
+  }
+
   vk::PhysicalDevice m_physical_device;
 };
 
@@ -317,6 +358,70 @@ public:
 private:
   vk::Device m_device;
 };
+template<configurable T>
+    requires queue_create_infos_gettable<T>
+class add_device<T> : public T {
+public:
+  using parent = T;
+  add_device(const configure auto& conf) : parent{conf} {
+    vk::PhysicalDevice physical_device = parent::get_physical_device();
+    auto queue_create_infos = parent::get_queue_create_infos();
+    auto exts = parent::get_extensions();
+    std::vector<const char *> ext_ptrs(exts.size());
+    std::ranges::transform(exts, ext_ptrs.begin(),
+                           [](auto &str) { return str.c_str(); });
+    m_device = physical_device.createDevice(
+        vk::DeviceCreateInfo{}
+            .setQueueCreateInfos(queue_create_infos)
+            .setPEnabledExtensionNames(ext_ptrs));
+  }
+  ~add_device() { m_device.destroy(); }
+  auto get_device() { return m_device; }
+
+private:
+  vk::Device m_device;
+};
+template <uint32_t Count, class T> class set_queue_count : public T {
+public:
+  using parent = T;
+  set_queue_count(const configure auto& conf) : parent{conf} {}
+  auto get_queue_priorities() { return std::vector<float>(Count, 1.0f); }
+};
+template <uint32_t QueueIndex, float Priority, class T>
+class set_queue_priority : public T {
+public:
+  using parent = T;
+  set_queue_priority(const configure auto& conf) : parent{conf} {}
+  auto get_queue_priorities() {
+    auto priorities = parent::get_queue_priorities();
+    priorities.at(QueueIndex) = Priority;
+    return priorities;
+  }
+};
+// queue create info points into m_priorities, so it stays valid as long as this
+// object lives.
+template <class T> class add_queue_create_infos : public T {
+public:
+  using parent = T;
+  add_queue_create_infos(const configure auto& conf) : parent{conf} {}
+  auto get_queue_create_infos() {
+    m_priorities = parent::get_queue_priorities();
+    uint32_t queue_family_index = parent::get_queue_family_index();
+    vk::PhysicalDevice physical_device = parent::get_physical_device();
+    auto families = physical_device.getQueueFamilyProperties();
+    if (m_priorities.empty() || queue_family_index >= families.size() ||
+        m_priorities.size() > families[queue_family_index].queueCount) {
+      throw std::runtime_error{
+          "requested queue count is not supported by the queue family"};
+    }
+    return std::vector{vk::DeviceQueueCreateInfo{}
+                           .setQueuePriorities(m_priorities)
+                           .setQueueFamilyIndex(queue_family_index)};
+  }
+
+private:
+  std::vector<float> m_priorities;
+};
 
 template <std::invocable<> GET_FEATURES, class T> class add_device_with_features : public T {
 public:
@@ -324,28 +429,36 @@ public:
   add_device_with_features(const configure auto& conf) : parent{conf} {
     vk::PhysicalDevice physical_device = parent::get_physical_device();
     auto priorities = std::vector{1.0f};
-    uint32_t queue_family_index = parent::get_queue_family_index();
-    auto queue_create_infos =
-        std::vector{vk::DeviceQueueCreateInfo{}
-                        .setQueueCount(priorities.size())
-                        .setQueuePriorities(priorities)
-                        .setQueueFamilyIndex(queue_family_index)};
+    std::vector<vk::DeviceQueueCreateInfo> queue_create_infos;
+    if constexpr (queue_create_infos_gettable<parent>) {
+      queue_create_infos = parent::get_queue_create_infos();
+    } else {
+      uint32_t queue_family_index = parent::get_queue_family_index();
+      queue_create_infos =
+          std::vector{vk::DeviceQueueCreateInfo{}
+                          .setQueueCount(priorities.size())
+                          .setQueuePriorities(priorities)
+                          .setQueueFamilyIndex(queue_family_index)};
+    }
     auto exts = parent::get_extensions();
     std::vector<const char *> ext_ptrs(exts.size());
     std::ranges::transform(exts, ext_ptrs.begin(),
                            [](auto &str) { return str.c_str(); });
-    auto features = GET_FEATURES{}();
     m_device = physical_device.createDevice(
         vk::DeviceCreateInfo{}
             .setQueueCreateInfos(queue_create_infos)
             .setPEnabledExtensionNames(ext_ptrs)
-            .setPNext(&std::get<vk::PhysicalDeviceFeatures2>(features))
+            .setPNext(&std::get<vk::PhysicalDeviceFeatures2>(m_features))
             );
   }
   ~add_device_with_features() { m_device.destroy(); }
   auto get_device() { return m_device; }
+  const vk::PhysicalDeviceFeatures2 &get_enabled_features() {
+    return std::get<vk::PhysicalDeviceFeatures2>(m_features);
+  }
 
 private:
+  decltype(GET_FEATURES{}()) m_features = GET_FEATURES{}();
   vk::Device m_device;
 };
 
@@ -362,6 +475,24 @@ public:
 private:
   vk::Queue m_queue;
 };
+template <class T> class add_queues : public T {
+public:
+  using parent = T;
+  add_queues(const configure auto& conf) : parent{conf} {
+    vk::Device device = parent::get_device();
+    uint32_t queue_family_index = parent::get_queue_family_index();
+    uint32_t queue_count = parent::get_queue_priorities().size();
+    m_queues.resize(queue_count);
+    for (uint32_t i = 0; i < queue_count; i++) {
+      m_queues[i] = device.getQueue(queue_family_index, i);
+    }
+  }
+  auto get_queues() { return m_queues; }
+  auto get_queue(uint32_t index) { return m_queues[index]; }
+
+private:
+  std::vector<vk::Queue> m_queues;
+};
 template<typename T>
 class add_decode_queue : public T {
 public:
@@ -983,7 +1114,12 @@ public:
   using parent = T;
   cache_physical_device_memory_properties(const configure auto& conf) : parent{conf} {
     vk::PhysicalDevice physical_device = parent::get_physical_device();
-    m_properties = physical_device.getMemoryProperties();
+    if constexpr (physical_device_snapshot_cache_gettable<parent>) {
+      m_properties = parent::get_physical_device_snapshot_cache()
+                         .get_memory_properties(physical_device);
+    } else {
+      m_properties = physical_device.getMemoryProperties();
+    }
   }
   auto get_physical_device_memory_properties() { return m_properties; }
 
@@ -995,7 +1131,12 @@ public:
   using parent = T;
   cache_physical_device_queue_properties(const configure auto& conf) : parent{conf} {
     vk::PhysicalDevice physical_device = parent::get_physical_device();
-    m_properties = physical_device.getQueueFamilyProperties();
+    if constexpr (physical_device_snapshot_cache_gettable<parent>) {
+      m_properties = parent::get_physical_device_snapshot_cache()
+                         .get_queue_family_properties(physical_device);
+    } else {
+      m_properties = physical_device.getQueueFamilyProperties();
+    }
   }
   auto get_physical_device_queue_family_properties() { return m_properties; }
 
@@ -1566,217 +1707,2261 @@ public:
 private:
   std::vector<vk::Fence> m_fences;
 };
-template <class T> class add_recreate_surface_for_pipeline : public T {
-public:
-  using parent = T;
-  void recreate_surface() {
-    parent::destroy_pipeline();
-    parent::recreate_surface();
-    parent::create_pipeline();
+// Pipeline cache blobs start with VkPipelineCacheHeaderVersionOne. A blob
+// written by another driver or device is dropped here instead of being handed
+// to vkCreatePipelineCache.
+inline bool is_pipeline_cache_compatible(
+    std::span<const char> data, const VkPhysicalDeviceProperties &properties) {
+  VkPipelineCacheHeaderVersionOne header{};
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  return header.headerSize >= sizeof(header) &&
+         header.headerSize <= data.size() &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == properties.vendorID &&
+         header.deviceID == properties.deviceID &&
+         std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                     VK_UUID_SIZE) == 0;
+}
+inline std::vector<char>
+load_pipeline_cache_data(const std::filesystem::path &path,
+                         const VkPhysicalDeviceProperties &properties) {
+  auto file = std::ifstream{path, std::ios::binary};
+  if (!file) {
+    return {};
+  }
+  auto data = std::vector<char>{std::istreambuf_iterator<char>{file},
+                                std::istreambuf_iterator<char>{}};
+  if (!is_pipeline_cache_compatible(data, properties)) {
+    return {};
+  }
+  return data;
+}
+// write to a uniquely named temporary file, flush it to disk and rename it
+// over the old one, so neither a crash nor a concurrent writer leaves a
+// truncated file behind.
+inline void write_file_atomically(const std::filesystem::path &path,
+                                  std::span<const char> data) {
+#ifdef __unix__
+  auto temp_name = path.string() + ".XXXXXX";
+  int fd = mkstemp(temp_name.data());
+  if (fd == -1) {
+    throw std::runtime_error{"failed to create file: " + temp_name};
+  }
+  // mkstemp creates the file with mode 0600, give it the mode of the file it
+  // replaces, or the one a plain open() would.
+  struct stat existing{};
+  mode_t mode = 0;
+  if (stat(path.c_str(), &existing) == 0) {
+    mode = existing.st_mode & 07777;
+  } else {
+    // umask can only be read by setting it, keep other callers of this out.
+    static std::mutex umask_mutex;
+    std::lock_guard lock{umask_mutex};
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+  }
+  bool written = fchmod(fd, mode) == 0;
+  for (size_t offset = 0; written && offset < data.size();) {
+    auto count = write(fd, data.data() + offset, data.size() - offset);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    written = count > 0;
+    offset += written ? count : 0;
+  }
+  written = written && fsync(fd) == 0;
+  written = close(fd) == 0 && written;
+  if (!written || rename(temp_name.c_str(), path.c_str()) != 0) {
+    unlink(temp_name.c_str());
+    throw std::runtime_error{"failed to write file: " + temp_name};
+  }
+  // the rename itself is only durable once the directory is synced.
+  auto directory = path.parent_path();
+  int directory_fd = open(directory.empty() ? "." : directory.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directory_fd != -1) {
+    fsync(directory_fd);
+    close(directory_fd);
+  }
+#endif
+#ifdef WIN32
+  static std::atomic<uint32_t> temp_counter{0};
+  auto temp_path = path;
+  temp_path += "." + std::to_string(GetCurrentProcessId()) + "." +
+               std::to_string(temp_counter++) + ".tmp";
+  HANDLE file = CreateFileW(temp_path.c_str(), GENERIC_WRITE, 0, nullptr,
+                            CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error{"failed to create file: " + temp_path.string()};
+  }
+  bool written = true;
+  for (size_t offset = 0; written && offset < data.size();) {
+    DWORD count = 0;
+    auto size = static_cast<DWORD>(
+        std::min<size_t>(data.size() - offset, 1u << 30));
+    written = WriteFile(file, data.data() + offset, size, &count, nullptr) &&
+              count > 0;
+    offset += count;
+  }
+  written = written && FlushFileBuffers(file);
+  CloseHandle(file);
+  if (!written ||
+      !MoveFileExW(temp_path.c_str(), path.c_str(),
+                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    DeleteFileW(temp_path.c_str());
+    throw std::runtime_error{"failed to write file: " + temp_path.string()};
+  }
+#endif
+}
+inline void save_pipeline_cache_data(const std::filesystem::path &path,
+                                     std::span<const char> data) {
+  write_file_atomically(path, data);
+}
+// identity and driver of a physical device, and the layers of the instance,
+// which can change what the queries report.
+struct physical_device_snapshot_key {
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint32_t driver_version;
+  uint32_t api_version;
+  std::array<uint8_t, VK_UUID_SIZE> pipeline_cache_uuid;
+  std::array<uint8_t, VK_UUID_SIZE> device_uuid;
+  std::array<uint8_t, VK_UUID_SIZE> driver_uuid;
+  uint64_t layers_hash;
+
+  bool operator==(const physical_device_snapshot_key &) const = default;
+};
+struct physical_device_snapshot {
+  physical_device_snapshot_key key;
+  std::vector<vk::ExtensionProperties> extension_properties;
+  std::vector<vk::QueueFamilyProperties> queue_family_properties;
+  vk::PhysicalDeviceMemoryProperties memory_properties;
+};
+// Results of the physical device queries that get slow with many layers:
+// extensions, queue families and memory properties. They are saved to a small
+// binary file and reused while the key of the device is unchanged, which
+// costs one vkGetPhysicalDeviceProperties2 per device. A snapshot is queried
+// again when its key changes, e.g. after a driver update or with other
+// layers. Surface formats are not kept, they depend on the surface and the
+// display it is on, and one query per swapchain is cheap.
+class physical_device_snapshot_cache {
+public:
+  physical_device_snapshot_cache() = default;
+  // layers are the names and versions of the layers the instance runs with.
+  explicit physical_device_snapshot_cache(
+      std::filesystem::path path, std::span<const std::string> layers = {})
+      : m_path{std::move(path)}, m_layers_hash{hash_layers(layers)} {
+    auto file = std::ifstream{m_path, std::ios::binary};
+    auto data = std::vector<char>{std::istreambuf_iterator<char>{file},
+                                  std::istreambuf_iterator<char>{}};
+    if (!read_snapshots(data, m_snapshots)) {
+      // a damaged file is rewritten from fresh queries.
+      m_snapshots.clear();
+    }
   }
-};
-template <class T> class add_graphics_pipeline : public T {
-public:
-  using parent = T;
-  add_graphics_pipeline(const configure auto& conf) : parent{conf} { create_pipeline(); }
-  ~add_graphics_pipeline() { destroy_pipeline(); }
-  void create_pipeline() {
-      create();
+
+  // the snapshot stored under key with the layers of the cache, query()
+  // takes a new one if there is none. A snapshot of the same device under
+  // another key is dropped.
+  physical_device_snapshot get_snapshot(const physical_device_snapshot_key &key,
+                                        std::invocable<> auto &&query) {
+    std::lock_guard lock{m_mutex};
+    return m_snapshots[find_locked(key, query)].value;
   }
-  void destroy_pipeline() {
-      destroy();
+
+  std::vector<vk::ExtensionProperties>
+  get_extension_properties(vk::PhysicalDevice physical_device) {
+    std::lock_guard lock{m_mutex};
+    return find_locked(physical_device).extension_properties;
   }
-  void create() {
-    vk::Device device = parent::get_device();
-    vk::PipelineLayout pipeline_layout = parent::get_pipeline_layout();
-    vk::PipelineColorBlendStateCreateInfo color_blend_state =
-        parent::get_pipeline_color_blend_state_create_info();
-    vk::PipelineDepthStencilStateCreateInfo depth_stencil_state =
-        parent::get_pipeline_depth_stencil_state_create_info();
-    vk::PipelineDynamicStateCreateInfo dynamic_state =
-        parent::get_pipeline_dynamic_state_create_info();
-    vk::PipelineInputAssemblyStateCreateInfo input_assembly_state =
-        parent::get_pipeline_input_assembly_state_create_info();
-    vk::PipelineMultisampleStateCreateInfo multisample_state =
-        parent::get_pipeline_multisample_state_create_info();
-    vk::PipelineRasterizationStateCreateInfo rasterization_state =
-        parent::get_pipeline_rasterization_state_create_info();
-    auto stages = parent::get_pipeline_stages();
-    vk::PipelineTessellationStateCreateInfo tessellation_state =
-        parent::get_pipeline_tessellation_state_create_info();
-    vk::PipelineVertexInputStateCreateInfo vertex_input_state =
-        parent::get_pipeline_vertex_input_state_create_info();
-    vk::PipelineViewportStateCreateInfo viewport_state =
-        parent::get_pipeline_viewport_state_create_info();
-    vk::RenderPass render_pass = parent::get_render_pass();
-    uint32_t subpass = parent::get_subpass();
-
-    auto [res, pipeline] = device.createGraphicsPipeline(
-        {}, vk::GraphicsPipelineCreateInfo{}
-                .setLayout(pipeline_layout)
-                .setPColorBlendState(&color_blend_state)
-                .setPDepthStencilState(&depth_stencil_state)
-                .setPDynamicState(&dynamic_state)
-                .setPInputAssemblyState(&input_assembly_state)
-                .setPMultisampleState(&multisample_state)
-                .setPRasterizationState(&rasterization_state)
-                .setStages(stages)
-                .setPTessellationState(&tessellation_state)
-                .setPVertexInputState(&vertex_input_state)
-                .setPViewportState(&viewport_state)
-                .setRenderPass(render_pass)
-                .setSubpass(subpass)
-
-    );
-    if (res != vk::Result::eSuccess) {
-      throw std::runtime_error{"failed to create graphics pipeline"};
-    }
-    m_pipeline = pipeline;
+  std::vector<vk::QueueFamilyProperties>
+  get_queue_family_properties(vk::PhysicalDevice physical_device) {
+    std::lock_guard lock{m_mutex};
+    return find_locked(physical_device).queue_family_properties;
   }
-  void destroy() {
-    vk::Device device = parent::get_device();
-    device.destroyPipeline(m_pipeline);
+  vk::PhysicalDeviceMemoryProperties
+  get_memory_properties(vk::PhysicalDevice physical_device) {
+    std::lock_guard lock{m_mutex};
+    return find_locked(physical_device).memory_properties;
+  }
+  // only writes the file when a snapshot was queried.
+  void save() {
+    std::lock_guard lock{m_mutex};
+    if (m_path.empty() || !m_modified) {
+      return;
+    }
+    auto data = write_snapshots(m_snapshots);
+    write_file_atomically(m_path, data);
+    m_modified = false;
   }
-  auto get_pipeline() { return m_pipeline; }
 
 private:
-  vk::Pipeline m_pipeline;
-};
-template <uint32_t Subpass, class T> class set_subpass : public T {
-public:
-  auto get_subpass() { return Subpass; }
-};
-template <class T> class add_empty_attachments : public T {
-public:
-  auto get_attachments() { return std::vector<vk::AttachmentDescription>{}; }
-};
-template <class T> class add_depth_attachment : public T {
-public:
-  using parent = T;
-  auto get_attachments() {
-    auto attachments = parent::get_attachments();
-    vk::Format format = parent::get_depth_image_format();
-    vk::ImageLayout initial_layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-    vk::ImageLayout final_layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-    attachments.emplace_back(
-        vk::AttachmentDescription{}
-            .setInitialLayout(initial_layout)
-            .setFinalLayout(final_layout)
-            .setFormat(format)
-            .setLoadOp(vk::AttachmentLoadOp::eClear)
-            .setStoreOp(vk::AttachmentStoreOp::eDontCare)
-            .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
-            .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare));
-    return attachments;
+  struct snapshot {
+    physical_device_snapshot value;
+    // replaced by a snapshot of the same device with another key.
+    bool stale = false;
+  };
+  static constexpr uint32_t magic_value = 0x43534450; // "PDSC"
+  static constexpr uint32_t current_version = 3;
+
+  static uint64_t hash_layers(std::span<const std::string> layers) {
+    uint64_t hash = layers.size();
+    for (auto &layer : layers) {
+      hash = vulkan_helper::hash_combine(
+          hash, vulkan_helper::hash_bytes(layer.data(), layer.size()));
+    }
+    return hash;
+  }
+  static physical_device_snapshot_key
+  get_key(vk::PhysicalDevice physical_device) {
+    auto chain = physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+                                                vk::PhysicalDeviceIDProperties>();
+    auto &properties = chain.get<vk::PhysicalDeviceProperties2>().properties;
+    auto &id_properties = chain.get<vk::PhysicalDeviceIDProperties>();
+    physical_device_snapshot_key key{};
+    key.vendor_id = properties.vendorID;
+    key.device_id = properties.deviceID;
+    key.driver_version = properties.driverVersion;
+    key.api_version = properties.apiVersion;
+    std::ranges::copy(properties.pipelineCacheUUID, key.pipeline_cache_uuid.begin());
+    std::ranges::copy(id_properties.deviceUUID, key.device_uuid.begin());
+    std::ranges::copy(id_properties.driverUUID, key.driver_uuid.begin());
+    return key;
+  }
+  size_t find_locked(physical_device_snapshot_key key, auto &&query) {
+    key.layers_hash = m_layers_hash;
+    size_t index = 0;
+    while (index < m_snapshots.size() &&
+           (m_snapshots[index].stale || m_snapshots[index].value.key != key)) {
+      index++;
+    }
+    if (index == m_snapshots.size()) {
+      for (auto &old : m_snapshots) {
+        old.stale = old.stale || old.value.key.device_uuid == key.device_uuid;
+      }
+      m_snapshots.push_back(snapshot{.value = query()});
+      m_snapshots.back().value.key = key;
+      m_modified = true;
+    }
+    return index;
+  }
+  physical_device_snapshot &find_locked(vk::PhysicalDevice physical_device) {
+    auto handle = static_cast<VkPhysicalDevice>(physical_device);
+    if (auto it = m_handles.find(handle); it != m_handles.end()) {
+      return m_snapshots[it->second].value;
+    }
+    auto index = find_locked(get_key(physical_device), [physical_device]() {
+      return physical_device_snapshot{
+          .key = {},
+          .extension_properties =
+              physical_device.enumerateDeviceExtensionProperties(),
+          .queue_family_properties = physical_device.getQueueFamilyProperties(),
+          .memory_properties = physical_device.getMemoryProperties(),
+      };
+    });
+    m_handles.emplace(handle, index);
+    return m_snapshots[index].value;
+  }
+
+  // values are stored as they are in memory, the file is not portable.
+  template <class V> static void write_value(std::string &data, const V &value) {
+    static_assert(std::is_trivially_copyable_v<V>);
+    data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+  template <class V>
+  static void write_array(std::string &data, const std::vector<V> &values) {
+    write_value(data, static_cast<uint32_t>(values.size()));
+    for (auto &value : values) {
+      write_value(data, value);
+    }
+  }
+  static std::string write_snapshots(const std::deque<snapshot> &snapshots) {
+    std::string data;
+    write_value(data, magic_value);
+    write_value(data, current_version);
+    write_value(data, static_cast<uint32_t>(std::ranges::count_if(
+                          snapshots, [](auto &s) { return !s.stale; })));
+    for (auto &s : snapshots) {
+      if (s.stale) {
+        continue;
+      }
+      write_value(data, s.value.key);
+      write_array(data, s.value.extension_properties);
+      write_array(data, s.value.queue_family_properties);
+      write_value(data, s.value.memory_properties);
+    }
+    return data;
+  }
+  class reader {
+  public:
+    explicit reader(std::span<const char> data) : m_data{data} {}
+    template <class V> bool read(V &value) {
+      static_assert(std::is_trivially_copyable_v<V>);
+      if (m_data.size() < sizeof(value)) {
+        return false;
+      }
+      std::memcpy(&value, m_data.data(), sizeof(value));
+      m_data = m_data.subspan(sizeof(value));
+      return true;
+    }
+    template <class V> bool read_array(std::vector<V> &values) {
+      uint32_t count = 0;
+      // the count must fit the rest of the file, so a damaged one cannot
+      // make this allocate a lot.
+      if (!read(count) || count > m_data.size() / sizeof(V)) {
+        return false;
+      }
+      values.resize(count);
+      for (auto &value : values) {
+        read(value);
+      }
+      return true;
+    }
+    bool empty() const { return m_data.empty(); }
+
+  private:
+    std::span<const char> m_data;
+  };
+  static bool read_snapshots(std::span<const char> data,
+                             std::deque<snapshot> &snapshots) {
+    if (data.empty()) {
+      return true;
+    }
+    reader r{data};
+    uint32_t magic = 0, version = 0, count = 0;
+    if (!r.read(magic) || !r.read(version) || !r.read(count) ||
+        magic != magic_value || version != current_version) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      snapshot s{};
+      if (!r.read(s.value.key) || !r.read_array(s.value.extension_properties) ||
+          !r.read_array(s.value.queue_family_properties) ||
+          !r.read(s.value.memory_properties)) {
+        return false;
+      }
+      snapshots.push_back(std::move(s));
+    }
+    return r.empty();
   }
+
+  std::filesystem::path m_path;
+  uint64_t m_layers_hash = 0;
+  std::mutex m_mutex;
+  std::deque<snapshot> m_snapshots;
+  std::map<VkPhysicalDevice, size_t> m_handles;
+  bool m_modified = false;
 };
-template <class T> class add_attachment : public T {
+template <class T> class add_pipeline_cache_path : public T {
 public:
   using parent = T;
-  auto get_attachments() {
-    auto attachments = parent::get_attachments();
-    vk::Format format = parent::get_swapchain_image_format();
-    vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
-    vk::ImageLayout final_layout = vk::ImageLayout::ePresentSrcKHR;
-    attachments.emplace_back(
-        vk::AttachmentDescription{}
-            .setInitialLayout(initial_layout)
-            .setFinalLayout(final_layout)
-            .setFormat(format)
-            .setLoadOp(vk::AttachmentLoadOp::eClear)
-            .setStoreOp(vk::AttachmentStoreOp::eStore)
-            .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
-            .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare));
-    return attachments;
+  add_pipeline_cache_path(const configure auto& conf) : parent{conf} {}
+  auto get_pipeline_cache_path() {
+    return std::filesystem::path{"pipeline_cache.bin"};
   }
 };
-template <class T> class add_subpass_dependency : public T {
+template <class T> class add_physical_device_snapshot_cache_path : public T {
 public:
   using parent = T;
-  auto get_subpass_dependencies() {
-    auto depends = parent::get_subpass_dependencies();
-    depends.emplace_back(
-        vk::SubpassDependency{}
-            .setSrcSubpass(vk::SubpassExternal)
-            .setDstSubpass(0)
-            .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
-            .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite |
-                              vk::AccessFlagBits::eColorAttachmentRead)
-            .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
-            .setDstStageMask(
-                vk::PipelineStageFlagBits::eColorAttachmentOutput));
-    return depends;
+  add_physical_device_snapshot_cache_path(const configure auto& conf)
+      : parent{conf} {}
+  auto get_physical_device_snapshot_cache_path() {
+    return std::filesystem::path{"physical_device_snapshot.bin"};
   }
 };
-template <class T> class add_empty_subpass_dependencies : public T {
+// Goes between the instance and the physical device mixins, which then take
+// extensions, queue families and memory properties from the snapshot of the
+// previous run.
+template <class T> class add_physical_device_snapshot_cache : public T {
 public:
-  auto get_subpass_dependencies() {
-    return std::vector<vk::SubpassDependency>{};
+  using parent = T;
+  add_physical_device_snapshot_cache(const configure auto& conf)
+      : parent{conf},
+        m_cache{parent::get_physical_device_snapshot_cache_path(),
+                get_layers()} {}
+  ~add_physical_device_snapshot_cache() {
+    try {
+      m_cache.save();
+    } catch (...) {
+    }
   }
-};
-template <class T> class add_subpasses : public T {
-public:
-  auto get_subpasses() {
-    static auto attachment_reference =
-        vk::AttachmentReference{}
-            .setAttachment(0)
-            .setLayout(vk::ImageLayout::eColorAttachmentOptimal);
-    return vk::SubpassDescription{}.setColorAttachments(
-            attachment_reference
-        );
+  auto &get_physical_device_snapshot_cache() { return m_cache; }
+
+private:
+  // the layers of the stack, those VK_INSTANCE_LAYERS names and every
+  // available layer with its version, since the loader enables implicit
+  // layers without them being named.
+  std::vector<std::string> get_layers() {
+    std::vector<std::string> layers;
+    if constexpr (instance_layers_gettable<parent>) {
+      layers = parent::get_instance_layers();
+    }
+    if (auto names = std::getenv("VK_INSTANCE_LAYERS")) {
+      layers.emplace_back(names);
+    }
+    for (auto &properties : vk::enumerateInstanceLayerProperties()) {
+      layers.push_back(std::string{properties.layerName.data()} + ' ' +
+                       std::to_string(properties.specVersion) + ' ' +
+                       std::to_string(properties.implementationVersion));
+    }
+    return layers;
   }
+
+  physical_device_snapshot_cache m_cache;
 };
-template <class T> class add_render_pass : public T {
+// add_physical_device_with_extension taking the extensions from the snapshot
+// cache, a stack for applications that start often.
+template <std::invocable<> GET_EXTENSION, class T>
+using add_cached_physical_device_with_extension =
+    add_physical_device_with_extension<
+        GET_EXTENSION, add_physical_device_snapshot_cache<
+                           add_physical_device_snapshot_cache_path<T>>>;
+template <class T> class add_pipeline_cache : public T {
 public:
   using parent = T;
-  add_render_pass() {
+  add_pipeline_cache(const configure auto& conf) : parent{conf} {
     vk::Device device = parent::get_device();
-    auto attachments = parent::get_attachments();
-    auto dependencies = parent::get_subpass_dependencies();
-    auto subpasses = parent::get_subpasses();
-
-    m_render_pass = device.createRenderPass(vk::RenderPassCreateInfo{}
-                                                .setAttachments(attachments)
-                                                .setDependencies(dependencies)
-                                                .setSubpasses(subpasses));
+    vk::PhysicalDevice physical_device = parent::get_physical_device();
+    VkPhysicalDeviceProperties properties = physical_device.getProperties();
+    auto data =
+        load_pipeline_cache_data(parent::get_pipeline_cache_path(), properties);
+    m_pipeline_cache = device.createPipelineCache(
+        vk::PipelineCacheCreateInfo{}.setInitialDataSize(data.size())
+                                     .setPInitialData(data.data()));
+  }
+  ~add_pipeline_cache() {
+    try {
+      save_pipeline_cache();
+    } catch (...) {
+    }
+    vk::Device device = parent::get_device();
+    device.destroyPipelineCache(m_pipeline_cache);
   }
-  ~add_render_pass() {
+  void save_pipeline_cache() {
     vk::Device device = parent::get_device();
-    device.destroyRenderPass(m_render_pass);
+    auto data = device.getPipelineCacheData(m_pipeline_cache);
+    save_pipeline_cache_data(
+        parent::get_pipeline_cache_path(),
+        std::span{reinterpret_cast<const char *>(data.data()), data.size()});
   }
-  auto get_render_pass() { return m_render_pass; }
+  auto get_pipeline_cache() { return m_pipeline_cache; }
 
 private:
-  vk::RenderPass m_render_pass;
+  vk::PipelineCache m_pipeline_cache;
 };
-template <class T> class add_pipeline_viewport_state : public T {
+template <typename T>
+concept pipeline_cache_gettable = requires(T t) { t.get_pipeline_cache(); };
+template <class T> class add_recreate_surface_for_pipeline : public T {
 public:
   using parent = T;
-  add_pipeline_viewport_state(const configure auto& conf) : parent{conf} {}
-  auto get_pipeline_viewport_state_create_info() {
-    m_viewports = parent::get_viewports();
-    m_scissors = parent::get_scissors();
-    if (m_viewports.size() != m_scissors.size()) {
-      throw std::runtime_error{"viewports count != scissors count"};
+  void recreate_surface() {
+    parent::destroy_pipeline();
+    parent::recreate_surface();
+    parent::create_pipeline();
+  }
+};
+// Storage for the creation feedback of one pipeline, chain info into the
+// create info. Not copyable, info points into this object.
+struct pipeline_creation_feedback {
+  explicit pipeline_creation_feedback(uint32_t stage_count)
+      : pipeline{}, stages(stage_count), info{} {
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+    info.pPipelineCreationFeedback = &pipeline;
+    info.pipelineStageCreationFeedbackCount = stage_count;
+    info.pPipelineStageCreationFeedbacks = stages.data();
+  }
+  pipeline_creation_feedback(const pipeline_creation_feedback &) = delete;
+  pipeline_creation_feedback &
+  operator=(const pipeline_creation_feedback &) = delete;
+
+  VkPipelineCreationFeedback pipeline;
+  std::vector<VkPipelineCreationFeedback> stages;
+  VkPipelineCreationFeedbackCreateInfo info;
+};
+struct pipeline_stage_creation_record {
+  VkShaderStageFlagBits stage;
+  uint64_t duration_ns;
+  bool cache_hit;
+};
+struct pipeline_creation_record {
+  // e.g. "compute", "graphics" or "library", key identifies the pipeline
+  // state when the creator has one.
+  std::string kind;
+  uint64_t key;
+  // false if the driver did not fill in the feedback.
+  bool valid;
+  uint64_t duration_ns;
+  bool cache_hit;
+  bool base_pipeline_acceleration;
+  std::vector<pipeline_stage_creation_record> stages;
+};
+struct pipeline_creation_summary {
+  uint32_t pipeline_count;
+  uint32_t cache_hit_count;
+  uint64_t total_duration_ns;
+  uint64_t max_duration_ns;
+  double get_cache_hit_rate() const {
+    return pipeline_count == 0
+               ? 0.0
+               : static_cast<double>(cache_hit_count) / pipeline_count;
+  }
+};
+// Collects the creation feedback of pipelines, it is thread safe so pipelines
+// compiled on workers can report into it. A cache hit rate falling to zero
+// after a driver update means the driver no longer accepts the cache.
+class pipeline_creation_stats {
+public:
+  void record(std::string kind, uint64_t key,
+              const pipeline_creation_feedback &feedback,
+              std::span<const VkShaderStageFlagBits> stages) {
+    pipeline_creation_record record{
+        .kind = std::move(kind),
+        .key = key,
+        .valid = (feedback.pipeline.flags &
+                  VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) != 0,
+        .duration_ns = feedback.pipeline.duration,
+        .cache_hit =
+            (feedback.pipeline.flags &
+             VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) != 0,
+        .base_pipeline_acceleration =
+            (feedback.pipeline.flags &
+             VK_PIPELINE_CREATION_FEEDBACK_BASE_PIPELINE_ACCELERATION_BIT) != 0,
+        .stages = {},
+    };
+    for (size_t i = 0; i < stages.size() && i < feedback.stages.size(); i++) {
+      auto &stage = feedback.stages[i];
+      record.stages.push_back(pipeline_stage_creation_record{
+          .stage = stages[i],
+          .duration_ns = stage.duration,
+          .cache_hit =
+              (stage.flags &
+               VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) != 0,
+      });
     }
-    return vk::PipelineViewportStateCreateInfo{}
-        .setViewports(m_viewports)
-        .setScissors(m_scissors);
+    std::lock_guard lock{m_mutex};
+    m_records.push_back(std::move(record));
+  }
+  std::vector<pipeline_creation_record> get_records() const {
+    std::lock_guard lock{m_mutex};
+    return m_records;
+  }
+  pipeline_creation_summary get_summary() const {
+    std::lock_guard lock{m_mutex};
+    pipeline_creation_summary summary{};
+    for (auto &record : m_records) {
+      summary.pipeline_count++;
+      summary.cache_hit_count += record.cache_hit;
+      summary.total_duration_ns += record.duration_ns;
+      summary.max_duration_ns =
+          std::max(summary.max_duration_ns, record.duration_ns);
+    }
+    return summary;
+  }
+  void clear() {
+    std::lock_guard lock{m_mutex};
+    m_records.clear();
+  }
+  std::string to_json() const {
+    auto summary = get_summary();
+    auto records = get_records();
+    std::ostringstream json;
+    json << "{\n  \"summary\": {\"pipeline_count\": " << summary.pipeline_count
+         << ", \"cache_hit_count\": " << summary.cache_hit_count
+         << ", \"cache_hit_rate\": " << summary.get_cache_hit_rate()
+         << ", \"total_duration_ns\": " << summary.total_duration_ns
+         << ", \"max_duration_ns\": " << summary.max_duration_ns
+         << "},\n  \"pipelines\": [";
+    for (size_t i = 0; i < records.size(); i++) {
+      auto &record = records[i];
+      json << (i == 0 ? "\n" : ",\n") << "    {\"kind\": \"" << record.kind
+           << "\", \"key\": \"" << std::hex << record.key << std::dec
+           << "\", \"valid\": " << std::boolalpha << record.valid
+           << ", \"duration_ns\": " << record.duration_ns
+           << ", \"cache_hit\": " << record.cache_hit
+           << ", \"base_pipeline_acceleration\": "
+           << record.base_pipeline_acceleration << ", \"stages\": [";
+      for (size_t j = 0; j < record.stages.size(); j++) {
+        auto &stage = record.stages[j];
+        json << (j == 0 ? "" : ", ") << "{\"stage\": " << stage.stage
+             << ", \"duration_ns\": " << stage.duration_ns
+             << ", \"cache_hit\": " << stage.cache_hit << "}";
+      }
+      json << std::noboolalpha << "]}";
+    }
+    json << "\n  ]\n}\n";
+    return json.str();
+  }
+  void save_json(const std::filesystem::path &path) const {
+    auto json = to_json();
+    write_file_atomically(path, json);
   }
 
 private:
-  std::vector<vk::Viewport> m_viewports;
-  std::vector<vk::Rect2D> m_scissors;
+  mutable std::mutex m_mutex;
+  std::vector<pipeline_creation_record> m_records;
 };
-template <class T> class add_scissor_equal_swapchain_extent : public T {
+// Declares that the stack binds and draws inside vkCmdBeginRendering, which
+// shader objects need. The caller begins and ends the rendering, the device
+// needs the dynamicRendering feature. Pipelines of the stack have no render
+// pass, they take the attachment formats from get_color_attachment_formats()
+// and get_depth_attachment_format(), by default the swapchain and the depth
+// image format of the stack.
+template <class T> class use_dynamic_rendering : public T {
 public:
   using parent = T;
-  auto get_scissors() {
-    auto scissors = parent::get_scissors();
-    auto extent = parent::get_swapchain_image_extent();
-
-    scissors.emplace_back(vk::Rect2D{}.setOffset({}).setExtent(extent));
-    return scissors;
+  bool is_dynamic_rendering_used() { return true; }
+  std::vector<vk::Format> get_color_attachment_formats() {
+    if constexpr (requires { parent::get_swapchain_image_format(); }) {
+      return {parent::get_swapchain_image_format()};
+    } else {
+      return {};
+    }
+  }
+  vk::Format get_depth_attachment_format() {
+    if constexpr (requires { parent::get_depth_image_format(); }) {
+      return parent::get_depth_image_format();
+    } else {
+      return vk::Format::eUndefined;
+    }
+  }
+};
+template <typename T>
+concept dynamic_rendering_usable =
+    requires(T t) { t.is_dynamic_rendering_used(); };
+inline bool has_stencil_component(vk::Format format) {
+  switch (format) {
+  case vk::Format::eS8Uint:
+  case vk::Format::eD16UnormS8Uint:
+  case vk::Format::eD24UnormS8Uint:
+  case vk::Format::eD32SfloatS8Uint:
+    return true;
+  default:
+    return false;
+  }
+}
+// Everything vkCreateGraphicsPipelines reads, copied out of a stack so that the
+// pipeline can be created after the getters have returned, e.g. on a worker.
+// Arrays the create infos point to still belong to the stack.
+struct graphics_pipeline_state {
+  vk::PipelineLayout pipeline_layout;
+  vk::PipelineColorBlendStateCreateInfo color_blend_state;
+  vk::PipelineDepthStencilStateCreateInfo depth_stencil_state;
+  vk::PipelineDynamicStateCreateInfo dynamic_state;
+  vk::PipelineInputAssemblyStateCreateInfo input_assembly_state;
+  vk::PipelineMultisampleStateCreateInfo multisample_state;
+  vk::PipelineRasterizationStateCreateInfo rasterization_state;
+  std::vector<vk::PipelineShaderStageCreateInfo> stages;
+  vk::PipelineTessellationStateCreateInfo tessellation_state;
+  vk::PipelineVertexInputStateCreateInfo vertex_input_state;
+  vk::PipelineViewportStateCreateInfo viewport_state;
+  vk::RenderPass render_pass;
+  uint32_t subpass;
+  vk::PipelineCache pipeline_cache;
+  // without a render pass, the formats VkPipelineRenderingCreateInfo names.
+  bool dynamic_rendering = false;
+  std::vector<vk::Format> color_attachment_formats;
+  vk::Format depth_attachment_format = vk::Format::eUndefined;
+  vk::Format stencil_attachment_format = vk::Format::eUndefined;
+};
+template <class T> graphics_pipeline_state get_graphics_pipeline_state(T &t) {
+  graphics_pipeline_state state{
+      .pipeline_layout = t.get_pipeline_layout(),
+      .color_blend_state = t.get_pipeline_color_blend_state_create_info(),
+      .depth_stencil_state = t.get_pipeline_depth_stencil_state_create_info(),
+      .dynamic_state = t.get_pipeline_dynamic_state_create_info(),
+      .input_assembly_state = t.get_pipeline_input_assembly_state_create_info(),
+      .multisample_state = t.get_pipeline_multisample_state_create_info(),
+      .rasterization_state = t.get_pipeline_rasterization_state_create_info(),
+      .stages = t.get_pipeline_stages(),
+      .tessellation_state = t.get_pipeline_tessellation_state_create_info(),
+      .vertex_input_state = t.get_pipeline_vertex_input_state_create_info(),
+      .viewport_state = t.get_pipeline_viewport_state_create_info(),
+      .render_pass = {},
+      .subpass = 0,
+      .pipeline_cache = {},
+  };
+  if constexpr (dynamic_rendering_usable<T>) {
+    auto depth_format = t.get_depth_attachment_format();
+    state.dynamic_rendering = true;
+    state.color_attachment_formats = t.get_color_attachment_formats();
+    if (depth_format != vk::Format::eS8Uint) {
+      state.depth_attachment_format = depth_format;
+    }
+    if (has_stencil_component(depth_format)) {
+      state.stencil_attachment_format = depth_format;
+    }
+  } else {
+    state.render_pass = t.get_render_pass();
+    state.subpass = t.get_subpass();
+  }
+  if constexpr (pipeline_cache_gettable<T>) {
+    state.pipeline_cache = t.get_pipeline_cache();
+  }
+  return state;
+}
+inline std::vector<VkShaderStageFlagBits>
+get_stage_bits(std::span<const vk::PipelineShaderStageCreateInfo> stages) {
+  std::vector<VkShaderStageFlagBits> bits;
+  for (auto &stage : stages) {
+    bits.push_back(static_cast<VkShaderStageFlagBits>(stage.stage));
+  }
+  return bits;
+}
+inline vk::PipelineRenderingCreateInfo
+get_pipeline_rendering_info(const graphics_pipeline_state &state) {
+  return vk::PipelineRenderingCreateInfo{}
+      .setColorAttachmentFormats(state.color_attachment_formats)
+      .setDepthAttachmentFormat(state.depth_attachment_format)
+      .setStencilAttachmentFormat(state.stencil_attachment_format);
+}
+// stats, if given, gets the creation feedback under key.
+inline vk::Pipeline create_graphics_pipeline(vk::Device device,
+                                             const graphics_pipeline_state &state,
+                                             pipeline_creation_stats *stats = nullptr,
+                                             uint64_t key = 0) {
+  pipeline_creation_feedback feedback{static_cast<uint32_t>(state.stages.size())};
+  auto rendering_info = get_pipeline_rendering_info(state).setPNext(
+      stats != nullptr ? &feedback.info : nullptr);
+  const void *next = rendering_info.pNext;
+  if (state.dynamic_rendering) {
+    next = &rendering_info;
+  }
+  auto [res, pipeline] = device.createGraphicsPipeline(
+      state.pipeline_cache, vk::GraphicsPipelineCreateInfo{}
+              .setPNext(next)
+              .setLayout(state.pipeline_layout)
+              .setPColorBlendState(&state.color_blend_state)
+              .setPDepthStencilState(&state.depth_stencil_state)
+              .setPDynamicState(&state.dynamic_state)
+              .setPInputAssemblyState(&state.input_assembly_state)
+              .setPMultisampleState(&state.multisample_state)
+              .setPRasterizationState(&state.rasterization_state)
+              .setStages(state.stages)
+              .setPTessellationState(&state.tessellation_state)
+              .setPVertexInputState(&state.vertex_input_state)
+              .setPViewportState(&state.viewport_state)
+              .setRenderPass(state.render_pass)
+              .setSubpass(state.subpass)
+
+  );
+  if (res != vk::Result::eSuccess) {
+    throw std::runtime_error{"failed to create graphics pipeline"};
+  }
+  if (stats != nullptr) {
+    stats->record("graphics", key, feedback, get_stage_bits(state.stages));
+  }
+  return pipeline;
+}
+constexpr std::array graphics_pipeline_library_parts{
+    vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface,
+    vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders,
+    vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader,
+    vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface,
+};
+// Builds one VK_EXT_graphics_pipeline_library part from the state that part
+// consumes. The link time optimization info is retained, so the library can
+// be linked fast first and optimized later.
+inline vk::Pipeline
+create_pipeline_library(vk::Device device,
+                        vk::GraphicsPipelineLibraryFlagBitsEXT part,
+                        const graphics_pipeline_state &state,
+                        pipeline_creation_stats *stats = nullptr,
+                        uint64_t key = 0) {
+  using part_bits = vk::GraphicsPipelineLibraryFlagBitsEXT;
+  auto library_info = vk::GraphicsPipelineLibraryCreateInfoEXT{}.setFlags(part);
+  auto create_info =
+      vk::GraphicsPipelineCreateInfo{}
+          .setPNext(&library_info)
+          .setFlags(vk::PipelineCreateFlagBits::eLibraryKHR |
+                    vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT)
+          .setPDynamicState(&state.dynamic_state);
+  std::vector<vk::PipelineShaderStageCreateInfo> stages;
+  for (auto &stage : state.stages) {
+    bool fragment = stage.stage == vk::ShaderStageFlagBits::eFragment;
+    if ((part == part_bits::eFragmentShader && fragment) ||
+        (part == part_bits::ePreRasterizationShaders && !fragment)) {
+      stages.push_back(stage);
+    }
+  }
+  create_info.setStages(stages);
+  pipeline_creation_feedback feedback{static_cast<uint32_t>(stages.size())};
+  if (stats != nullptr) {
+    library_info.setPNext(&feedback.info);
+  }
+  // every part but the vertex input one needs the formats without a render
+  // pass.
+  auto rendering_info =
+      get_pipeline_rendering_info(state).setPNext(&library_info);
+  if (state.dynamic_rendering && part != part_bits::eVertexInputInterface) {
+    create_info.setPNext(&rendering_info);
+  }
+  switch (part) {
+  case part_bits::eVertexInputInterface:
+    create_info.setPVertexInputState(&state.vertex_input_state)
+        .setPInputAssemblyState(&state.input_assembly_state);
+    break;
+  case part_bits::ePreRasterizationShaders:
+    create_info.setLayout(state.pipeline_layout)
+        .setPViewportState(&state.viewport_state)
+        .setPRasterizationState(&state.rasterization_state)
+        .setPTessellationState(&state.tessellation_state)
+        .setRenderPass(state.render_pass)
+        .setSubpass(state.subpass);
+    break;
+  case part_bits::eFragmentShader:
+    create_info.setLayout(state.pipeline_layout)
+        .setPMultisampleState(&state.multisample_state)
+        .setPDepthStencilState(&state.depth_stencil_state)
+        .setRenderPass(state.render_pass)
+        .setSubpass(state.subpass);
+    break;
+  case part_bits::eFragmentOutputInterface:
+    create_info.setPColorBlendState(&state.color_blend_state)
+        .setPMultisampleState(&state.multisample_state)
+        .setRenderPass(state.render_pass)
+        .setSubpass(state.subpass);
+    break;
+  }
+  auto [res, pipeline] =
+      device.createGraphicsPipeline(state.pipeline_cache, create_info);
+  if (res != vk::Result::eSuccess) {
+    throw std::runtime_error{"failed to create pipeline library"};
+  }
+  if (stats != nullptr) {
+    stats->record("library", key, feedback, get_stage_bits(stages));
+  }
+  return pipeline;
+}
+// Links complete libraries into a graphics pipeline. A plain link only
+// stitches the compiled parts together, optimize asks the driver to optimize
+// across them, which takes about as long as a monolithic pipeline.
+inline vk::Pipeline link_graphics_pipeline(vk::Device device,
+                                           vk::PipelineLayout pipeline_layout,
+                                           std::span<const vk::Pipeline> libraries,
+                                           bool optimize,
+                                           vk::PipelineCache pipeline_cache,
+                                           pipeline_creation_stats *stats = nullptr,
+                                           uint64_t key = 0) {
+  pipeline_creation_feedback feedback{0};
+  auto library_info = vk::PipelineLibraryCreateInfoKHR{}
+                          .setPNext(stats != nullptr ? &feedback.info : nullptr)
+                          .setLibraryCount(libraries.size())
+                          .setPLibraries(libraries.data());
+  auto create_info = vk::GraphicsPipelineCreateInfo{}
+                         .setPNext(&library_info)
+                         .setLayout(pipeline_layout);
+  if (optimize) {
+    create_info.setFlags(vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT);
+  }
+  auto [res, pipeline] =
+      device.createGraphicsPipeline(pipeline_cache, create_info);
+  if (res != vk::Result::eSuccess) {
+    throw std::runtime_error{"failed to link graphics pipeline"};
+  }
+  if (stats != nullptr) {
+    stats->record(optimize ? "optimized link" : "link", key, feedback, {});
+  }
+  return pipeline;
+}
+inline vk::DescriptorType
+get_descriptor_type(vulkan_helper::spirv_descriptor_type type) {
+  using enum vulkan_helper::spirv_descriptor_type;
+  switch (type) {
+  case sampler:
+    return vk::DescriptorType::eSampler;
+  case combined_image_sampler:
+    return vk::DescriptorType::eCombinedImageSampler;
+  case sampled_image:
+    return vk::DescriptorType::eSampledImage;
+  case storage_image:
+    return vk::DescriptorType::eStorageImage;
+  case uniform_texel_buffer:
+    return vk::DescriptorType::eUniformTexelBuffer;
+  case storage_texel_buffer:
+    return vk::DescriptorType::eStorageTexelBuffer;
+  case uniform_buffer:
+    return vk::DescriptorType::eUniformBuffer;
+  case storage_buffer:
+    return vk::DescriptorType::eStorageBuffer;
+  case input_attachment:
+    return vk::DescriptorType::eInputAttachment;
+  case acceleration_structure:
+    return vk::DescriptorType::eAccelerationStructureKHR;
+  }
+  throw std::runtime_error{"unknown spirv descriptor type"};
+}
+// stages of the entry points of a module.
+inline vk::ShaderStageFlags
+get_shader_stage_flags(const vulkan_helper::spirv_reflection &reflection) {
+  vk::ShaderStageFlags stages{};
+  for (auto &entry_point : reflection.entry_points) {
+    switch (entry_point.execution_model) {
+    case 0:
+      stages |= vk::ShaderStageFlagBits::eVertex;
+      break;
+    case 1:
+      stages |= vk::ShaderStageFlagBits::eTessellationControl;
+      break;
+    case 2:
+      stages |= vk::ShaderStageFlagBits::eTessellationEvaluation;
+      break;
+    case 3:
+      stages |= vk::ShaderStageFlagBits::eGeometry;
+      break;
+    case 4:
+      stages |= vk::ShaderStageFlagBits::eFragment;
+      break;
+    case 5:
+      stages |= vk::ShaderStageFlagBits::eCompute;
+      break;
+    case 5313:
+      stages |= vk::ShaderStageFlagBits::eRaygenKHR;
+      break;
+    case 5314:
+      stages |= vk::ShaderStageFlagBits::eIntersectionKHR;
+      break;
+    case 5315:
+      stages |= vk::ShaderStageFlagBits::eAnyHitKHR;
+      break;
+    case 5316:
+      stages |= vk::ShaderStageFlagBits::eClosestHitKHR;
+      break;
+    case 5317:
+      stages |= vk::ShaderStageFlagBits::eMissKHR;
+      break;
+    case 5318:
+      stages |= vk::ShaderStageFlagBits::eCallableKHR;
+      break;
+    case 5364:
+      stages |= vk::ShaderStageFlagBits::eTaskEXT;
+      break;
+    case 5365:
+      stages |= vk::ShaderStageFlagBits::eMeshEXT;
+      break;
+    }
+  }
+  return stages;
+}
+// Bindings of each set and the push constant range of all stages of a
+// pipeline. Sets without bindings between used sets are empty, runtime arrays
+// get runtime_array_count descriptors.
+struct reflected_layout {
+  std::vector<std::vector<vk::DescriptorSetLayoutBinding>> sets;
+  std::vector<vk::PushConstantRange> push_constant_ranges;
+};
+inline reflected_layout
+get_reflected_layout(std::span<const vulkan_helper::spirv_reflection> stages,
+                     uint32_t runtime_array_count = 1) {
+  reflected_layout layout{};
+  std::optional<vk::PushConstantRange> push_constant_range;
+  for (auto &stage : stages) {
+    auto stage_flags = get_shader_stage_flags(stage);
+    for (auto &binding : stage.descriptor_bindings) {
+      if (layout.sets.size() <= binding.set) {
+        layout.sets.resize(binding.set + 1);
+      }
+      auto &set = layout.sets[binding.set];
+      auto type = get_descriptor_type(binding.type);
+      auto count = binding.count == 0 ? runtime_array_count : binding.count;
+      auto it = std::ranges::find(set, binding.binding,
+                                  &vk::DescriptorSetLayoutBinding::binding);
+      if (it == set.end()) {
+        set.emplace_back(vk::DescriptorSetLayoutBinding{}
+                             .setBinding(binding.binding)
+                             .setDescriptorType(type)
+                             .setDescriptorCount(count)
+                             .setStageFlags(stage_flags));
+        continue;
+      }
+      if (it->descriptorType != type) {
+        throw std::runtime_error{
+            "stages disagree on the type of a descriptor binding"};
+      }
+      it->descriptorCount = std::max(it->descriptorCount, count);
+      it->stageFlags |= stage_flags;
+    }
+    if (auto &block = stage.push_constants) {
+      if (!push_constant_range) {
+        push_constant_range = vk::PushConstantRange{}
+                                  .setStageFlags(stage_flags)
+                                  .setOffset(block->offset)
+                                  .setSize(block->size);
+      } else {
+        auto end = std::max(push_constant_range->offset +
+                                push_constant_range->size,
+                            block->offset + block->size);
+        push_constant_range->offset =
+            std::min(push_constant_range->offset, block->offset);
+        push_constant_range->size = end - push_constant_range->offset;
+        push_constant_range->stageFlags |= stage_flags;
+      }
+    }
+  }
+  for (auto &set : layout.sets) {
+    std::ranges::sort(set, {}, &vk::DescriptorSetLayoutBinding::binding);
+  }
+  if (push_constant_range) {
+    layout.push_constant_ranges.push_back(*push_constant_range);
+  }
+  return layout;
+}
+// Reflections keyed by the code hash, so that shaders are parsed once per
+// process, or once at all with a file path. The file is written by save(),
+// each line starts with spirv_reflection_version and lines of another
+// version are dropped.
+class spirv_reflection_cache {
+public:
+  spirv_reflection_cache() = default;
+  explicit spirv_reflection_cache(std::filesystem::path path)
+      : m_path{std::move(path)} {
+    auto file = std::ifstream{m_path};
+    std::string line;
+    while (std::getline(file, line)) {
+      auto stream = std::istringstream{line};
+      uint32_t version;
+      uint64_t hash;
+      vulkan_helper::spirv_reflection reflection{};
+      if (stream >> std::hex >> version >> hash >> std::dec &&
+          version == vulkan_helper::spirv_reflection_version &&
+          read_reflection(stream, reflection)) {
+        m_reflections.emplace(hash, std::move(reflection));
+      }
+    }
+  }
+
+  vulkan_helper::spirv_reflection get(std::span<const uint32_t> code) {
+    return get(code, vulkan_helper::hash_spirv(code));
+  }
+  // content_hash has to be hash_spirv(code).
+  vulkan_helper::spirv_reflection get(std::span<const uint32_t> code,
+                                      uint64_t content_hash) {
+    {
+      std::lock_guard lock{m_mutex};
+      auto it = m_reflections.find(content_hash);
+      if (it != m_reflections.end()) {
+        return it->second;
+      }
+    }
+    auto reflection = vulkan_helper::reflect_spirv(code);
+    std::lock_guard lock{m_mutex};
+    m_reflections.emplace(content_hash, reflection);
+    return reflection;
+  }
+  void save() {
+    if (m_path.empty()) {
+      return;
+    }
+    auto stream = std::ostringstream{};
+    {
+      std::lock_guard lock{m_mutex};
+      for (auto &[hash, reflection] : m_reflections) {
+        stream << std::hex << vulkan_helper::spirv_reflection_version << ' '
+               << hash << std::dec;
+        write_reflection(stream, reflection);
+        stream << '\n';
+      }
+    }
+    auto data = stream.str();
+    write_file_atomically(m_path, data);
+  }
+
+private:
+  static void write_reflection(std::ostream &stream,
+                               const vulkan_helper::spirv_reflection &r) {
+    stream << ' ' << r.entry_points.size();
+    for (auto &entry_point : r.entry_points) {
+      stream << ' ' << entry_point.execution_model << ' '
+             << std::quoted(entry_point.name);
+    }
+    stream << ' ' << r.descriptor_bindings.size();
+    for (auto &binding : r.descriptor_bindings) {
+      stream << ' ' << binding.set << ' ' << binding.binding << ' '
+             << static_cast<uint32_t>(binding.type) << ' ' << binding.count;
+    }
+    stream << ' ' << r.push_constants.has_value();
+    if (r.push_constants) {
+      stream << ' ' << r.push_constants->offset << ' '
+             << r.push_constants->size;
+    }
+    for (auto size : r.workgroup_size) {
+      stream << ' ' << size;
+    }
+    for (auto id : r.workgroup_size_constant_ids) {
+      stream << ' ' << id.has_value() << ' ' << id.value_or(0);
+    }
+    stream << ' ' << r.specialization_constants.size();
+    for (auto &constant : r.specialization_constants) {
+      stream << ' ' << constant.constant_id << ' ' << constant.size;
+    }
+  }
+  static bool read_reflection(std::istream &stream,
+                              vulkan_helper::spirv_reflection &r) {
+    // a damaged line must not make the cache allocate a lot.
+    constexpr size_t max_count = 1 << 16;
+    size_t count;
+    if (!(stream >> count) || count > max_count) {
+      return false;
+    }
+    r.entry_points.resize(count);
+    for (auto &entry_point : r.entry_points) {
+      stream >> entry_point.execution_model >> std::quoted(entry_point.name);
+    }
+    if (!(stream >> count) || count > max_count) {
+      return false;
+    }
+    r.descriptor_bindings.resize(count);
+    for (auto &binding : r.descriptor_bindings) {
+      uint32_t type;
+      stream >> binding.set >> binding.binding >> type >> binding.count;
+      binding.type = static_cast<vulkan_helper::spirv_descriptor_type>(type);
+    }
+    bool has_push_constants;
+    if (stream >> has_push_constants && has_push_constants) {
+      r.push_constants.emplace();
+      stream >> r.push_constants->offset >> r.push_constants->size;
+    }
+    for (auto &size : r.workgroup_size) {
+      stream >> size;
+    }
+    for (auto &id : r.workgroup_size_constant_ids) {
+      bool has_id;
+      uint32_t value;
+      if (stream >> has_id >> value && has_id) {
+        id = value;
+      }
+    }
+    if (!(stream >> count) || count > max_count) {
+      return false;
+    }
+    r.specialization_constants.resize(count);
+    for (auto &constant : r.specialization_constants) {
+      stream >> constant.constant_id >> constant.size;
+    }
+    return static_cast<bool>(stream);
+  }
+
+  std::filesystem::path m_path;
+  std::mutex m_mutex;
+  std::map<uint64_t, vulkan_helper::spirv_reflection> m_reflections;
+};
+namespace hash_helper {
+inline uint64_t to_hash_value(std::integral auto value) {
+  return static_cast<uint64_t>(value);
+}
+inline uint64_t to_hash_value(float value) {
+  return std::bit_cast<uint32_t>(value);
+}
+template <class E>
+  requires std::is_enum_v<E>
+uint64_t to_hash_value(E value) {
+  return static_cast<uint64_t>(value);
+}
+template <class Bits> uint64_t to_hash_value(vk::Flags<Bits> value) {
+  return static_cast<typename vk::Flags<Bits>::MaskType>(value);
+}
+template <class Handle>
+  requires requires { typename Handle::CType; }
+uint64_t to_hash_value(Handle handle) {
+  return reinterpret_cast<uint64_t>(
+      static_cast<typename Handle::CType>(handle));
+}
+// Hashes the values and keeps them as the key, so that a cache compares the
+// key on a hit instead of trusting the 64-bit hash.
+class hasher {
+public:
+  hasher &add(const auto &...values) {
+    (add_value(to_hash_value(values)), ...);
+    return *this;
+  }
+  // hashes count, then every element through f(hasher&, element).
+  template <class E>
+  hasher &add_array(const E *elements, uint32_t count, auto &&f) {
+    add(count);
+    if (elements != nullptr) {
+      for (auto &element : std::span{elements, count}) {
+        f(*this, element);
+      }
+    }
+    return *this;
+  }
+  // the content of an object referenced by handle, its hash and whole key.
+  hasher &add_content(uint64_t hash, std::span<const uint64_t> key) {
+    add(hash, key.size());
+    m_key.insert(m_key.end(), key.begin(), key.end());
+    return *this;
+  }
+  hasher &add_bytes(const void *data, size_t size) {
+    add(vulkan_helper::hash_bytes(data, size), size);
+    auto bytes = static_cast<const char *>(data);
+    for (size_t offset = 0; offset < size; offset += sizeof(uint64_t)) {
+      uint64_t word = 0;
+      std::memcpy(&word, bytes + offset,
+                  std::min(sizeof(word), size - offset));
+      m_key.push_back(word);
+    }
+    return *this;
+  }
+  // e.g. an object the registry does not know, whose handle may be reused.
+  void mark_unshareable() { m_shareable = false; }
+  bool is_shareable() const { return m_shareable; }
+  uint64_t get() const { return m_hash; }
+  const std::vector<uint64_t> &get_key() const { return m_key; }
+
+private:
+  void add_value(uint64_t value) {
+    m_hash = vulkan_helper::hash_combine(m_hash, value);
+    m_key.push_back(value);
+  }
+
+  uint64_t m_hash = 0;
+  std::vector<uint64_t> m_key;
+  bool m_shareable = true;
+};
+} // namespace hash_helper
+
+// Device wide cache of immutable objects keyed by their create info, a hit
+// compares the whole key and not only its hash. Identical requests get the
+// same object, which lives as long as one of the returned shared_ptrs does.
+// Shader modules and render passes are keyed by content through
+// register_shader_module() and register_render_pass(), so pipelines built from
+// equal code in compatible render passes are shared too. Create infos with a
+// pNext chain, or referencing an object neither created nor registered here,
+// are never shared: the chain is not hashed and the handle may be reused once
+// the object is destroyed.
+class pipeline_registry
+    : public std::enable_shared_from_this<pipeline_registry> {
+public:
+  // a preload started by preload_shader_modules(), keyed by its normal path.
+  struct shader_preload {
+    std::filesystem::path path;
+    std::shared_future<std::shared_ptr<const vk::ShaderModule>> module;
+  };
+
+  explicit pipeline_registry(vk::Device device) : m_device{device} {}
+  // the registry lives as long as an object from it or a reference to it, all
+  // of them have to be released before the device is destroyed.
+  ~pipeline_registry() {
+    for (auto &retained : m_retained_shader_modules) {
+      m_device.destroy(retained.module);
+    }
+  }
+  pipeline_registry(const pipeline_registry &) = delete;
+  pipeline_registry &operator=(const pipeline_registry &) = delete;
+
+  static std::shared_ptr<pipeline_registry> for_device(vk::Device device) {
+    static std::mutex mutex;
+    static std::map<VkDevice, std::weak_ptr<pipeline_registry>> registries;
+    std::lock_guard lock{mutex};
+    std::erase_if(registries,
+                  [](auto &registry) { return registry.second.expired(); });
+    auto &registry = registries[static_cast<VkDevice>(device)];
+    auto shared = registry.lock();
+    if (!shared) {
+      shared = std::make_shared<pipeline_registry>(device);
+      registry = shared;
+    }
+    return shared;
+  }
+
+  void register_shader_module(vk::ShaderModule module,
+                              std::span<const uint32_t> code) {
+    set_content_hash(module, vulkan_helper::hash_spirv(code),
+                     get_code_key(code));
+  }
+  void unregister_shader_module(vk::ShaderModule module) {
+    erase_content_hash(module);
+  }
+  // one module per distinct code, so stacks and files loading the same shader
+  // share it. A module is destroyed with its last reference unless it is
+  // retained for later loads, see set_shader_module_retention().
+  std::shared_ptr<const vk::ShaderModule>
+  get_shader_module(std::span<const uint32_t> code) {
+    return get_shader_module(code, vulkan_helper::hash_spirv(code));
+  }
+  // content_hash has to be hash_spirv(code), e.g. from a spirv archive.
+  std::shared_ptr<const vk::ShaderModule>
+  get_shader_module(std::span<const uint32_t> code, uint64_t content_hash) {
+    auto key = get_code_key(code);
+    return get_shared(m_shader_modules, content_hash, key,
+                      [this, code, content_hash, &key]() {
+                        if (auto module =
+                                take_retained_shader_module(content_hash, key)) {
+                          return *module;
+                        }
+                        return m_device.createShaderModule(
+                            vk::ShaderModuleCreateInfo{}.setCode(code));
+                      });
+  }
+  // keep up to count of the most recently unused modules for later loads.
+  // The registry owns them, they are destroyed with it, so the setting lasts
+  // as long as a reference to the registry is kept.
+  void set_shader_module_retention(size_t count) {
+    std::vector<vk::ShaderModule> evicted;
+    {
+      std::lock_guard lock{m_mutex};
+      m_shader_module_retention = count;
+      evict_shader_modules_locked(count, evicted);
+    }
+    destroy_shader_modules(evicted);
+  }
+  void evict_shader_modules() {
+    std::vector<vk::ShaderModule> evicted;
+    {
+      std::lock_guard lock{m_mutex};
+      evict_shader_modules_locked(0, evicted);
+    }
+    destroy_shader_modules(evicted);
+  }
+  // Reads, hashes and creates the modules of the files on pool, so that the
+  // stacks built afterwards only pick them up through
+  // find_preloaded_shader_module(). Creating shader modules is thread safe.
+  // With strip the code is stripped before it is hashed, as
+  // add_stripped_spirv_code does, so both find the same module.
+  // The modules stay alive, and keep the registry alive, until
+  // release_preloaded_shader_modules() of the returned preloads. Returns the
+  // preloads this call started, paths already preloaded are skipped; the
+  // caller waits for them before the device is destroyed, and not on a worker
+  // of pool.
+  std::vector<shader_preload>
+  preload_shader_modules(std::span<const std::filesystem::path> paths,
+                         vulkan_helper::thread_pool &pool, bool strip = false) {
+    std::vector<shader_preload> started;
+    std::lock_guard lock{m_mutex};
+    for (auto &path : paths) {
+      auto key = get_preload_key(path);
+      if (m_preloaded_shader_modules.contains(key)) {
+        continue;
+      }
+      auto module =
+          pool.submit([registry = shared_from_this(), key, strip]() {
+                vulkan_helper::spirv_file file{
+                    key, vulkan_helper::mapped_file_options{.populate = true}};
+                if (strip) {
+                  return registry->get_shader_module(
+                      vulkan_helper::strip_spirv(file.get_code()));
+                }
+                return registry->get_shader_module(file.get_code());
+              })
+              .share();
+      m_preloaded_shader_modules.emplace(
+          key, preloaded_shader_module{module, &pool, strip});
+      started.push_back(shader_preload{key, std::move(module)});
+    }
+    return started;
+  }
+  // waits for the preload of path, returns nullptr if path was not preloaded
+  // with the same stripping or failed to load, so that the caller loads it
+  // itself. On a worker of the preloading pool an unfinished preload is not
+  // waited for, it may be queued behind the caller.
+  std::shared_ptr<const vk::ShaderModule>
+  find_preloaded_shader_module(const std::filesystem::path &path,
+                               bool stripped = false) {
+    preloaded_shader_module preloaded;
+    {
+      std::lock_guard lock{m_mutex};
+      auto it = m_preloaded_shader_modules.find(get_preload_key(path));
+      if (it == m_preloaded_shader_modules.end() ||
+          it->second.stripped != stripped) {
+        return nullptr;
+      }
+      preloaded = it->second;
+    }
+    if (preloaded.pool->is_worker_thread() &&
+        preloaded.module.wait_for(std::chrono::seconds{0}) !=
+            std::future_status::ready) {
+      return nullptr;
+    }
+    try {
+      return preloaded.module.get();
+    } catch (...) {
+      return nullptr;
+    }
+  }
+  // releases the given preloads only, the ones of other stacks stay.
+  void release_preloaded_shader_modules(
+      std::span<const shader_preload> preloads) {
+    std::vector<preloaded_shader_module> released;
+    {
+      std::lock_guard lock{m_mutex};
+      for (auto &preload : preloads) {
+        auto node = m_preloaded_shader_modules.extract(preload.path);
+        if (node) {
+          released.push_back(std::move(node.mapped()));
+        }
+      }
+    }
+    // released unlocked, the deleter locks the registry.
+  }
+  // render pass compatibility only depends on the format and sample count of
+  // the attachments each subpass references, so only those are hashed.
+  void register_render_pass(vk::RenderPass render_pass,
+                            const vk::RenderPassCreateInfo &info) {
+    auto attachments = std::span{info.pAttachments, info.attachmentCount};
+    auto add_reference = [attachments](hash_helper::hasher &h,
+                                       const vk::AttachmentReference &ref) {
+      if (ref.attachment == VK_ATTACHMENT_UNUSED) {
+        h.add(ref.attachment);
+      } else {
+        h.add(attachments[ref.attachment].format,
+              attachments[ref.attachment].samples);
+      }
+    };
+    hash_helper::hasher h{};
+    h.add_array(info.pSubpasses, info.subpassCount,
+                [&add_reference](auto &h, const vk::SubpassDescription &subpass) {
+                  h.add(subpass.pipelineBindPoint);
+                  h.add_array(subpass.pInputAttachments,
+                              subpass.inputAttachmentCount, add_reference);
+                  h.add_array(subpass.pColorAttachments,
+                              subpass.colorAttachmentCount, add_reference);
+                  h.add_array(subpass.pResolveAttachments,
+                              subpass.pResolveAttachments != nullptr
+                                  ? subpass.colorAttachmentCount
+                                  : 0,
+                              add_reference);
+                  h.add_array(subpass.pDepthStencilAttachment,
+                              subpass.pDepthStencilAttachment != nullptr, add_reference);
+                });
+    set_content_hash(render_pass, h.get(), h.get_key());
+  }
+  void unregister_render_pass(vk::RenderPass render_pass) {
+    erase_content_hash(render_pass);
+  }
+  // feedback of every pipeline and library this registry created.
+  pipeline_creation_stats &get_creation_stats() { return m_creation_stats; }
+
+  // set layouts and pipeline layout for the reflected stages of a pipeline,
+  // shared with every pipeline using the same interface.
+  struct reflected_pipeline_layout {
+    std::vector<std::shared_ptr<const vk::DescriptorSetLayout>> set_layouts;
+    std::vector<vk::PushConstantRange> push_constant_ranges;
+    std::shared_ptr<const vk::PipelineLayout> pipeline_layout;
+
+    std::vector<vk::DescriptorSetLayout> get_set_layouts() const {
+      std::vector<vk::DescriptorSetLayout> handles;
+      for (auto &layout : set_layouts) {
+        handles.push_back(*layout);
+      }
+      return handles;
+    }
+  };
+  reflected_pipeline_layout get_reflected_pipeline_layout(
+      std::span<const vulkan_helper::spirv_reflection> stages,
+      uint32_t runtime_array_count = 1) {
+    auto layout = get_reflected_layout(stages, runtime_array_count);
+    reflected_pipeline_layout result{};
+    for (auto &bindings : layout.sets) {
+      result.set_layouts.push_back(get_descriptor_set_layout(
+          vk::DescriptorSetLayoutCreateInfo{}.setBindings(bindings)));
+    }
+    result.push_constant_ranges = std::move(layout.push_constant_ranges);
+    auto set_layouts = result.get_set_layouts();
+    result.pipeline_layout = get_pipeline_layout(
+        vk::PipelineLayoutCreateInfo{}
+            .setSetLayouts(set_layouts)
+            .setPushConstantRanges(result.push_constant_ranges));
+    return result;
+  }
+
+  std::shared_ptr<const vk::DescriptorSetLayout>
+  get_descriptor_set_layout(const vk::DescriptorSetLayoutCreateInfo &info) {
+    if (info.pNext != nullptr) {
+      return get_unshared(m_device.createDescriptorSetLayout(info));
+    }
+    hash_helper::hasher h{};
+    h.add(info.flags).add_array(
+        info.pBindings, info.bindingCount,
+        [](auto &h, const vk::DescriptorSetLayoutBinding &binding) {
+          h.add(binding.binding, binding.descriptorType,
+                binding.descriptorCount, binding.stageFlags);
+          h.add_array(binding.pImmutableSamplers,
+                      binding.pImmutableSamplers != nullptr
+                          ? binding.descriptorCount
+                          : 0,
+                      [](auto &h, vk::Sampler sampler) { h.add(sampler); });
+        });
+    return get_shared(m_descriptor_set_layouts, h, [this, &info]() {
+      return m_device.createDescriptorSetLayout(info);
+    });
+  }
+  std::shared_ptr<const vk::PipelineLayout>
+  get_pipeline_layout(const vk::PipelineLayoutCreateInfo &info) {
+    if (info.pNext != nullptr) {
+      return get_unshared(m_device.createPipelineLayout(info));
+    }
+    hash_helper::hasher h{};
+    h.add(info.flags);
+    h.add_array(info.pSetLayouts, info.setLayoutCount,
+                [this](auto &h, vk::DescriptorSetLayout layout) {
+                  add_content_hash(h, layout);
+                });
+    h.add_array(info.pPushConstantRanges, info.pushConstantRangeCount,
+                [](auto &h, const vk::PushConstantRange &range) {
+                  h.add(range.stageFlags, range.offset, range.size);
+                });
+    return get_shared(m_pipeline_layouts, h, [this, &info]() {
+      return m_device.createPipelineLayout(info);
+    });
+  }
+  std::shared_ptr<const vk::Pipeline>
+  get_graphics_pipeline(const graphics_pipeline_state &state) {
+    auto h = hash_graphics_pipeline_state(state);
+    if (!h.is_shareable()) {
+      return get_unshared(
+          create_graphics_pipeline(m_device, state, &m_creation_stats));
+    }
+    return get_shared(m_pipelines, h, [this, &state, &h]() {
+      return create_graphics_pipeline(m_device, state, &m_creation_stats,
+                                      h.get());
+    });
+  }
+  // one part of a graphics pipeline, shared by every state that agrees on the
+  // state this part consumes.
+  std::shared_ptr<const vk::Pipeline>
+  get_pipeline_library(vk::GraphicsPipelineLibraryFlagBitsEXT part,
+                       const graphics_pipeline_state &state) {
+    auto h = hash_pipeline_library(part, state);
+    if (!h.is_shareable()) {
+      return get_unshared(
+          create_pipeline_library(m_device, part, state, &m_creation_stats));
+    }
+    return get_shared(m_pipelines, h, [this, part, &state, &h]() {
+      return create_pipeline_library(m_device, part, state, &m_creation_stats,
+                                     h.get());
+    });
+  }
+  // the pipeline linked from the libraries of state, it keeps them alive.
+  std::shared_ptr<const vk::Pipeline>
+  get_linked_graphics_pipeline(const graphics_pipeline_state &state,
+                               bool optimize) {
+    std::vector<std::shared_ptr<const vk::Pipeline>> libraries;
+    std::vector<vk::Pipeline> library_handles;
+    for (auto part : graphics_pipeline_library_parts) {
+      libraries.push_back(get_pipeline_library(part, state));
+      library_handles.push_back(*libraries.back());
+    }
+    auto h = hash_graphics_pipeline_state(state);
+    h.add(optimize ? 2 : 1);
+    auto key = h.is_shareable() ? h.get() : 0;
+    auto link = [this, &state, &library_handles, optimize, key]() {
+      return link_graphics_pipeline(m_device, state.pipeline_layout,
+                                    library_handles, optimize,
+                                    state.pipeline_cache, &m_creation_stats,
+                                    key);
+    };
+    if (!h.is_shareable()) {
+      return get_unshared(link(), std::move(libraries));
+    }
+    return get_shared(m_pipelines, h, link, std::move(libraries));
+  }
+
+private:
+  template <class Handle> struct cached_object {
+    std::vector<uint64_t> key;
+    std::weak_ptr<const Handle> object;
+  };
+  template <class Handle> using object_map =
+      std::map<uint64_t, cached_object<Handle>>;
+
+  template <class Handle>
+  static auto content_key(Handle handle) {
+    return std::pair{Handle::objectType, hash_helper::to_hash_value(handle)};
+  }
+  // objects referencing the content compare the whole key on a hash hit.
+  struct content_hash {
+    uint64_t hash;
+    std::vector<uint64_t> key;
+  };
+  template <class Handle>
+  void set_content_hash(Handle handle, uint64_t hash,
+                        std::vector<uint64_t> key) {
+    std::lock_guard lock{m_mutex};
+    m_content_hashes[content_key(handle)] = content_hash{hash, std::move(key)};
+  }
+  template <class Handle> void erase_content_hash(Handle handle) {
+    std::lock_guard lock{m_mutex};
+    m_content_hashes.erase(content_key(handle));
+  }
+  // an object created elsewhere makes h unshareable, nothing tells the
+  // registry when it is destroyed and its handle reused.
+  template <class Handle>
+  void add_content_hash(hash_helper::hasher &h, Handle handle) {
+    if (!handle) {
+      h.add(Handle::objectType, handle);
+      return;
+    }
+    std::lock_guard lock{m_mutex};
+    auto it = m_content_hashes.find(content_key(handle));
+    if (it == m_content_hashes.end()) {
+      h.mark_unshareable();
+      return;
+    }
+    h.add_content(it->second.hash, it->second.key);
+  }
+  // two code words per key word.
+  static std::vector<uint64_t> get_code_key(std::span<const uint32_t> code) {
+    std::vector<uint64_t> key((code.size() + 1) / 2);
+    std::memcpy(key.data(), code.data(), code.size_bytes());
+    key.push_back(code.size());
+    return key;
+  }
+
+  // dependencies are kept alive as long as the object, e.g. the libraries of
+  // a linked pipeline.
+  using dependency_list = std::vector<std::shared_ptr<const vk::Pipeline>>;
+  template <class Handle>
+  std::shared_ptr<const Handle> get_unshared(Handle handle,
+                                             dependency_list dependencies = {}) {
+    std::lock_guard lock{m_mutex};
+    return get_unshared_locked(handle, std::move(dependencies));
+  }
+  // the object gets a content hash that is never reused, so objects
+  // referencing it are shared only while it is alive.
+  template <class Handle>
+  std::shared_ptr<const Handle>
+  get_unshared_locked(Handle handle, dependency_list dependencies) {
+    auto id = m_next_unshared_id++;
+    m_content_hashes[content_key(handle)] = content_hash{
+        vulkan_helper::hash_combine(static_cast<uint64_t>(Handle::objectType),
+                                    id),
+        {static_cast<uint64_t>(Handle::objectType), id}};
+    return std::shared_ptr<const Handle>{
+        new Handle{handle},
+        [registry = weak_from_this(), device = m_device,
+         dependencies = std::move(dependencies)](const Handle *handle) {
+          if (auto shared = registry.lock()) {
+            std::lock_guard lock{shared->m_mutex};
+            shared->erase_content_hash_locked(*handle);
+          }
+          device.destroy(*handle);
+          delete handle;
+        }};
+  }
+  template <class Handle>
+  std::shared_ptr<const Handle> get_shared(object_map<Handle> &objects,
+                                           const hash_helper::hasher &h,
+                                           auto &&create,
+                                           dependency_list dependencies = {}) {
+    return get_shared(objects, h.get(), h.get_key(), create,
+                      std::move(dependencies));
+  }
+  template <class Handle>
+  std::shared_ptr<const Handle> get_shared(object_map<Handle> &objects,
+                                           uint64_t hash,
+                                           const std::vector<uint64_t> &key,
+                                           auto &&create,
+                                           dependency_list dependencies = {}) {
+    {
+      std::lock_guard lock{m_mutex};
+      auto it = objects.find(hash);
+      if (it != objects.end() && it->second.key == key) {
+        if (auto object = it->second.object.lock()) {
+          return object;
+        }
+      }
+    }
+    // create unlocked so that workers compiling different pipelines do not
+    // wait on each other, a racing duplicate is dropped below.
+    auto handle = create();
+    std::lock_guard lock{m_mutex};
+    auto &entry = objects[hash];
+    if (auto object = entry.object.lock()) {
+      if (entry.key == key) {
+        m_device.destroy(handle);
+        return object;
+      }
+      // a different key with the same hash keeps the entry.
+      return get_unshared_locked(handle, std::move(dependencies));
+    }
+    std::shared_ptr<const Handle> object{
+        new Handle{handle},
+        [registry = shared_from_this(), &objects, hash,
+         dependencies = std::move(dependencies)](const Handle *handle) {
+          std::vector<Handle> destroyed{*handle};
+          {
+            std::lock_guard lock{registry->m_mutex};
+            auto it = objects.find(hash);
+            if (it != objects.end() && it->second.object.expired()) {
+              if constexpr (std::same_as<Handle, vk::ShaderModule>) {
+                if (registry->m_shader_module_retention > 0) {
+                  registry->m_retained_shader_modules.emplace_back(
+                      hash, std::move(it->second.key), *handle);
+                  destroyed.clear();
+                  registry->evict_shader_modules_locked(
+                      registry->m_shader_module_retention, destroyed);
+                }
+              }
+              objects.erase(it);
+            }
+            registry->erase_content_hash_locked(*handle);
+          }
+          for (auto destroyed_handle : destroyed) {
+            registry->m_device.destroy(destroyed_handle);
+          }
+          delete handle;
+        }};
+    entry = cached_object<Handle>{key, object};
+    m_content_hashes[content_key(handle)] = content_hash{hash, key};
+    return object;
+  }
+  template <class Handle> void erase_content_hash_locked(Handle handle) {
+    m_content_hashes.erase(content_key(handle));
+  }
+  // evicted has to be destroyed after m_mutex is released.
+  void evict_shader_modules_locked(size_t count,
+                                   std::vector<vk::ShaderModule> &evicted) {
+    while (m_retained_shader_modules.size() > count) {
+      evicted.push_back(m_retained_shader_modules.front().module);
+      m_retained_shader_modules.pop_front();
+    }
+  }
+  void destroy_shader_modules(std::span<const vk::ShaderModule> modules) {
+    for (auto module : modules) {
+      m_device.destroy(module);
+    }
+  }
+  std::optional<vk::ShaderModule>
+  take_retained_shader_module(uint64_t hash, const std::vector<uint64_t> &key) {
+    std::lock_guard lock{m_mutex};
+    auto it = std::ranges::find_if(
+        m_retained_shader_modules, [hash, &key](auto &retained) {
+          return retained.hash == hash && retained.key == key;
+        });
+    if (it == m_retained_shader_modules.end()) {
+      return std::nullopt;
+    }
+    auto module = it->module;
+    m_retained_shader_modules.erase(it);
+    return module;
+  }
+
+  static bool is_shareable(const graphics_pipeline_state &state) {
+    const void *chains[] = {
+        state.color_blend_state.pNext,   state.depth_stencil_state.pNext,
+        state.dynamic_state.pNext,       state.input_assembly_state.pNext,
+        state.multisample_state.pNext,   state.rasterization_state.pNext,
+        state.tessellation_state.pNext,  state.vertex_input_state.pNext,
+        state.viewport_state.pNext,
+    };
+    return std::ranges::none_of(chains, [](auto p) { return p != nullptr; }) &&
+           std::ranges::all_of(state.stages, [](auto &stage) {
+             return stage.pNext == nullptr ||
+                    get_inline_shader_code(stage).has_value();
+           });
+  }
+  // the code of a stage that chains its VkShaderModuleCreateInfo instead of
+  // naming a module (VK_KHR_maintenance5), if nothing else is chained.
+  static std::optional<std::span<const uint32_t>>
+  get_inline_shader_code(const vk::PipelineShaderStageCreateInfo &stage) {
+    auto info = static_cast<const vk::ShaderModuleCreateInfo *>(stage.pNext);
+    if (stage.module || info == nullptr ||
+        info->sType != vk::StructureType::eShaderModuleCreateInfo ||
+        info->pNext != nullptr) {
+      return std::nullopt;
+    }
+    return std::span{info->pCode, info->codeSize / 4};
+  }
+  hash_helper::hasher
+  hash_graphics_pipeline_state(const graphics_pipeline_state &state) {
+    hash_helper::hasher h{};
+    if (!is_shareable(state)) {
+      h.mark_unshareable();
+      return h;
+    }
+    hash_vertex_input(h, state);
+    hash_pre_rasterization(h, state);
+    hash_fragment_shader(h, state);
+    hash_fragment_output(h, state);
+    hash_dynamic(h, state);
+    return h;
+  }
+  hash_helper::hasher
+  hash_pipeline_library(vk::GraphicsPipelineLibraryFlagBitsEXT part,
+                        const graphics_pipeline_state &state) {
+    hash_helper::hasher h{};
+    if (!is_shareable(state)) {
+      h.mark_unshareable();
+      return h;
+    }
+    h.add(part);
+    switch (part) {
+    case vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface:
+      hash_vertex_input(h, state);
+      break;
+    case vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders:
+      hash_pre_rasterization(h, state);
+      break;
+    case vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader:
+      hash_fragment_shader(h, state);
+      break;
+    case vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface:
+      hash_fragment_output(h, state);
+      break;
+    }
+    hash_dynamic(h, state);
+    return h;
+  }
+  void hash_stages(hash_helper::hasher &h, const graphics_pipeline_state &state,
+                   bool fragment) {
+    for (auto &stage : state.stages) {
+      if ((stage.stage == vk::ShaderStageFlagBits::eFragment) != fragment) {
+        continue;
+      }
+      // inline code hashes like a module of that code, so both share.
+      auto code = get_inline_shader_code(stage);
+      h.add(stage.flags, stage.stage);
+      if (code) {
+        h.add(vulkan_helper::hash_spirv(*code));
+      } else {
+        add_content_hash(h, stage.module);
+      }
+      h.add_bytes(stage.pName, std::strlen(stage.pName));
+      h.add(stage.pSpecializationInfo != nullptr);
+      if (auto info = stage.pSpecializationInfo) {
+        h.add_array(info->pMapEntries, info->mapEntryCount,
+                    [](auto &h, const vk::SpecializationMapEntry &entry) {
+                      h.add(entry.constantID, entry.offset, entry.size);
+                    });
+        h.add_bytes(info->pData, info->dataSize);
+      }
+    }
+  }
+  void hash_vertex_input(hash_helper::hasher &h,
+                         const graphics_pipeline_state &state) {
+    auto &vertex_input = state.vertex_input_state;
+    h.add(vertex_input.flags);
+    h.add_array(vertex_input.pVertexBindingDescriptions,
+                vertex_input.vertexBindingDescriptionCount,
+                [](auto &h, const vk::VertexInputBindingDescription &binding) {
+                  h.add(binding.binding, binding.stride, binding.inputRate);
+                });
+    h.add_array(vertex_input.pVertexAttributeDescriptions,
+                vertex_input.vertexAttributeDescriptionCount,
+                [](auto &h, const vk::VertexInputAttributeDescription &attribute) {
+                  h.add(attribute.location, attribute.binding, attribute.format,
+                        attribute.offset);
+                });
+    auto &input_assembly = state.input_assembly_state;
+    h.add(input_assembly.flags, input_assembly.topology,
+          input_assembly.primitiveRestartEnable);
+  }
+  void hash_rendering(hash_helper::hasher &h,
+                      const graphics_pipeline_state &state) {
+    add_content_hash(h, state.render_pass);
+    h.add(state.subpass, state.dynamic_rendering);
+    h.add_array(state.color_attachment_formats.data(),
+                static_cast<uint32_t>(state.color_attachment_formats.size()),
+                [](auto &h, vk::Format format) { h.add(format); });
+    h.add(state.depth_attachment_format, state.stencil_attachment_format);
+  }
+  void hash_pre_rasterization(hash_helper::hasher &h,
+                              const graphics_pipeline_state &state) {
+    add_content_hash(h, state.pipeline_layout);
+    hash_rendering(h, state);
+    hash_stages(h, state, false);
+    h.add(state.tessellation_state.flags,
+          state.tessellation_state.patchControlPoints);
+    auto &viewport = state.viewport_state;
+    h.add(viewport.flags);
+    h.add_array(viewport.pViewports,
+                viewport.pViewports != nullptr ? viewport.viewportCount : 0,
+                [](auto &h, const vk::Viewport &v) {
+                  h.add(v.x, v.y, v.width, v.height, v.minDepth, v.maxDepth);
+                });
+    h.add_array(viewport.pScissors,
+                viewport.pScissors != nullptr ? viewport.scissorCount : 0,
+                [](auto &h, const vk::Rect2D &r) {
+                  h.add(r.offset.x, r.offset.y, r.extent.width, r.extent.height);
+                });
+    h.add(viewport.viewportCount, viewport.scissorCount);
+    auto &rasterization = state.rasterization_state;
+    h.add(rasterization.flags, rasterization.depthClampEnable,
+          rasterization.rasterizerDiscardEnable, rasterization.polygonMode,
+          rasterization.cullMode, rasterization.frontFace,
+          rasterization.depthBiasEnable, rasterization.depthBiasConstantFactor,
+          rasterization.depthBiasClamp, rasterization.depthBiasSlopeFactor,
+          rasterization.lineWidth);
+  }
+  void hash_fragment_shader(hash_helper::hasher &h,
+                            const graphics_pipeline_state &state) {
+    add_content_hash(h, state.pipeline_layout);
+    hash_rendering(h, state);
+    hash_stages(h, state, true);
+    hash_multisample(h, state);
+    auto &depth_stencil = state.depth_stencil_state;
+    auto add_stencil = [&h](const vk::StencilOpState &op) {
+      h.add(op.failOp, op.passOp, op.depthFailOp, op.compareOp, op.compareMask,
+            op.writeMask, op.reference);
+    };
+    h.add(depth_stencil.flags, depth_stencil.depthTestEnable,
+          depth_stencil.depthWriteEnable, depth_stencil.depthCompareOp,
+          depth_stencil.depthBoundsTestEnable, depth_stencil.stencilTestEnable,
+          depth_stencil.minDepthBounds, depth_stencil.maxDepthBounds);
+    add_stencil(depth_stencil.front);
+    add_stencil(depth_stencil.back);
+  }
+  void hash_fragment_output(hash_helper::hasher &h,
+                            const graphics_pipeline_state &state) {
+    hash_rendering(h, state);
+    hash_multisample(h, state);
+    auto &color_blend = state.color_blend_state;
+    h.add(color_blend.flags, color_blend.logicOpEnable, color_blend.logicOp);
+    h.add_array(color_blend.pAttachments, color_blend.attachmentCount,
+                [](auto &h, const vk::PipelineColorBlendAttachmentState &a) {
+                  h.add(a.blendEnable, a.srcColorBlendFactor,
+                        a.dstColorBlendFactor, a.colorBlendOp,
+                        a.srcAlphaBlendFactor, a.dstAlphaBlendFactor,
+                        a.alphaBlendOp, a.colorWriteMask);
+                });
+    for (float constant : color_blend.blendConstants) {
+      h.add(constant);
+    }
+  }
+  void hash_multisample(hash_helper::hasher &h,
+                        const graphics_pipeline_state &state) {
+    auto &multisample = state.multisample_state;
+    h.add(multisample.flags, multisample.rasterizationSamples,
+          multisample.sampleShadingEnable, multisample.minSampleShading,
+          multisample.alphaToCoverageEnable, multisample.alphaToOneEnable);
+    h.add_array(multisample.pSampleMask,
+                multisample.pSampleMask != nullptr
+                    ? (static_cast<uint32_t>(multisample.rasterizationSamples) + 31) / 32
+                    : 0,
+                [](auto &h, vk::SampleMask mask) { h.add(mask); });
+  }
+  void hash_dynamic(hash_helper::hasher &h,
+                    const graphics_pipeline_state &state) {
+    auto &dynamic = state.dynamic_state;
+    h.add(dynamic.flags);
+    h.add_array(dynamic.pDynamicStates, dynamic.dynamicStateCount,
+                [](auto &h, vk::DynamicState s) { h.add(s); });
+  }
+
+  static std::filesystem::path
+  get_preload_key(const std::filesystem::path &path) {
+    return std::filesystem::absolute(path).lexically_normal();
+  }
+
+  vk::Device m_device;
+  std::mutex m_mutex;
+  std::map<std::pair<vk::ObjectType, uint64_t>, content_hash> m_content_hashes;
+  uint64_t m_next_unshared_id = 0;
+  object_map<vk::ShaderModule> m_shader_modules;
+  // unused modules, least recently used first.
+  struct retained_shader_module {
+    uint64_t hash;
+    std::vector<uint64_t> key;
+    vk::ShaderModule module;
+  };
+  std::deque<retained_shader_module> m_retained_shader_modules;
+  size_t m_shader_module_retention = 0;
+  struct preloaded_shader_module {
+    std::shared_future<std::shared_ptr<const vk::ShaderModule>> module;
+    vulkan_helper::thread_pool *pool;
+    bool stripped;
+  };
+  std::map<std::filesystem::path, preloaded_shader_module>
+      m_preloaded_shader_modules;
+  object_map<vk::DescriptorSetLayout> m_descriptor_set_layouts;
+  object_map<vk::PipelineLayout> m_pipeline_layouts;
+  object_map<vk::Pipeline> m_pipelines;
+  pipeline_creation_stats m_creation_stats;
+};
+template <class T> class add_graphics_pipeline : public T {
+public:
+  using parent = T;
+  add_graphics_pipeline(const configure auto& conf) : parent{conf} { create_pipeline(); }
+  ~add_graphics_pipeline() { destroy_pipeline(); }
+  void create_pipeline() {
+      create();
+  }
+  void destroy_pipeline() {
+      destroy();
+  }
+  // stacks with identical state share one pipeline through the registry.
+  void create() {
+    vk::Device device = parent::get_device();
+    m_pipeline = pipeline_registry::for_device(device)->get_graphics_pipeline(
+        get_graphics_pipeline_state(static_cast<parent &>(*this)));
+  }
+  void destroy() { m_pipeline.reset(); }
+  auto get_pipeline() { return *m_pipeline; }
+
+private:
+  std::shared_ptr<const vk::Pipeline> m_pipeline;
+};
+template <typename T>
+concept thread_pool_gettable = requires(T t) { t.get_thread_pool(); };
+template <class T> class add_thread_pool : public T {
+public:
+  using parent = T;
+  add_thread_pool(const configure auto& conf) : parent{conf} {}
+  auto& get_thread_pool() { return m_thread_pool; }
+
+private:
+  vulkan_helper::thread_pool m_thread_pool;
+};
+// Same as add_graphics_pipeline, but the pipeline is compiled on
+// parent::get_thread_pool() and get_pipeline() waits for it. Stacks sharing
+// one pool and one pipeline cache compile concurrently, a cache created
+// without the externally synchronized flag is safe to use that way.
+template <class T> class add_async_graphics_pipeline : public T {
+public:
+  using parent = T;
+  add_async_graphics_pipeline(const configure auto& conf) : parent{conf} {
+    create_pipeline();
+  }
+  ~add_async_graphics_pipeline() { destroy_pipeline(); }
+  void create_pipeline() {
+      create();
+  }
+  void destroy_pipeline() {
+      destroy();
+  }
+  void create() {
+    vk::Device device = parent::get_device();
+    auto registry = pipeline_registry::for_device(device);
+    auto state = std::make_shared<graphics_pipeline_state>(
+        get_graphics_pipeline_state(static_cast<parent &>(*this)));
+    m_pipeline = parent::get_thread_pool()
+                     .submit([registry, state]() {
+                       return registry->get_graphics_pipeline(*state);
+                     })
+                     .share();
+  }
+  void destroy() {
+    if (!m_pipeline.valid()) {
+      return;
+    }
+    // the worker reads state owned by this stack, so let it finish first.
+    m_pipeline.wait();
+    m_pipeline = {};
+  }
+  bool is_pipeline_ready() {
+    return m_pipeline.wait_for(std::chrono::seconds{0}) ==
+           std::future_status::ready;
+  }
+  auto get_pipeline() { return *m_pipeline.get(); }
+
+private:
+  std::shared_future<std::shared_ptr<const vk::Pipeline>> m_pipeline;
+};
+template <class T> class add_graphics_pipeline_library_extension : public T {
+public:
+  using parent = T;
+  add_graphics_pipeline_library_extension(const configure auto& conf)
+      : parent{conf} {}
+  auto get_extensions() {
+    auto ext = parent::get_extensions();
+    ext.emplace_back(vk::KHRPipelineLibraryExtensionName);
+    ext.emplace_back(vk::EXTGraphicsPipelineLibraryExtensionName);
+    return ext;
+  }
+};
+// Same state as add_graphics_pipeline, built as the four
+// VK_EXT_graphics_pipeline_library parts. Parts are cached in the registry,
+// so a stack that differs in one part only compiles that part, and the parts
+// are linked without optimization, which is cheap. With a thread pool in the
+// stack an optimized link is made there and get_pipeline() switches to it
+// once ready, the fast link stays alive for commands recorded with it.
+// Needs the graphicsPipelineLibrary feature.
+template <class T> class add_linked_graphics_pipeline : public T {
+public:
+  using parent = T;
+  add_linked_graphics_pipeline(const configure auto& conf) : parent{conf} {
+    create_pipeline();
+  }
+  ~add_linked_graphics_pipeline() { destroy_pipeline(); }
+  void create_pipeline() {
+      create();
+  }
+  void destroy_pipeline() {
+      destroy();
+  }
+  void create() {
+    vk::Device device = parent::get_device();
+    auto registry = pipeline_registry::for_device(device);
+    auto state = std::make_shared<graphics_pipeline_state>(
+        get_graphics_pipeline_state(static_cast<parent &>(*this)));
+    m_fast_pipeline = registry->get_linked_graphics_pipeline(*state, false);
+    if constexpr (thread_pool_gettable<parent>) {
+      m_optimized_pipeline =
+          parent::get_thread_pool()
+              .submit([registry, state]() {
+                return registry->get_linked_graphics_pipeline(*state, true);
+              })
+              .share();
+    }
+  }
+  void destroy() {
+    if (m_optimized_pipeline.valid()) {
+      m_optimized_pipeline.wait();
+      m_optimized_pipeline = {};
+    }
+    m_fast_pipeline.reset();
+  }
+  auto get_pipeline() {
+    if (m_optimized_pipeline.valid() &&
+        m_optimized_pipeline.wait_for(std::chrono::seconds{0}) ==
+            std::future_status::ready) {
+      try {
+        return *m_optimized_pipeline.get();
+      } catch (...) {
+        // keep using the fast link if optimization failed.
+        m_optimized_pipeline = {};
+      }
+    }
+    return *m_fast_pipeline;
+  }
+
+private:
+  std::shared_ptr<const vk::Pipeline> m_fast_pipeline;
+  std::shared_future<std::shared_ptr<const vk::Pipeline>> m_optimized_pipeline;
+};
+template <uint32_t Subpass, class T> class set_subpass : public T {
+public:
+  auto get_subpass() { return Subpass; }
+};
+template <class T> class add_empty_attachments : public T {
+public:
+  auto get_attachments() { return std::vector<vk::AttachmentDescription>{}; }
+};
+template <class T> class add_depth_attachment : public T {
+public:
+  using parent = T;
+  auto get_attachments() {
+    auto attachments = parent::get_attachments();
+    vk::Format format = parent::get_depth_image_format();
+    vk::ImageLayout initial_layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    vk::ImageLayout final_layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    attachments.emplace_back(
+        vk::AttachmentDescription{}
+            .setInitialLayout(initial_layout)
+            .setFinalLayout(final_layout)
+            .setFormat(format)
+            .setLoadOp(vk::AttachmentLoadOp::eClear)
+            .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+            .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+            .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare));
+    return attachments;
+  }
+};
+template <class T> class add_attachment : public T {
+public:
+  using parent = T;
+  auto get_attachments() {
+    auto attachments = parent::get_attachments();
+    vk::Format format = parent::get_swapchain_image_format();
+    vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
+    vk::ImageLayout final_layout = vk::ImageLayout::ePresentSrcKHR;
+    attachments.emplace_back(
+        vk::AttachmentDescription{}
+            .setInitialLayout(initial_layout)
+            .setFinalLayout(final_layout)
+            .setFormat(format)
+            .setLoadOp(vk::AttachmentLoadOp::eClear)
+            .setStoreOp(vk::AttachmentStoreOp::eStore)
+            .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+            .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare));
+    return attachments;
+  }
+};
+template <class T> class add_subpass_dependency : public T {
+public:
+  using parent = T;
+  auto get_subpass_dependencies() {
+    auto depends = parent::get_subpass_dependencies();
+    depends.emplace_back(
+        vk::SubpassDependency{}
+            .setSrcSubpass(vk::SubpassExternal)
+            .setDstSubpass(0)
+            .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite |
+                              vk::AccessFlagBits::eColorAttachmentRead)
+            .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+            .setDstStageMask(
+                vk::PipelineStageFlagBits::eColorAttachmentOutput));
+    return depends;
+  }
+};
+template <class T> class add_empty_subpass_dependencies : public T {
+public:
+  auto get_subpass_dependencies() {
+    return std::vector<vk::SubpassDependency>{};
+  }
+};
+template <class T> class add_subpasses : public T {
+public:
+  auto get_subpasses() {
+    static auto attachment_reference =
+        vk::AttachmentReference{}
+            .setAttachment(0)
+            .setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+    return vk::SubpassDescription{}.setColorAttachments(
+            attachment_reference
+        );
+  }
+};
+template <class T> class add_render_pass : public T {
+public:
+  using parent = T;
+  add_render_pass() {
+    vk::Device device = parent::get_device();
+    auto attachments = parent::get_attachments();
+    auto dependencies = parent::get_subpass_dependencies();
+    auto subpasses = parent::get_subpasses();
+
+    auto create_info = vk::RenderPassCreateInfo{}
+                           .setAttachments(attachments)
+                           .setDependencies(dependencies)
+                           .setSubpasses(subpasses);
+    m_render_pass = device.createRenderPass(create_info);
+    m_registry = pipeline_registry::for_device(device);
+    m_registry->register_render_pass(m_render_pass, create_info);
+  }
+  ~add_render_pass() {
+    vk::Device device = parent::get_device();
+    m_registry->unregister_render_pass(m_render_pass);
+    device.destroyRenderPass(m_render_pass);
+  }
+  auto get_render_pass() { return m_render_pass; }
+
+private:
+  vk::RenderPass m_render_pass;
+  std::shared_ptr<pipeline_registry> m_registry;
+};
+template <class T> class add_pipeline_viewport_state : public T {
+public:
+  using parent = T;
+  add_pipeline_viewport_state(const configure auto& conf) : parent{conf} {}
+  auto get_pipeline_viewport_state_create_info() {
+    m_viewports = parent::get_viewports();
+    m_scissors = parent::get_scissors();
+    if (m_viewports.size() != m_scissors.size()) {
+      throw std::runtime_error{"viewports count != scissors count"};
+    }
+    return vk::PipelineViewportStateCreateInfo{}
+        .setViewports(m_viewports)
+        .setScissors(m_scissors);
+  }
+
+private:
+  std::vector<vk::Viewport> m_viewports;
+  std::vector<vk::Rect2D> m_scissors;
+};
+template <class T> class add_scissor_equal_swapchain_extent : public T {
+public:
+  using parent = T;
+  auto get_scissors() {
+    auto scissors = parent::get_scissors();
+    auto extent = parent::get_swapchain_image_extent();
+
+    scissors.emplace_back(vk::Rect2D{}.setOffset({}).setExtent(extent));
+    return scissors;
   }
 };
 template <class T> class add_scissor_equal_surface_rect : public T {
@@ -1990,6 +4175,77 @@ public:
         Count);
   }
 };
+template <class T>
+concept specialization_value =
+    std::same_as<T, bool> || std::same_as<T, int32_t> ||
+    std::same_as<T, uint32_t> || std::same_as<T, float> ||
+    std::same_as<T, int64_t> || std::same_as<T, uint64_t> ||
+    std::same_as<T, double>;
+// Values for the shader's constant_id decorations. set() adds a constant or
+// overrides an earlier value of it, so a compile time default can be replaced
+// at runtime. get_info() points into this object.
+class specialization_constants {
+public:
+  template <specialization_value V>
+  specialization_constants &set(uint32_t constant_id, V value) {
+    // booleans are 32 bit in SPIR-V.
+    if constexpr (std::same_as<V, bool>) {
+      return set(constant_id, static_cast<VkBool32>(value ? VK_TRUE : VK_FALSE));
+    } else {
+      auto entry = std::ranges::find(m_entries, constant_id,
+                                     &VkSpecializationMapEntry::constantID);
+      if (entry == m_entries.end() || entry->size != sizeof(V)) {
+        auto offset = (m_data.size() + sizeof(V) - 1) / sizeof(V) * sizeof(V);
+        m_data.resize(offset + sizeof(V));
+        if (entry == m_entries.end()) {
+          entry = m_entries.insert(m_entries.end(), VkSpecializationMapEntry{});
+        }
+        *entry = VkSpecializationMapEntry{.constantID = constant_id,
+                                          .offset = static_cast<uint32_t>(offset),
+                                          .size = sizeof(V)};
+      }
+      std::memcpy(m_data.data() + entry->offset, &value, sizeof(V));
+      return *this;
+    }
+  }
+  bool empty() const { return m_entries.empty(); }
+  VkSpecializationInfo get_info() const {
+    return VkSpecializationInfo{
+        .mapEntryCount = static_cast<uint32_t>(m_entries.size()),
+        .pMapEntries = m_entries.data(),
+        .dataSize = m_data.size(),
+        .pData = m_data.data(),
+    };
+  }
+
+private:
+  std::vector<VkSpecializationMapEntry> m_entries;
+  std::vector<char> m_data;
+};
+template <class T> class add_empty_specialization_constants : public T {
+public:
+  using parent = T;
+  add_empty_specialization_constants(const configure auto& conf) : parent{conf} {}
+  auto get_specialization_constants() { return specialization_constants{}; }
+};
+template <uint32_t ConstantID, auto Value, class T>
+  requires specialization_value<decltype(Value)>
+class set_specialization_constant : public T {
+public:
+  using parent = T;
+  set_specialization_constant(const configure auto& conf) : parent{conf} {}
+  auto get_specialization_constants() {
+    auto constants = parent::get_specialization_constants();
+    constants.set(ConstantID, Value);
+    return constants;
+  }
+};
+template <typename T>
+concept specialization_constants_gettable =
+    requires(T t) { t.get_specialization_constants(); };
+template <typename T>
+concept shader_module_create_info_gettable =
+    requires(T t) { t.get_shader_module_create_info(); };
 template <class T> class add_pipeline_stage_to_stages : public T {
 public:
   using parent = T;
@@ -2008,14 +4264,464 @@ public:
     vk::ShaderModule shader_module = parent::get_shader_module();
     m_entry_name = parent::get_shader_entry_name();
     vk::ShaderStageFlagBits stage = parent::get_shader_stage();
-    return vk::PipelineShaderStageCreateInfo{}
-        .setModule(shader_module)
-        .setPName(m_entry_name.data())
-        .setStage(stage);
+    auto stage_info = vk::PipelineShaderStageCreateInfo{}
+                          .setModule(shader_module)
+                          .setPName(m_entry_name.data())
+                          .setStage(stage);
+    if constexpr (shader_module_create_info_gettable<parent>) {
+      stage_info.setPNext(parent::get_shader_module_create_info());
+    }
+    if constexpr (specialization_constants_gettable<parent>) {
+      m_specialization_constants = parent::get_specialization_constants();
+      if (!m_specialization_constants.empty()) {
+        m_specialization_info = m_specialization_constants.get_info();
+        stage_info.setPSpecializationInfo(&m_specialization_info);
+      }
+    }
+    return stage_info;
   }
 
 private:
   std::string m_entry_name;
+  specialization_constants m_specialization_constants;
+  vk::SpecializationInfo m_specialization_info;
+};
+// SPIR-V of one stage, for the shader object path. Layers in the stage stack
+// add it to get_shader_codes() like add_pipeline_stage_to_stages does for
+// pipeline stages.
+struct shader_code {
+  vk::ShaderStageFlagBits stage;
+  std::span<const uint32_t> code;
+  std::string entry_name;
+  specialization_constants specialization;
+};
+template <class T> class add_empty_shader_codes : public T {
+public:
+  auto get_shader_codes() { return std::vector<shader_code>{}; }
+};
+template <class T> class add_shader_code_to_shader_codes : public T {
+public:
+  using parent = T;
+  auto get_shader_codes() {
+    auto codes = parent::get_shader_codes();
+    auto spirv = parent::get_spirv_code();
+    auto &code = codes.emplace_back(shader_code{
+        .stage = parent::get_shader_stage(),
+        .code = std::span<const uint32_t>{spirv.data(), spirv.size()},
+        .entry_name = parent::get_shader_entry_name(),
+        .specialization = {},
+    });
+    if constexpr (specialization_constants_gettable<parent>) {
+      code.specialization = parent::get_specialization_constants();
+    }
+    return codes;
+  }
+};
+template <class T> class add_shader_object_extension : public T {
+public:
+  using parent = T;
+  add_shader_object_extension(const configure auto& conf) : parent{conf} {}
+  auto get_extensions() {
+    auto ext = parent::get_extensions();
+    ext.emplace_back(vk::EXTShaderObjectExtensionName);
+    return ext;
+  }
+};
+// VK_EXT_shader_object entry points. The default dispatcher only has the
+// loader exports, so they are queried from the device. All are null when the
+// extension is not enabled on it.
+struct shader_object_functions {
+  explicit shader_object_functions(vk::Device device) {
+    auto load = [device](auto &function, const char *name) {
+      function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(
+          device.getProcAddr(name));
+    };
+    load(create_shaders, "vkCreateShadersEXT");
+    load(destroy_shader, "vkDestroyShaderEXT");
+    load(cmd_bind_shaders, "vkCmdBindShadersEXT");
+    load(cmd_set_vertex_input, "vkCmdSetVertexInputEXT");
+    load(cmd_set_polygon_mode, "vkCmdSetPolygonModeEXT");
+    load(cmd_set_depth_clamp_enable, "vkCmdSetDepthClampEnableEXT");
+    load(cmd_set_rasterization_samples, "vkCmdSetRasterizationSamplesEXT");
+    load(cmd_set_sample_mask, "vkCmdSetSampleMaskEXT");
+    load(cmd_set_alpha_to_coverage_enable, "vkCmdSetAlphaToCoverageEnableEXT");
+    load(cmd_set_alpha_to_one_enable, "vkCmdSetAlphaToOneEnableEXT");
+    load(cmd_set_logic_op_enable, "vkCmdSetLogicOpEnableEXT");
+    load(cmd_set_logic_op, "vkCmdSetLogicOpEXT");
+    load(cmd_set_color_blend_enable, "vkCmdSetColorBlendEnableEXT");
+    load(cmd_set_color_blend_equation, "vkCmdSetColorBlendEquationEXT");
+    load(cmd_set_color_write_mask, "vkCmdSetColorWriteMaskEXT");
+    load(cmd_set_patch_control_points, "vkCmdSetPatchControlPointsEXT");
+    load(cmd_set_color_write_enable, "vkCmdSetColorWriteEnableEXT");
+  }
+  bool is_supported() const {
+    return create_shaders != nullptr && destroy_shader != nullptr &&
+           cmd_bind_shaders != nullptr;
+  }
+
+  PFN_vkCreateShadersEXT create_shaders;
+  PFN_vkDestroyShaderEXT destroy_shader;
+  PFN_vkCmdBindShadersEXT cmd_bind_shaders;
+  PFN_vkCmdSetVertexInputEXT cmd_set_vertex_input;
+  PFN_vkCmdSetPolygonModeEXT cmd_set_polygon_mode;
+  PFN_vkCmdSetDepthClampEnableEXT cmd_set_depth_clamp_enable;
+  PFN_vkCmdSetRasterizationSamplesEXT cmd_set_rasterization_samples;
+  PFN_vkCmdSetSampleMaskEXT cmd_set_sample_mask;
+  PFN_vkCmdSetAlphaToCoverageEnableEXT cmd_set_alpha_to_coverage_enable;
+  PFN_vkCmdSetAlphaToOneEnableEXT cmd_set_alpha_to_one_enable;
+  PFN_vkCmdSetLogicOpEnableEXT cmd_set_logic_op_enable;
+  PFN_vkCmdSetLogicOpEXT cmd_set_logic_op;
+  PFN_vkCmdSetColorBlendEnableEXT cmd_set_color_blend_enable;
+  PFN_vkCmdSetColorBlendEquationEXT cmd_set_color_blend_equation;
+  PFN_vkCmdSetColorWriteMaskEXT cmd_set_color_write_mask;
+  PFN_vkCmdSetPatchControlPointsEXT cmd_set_patch_control_points;
+  PFN_vkCmdSetColorWriteEnableEXT cmd_set_color_write_enable;
+};
+// The device features that add state a draw with shader objects has to set.
+struct dynamic_state_features {
+  bool depth_clamp = false;
+  bool logic_op = false;
+  bool alpha_to_one = false;
+  bool color_write_enable = false;
+};
+inline dynamic_state_features
+get_dynamic_state_features(const vk::PhysicalDeviceFeatures2 &features) {
+  dynamic_state_features result{
+      .depth_clamp = features.features.depthClamp == VK_TRUE,
+      .logic_op = features.features.logicOp == VK_TRUE,
+      .alpha_to_one = features.features.alphaToOne == VK_TRUE,
+  };
+  for (auto next = static_cast<const vk::BaseInStructure *>(features.pNext);
+       next != nullptr; next = next->pNext) {
+    if (next->sType ==
+        vk::StructureType::ePhysicalDeviceColorWriteEnableFeaturesEXT) {
+      result.color_write_enable =
+          reinterpret_cast<const vk::PhysicalDeviceColorWriteEnableFeaturesEXT *>(
+              next)
+              ->colorWriteEnable == VK_TRUE;
+    }
+  }
+  return result;
+}
+// Records the fixed function part of a graphics pipeline state as dynamic
+// state, which is all the state a draw with shader objects uses. The state of
+// an enabled feature is always recorded, off when the stack does not use it,
+// so no value of an earlier bind stays. Viewports and scissors are skipped
+// when the state has no pointer to them, so they can be set by the caller.
+inline void set_dynamic_graphics_state(const shader_object_functions &functions,
+                                       const dynamic_state_features &features,
+                                       vk::CommandBuffer cmd,
+                                       const graphics_pipeline_state &state) {
+  auto command_buffer = static_cast<VkCommandBuffer>(cmd);
+
+  auto &vertex_input = state.vertex_input_state;
+  std::vector<VkVertexInputBindingDescription2EXT> bindings;
+  for (uint32_t i = 0; i < vertex_input.vertexBindingDescriptionCount; i++) {
+    auto &binding = vertex_input.pVertexBindingDescriptions[i];
+    bindings.emplace_back(VkVertexInputBindingDescription2EXT{
+        .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT,
+        .binding = binding.binding,
+        .stride = binding.stride,
+        .inputRate = static_cast<VkVertexInputRate>(binding.inputRate),
+        .divisor = 1,
+    });
+  }
+  std::vector<VkVertexInputAttributeDescription2EXT> attributes;
+  for (uint32_t i = 0; i < vertex_input.vertexAttributeDescriptionCount; i++) {
+    auto &attribute = vertex_input.pVertexAttributeDescriptions[i];
+    attributes.emplace_back(VkVertexInputAttributeDescription2EXT{
+        .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT,
+        .location = attribute.location,
+        .binding = attribute.binding,
+        .format = static_cast<VkFormat>(attribute.format),
+        .offset = attribute.offset,
+    });
+  }
+  functions.cmd_set_vertex_input(command_buffer, bindings.size(),
+                                 bindings.data(), attributes.size(),
+                                 attributes.data());
+
+  auto &input_assembly = state.input_assembly_state;
+  cmd.setPrimitiveTopology(input_assembly.topology);
+  cmd.setPrimitiveRestartEnable(input_assembly.primitiveRestartEnable);
+  if (input_assembly.topology == vk::PrimitiveTopology::ePatchList) {
+    functions.cmd_set_patch_control_points(
+        command_buffer, state.tessellation_state.patchControlPoints);
+  }
+
+  auto &viewport = state.viewport_state;
+  if (viewport.pViewports != nullptr) {
+    cmd.setViewportWithCount(vk::ArrayProxy<const vk::Viewport>{
+        viewport.viewportCount, viewport.pViewports});
+  }
+  if (viewport.pScissors != nullptr) {
+    cmd.setScissorWithCount(vk::ArrayProxy<const vk::Rect2D>{
+        viewport.scissorCount, viewport.pScissors});
+  }
+
+  auto &rasterization = state.rasterization_state;
+  cmd.setRasterizerDiscardEnable(rasterization.rasterizerDiscardEnable);
+  cmd.setCullMode(rasterization.cullMode);
+  cmd.setFrontFace(rasterization.frontFace);
+  cmd.setDepthBiasEnable(rasterization.depthBiasEnable);
+  if (rasterization.depthBiasEnable) {
+    cmd.setDepthBias(rasterization.depthBiasConstantFactor,
+                     rasterization.depthBiasClamp,
+                     rasterization.depthBiasSlopeFactor);
+  }
+  cmd.setLineWidth(rasterization.lineWidth);
+  functions.cmd_set_polygon_mode(
+      command_buffer, static_cast<VkPolygonMode>(rasterization.polygonMode));
+  if (features.depth_clamp) {
+    functions.cmd_set_depth_clamp_enable(command_buffer,
+                                         rasterization.depthClampEnable);
+  }
+
+  auto &multisample = state.multisample_state;
+  auto samples =
+      static_cast<VkSampleCountFlagBits>(multisample.rasterizationSamples);
+  functions.cmd_set_rasterization_samples(command_buffer, samples);
+  std::array<VkSampleMask, 2> all_samples{~0u, ~0u};
+  functions.cmd_set_sample_mask(command_buffer, samples,
+                                multisample.pSampleMask != nullptr
+                                    ? multisample.pSampleMask
+                                    : all_samples.data());
+  functions.cmd_set_alpha_to_coverage_enable(command_buffer,
+                                             multisample.alphaToCoverageEnable);
+  if (features.alpha_to_one) {
+    functions.cmd_set_alpha_to_one_enable(command_buffer,
+                                          multisample.alphaToOneEnable);
+  }
+
+  auto &depth_stencil = state.depth_stencil_state;
+  cmd.setDepthTestEnable(depth_stencil.depthTestEnable);
+  cmd.setDepthWriteEnable(depth_stencil.depthWriteEnable);
+  cmd.setDepthCompareOp(depth_stencil.depthCompareOp);
+  cmd.setDepthBoundsTestEnable(depth_stencil.depthBoundsTestEnable);
+  if (depth_stencil.depthBoundsTestEnable) {
+    cmd.setDepthBounds(depth_stencil.minDepthBounds,
+                       depth_stencil.maxDepthBounds);
+  }
+  cmd.setStencilTestEnable(depth_stencil.stencilTestEnable);
+  if (depth_stencil.stencilTestEnable) {
+    for (auto [face, op] :
+         {std::pair{vk::StencilFaceFlagBits::eFront, depth_stencil.front},
+          std::pair{vk::StencilFaceFlagBits::eBack, depth_stencil.back}}) {
+      cmd.setStencilOp(face, op.failOp, op.passOp, op.depthFailOp,
+                       op.compareOp);
+      cmd.setStencilCompareMask(face, op.compareMask);
+      cmd.setStencilWriteMask(face, op.writeMask);
+      cmd.setStencilReference(face, op.reference);
+    }
+  }
+
+  auto &color_blend = state.color_blend_state;
+  if (features.logic_op) {
+    functions.cmd_set_logic_op_enable(command_buffer,
+                                      color_blend.logicOpEnable);
+    functions.cmd_set_logic_op(command_buffer,
+                               static_cast<VkLogicOp>(color_blend.logicOp));
+  }
+  cmd.setBlendConstants(color_blend.blendConstants.data());
+  if (color_blend.attachmentCount > 0) {
+    std::vector<VkBool32> enables;
+    std::vector<VkColorBlendEquationEXT> equations;
+    std::vector<VkColorComponentFlags> write_masks;
+    for (uint32_t i = 0; i < color_blend.attachmentCount; i++) {
+      auto &attachment = color_blend.pAttachments[i];
+      enables.emplace_back(attachment.blendEnable);
+      equations.emplace_back(VkColorBlendEquationEXT{
+          .srcColorBlendFactor =
+              static_cast<VkBlendFactor>(attachment.srcColorBlendFactor),
+          .dstColorBlendFactor =
+              static_cast<VkBlendFactor>(attachment.dstColorBlendFactor),
+          .colorBlendOp = static_cast<VkBlendOp>(attachment.colorBlendOp),
+          .srcAlphaBlendFactor =
+              static_cast<VkBlendFactor>(attachment.srcAlphaBlendFactor),
+          .dstAlphaBlendFactor =
+              static_cast<VkBlendFactor>(attachment.dstAlphaBlendFactor),
+          .alphaBlendOp = static_cast<VkBlendOp>(attachment.alphaBlendOp),
+      });
+      write_masks.emplace_back(
+          static_cast<VkColorComponentFlags>(attachment.colorWriteMask));
+    }
+    functions.cmd_set_color_blend_enable(command_buffer, 0, enables.size(),
+                                         enables.data());
+    functions.cmd_set_color_blend_equation(command_buffer, 0, equations.size(),
+                                           equations.data());
+    functions.cmd_set_color_write_mask(command_buffer, 0, write_masks.size(),
+                                       write_masks.data());
+  }
+  if (features.color_write_enable) {
+    // every attachment writes unless the state chains its own enables.
+    std::vector<VkBool32> write_enables(color_blend.attachmentCount, VK_TRUE);
+    for (auto next =
+             static_cast<const vk::BaseInStructure *>(color_blend.pNext);
+         next != nullptr; next = next->pNext) {
+      if (next->sType == vk::StructureType::ePipelineColorWriteCreateInfoEXT) {
+        auto info =
+            reinterpret_cast<const vk::PipelineColorWriteCreateInfoEXT *>(next);
+        write_enables.assign(info->pColorWriteEnables,
+                             info->pColorWriteEnables +
+                                 info->attachmentCount);
+      }
+    }
+    functions.cmd_set_color_write_enable(command_buffer, write_enables.size(),
+                                         write_enables.data());
+  }
+}
+template <typename T>
+concept enabled_features_gettable = requires(T t) { t.get_enabled_features(); };
+// Shader object mode for a graphics pipeline stack: the stages from
+// get_shader_codes() become linked VkShaderEXT objects, and bind() binds them
+// and records the stack's fixed function state as dynamic state, so changing
+// that state costs commands instead of a pipeline compile. The stack needs
+// the same getters as add_graphics_pipeline.
+// Shader objects only draw inside dynamic rendering, so they are used when
+// the stack has use_dynamic_rendering and the device VK_EXT_shader_object.
+// Otherwise bind() binds a pipeline of the current state taken from the
+// registry, which compiles each distinct state once and works inside the
+// render pass of the stack, or inside the dynamic rendering when the stack
+// has use_dynamic_rendering. The optional features the state depends on are
+// taken from get_enabled_features() of the device layer, e.g.
+// add_device_with_features, and are all off without it. Stacks for other
+// tessellation or geometry stages have to bind those stages to null
+// themselves when the features are enabled.
+template <class T> class add_shader_objects : public T {
+public:
+  using parent = T;
+  add_shader_objects(const configure auto& conf)
+      : parent{conf}, m_functions{parent::get_device()} {
+    if constexpr (enabled_features_gettable<parent>) {
+      m_features = get_dynamic_state_features(parent::get_enabled_features());
+    }
+    create();
+  }
+  ~add_shader_objects() { destroy(); }
+  void create() {
+    if (!is_shader_object_used()) {
+      m_registry = pipeline_registry::for_device(parent::get_device());
+      return;
+    }
+    auto codes = parent::get_shader_codes();
+    auto set_layouts = parent::get_descriptor_set_layouts();
+    vk::ArrayProxy<const vk::DescriptorSetLayout> set_layout_proxy{set_layouts};
+    std::vector<vk::PushConstantRange> push_constant_ranges;
+    if constexpr (requires { parent::get_push_constant_ranges(); }) {
+      push_constant_ranges = parent::get_push_constant_ranges();
+    }
+
+    // the stages are linked, each one names the next stage in the set.
+    constexpr std::array graphics_stage_order{
+        VK_SHADER_STAGE_VERTEX_BIT,
+        VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+        VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+        VK_SHADER_STAGE_GEOMETRY_BIT,
+        VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+    VkShaderStageFlags present_stages = 0;
+    for (auto &code : codes) {
+      present_stages |= static_cast<VkShaderStageFlags>(code.stage);
+    }
+    auto get_next_stage = [&](VkShaderStageFlagBits stage) {
+      auto it = std::ranges::find(graphics_stage_order, stage);
+      for (it = std::next(it); it < graphics_stage_order.end(); it++) {
+        if (present_stages & *it) {
+          return static_cast<VkShaderStageFlags>(*it);
+        }
+      }
+      return VkShaderStageFlags{0};
+    };
+
+    std::vector<VkSpecializationInfo> specialization_infos;
+    specialization_infos.reserve(codes.size());
+    std::vector<VkShaderCreateInfoEXT> create_infos;
+    for (auto &code : codes) {
+      auto stage = static_cast<VkShaderStageFlagBits>(code.stage);
+      auto &specialization_info =
+          specialization_infos.emplace_back(code.specialization.get_info());
+      create_infos.emplace_back(VkShaderCreateInfoEXT{
+          .sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+          .flags = codes.size() > 1
+                       ? VkShaderCreateFlagsEXT{VK_SHADER_CREATE_LINK_STAGE_BIT_EXT}
+                       : VkShaderCreateFlagsEXT{0},
+          .stage = stage,
+          .nextStage = get_next_stage(stage),
+          .codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT,
+          .codeSize = code.code.size_bytes(),
+          .pCode = code.code.data(),
+          .pName = code.entry_name.c_str(),
+          .setLayoutCount = set_layout_proxy.size(),
+          .pSetLayouts = reinterpret_cast<const VkDescriptorSetLayout *>(
+              set_layout_proxy.data()),
+          .pushConstantRangeCount =
+              static_cast<uint32_t>(push_constant_ranges.size()),
+          .pPushConstantRanges = reinterpret_cast<const VkPushConstantRange *>(
+              push_constant_ranges.data()),
+          .pSpecializationInfo = code.specialization.empty()
+                                     ? nullptr
+                                     : &specialization_info,
+      });
+    }
+    std::vector<VkShaderEXT> shaders(create_infos.size());
+    VkResult res = m_functions.create_shaders(
+        static_cast<VkDevice>(parent::get_device()), create_infos.size(),
+        create_infos.data(), nullptr, shaders.data());
+    if (res != VK_SUCCESS) {
+      // failed creations are null, the others still have to be destroyed.
+      m_shaders = std::move(shaders);
+      destroy();
+      throw std::runtime_error{"failed to create shader objects"};
+    }
+    m_shaders = std::move(shaders);
+    m_stages.clear();
+    for (auto &info : create_infos) {
+      m_stages.emplace_back(info.stage);
+    }
+  }
+  void destroy() {
+    auto device = static_cast<VkDevice>(parent::get_device());
+    for (auto shader : m_shaders) {
+      if (shader != VK_NULL_HANDLE) {
+        m_functions.destroy_shader(device, shader, nullptr);
+      }
+    }
+    m_shaders.clear();
+    m_stages.clear();
+    m_emulated_pipelines.clear();
+  }
+  bool is_shader_object_used() {
+    if constexpr (dynamic_rendering_usable<parent>) {
+      return m_functions.is_supported() && parent::is_dynamic_rendering_used();
+    } else {
+      return false;
+    }
+  }
+  auto get_shader_objects() { return m_shaders; }
+  // Binds the shaders and the current state of the stack to cmd. Call it again
+  // after changing state, inside the rendering when shader objects are used.
+  void bind(vk::CommandBuffer cmd) {
+    auto state = get_graphics_pipeline_state(static_cast<parent &>(*this));
+    if (!is_shader_object_used()) {
+      auto pipeline = m_registry->get_graphics_pipeline(state);
+      cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline);
+      // commands recorded with a pipeline need it until they completed.
+      m_emulated_pipelines.emplace(std::move(pipeline));
+      return;
+    }
+    m_functions.cmd_bind_shaders(static_cast<VkCommandBuffer>(cmd),
+                                 m_stages.size(), m_stages.data(),
+                                 m_shaders.data());
+    set_dynamic_graphics_state(m_functions, m_features, cmd, state);
+  }
+
+private:
+  shader_object_functions m_functions;
+  dynamic_state_features m_features;
+  std::vector<VkShaderStageFlagBits> m_stages;
+  std::vector<VkShaderEXT> m_shaders;
+  std::shared_ptr<pipeline_registry> m_registry;
+  std::set<std::shared_ptr<const vk::Pipeline>> m_emulated_pipelines;
 };
 template <vk::ShaderStageFlagBits Shader_stage, class T>
 class set_shader_stage : public T {
@@ -2026,33 +4732,141 @@ template <class T> class set_shader_entry_name_with_main : public T {
 public:
   auto get_shader_entry_name() { return std::string{"main"}; }
 };
+template <typename T>
+concept spirv_code_hash_gettable =
+    requires(T t) { t.get_spirv_code_hash(); };
+template <typename T>
+concept file_path_gettable = requires(T t) { t.get_file_path(); };
+template <typename T>
+concept spirv_code_stripped = requires(T t) {
+  { t.is_spirv_code_stripped() } -> std::convertible_to<bool>;
+};
+// stacks with the same code share one module through the registry. A module
+// preloaded from get_file_path() is taken when it was stripped like the code
+// of this stack, see add_shader_preload.
 template <class T> class add_shader_module : public T {
 public:
   using parent = T;
   add_shader_module(const configure auto& conf) : parent{conf}{
     vk::Device device = parent::get_device();
-    auto code = parent::get_spirv_code();
-    m_module =
-        device.createShaderModule(vk::ShaderModuleCreateInfo{}.setCode(code));
+    auto registry = pipeline_registry::for_device(device);
+    if constexpr (file_path_gettable<parent>) {
+      bool stripped = false;
+      if constexpr (spirv_code_stripped<parent>) {
+        stripped = parent::is_spirv_code_stripped();
+      }
+      m_module = registry->find_preloaded_shader_module(parent::get_file_path(),
+                                                        stripped);
+      if (m_module) {
+        return;
+      }
+    }
+    if constexpr (spirv_code_hash_gettable<parent>) {
+      m_module = registry->get_shader_module(parent::get_spirv_code(),
+                                             parent::get_spirv_code_hash());
+    } else {
+      m_module = registry->get_shader_module(parent::get_spirv_code());
+    }
   }
-  ~add_shader_module() {
+  auto get_shader_module() { return *m_module; }
+
+private:
+  std::shared_ptr<const vk::ShaderModule> m_module;
+};
+template <typename T>
+concept preloaded_shaders_stripped = requires(T t) {
+  { t.is_preloaded_shader_code_stripped() } -> std::convertible_to<bool>;
+};
+// Starts loading the shaders of get_preload_shader_paths() on the thread pool
+// of the stack when the device is created, so that the add_shader_module of
+// the pipeline stacks built later finds the modules ready. The preloaded
+// modules started here are released with this stack, which waits for its own
+// preloads only, so it must not be destroyed on a worker of that pool. Stack
+// strip_preloaded_shaders on it when the pipeline stacks use
+// add_stripped_spirv_code.
+template <class T> class add_shader_preload : public T {
+public:
+  using parent = T;
+  add_shader_preload(const configure auto& conf) : parent{conf} {
     vk::Device device = parent::get_device();
-    device.destroyShaderModule(m_module);
+    m_registry = pipeline_registry::for_device(device);
+    std::vector<std::filesystem::path> paths = parent::get_preload_shader_paths();
+    bool strip = false;
+    if constexpr (preloaded_shaders_stripped<parent>) {
+      strip = parent::is_preloaded_shader_code_stripped();
+    }
+    m_preloads = m_registry->preload_shader_modules(
+        paths, parent::get_thread_pool(), strip);
+  }
+  ~add_shader_preload() {
+    // the preloads use the device, finish them before it is destroyed.
+    for (auto &preload : m_preloads) {
+      preload.module.wait();
+    }
+    m_registry->release_preloaded_shader_modules(m_preloads);
+  }
+
+private:
+  std::shared_ptr<pipeline_registry> m_registry;
+  std::vector<pipeline_registry::shader_preload> m_preloads;
+};
+template <class T> class strip_preloaded_shaders : public T {
+public:
+  using parent = T;
+  strip_preloaded_shaders(const configure auto& conf) : parent{conf} {}
+  bool is_preloaded_shader_code_stripped() { return true; }
+};
+template <class T> class add_maintenance5_extension : public T {
+public:
+  using parent = T;
+  add_maintenance5_extension(const configure auto& conf) : parent{conf} {}
+  auto get_extensions() {
+    auto ext = parent::get_extensions();
+    ext.emplace_back(vk::KHRMaintenance5ExtensionName);
+    return ext;
+  }
+};
+// Replaces add_shader_module when the maintenance5 feature is enabled: no
+// module is created, add_pipeline_stage chains the create info to the stage
+// and the driver compiles the code with the pipeline.
+template <class T> class add_inline_shader_module : public T {
+public:
+  using parent = T;
+  add_inline_shader_module(const configure auto& conf) : parent{conf} {
+    auto code = parent::get_spirv_code();
+    m_create_info.setCode(code);
+  }
+  auto get_shader_module() { return vk::ShaderModule{}; }
+  const vk::ShaderModuleCreateInfo *get_shader_module_create_info() {
+    return &m_create_info;
   }
-  auto get_shader_module() { return m_module; }
 
 private:
-  vk::ShaderModule m_module;
+  vk::ShaderModuleCreateInfo m_create_info;
 };
 template <class T> class add_spirv_code : public T {
 public:
   using parent = T;
   auto get_spirv_code() {
-    void *ptr = parent::get_code_pointer();
-    std::uint32_t size = parent::get_size_in_bytes();
-    return std::span{reinterpret_cast<uint32_t *>(ptr), size / 4};
+    const void *ptr = parent::get_code_pointer();
+    uint64_t size = parent::get_size_in_bytes();
+    return std::span{static_cast<const uint32_t *>(ptr), size / 4};
   }
 };
+// removes debug instructions from the code of the stack when it is loaded,
+// see vulkan_helper::strip_spirv().
+template <class T> class add_stripped_spirv_code : public T {
+public:
+  using parent = T;
+  add_stripped_spirv_code(const configure auto& conf)
+      : parent{conf},
+        m_code{vulkan_helper::strip_spirv(parent::get_spirv_code())} {}
+  auto get_spirv_code() { return std::span<const uint32_t>{m_code}; }
+  bool is_spirv_code_stripped() { return true; }
+
+private:
+  std::vector<uint32_t> m_code;
+};
 template <class T> class adapte_map_file_to_spirv_code : public T {
 public:
   using parent = T;
@@ -2060,6 +4874,49 @@ public:
   auto get_size_in_bytes() { return parent::get_file_size(); }
 };
 
+// same contract as add_spirv_code for code compiled into the program, e.g. a
+// header from the add_embedded_spirv() CMake function.
+template <auto &Code, class T> class add_embedded_spirv_code : public T {
+public:
+  auto get_spirv_code() { return std::span<const uint32_t>{Code}; }
+};
+// maps the archive of get_spirv_archive_path() once for all stages of the
+// stack.
+template <class T> class add_spirv_archive : public T {
+public:
+  using parent = T;
+  add_spirv_archive(const configure auto& conf)
+      : parent{conf}, m_archive{parent::get_spirv_archive_path()} {}
+  const vulkan_helper::spirv_archive &get_spirv_archive() { return m_archive; }
+
+private:
+  vulkan_helper::spirv_archive m_archive;
+};
+// same contract as add_spirv_code, the code of get_shader_name() is a view
+// into the archive and its hash is taken from the index.
+template <class T> class add_archive_spirv_code : public T {
+public:
+  using parent = T;
+  auto get_spirv_code() {
+    return parent::get_spirv_archive().get(parent::get_shader_name());
+  }
+  auto get_spirv_code_hash() {
+    auto entry =
+        parent::get_spirv_archive().find_entry(parent::get_shader_name());
+    if (!entry) {
+      throw std::runtime_error{"failed to find shader in spirv archive"};
+    }
+    return entry->content_hash;
+  }
+};
+template <class T> class add_vertex_shader_name : public T {
+public:
+  auto get_shader_name() { return std::string{"vert.spv"}; }
+};
+template <class T> class add_fragment_shader_name : public T {
+public:
+  auto get_shader_name() { return std::string{"frag.spv"}; }
+};
 template <class T> class add_vertex_shader_path : public T {
 public:
   auto get_file_path() { return std::filesystem::path{"vert.spv"}; }
@@ -2166,17 +5023,67 @@ public:
     vk::Device device = parent::get_device();
     auto set_layouts = parent::get_descriptor_set_layouts();
 
-    m_layout = device.createPipelineLayout(
+    m_layout = pipeline_registry::for_device(device)->get_pipeline_layout(
         vk::PipelineLayoutCreateInfo{}.setSetLayouts(set_layouts));
   }
-  ~add_pipeline_layout() {
+  auto get_pipeline_layout() { return *m_layout; }
+
+private:
+  std::shared_ptr<const vk::PipelineLayout> m_layout;
+};
+template <class T> class add_spirv_reflection_cache_path : public T {
+public:
+  using parent = T;
+  add_spirv_reflection_cache_path(const configure auto& conf) : parent{conf} {}
+  auto get_spirv_reflection_cache_path() {
+    return std::filesystem::path{"spirv_reflection_cache.txt"};
+  }
+};
+template <class T> class add_spirv_reflection_cache : public T {
+public:
+  using parent = T;
+  add_spirv_reflection_cache(const configure auto& conf)
+      : parent{conf}, m_cache{parent::get_spirv_reflection_cache_path()} {}
+  ~add_spirv_reflection_cache() {
+    try {
+      m_cache.save();
+    } catch (...) {
+    }
+  }
+  auto &get_spirv_reflection_cache() { return m_cache; }
+
+private:
+  spirv_reflection_cache m_cache;
+};
+template <typename T>
+concept spirv_reflection_cache_gettable =
+    requires(T t) { t.get_spirv_reflection_cache(); };
+// Replaces add_descriptor_set_layout and add_pipeline_layout: the set layouts,
+// push constant range and pipeline layout are reflected from the code of
+// get_shader_codes().
+template <class T> class add_reflected_pipeline_layout : public T {
+public:
+  using parent = T;
+  add_reflected_pipeline_layout(const configure auto& conf) : parent{conf} {
     vk::Device device = parent::get_device();
-    device.destroyPipelineLayout(m_layout);
+    std::vector<vulkan_helper::spirv_reflection> reflections;
+    for (auto &code : parent::get_shader_codes()) {
+      if constexpr (spirv_reflection_cache_gettable<parent>) {
+        reflections.push_back(
+            parent::get_spirv_reflection_cache().get(code.code));
+      } else {
+        reflections.push_back(vulkan_helper::reflect_spirv(code.code));
+      }
+    }
+    m_layout = pipeline_registry::for_device(device)
+                   ->get_reflected_pipeline_layout(reflections);
   }
-  auto get_pipeline_layout() { return m_layout; }
+  auto get_descriptor_set_layouts() { return m_layout.get_set_layouts(); }
+  auto get_push_constant_ranges() { return m_layout.push_constant_ranges; }
+  auto get_pipeline_layout() { return *m_layout.pipeline_layout; }
 
 private:
-  vk::PipelineLayout m_layout;
+  pipeline_registry::reflected_pipeline_layout m_layout;
 };
 template <class T> class add_single_descriptor_set_layout : public T {
 public:
@@ -2191,17 +5098,13 @@ public:
   add_descriptor_set_layout(const configure auto& conf) : parent{conf} {
     vk::Device device = parent::get_device();
     auto bindings = parent::get_descriptor_set_layout_bindings();
-    m_layout = device.createDescriptorSetLayout(
+    m_layout = pipeline_registry::for_device(device)->get_descriptor_set_layout(
         vk::DescriptorSetLayoutCreateInfo{}.setBindings(bindings));
   }
-  ~add_descriptor_set_layout() {
-    vk::Device device = parent::get_device();
-    device.destroyDescriptorSetLayout(m_layout);
-  }
-  auto get_descriptor_set_layout() { return m_layout; }
+  auto get_descriptor_set_layout() { return *m_layout; }
 
 private:
-  vk::DescriptorSetLayout m_layout;
+  std::shared_ptr<const vk::DescriptorSetLayout> m_layout;
 };
 template <class T> class add_descriptor_set_layout_binding : public T {
 public:
@@ -2387,11 +5290,56 @@ public:
     m_queue_family_index = index;
     return *this;
   }
+  auto enable_draw_indirect_count() {
+    m_draw_indirect_count = true;
+    return *this;
+  }
+  bool is_draw_indirect_count_enabled() const { return m_draw_indirect_count; }
+  // lets pipelines require a subgroup size, see compute_autotuner.
+  auto enable_subgroup_size_control() {
+    m_subgroup_size_control = true;
+    return *this;
+  }
+  bool is_subgroup_size_control_enabled() const {
+    return m_subgroup_size_control;
+  }
   uint32_t get_queue_family_index() const { return m_queue_family_index; }
 
+  struct queue_family {
+    uint32_t queue_family_index;
+    std::vector<float> priorities;
+  };
+  // Request queues of a family. If no family is added, one queue of
+  // get_queue_family_index() is created with priority 1.0.
+  auto add_queue_family(uint32_t index, std::vector<float> priorities) {
+    auto it = std::ranges::find(m_queue_families, index,
+                                &queue_family::queue_family_index);
+    if (it != m_queue_families.end()) {
+      it->priorities = std::move(priorities);
+    } else {
+      m_queue_families.emplace_back(index, std::move(priorities));
+    }
+    return *this;
+  }
+  auto set_queue_count(uint32_t index, uint32_t count, float priority = 1.0f) {
+    return add_queue_family(index, std::vector<float>(count, priority));
+  }
+  const auto &get_queue_families() const { return m_queue_families; }
+  uint32_t get_queue_count(uint32_t index) const {
+    auto it = std::ranges::find(m_queue_families, index,
+                                &queue_family::queue_family_index);
+    if (it != m_queue_families.end()) {
+      return it->priorities.size();
+    }
+    return index == m_queue_family_index ? 1 : 0;
+  }
+
 private:
   VkDeviceCreateInfo m_create_info;
   int m_queue_family_index;
+  std::vector<queue_family> m_queue_families;
+  bool m_draw_indirect_count{};
+  bool m_subgroup_size_control{};
 };
 
 template <concept_helper::physical_device physical_device>
@@ -2420,22 +5368,111 @@ public:
         physical_device::get_vulkan_physical_device(), &properties);
     return properties;
   }
-  auto get_memory_properties() {
-    return get_physical_device_memory_properties();
+  auto get_memory_properties() {
+    return get_physical_device_memory_properties();
+  }
+  bool supports_draw_indirect_count() {
+    VkPhysicalDeviceVulkan12Features vulkan_1_2_features{};
+    vulkan_1_2_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &vulkan_1_2_features;
+    vkGetPhysicalDeviceFeatures2(physical_device::get_vulkan_physical_device(),
+                                 &features2);
+    return vulkan_1_2_features.drawIndirectCount == VK_TRUE;
+  }
+  auto get_physical_device_properties() {
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physical_device::get_vulkan_physical_device(),
+                                  &properties);
+    return properties;
+  }
+  auto get_physical_device_id_properties() {
+    VkPhysicalDeviceIDProperties id_properties{};
+    id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &id_properties;
+    vkGetPhysicalDeviceProperties2(
+        physical_device::get_vulkan_physical_device(), &properties2);
+    return id_properties;
+  }
+  auto get_subgroup_size_control_properties() {
+    VkPhysicalDeviceSubgroupSizeControlProperties subgroup_properties{};
+    subgroup_properties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &subgroup_properties;
+    vkGetPhysicalDeviceProperties2(
+        physical_device::get_vulkan_physical_device(), &properties2);
+    return subgroup_properties;
+  }
+  bool supports_subgroup_size_control() {
+    VkPhysicalDeviceVulkan13Features vulkan_1_3_features{};
+    vulkan_1_3_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    VkPhysicalDeviceFeatures2 features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &vulkan_1_3_features;
+    vkGetPhysicalDeviceFeatures2(physical_device::get_vulkan_physical_device(),
+                                 &features2);
+    return vulkan_1_3_features.subgroupSizeControl == VK_TRUE;
+  }
+  uint32_t get_queue_family_queue_count(uint32_t queue_family_index) {
+    uint32_t count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        physical_device::get_vulkan_physical_device(), &count, nullptr);
+    std::vector<VkQueueFamilyProperties> properties(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        physical_device::get_vulkan_physical_device(), &count,
+        properties.data());
+    if (queue_family_index >= count) {
+      throw std::runtime_error{"queue family index out of range"};
+    }
+    return properties[queue_family_index].queueCount;
   }
   VkDevice create_device(const device_create_info &info) {
-    VkDeviceQueueCreateInfo queue_create_info{};
-    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_create_info.queueFamilyIndex = info.get_queue_family_index();
-    queue_create_info.queueCount = 1;
     float priority = 1.0;
-    queue_create_info.pQueuePriorities = &priority;
+    std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
+    for (auto &family : info.get_queue_families()) {
+      if (family.priorities.empty() ||
+          family.priorities.size() >
+              get_queue_family_queue_count(family.queue_family_index)) {
+        throw std::runtime_error{
+            "requested queue count is not supported by the queue family"};
+      }
+      VkDeviceQueueCreateInfo queue_create_info{};
+      queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      queue_create_info.queueFamilyIndex = family.queue_family_index;
+      queue_create_info.queueCount = family.priorities.size();
+      queue_create_info.pQueuePriorities = family.priorities.data();
+      queue_create_infos.push_back(queue_create_info);
+    }
+    if (queue_create_infos.empty()) {
+      VkDeviceQueueCreateInfo queue_create_info{};
+      queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      queue_create_info.queueFamilyIndex = info.get_queue_family_index();
+      queue_create_info.queueCount = 1;
+      queue_create_info.pQueuePriorities = &priority;
+      queue_create_infos.push_back(queue_create_info);
+    }
 
     VkPhysicalDeviceVulkan13Features vulkan_1_3_features{};
     vulkan_1_3_features.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
     vulkan_1_3_features.synchronization2 = VK_TRUE;
     vulkan_1_3_features.maintenance4 = VK_TRUE;
+    vulkan_1_3_features.subgroupSizeControl =
+        info.is_subgroup_size_control_enabled() ? VK_TRUE : VK_FALSE;
+
+    VkPhysicalDeviceVulkan12Features vulkan_1_2_features{};
+    vulkan_1_2_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan_1_2_features.drawIndirectCount =
+        info.is_draw_indirect_count_enabled() ? VK_TRUE : VK_FALSE;
+    vulkan_1_3_features.pNext = &vulkan_1_2_features;
 
     VkPhysicalDeviceFeatures2 features2{};
     features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
@@ -2444,8 +5481,8 @@ public:
     VkDeviceCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     create_info.pNext = &features2;
-    create_info.queueCreateInfoCount = 1;
-    create_info.pQueueCreateInfos = &queue_create_info;
+    create_info.queueCreateInfoCount = queue_create_infos.size();
+    create_info.pQueueCreateInfos = queue_create_infos.data();
 
     VkDevice device;
     auto res = vkCreateDevice(physical_device::get_vulkan_physical_device(),
@@ -2461,6 +5498,34 @@ public:
   }
 };
 
+struct compute_pipeline_description {
+  VkShaderModule shader_module;
+  VkPipelineLayout pipeline_layout;
+  const VkSpecializationInfo *specialization_info = nullptr;
+  const char *entry_name = "main";
+};
+// pipeline is VK_NULL_HANDLE when the pipeline failed, result is then the
+// error of the batch. feedback says how long the creation took and whether
+// it hit the pipeline cache.
+struct compute_pipeline_result {
+  VkResult result;
+  VkPipeline pipeline;
+  VkPipelineCreationFeedback feedback;
+  VkPipelineCreationFeedback stage_feedback;
+};
+inline VkComputePipelineCreateInfo
+get_compute_pipeline_create_info(const compute_pipeline_description &description) {
+  VkComputePipelineCreateInfo create_info{};
+  create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  create_info.stage.module = description.shader_module;
+  create_info.stage.pName = description.entry_name;
+  create_info.stage.pSpecializationInfo = description.specialization_info;
+  create_info.layout = description.pipeline_layout;
+  return create_info;
+}
+
 uint32_t findProperties(VkPhysicalDeviceMemoryProperties memory_properties,
                         uint32_t memoryTypeBitsRequirements,
                         VkMemoryPropertyFlags requiredProperty) {
@@ -2506,10 +5571,13 @@ public:
     vkDestroyFence(device::get_vulkan_device(), fence, nullptr);
   }
   VkShaderModule create_shader_module(const spirv_file &file) {
+    return create_shader_module(std::span{file.data(), file.size() / 4});
+  }
+  VkShaderModule create_shader_module(std::span<const uint32_t> code) {
     VkShaderModuleCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    create_info.codeSize = file.size();
-    create_info.pCode = file.data();
+    create_info.codeSize = code.size_bytes();
+    create_info.pCode = code.data();
     VkShaderModule shader_module;
     auto res = vkCreateShaderModule(device::get_vulkan_device(), &create_info,
                                     NULL, &shader_module);
@@ -2552,30 +5620,114 @@ public:
     }
     return pipeline_layout;
   }
+  VkPipelineLayout create_pipeline_layout(
+      std::span<const VkDescriptorSetLayout> set_layouts,
+      std::span<const VkPushConstantRange> push_constant_ranges = {}) {
+    VkPipelineLayoutCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    create_info.setLayoutCount = set_layouts.size();
+    create_info.pSetLayouts = set_layouts.data();
+    create_info.pushConstantRangeCount = push_constant_ranges.size();
+    create_info.pPushConstantRanges = push_constant_ranges.data();
+    VkPipelineLayout pipeline_layout;
+    auto res = vkCreatePipelineLayout(device::get_vulkan_device(), &create_info,
+                                      NULL, &pipeline_layout);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to create pipeline layout"};
+    }
+    return pipeline_layout;
+  }
   void destroy_pipeline_layout(VkPipelineLayout pipeline_layout) {
     vkDestroyPipelineLayout(device::get_vulkan_device(), pipeline_layout, NULL);
   }
-  auto create_pipeline(VkShaderModule shader_module,
-                       VkPipelineLayout pipeline_layout) {
-    VkComputePipelineCreateInfo create_info{};
-    create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    create_info.flags = 0;
-    create_info.stage.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    create_info.stage.module = shader_module;
-    create_info.stage.pName = "main";
-    create_info.layout = pipeline_layout;
-
+  VkPipelineCache create_pipeline_cache(std::span<const char> initial_data) {
+    VkPipelineCacheCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = initial_data.size();
+    create_info.pInitialData = initial_data.data();
+    VkPipelineCache pipeline_cache;
+    auto res = vkCreatePipelineCache(device::get_vulkan_device(), &create_info,
+                                     NULL, &pipeline_cache);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to create pipeline cache"};
+    }
+    return pipeline_cache;
+  }
+  void destroy_pipeline_cache(VkPipelineCache pipeline_cache) {
+    vkDestroyPipelineCache(device::get_vulkan_device(), pipeline_cache, NULL);
+  }
+  std::vector<char> get_pipeline_cache_data(VkPipelineCache pipeline_cache) {
+    size_t size = 0;
+    auto res = vkGetPipelineCacheData(device::get_vulkan_device(),
+                                      pipeline_cache, &size, NULL);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to get pipeline cache data"};
+    }
+    std::vector<char> data(size);
+    res = vkGetPipelineCacheData(device::get_vulkan_device(), pipeline_cache,
+                                 &size, data.data());
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to get pipeline cache data"};
+    }
+    data.resize(size);
+    return data;
+  }
+  auto create_pipeline(
+      VkShaderModule shader_module, VkPipelineLayout pipeline_layout,
+      const VkSpecializationInfo *specialization_info = nullptr,
+      const char *entry_name = "main",
+      VkPipelineCache pipeline_cache = VK_NULL_HANDLE) {
+    return create_compute_pipeline(
+        get_compute_pipeline_create_info(compute_pipeline_description{
+            shader_module, pipeline_layout, specialization_info, entry_name}),
+        pipeline_cache);
+  }
+  VkPipeline
+  create_compute_pipeline(const VkComputePipelineCreateInfo &create_info,
+                          VkPipelineCache pipeline_cache = VK_NULL_HANDLE) {
     VkPipeline pipeline;
     auto res =
-        vkCreateComputePipelines(device::get_vulkan_device(), VK_NULL_HANDLE, 1,
+        vkCreateComputePipelines(device::get_vulkan_device(), pipeline_cache, 1,
                                  &create_info, NULL, &pipeline);
     if (res != VK_SUCCESS) {
       throw std::runtime_error{"failed to create compute pipeline"};
     }
     return pipeline;
   }
+  // Creates all pipelines in one vkCreateComputePipelines call, so the driver
+  // can compile them in parallel. Does not throw when some of them fail.
+  std::vector<compute_pipeline_result>
+  create_pipelines(std::span<const compute_pipeline_description> descriptions,
+                   VkPipelineCache pipeline_cache = VK_NULL_HANDLE) {
+    // createInfoCount has to be greater than 0.
+    if (descriptions.empty()) {
+      return {};
+    }
+    std::vector<compute_pipeline_result> results(descriptions.size());
+    std::vector<VkPipelineCreationFeedbackCreateInfo> feedback_infos(
+        descriptions.size());
+    std::vector<VkComputePipelineCreateInfo> create_infos(descriptions.size());
+    for (size_t i = 0; i < descriptions.size(); i++) {
+      auto &description = descriptions[i];
+      auto &feedback_info = feedback_infos[i];
+      feedback_info.sType =
+          VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+      feedback_info.pPipelineCreationFeedback = &results[i].feedback;
+      feedback_info.pipelineStageCreationFeedbackCount = 1;
+      feedback_info.pPipelineStageCreationFeedbacks = &results[i].stage_feedback;
+      create_infos[i] = get_compute_pipeline_create_info(description);
+      create_infos[i].pNext = &feedback_info;
+    }
+    std::vector<VkPipeline> pipelines(descriptions.size());
+    auto res = vkCreateComputePipelines(
+        device::get_vulkan_device(), pipeline_cache, create_infos.size(),
+        create_infos.data(), NULL, pipelines.data());
+    for (size_t i = 0; i < descriptions.size(); i++) {
+      results[i].pipeline = pipelines[i];
+      results[i].result = pipelines[i] != VK_NULL_HANDLE ? VK_SUCCESS : res;
+    }
+    return results;
+  }
   void destroy_pipeline(VkPipeline pipeline) {
     vkDestroyPipeline(device::get_vulkan_device(), pipeline, NULL);
   }
@@ -2595,6 +5747,12 @@ public:
   void destroy_command_pool(VkCommandPool command_pool) {
     vkDestroyCommandPool(device::get_vulkan_device(), command_pool, NULL);
   }
+  void reset_command_pool(VkCommandPool command_pool) {
+    auto res = vkResetCommandPool(device::get_vulkan_device(), command_pool, 0);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to reset command pool"};
+    }
+  }
 
   auto allocate_command_buffer(VkCommandPool command_pool) {
     VkCommandBufferAllocateInfo info{};
@@ -2629,9 +5787,60 @@ public:
     }
     return buffer;
   }
+  VkBuffer create_buffer(const VkBufferCreateInfo *create_info) {
+    VkBuffer buffer;
+    auto res = vkCreateBuffer(device::get_vulkan_device(), create_info, NULL,
+                              &buffer);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to create buffer"};
+    }
+    return buffer;
+  }
   void destroy_buffer(VkBuffer buffer) {
     vkDestroyBuffer(device::get_vulkan_device(), buffer, NULL);
   }
+  VkMemoryRequirements get_buffer_memory_requirements(VkBuffer buffer) {
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device::get_vulkan_device(), buffer,
+                                  &requirements);
+    return requirements;
+  }
+  VkMemoryRequirements get_image_memory_requirements(VkImage image) {
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device::get_vulkan_device(), image,
+                                 &requirements);
+    return requirements;
+  }
+  VkDeviceMemory allocate_device_memory(VkDeviceSize size,
+                                        uint32_t memory_type_index) {
+    VkMemoryAllocateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    info.allocationSize = size;
+    info.memoryTypeIndex = memory_type_index;
+    VkDeviceMemory device_memory{};
+    auto res = vkAllocateMemory(device::get_vulkan_device(), &info, NULL,
+                                &device_memory);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to allocate device memory"};
+    }
+    return device_memory;
+  }
+  void bind_buffer_memory(VkBuffer buffer, VkDeviceMemory memory,
+                          VkDeviceSize offset) {
+    auto res = vkBindBufferMemory(device::get_vulkan_device(), buffer, memory,
+                                  offset);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to bind buffer memory"};
+    }
+  }
+  void bind_image_memory(VkImage image, VkDeviceMemory memory,
+                         VkDeviceSize offset) {
+    auto res =
+        vkBindImageMemory(device::get_vulkan_device(), image, memory, offset);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to bind image memory"};
+    }
+  }
 
   VkDeviceMemory
   alloc_device_memory(VkPhysicalDeviceMemoryProperties memory_properties,
@@ -2743,6 +5952,15 @@ public:
       throw std::runtime_error{"wait fence fail"};
     }
   }
+  bool is_fence_signaled(VkFence fence) {
+    auto res = vkGetFenceStatus(device::get_vulkan_device(), fence);
+    if (res == VK_SUCCESS) {
+      return true;
+    } else if (res == VK_NOT_READY) {
+      return false;
+    }
+    throw std::runtime_error{"failed to get fence status"};
+  }
 
   void invalidate_mapped_memory_ranges(VkDeviceMemory memory,
                                        VkDeviceSize offset, VkDeviceSize size) {
@@ -2782,6 +6000,36 @@ public:
   void destroy_image_view(VkImageView view) {
     vkDestroyImageView(device::get_vulkan_device(), view, nullptr);
   }
+  VkQueryPool create_query_pool(VkQueryType query_type, uint32_t query_count) {
+    VkQueryPoolCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    create_info.queryType = query_type;
+    create_info.queryCount = query_count;
+    VkQueryPool query_pool;
+    auto res = vkCreateQueryPool(device::get_vulkan_device(), &create_info,
+                                 NULL, &query_pool);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to create query pool"};
+    }
+    return query_pool;
+  }
+  void destroy_query_pool(VkQueryPool query_pool) {
+    vkDestroyQueryPool(device::get_vulkan_device(), query_pool, NULL);
+  }
+  // waits for the queries and returns them as 64 bit values.
+  std::vector<uint64_t> get_query_pool_results(VkQueryPool query_pool,
+                                               uint32_t first_query,
+                                               uint32_t query_count) {
+    std::vector<uint64_t> results(query_count);
+    auto res = vkGetQueryPoolResults(
+        device::get_vulkan_device(), query_pool, first_query, query_count,
+        results.size() * sizeof(uint64_t), results.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to get query pool results"};
+    }
+    return results;
+  }
 };
 
 template <concept_helper::physical_device physical_device>
@@ -2832,6 +6080,287 @@ private:
   VkFence m_fence;
 };
 
+enum class queue_selection {
+  round_robin,
+  least_outstanding_work,
+};
+
+// Hands out the queues of one family so that independent job streams land on
+// different hardware queues. Outstanding work is counted by the fences passed
+// to submit(), so those fences must stay alive until they are signaled.
+template <class D> class queue_set : public D {
+public:
+  queue_set(uint32_t queue_family_index, uint32_t queue_count,
+            queue_selection selection = queue_selection::round_robin)
+      : m_selection{selection}, m_next_queue{0} {
+    if (queue_count == 0) {
+      throw std::runtime_error{"queue set needs at least one queue"};
+    }
+    m_queues.resize(queue_count);
+    for (uint32_t i = 0; i < queue_count; i++) {
+      m_queues[i].queue = D::get_device_queue(queue_family_index, i);
+    }
+  }
+  queue_set(const queue_set &) = delete;
+  queue_set(queue_set &&) = delete;
+  ~queue_set() { wait_idle(); }
+  queue_set &operator=(const queue_set &) = delete;
+  queue_set &operator=(queue_set &&) = delete;
+
+  uint32_t get_queue_count() const { return m_queues.size(); }
+  VkQueue get_queue(uint32_t index) const { return m_queues[index].queue; }
+
+  uint32_t select_queue() {
+    std::lock_guard lock{m_mutex};
+    return select_queue_locked();
+  }
+  // Submit to the selected queue, returns the index of the queue used.
+  uint32_t submit(uint32_t submit_count, const VkSubmitInfo *submits,
+                  VkFence fence) {
+    std::lock_guard lock{m_mutex};
+    uint32_t index = select_queue_locked();
+    submit_locked(index, submit_count, submits, fence);
+    return index;
+  }
+  void submit(uint32_t index, uint32_t submit_count,
+              const VkSubmitInfo *submits, VkFence fence) {
+    std::lock_guard lock{m_mutex};
+    submit_locked(index, submit_count, submits, fence);
+  }
+  uint32_t get_outstanding_work(uint32_t index) {
+    std::lock_guard lock{m_mutex};
+    return retire_signaled_fences(m_queues[index]);
+  }
+  void wait_idle() {
+    std::lock_guard lock{m_mutex};
+    for (auto &queue : m_queues) {
+      vkQueueWaitIdle(queue.queue);
+      queue.pending_fences.clear();
+    }
+  }
+
+private:
+  struct tracked_queue {
+    VkQueue queue;
+    std::vector<VkFence> pending_fences;
+  };
+  uint32_t retire_signaled_fences(tracked_queue &queue) {
+    std::erase_if(queue.pending_fences,
+                  [this](VkFence fence) { return D::is_fence_signaled(fence); });
+    return queue.pending_fences.size();
+  }
+  uint32_t select_queue_locked() {
+    if (m_selection == queue_selection::round_robin) {
+      uint32_t index = m_next_queue;
+      m_next_queue = (m_next_queue + 1) % m_queues.size();
+      return index;
+    }
+    // start from the round robin cursor so that ties are spread out.
+    uint32_t best = m_next_queue;
+    uint32_t best_work = UINT32_MAX;
+    for (uint32_t i = 0; i < m_queues.size(); i++) {
+      uint32_t index = (m_next_queue + i) % m_queues.size();
+      uint32_t work = retire_signaled_fences(m_queues[index]);
+      if (work < best_work) {
+        best = index;
+        best_work = work;
+      }
+    }
+    m_next_queue = (best + 1) % m_queues.size();
+    return best;
+  }
+  void submit_locked(uint32_t index, uint32_t submit_count,
+                     const VkSubmitInfo *submits, VkFence fence) {
+    auto &queue = m_queues[index];
+    auto res = vkQueueSubmit(queue.queue, submit_count, submits, fence);
+    if (res != VK_SUCCESS) {
+      throw std::runtime_error{"failed to submit to queue"};
+    }
+    retire_signaled_fences(queue);
+    if (fence != VK_NULL_HANDLE) {
+      queue.pending_fences.push_back(fence);
+    }
+  }
+
+  queue_selection m_selection;
+  uint32_t m_next_queue;
+  std::vector<tracked_queue> m_queues;
+  std::mutex m_mutex;
+};
+
+// Loads the cache blob from D::get_pipeline_cache_path() when it matches this
+// device, feeds it to every create_pipeline() of the stack, and writes it back
+// on destruction or save_pipeline_cache().
+template <class D> class add_pipeline_cache : public D {
+public:
+  add_pipeline_cache()
+      : m_pipeline_cache{D::create_pipeline_cache(
+            vulkan_hpp_helper::load_pipeline_cache_data(
+                D::get_pipeline_cache_path(),
+                D::get_physical_device_properties()))} {}
+  add_pipeline_cache(const add_pipeline_cache &) = delete;
+  add_pipeline_cache(add_pipeline_cache &&) = delete;
+  ~add_pipeline_cache() {
+    try {
+      save_pipeline_cache();
+    } catch (...) {
+    }
+    D::destroy_pipeline_cache(m_pipeline_cache);
+  }
+  add_pipeline_cache &operator=(const add_pipeline_cache &) = delete;
+  add_pipeline_cache &operator=(add_pipeline_cache &&) = delete;
+
+  VkPipelineCache get_pipeline_cache() const { return m_pipeline_cache; }
+  void save_pipeline_cache() {
+    vulkan_hpp_helper::save_pipeline_cache_data(
+        D::get_pipeline_cache_path(),
+        D::get_pipeline_cache_data(m_pipeline_cache));
+  }
+  auto create_pipeline(VkShaderModule shader_module,
+                       VkPipelineLayout pipeline_layout,
+                       const VkSpecializationInfo *specialization_info = nullptr,
+                       const char *entry_name = "main") {
+    return D::create_pipeline(shader_module, pipeline_layout,
+                              specialization_info, entry_name,
+                              m_pipeline_cache);
+  }
+  auto create_pipelines(
+      std::span<const compute_pipeline_description> descriptions) {
+    return D::create_pipelines(descriptions, m_pipeline_cache);
+  }
+
+private:
+  VkPipelineCache m_pipeline_cache;
+};
+
+// Records the creation feedback of every compute pipeline the stack creates.
+// Stack it below add_pipeline_cache so that the cache is passed through.
+template <class D> class add_pipeline_creation_stats : public D {
+public:
+  auto create_pipeline(
+      VkShaderModule shader_module, VkPipelineLayout pipeline_layout,
+      const VkSpecializationInfo *specialization_info = nullptr,
+      const char *entry_name = "main",
+      VkPipelineCache pipeline_cache = VK_NULL_HANDLE) {
+    vulkan_hpp_helper::pipeline_creation_feedback feedback{1};
+    auto create_info =
+        get_compute_pipeline_create_info(compute_pipeline_description{
+            shader_module, pipeline_layout, specialization_info, entry_name});
+    create_info.pNext = &feedback.info;
+    auto pipeline = D::create_compute_pipeline(create_info, pipeline_cache);
+    m_stats.record("compute", 0, feedback, compute_stage);
+    return pipeline;
+  }
+  auto create_pipelines(
+      std::span<const compute_pipeline_description> descriptions,
+      VkPipelineCache pipeline_cache = VK_NULL_HANDLE) {
+    auto results = D::create_pipelines(descriptions, pipeline_cache);
+    for (auto &result : results) {
+      vulkan_hpp_helper::pipeline_creation_feedback feedback{1};
+      feedback.pipeline = result.feedback;
+      feedback.stages[0] = result.stage_feedback;
+      m_stats.record("compute", 0, feedback, compute_stage);
+    }
+    return results;
+  }
+  auto &get_pipeline_creation_stats() { return m_stats; }
+
+private:
+  static constexpr VkShaderStageFlagBits compute_stage[] = {
+      VK_SHADER_STAGE_COMPUTE_BIT};
+  vulkan_hpp_helper::pipeline_creation_stats m_stats;
+};
+
+// Compiles compute pipelines on a thread pool instead of the calling thread.
+// submit_pipeline() returns at once and the handle waits for the pipeline on
+// first use. Stacked on add_pipeline_cache, all workers share its cache.
+// The pipelines are owned by this class and destroyed with it.
+template <class D> class add_async_pipelines : public D {
+public:
+  class pipeline_handle {
+  public:
+    pipeline_handle() = default;
+    explicit pipeline_handle(std::shared_future<VkPipeline> future)
+        : m_future{std::move(future)} {}
+    bool is_ready() const {
+      return m_future.wait_for(std::chrono::seconds{0}) ==
+             std::future_status::ready;
+    }
+    // rethrows the error if the pipeline failed to compile.
+    VkPipeline get() const { return m_future.get(); }
+
+  private:
+    std::shared_future<VkPipeline> m_future;
+  };
+
+  add_async_pipelines(
+      uint32_t thread_count = thread_pool::default_thread_count())
+      : m_thread_pool{thread_count} {}
+  add_async_pipelines(const add_async_pipelines &) = delete;
+  add_async_pipelines(add_async_pipelines &&) = delete;
+  ~add_async_pipelines() {
+    for (auto &pipeline : m_pipelines) {
+      try {
+        D::destroy_pipeline(pipeline.get());
+      } catch (...) {
+      }
+    }
+  }
+  add_async_pipelines &operator=(const add_async_pipelines &) = delete;
+  add_async_pipelines &operator=(add_async_pipelines &&) = delete;
+
+  // shader_module has to stay alive until the handle is ready.
+  pipeline_handle submit_pipeline(
+      VkShaderModule shader_module, VkPipelineLayout pipeline_layout,
+      vulkan_hpp_helper::specialization_constants specialization = {}) {
+    return add_pipeline(m_thread_pool.submit(
+        [this, shader_module, pipeline_layout,
+         specialization = std::move(specialization)]() {
+          return compile_pipeline(shader_module, pipeline_layout,
+                                  specialization);
+        }));
+  }
+  // the spirv file is read and turned into a module on the worker too.
+  pipeline_handle submit_pipeline(
+      std::filesystem::path shader_path, VkPipelineLayout pipeline_layout,
+      vulkan_hpp_helper::specialization_constants specialization = {}) {
+    return add_pipeline(m_thread_pool.submit(
+        [this, shader_path = std::move(shader_path), pipeline_layout,
+         specialization = std::move(specialization)]() {
+          spirv_file file{shader_path};
+          VkShaderModule shader_module = D::create_shader_module(file);
+          try {
+            auto pipeline =
+                compile_pipeline(shader_module, pipeline_layout, specialization);
+            D::destroy_shader_module(shader_module);
+            return pipeline;
+          } catch (...) {
+            D::destroy_shader_module(shader_module);
+            throw;
+          }
+        }));
+  }
+  auto &get_thread_pool() { return m_thread_pool; }
+
+private:
+  VkPipeline compile_pipeline(
+      VkShaderModule shader_module, VkPipelineLayout pipeline_layout,
+      const vulkan_hpp_helper::specialization_constants &specialization) {
+    auto info = specialization.get_info();
+    return D::create_pipeline(shader_module, pipeline_layout,
+                              specialization.empty() ? nullptr : &info);
+  }
+  pipeline_handle add_pipeline(std::future<VkPipeline> future) {
+    std::lock_guard lock{m_mutex};
+    m_pipelines.emplace_back(future.share());
+    return pipeline_handle{m_pipelines.back()};
+  }
+
+  std::mutex m_mutex;
+  std::vector<std::shared_future<VkPipeline>> m_pipelines;
+  thread_pool m_thread_pool;
+};
+
 template <class D> class descriptor_set : public D {
 public:
 public:
@@ -2857,32 +6386,174 @@ private:
   VkPipelineLayout m_pipeline_layout;
 };
 
+// set layouts and pipeline layout reflected from the code of the stages,
+// shared with other pipelines of the same interface.
+template <class D> class reflected_pipeline_layout : public D {
+public:
+  reflected_pipeline_layout(
+      std::span<const vulkan_helper::spirv_reflection> stages)
+      : m_layout{vulkan_hpp_helper::pipeline_registry::for_device(
+                     vk::Device{D::get_vulkan_device()})
+                     ->get_reflected_pipeline_layout(stages)} {}
+  std::vector<VkDescriptorSetLayout> get_descriptor_set_layouts() const {
+    std::vector<VkDescriptorSetLayout> layouts;
+    for (auto &layout : m_layout.set_layouts) {
+      layouts.push_back(*layout);
+    }
+    return layouts;
+  }
+  VkPipelineLayout get_pipeline_layout() const {
+    return *m_layout.pipeline_layout;
+  }
+
+private:
+  vulkan_hpp_helper::pipeline_registry::reflected_pipeline_layout m_layout;
+};
+
 template <class D> class shader_module {
 public:
+  // the module is shared with every other load of the same code.
   shader_module(D &device, const spirv_file &file)
-      : m_device{device}, m_shader_module{device.create_shader_module(file)} {}
-  ~shader_module() { m_device.destroy_shader_module(m_shader_module); }
+      : m_shader_module{
+            vulkan_hpp_helper::pipeline_registry::for_device(
+                vk::Device{device.get_vulkan_device()})
+                ->get_shader_module(std::span{file.data(), file.size() / 4})} {}
+  shader_module(D &device, std::span<const uint32_t> code)
+      : m_shader_module{vulkan_hpp_helper::pipeline_registry::for_device(
+                            vk::Device{device.get_vulkan_device()})
+                            ->get_shader_module(code)} {}
 
-  auto get_shader_module() const { return m_shader_module; }
+  VkShaderModule get_shader_module() const { return *m_shader_module; }
 
 private:
-  D &m_device;
-  VkShaderModule m_shader_module;
+  std::shared_ptr<const vk::ShaderModule> m_shader_module;
 };
 
 template <class D> class pipeline : public D {
 public:
-  pipeline(std::invocable<D &> auto &&generate_shader_module)
-      : m_pipeline{D::create_pipeline(
-            generate_shader_module(*this).get_shader_module(),
-            D::get_pipeline_layout())} {}
+  pipeline(std::invocable<D &> auto &&generate_shader_module,
+           const vulkan_hpp_helper::specialization_constants &specialization =
+               {})
+      : m_pipeline{create(generate_shader_module(*this).get_shader_module(),
+                          specialization)} {}
   ~pipeline() { D::destroy_pipeline(m_pipeline); }
   auto get_pipeline() const { return m_pipeline; }
 
 private:
+  VkPipeline
+  create(VkShaderModule shader_module,
+         const vulkan_hpp_helper::specialization_constants &specialization) {
+    auto info = specialization.get_info();
+    return D::create_pipeline(shader_module, D::get_pipeline_layout(),
+                              specialization.empty() ? nullptr : &info);
+  }
+
   VkPipeline m_pipeline;
 };
 
+namespace barrier_helper {
+inline bool ranges_overlap(uint64_t begin0, uint64_t count0, uint64_t begin1,
+                           uint64_t count1, uint64_t remaining) {
+  uint64_t end0 = count0 == remaining ? UINT64_MAX : begin0 + count0;
+  uint64_t end1 = count1 == remaining ? UINT64_MAX : begin1 + count1;
+  return begin0 < end1 && begin1 < end0;
+}
+inline bool overlap(const VkBufferMemoryBarrier2 &lhs,
+                    const VkBufferMemoryBarrier2 &rhs) {
+  return lhs.buffer == rhs.buffer &&
+         ranges_overlap(lhs.offset, lhs.size, rhs.offset, rhs.size,
+                        VK_WHOLE_SIZE);
+}
+inline bool overlap(const VkImageSubresourceRange &lhs,
+                    const VkImageSubresourceRange &rhs) {
+  return (lhs.aspectMask & rhs.aspectMask) &&
+         ranges_overlap(lhs.baseMipLevel, lhs.levelCount, rhs.baseMipLevel,
+                        rhs.levelCount, VK_REMAINING_MIP_LEVELS) &&
+         ranges_overlap(lhs.baseArrayLayer, lhs.layerCount, rhs.baseArrayLayer,
+                        rhs.layerCount, VK_REMAINING_ARRAY_LAYERS);
+}
+inline bool overlap(const VkImageMemoryBarrier2 &lhs,
+                    const VkImageMemoryBarrier2 &rhs) {
+  return lhs.image == rhs.image &&
+         overlap(lhs.subresourceRange, rhs.subresourceRange);
+}
+inline bool same_range(const VkImageSubresourceRange &lhs,
+                       const VkImageSubresourceRange &rhs) {
+  return lhs.aspectMask == rhs.aspectMask &&
+         lhs.baseMipLevel == rhs.baseMipLevel &&
+         lhs.levelCount == rhs.levelCount &&
+         lhs.baseArrayLayer == rhs.baseArrayLayer &&
+         lhs.layerCount == rhs.layerCount;
+}
+// the stages a mask stands for, with the meta stages spelled out.
+inline VkPipelineStageFlags2 expand_stages(VkPipelineStageFlags2 stages) {
+  if (stages & VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT) {
+    return ~(VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT |
+             VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT);
+  }
+  if (stages & VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT) {
+    stages |= VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+              VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT |
+              VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT |
+              VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+              VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+              VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT |
+              VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+  }
+  if (stages & VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT) {
+    stages |= VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT |
+              VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT;
+  }
+  if (stages & VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT) {
+    stages |= VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT |
+              VK_PIPELINE_STAGE_2_TESSELLATION_CONTROL_SHADER_BIT |
+              VK_PIPELINE_STAGE_2_TESSELLATION_EVALUATION_SHADER_BIT |
+              VK_PIPELINE_STAGE_2_GEOMETRY_SHADER_BIT;
+  }
+  if (stages & VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT) {
+    stages |= VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT |
+              VK_PIPELINE_STAGE_2_RESOLVE_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT;
+  }
+  return stages & ~(VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT |
+                    VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT);
+}
+// whether a barrier with first scope src_stage_mask would chain after one
+// with second scope dst_stage_mask if they were recorded separately.
+inline bool chains_after(VkPipelineStageFlags2 src_stage_mask,
+                         VkPipelineStageFlags2 dst_stage_mask) {
+  return (expand_stages(src_stage_mask) & expand_stages(dst_stage_mask)) != 0;
+}
+template <class Barrier> void merge_masks(Barrier &dst, const Barrier &src) {
+  dst.srcStageMask |= src.srcStageMask;
+  dst.srcAccessMask |= src.srcAccessMask;
+  dst.dstStageMask |= src.dstStageMask;
+  dst.dstAccessMask |= src.dstAccessMask;
+}
+} // namespace barrier_helper
+
+template <class Command>
+concept indirect_command = std::same_as<Command, VkDispatchIndirectCommand> ||
+                           std::same_as<Command, VkDrawIndirectCommand> ||
+                           std::same_as<Command, VkDrawIndexedIndirectCommand>;
+
+// Argument buffer written on the GPU and consumed by indirect commands,
+// matching the std430 block
+//   { uint count; uint pad[3]; Command commands[]; }
+template <indirect_command Command> struct indirect_arguments_layout {
+  static constexpr VkDeviceSize count_offset = 0;
+  static constexpr VkDeviceSize commands_offset = 16;
+  static constexpr uint32_t stride = sizeof(Command);
+  static constexpr VkDeviceSize size(uint32_t max_command_count) {
+    return commands_offset + VkDeviceSize{stride} * max_command_count;
+  }
+};
+
+// Barriers are queued with sync2 masks and merged where possible, then the
+// whole batch is recorded with one vkCmdPipelineBarrier2 right before the next
+// action command. A barrier that cannot be merged with a queued barrier on the
+// same resource flushes the batch first, so ordering is preserved. Barriers of
+// one batch do not chain, so a barrier whose source stages overlap the
+// destination stages of another queued barrier also starts a new batch.
 template <class D> class command_buffer : public D {
 public:
   command_buffer()
@@ -2897,6 +6568,7 @@ public:
     }
   }
   void end() {
+    flush_barriers();
     auto res = vkEndCommandBuffer(m_command_buffer);
     if (res != VK_SUCCESS) {
       throw std::runtime_error{"failed to end command buffer"};
@@ -2912,8 +6584,249 @@ public:
                             &descriptor_set, 0, NULL);
   }
   void dispatch(uint32_t x, uint32_t y, uint32_t z) {
+    flush_barriers();
     vkCmdDispatch(m_command_buffer, x, y, z);
   }
+  void reset_query_pool(VkQueryPool query_pool, uint32_t first_query,
+                        uint32_t query_count) {
+    vkCmdResetQueryPool(m_command_buffer, query_pool, first_query,
+                        query_count);
+  }
+  void write_timestamp(VkPipelineStageFlags2 stage, VkQueryPool query_pool,
+                       uint32_t query) {
+    flush_barriers();
+    vkCmdWriteTimestamp2(m_command_buffer, stage, query_pool, query);
+  }
+  void dispatch_indirect(VkBuffer buffer, VkDeviceSize offset) {
+    flush_barriers();
+    vkCmdDispatchIndirect(m_command_buffer, buffer, offset);
+  }
+  void copy_buffer(VkBuffer src, VkBuffer dst, VkDeviceSize src_offset,
+                   VkDeviceSize dst_offset, VkDeviceSize size) {
+    flush_barriers();
+    VkBufferCopy region{};
+    region.srcOffset = src_offset;
+    region.dstOffset = dst_offset;
+    region.size = size;
+    vkCmdCopyBuffer(m_command_buffer, src, dst, 1, &region);
+  }
+  void bind_vertex_buffer(uint32_t binding, VkBuffer buffer,
+                          VkDeviceSize offset) {
+    vkCmdBindVertexBuffers(m_command_buffer, binding, 1, &buffer, &offset);
+  }
+  void bind_index_buffer(VkBuffer buffer, VkDeviceSize offset,
+                         VkIndexType index_type) {
+    vkCmdBindIndexBuffer(m_command_buffer, buffer, offset, index_type);
+  }
+  void draw(uint32_t vertex_count, uint32_t instance_count,
+            uint32_t first_vertex, uint32_t first_instance) {
+    flush_barriers();
+    vkCmdDraw(m_command_buffer, vertex_count, instance_count, first_vertex,
+              first_instance);
+  }
+  void draw_indexed(uint32_t index_count, uint32_t instance_count,
+                    uint32_t first_index, int32_t vertex_offset,
+                    uint32_t first_instance) {
+    flush_barriers();
+    vkCmdDrawIndexed(m_command_buffer, index_count, instance_count,
+                     first_index, vertex_offset, first_instance);
+  }
+  void draw_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count,
+                     uint32_t stride) {
+    flush_barriers();
+    vkCmdDrawIndirect(m_command_buffer, buffer, offset, draw_count, stride);
+  }
+  void draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset,
+                             uint32_t draw_count, uint32_t stride) {
+    flush_barriers();
+    vkCmdDrawIndexedIndirect(m_command_buffer, buffer, offset, draw_count,
+                             stride);
+  }
+  // needs device_create_info::enable_draw_indirect_count().
+  void draw_indirect_count(VkBuffer buffer, VkDeviceSize offset,
+                           VkBuffer count_buffer,
+                           VkDeviceSize count_buffer_offset,
+                           uint32_t max_draw_count, uint32_t stride) {
+    flush_barriers();
+    vkCmdDrawIndirectCount(m_command_buffer, buffer, offset, count_buffer,
+                           count_buffer_offset, max_draw_count, stride);
+  }
+  void draw_indexed_indirect_count(VkBuffer buffer, VkDeviceSize offset,
+                                   VkBuffer count_buffer,
+                                   VkDeviceSize count_buffer_offset,
+                                   uint32_t max_draw_count, uint32_t stride) {
+    flush_barriers();
+    vkCmdDrawIndexedIndirectCount(m_command_buffer, buffer, offset,
+                                  count_buffer, count_buffer_offset,
+                                  max_draw_count, stride);
+  }
+  // Consume an argument buffer laid out by indirect_arguments_layout<Command>.
+  // Draws use the count written at count_offset, a dispatch uses the first
+  // command.
+  template <indirect_command Command>
+  void execute_indirect(VkBuffer buffer, uint32_t max_command_count) {
+    using layout = indirect_arguments_layout<Command>;
+    if constexpr (std::same_as<Command, VkDispatchIndirectCommand>) {
+      dispatch_indirect(buffer, layout::commands_offset);
+    } else if constexpr (std::same_as<Command, VkDrawIndirectCommand>) {
+      draw_indirect_count(buffer, layout::commands_offset, buffer,
+                          layout::count_offset, max_command_count,
+                          layout::stride);
+    } else {
+      draw_indexed_indirect_count(buffer, layout::commands_offset, buffer,
+                                  layout::count_offset, max_command_count,
+                                  layout::stride);
+    }
+  }
+  // make arguments written by a compute shader visible to indirect commands.
+  void indirect_arguments_barrier(VkBuffer buffer) {
+    buffer_barrier(buffer, 0, VK_WHOLE_SIZE,
+                   VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                   VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+  }
+  void memory_barrier(VkPipelineStageFlags2 src_stage_mask,
+                      VkAccessFlags2 src_access_mask,
+                      VkPipelineStageFlags2 dst_stage_mask,
+                      VkAccessFlags2 dst_access_mask) {
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = src_stage_mask;
+    barrier.srcAccessMask = src_access_mask;
+    barrier.dstStageMask = dst_stage_mask;
+    barrier.dstAccessMask = dst_access_mask;
+    memory_barrier(barrier);
+  }
+  // every global barrier is merged into one, which only widens the dependency.
+  void memory_barrier(const VkMemoryBarrier2 &barrier) {
+    // merging into the queued global barrier keeps a chain between the two.
+    const void *merge_target =
+        m_memory_barriers.empty() ? nullptr : &m_memory_barriers.front();
+    if (waits_for_queued(barrier.srcStageMask, merge_target)) {
+      flush_barriers();
+    }
+    if (m_memory_barriers.empty()) {
+      m_memory_barriers.push_back(barrier);
+      m_memory_barriers.back().pNext = nullptr;
+    } else {
+      barrier_helper::merge_masks(m_memory_barriers.front(), barrier);
+    }
+  }
+  void buffer_barrier(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                      VkPipelineStageFlags2 src_stage_mask,
+                      VkAccessFlags2 src_access_mask,
+                      VkPipelineStageFlags2 dst_stage_mask,
+                      VkAccessFlags2 dst_access_mask,
+                      uint32_t src_queue_family_index = VK_QUEUE_FAMILY_IGNORED,
+                      uint32_t dst_queue_family_index = VK_QUEUE_FAMILY_IGNORED) {
+    VkBufferMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier.srcStageMask = src_stage_mask;
+    barrier.srcAccessMask = src_access_mask;
+    barrier.dstStageMask = dst_stage_mask;
+    barrier.dstAccessMask = dst_access_mask;
+    barrier.srcQueueFamilyIndex = src_queue_family_index;
+    barrier.dstQueueFamilyIndex = dst_queue_family_index;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    buffer_barrier(barrier);
+  }
+  void buffer_barrier(const VkBufferMemoryBarrier2 &barrier) {
+    auto merge_target = std::ranges::find_if(
+        m_buffer_barriers,
+        [&barrier](auto &queued) { return barrier_helper::overlap(queued, barrier); });
+    if (merge_target != m_buffer_barriers.end() &&
+        (merge_target->srcQueueFamilyIndex != barrier.srcQueueFamilyIndex ||
+         merge_target->dstQueueFamilyIndex != barrier.dstQueueFamilyIndex)) {
+      flush_barriers();
+    } else if (waits_for_queued(barrier.srcStageMask,
+                                merge_target != m_buffer_barriers.end()
+                                    ? &*merge_target
+                                    : nullptr)) {
+      flush_barriers();
+    }
+    for (auto &queued : m_buffer_barriers) {
+      if (!barrier_helper::overlap(queued, barrier)) {
+        continue;
+      }
+      VkDeviceSize end = queued.size == VK_WHOLE_SIZE ||
+                                 barrier.size == VK_WHOLE_SIZE
+                             ? VK_WHOLE_SIZE
+                             : std::max(queued.offset + queued.size,
+                                        barrier.offset + barrier.size);
+      queued.offset = std::min(queued.offset, barrier.offset);
+      queued.size = end == VK_WHOLE_SIZE ? VK_WHOLE_SIZE : end - queued.offset;
+      barrier_helper::merge_masks(queued, barrier);
+      return;
+    }
+    m_buffer_barriers.push_back(barrier);
+    m_buffer_barriers.back().pNext = nullptr;
+  }
+  void image_barrier(VkImage image, const VkImageSubresourceRange &range,
+                     VkImageLayout old_layout, VkImageLayout new_layout,
+                     VkPipelineStageFlags2 src_stage_mask,
+                     VkAccessFlags2 src_access_mask,
+                     VkPipelineStageFlags2 dst_stage_mask,
+                     VkAccessFlags2 dst_access_mask,
+                     uint32_t src_queue_family_index = VK_QUEUE_FAMILY_IGNORED,
+                     uint32_t dst_queue_family_index = VK_QUEUE_FAMILY_IGNORED) {
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = src_stage_mask;
+    barrier.srcAccessMask = src_access_mask;
+    barrier.dstStageMask = dst_stage_mask;
+    barrier.dstAccessMask = dst_access_mask;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = src_queue_family_index;
+    barrier.dstQueueFamilyIndex = dst_queue_family_index;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+    image_barrier(barrier);
+  }
+  void image_barrier(const VkImageMemoryBarrier2 &barrier) {
+    auto merge_target = std::ranges::find_if(
+        m_image_barriers,
+        [&barrier](auto &queued) { return barrier_helper::overlap(queued, barrier); });
+    if (merge_target != m_image_barriers.end()) {
+      auto &queued = *merge_target;
+      if (barrier_helper::same_range(queued.subresourceRange,
+                                     barrier.subresourceRange) &&
+          queued.oldLayout == barrier.oldLayout &&
+          queued.newLayout == barrier.newLayout &&
+          queued.srcQueueFamilyIndex == barrier.srcQueueFamilyIndex &&
+          queued.dstQueueFamilyIndex == barrier.dstQueueFamilyIndex &&
+          !waits_for_queued(barrier.srcStageMask, &queued)) {
+        barrier_helper::merge_masks(queued, barrier);
+        return;
+      }
+      flush_barriers();
+    } else if (waits_for_queued(barrier.srcStageMask, nullptr)) {
+      flush_barriers();
+    }
+    m_image_barriers.push_back(barrier);
+    m_image_barriers.back().pNext = nullptr;
+  }
+  void flush_barriers() {
+    if (m_memory_barriers.empty() && m_buffer_barriers.empty() &&
+        m_image_barriers.empty()) {
+      return;
+    }
+    VkDependencyInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    info.memoryBarrierCount = m_memory_barriers.size();
+    info.pMemoryBarriers = m_memory_barriers.data();
+    info.bufferMemoryBarrierCount = m_buffer_barriers.size();
+    info.pBufferMemoryBarriers = m_buffer_barriers.data();
+    info.imageMemoryBarrierCount = m_image_barriers.size();
+    info.pImageMemoryBarriers = m_image_barriers.data();
+    vkCmdPipelineBarrier2(m_command_buffer, &info);
+    m_memory_barriers.clear();
+    m_buffer_barriers.clear();
+    m_image_barriers.clear();
+  }
   void pipeline_barrier(VkPipelineStageFlags src_stage_mask,
                         VkPipelineStageFlags dst_stage_mask,
                         VkDependencyFlags dependency_flags,
@@ -2923,6 +6836,7 @@ public:
                         const VkBufferMemoryBarrier *buffer_memory_barriers,
                         uint32_t image_memory_barrier_count,
                         const VkImageMemoryBarrier *image_memory_barriers) {
+    flush_barriers();
     vkCmdPipelineBarrier(m_command_buffer, src_stage_mask, dst_stage_mask,
                          dependency_flags, memory_barrier_count,
                          memory_barriers, buffer_memory_barrier_count,
@@ -2933,12 +6847,319 @@ public:
                          const VkClearColorValue *clear_color,
                          uint32_t range_count,
                          const VkImageSubresourceRange *ranges) {
+    flush_barriers();
     vkCmdClearColorImage(m_command_buffer, image, layout, clear_color,
                          range_count, ranges);
   }
 
 private:
+  // merge_target is the queued barrier the new one is merged into, the merged
+  // masks cover the chain between the two.
+  bool waits_for_queued(VkPipelineStageFlags2 src_stage_mask,
+                        const void *merge_target) const {
+    auto waits = [src_stage_mask, merge_target](auto &queued) {
+      return &queued != merge_target &&
+             barrier_helper::chains_after(src_stage_mask, queued.dstStageMask);
+    };
+    return std::ranges::any_of(m_memory_barriers, waits) ||
+           std::ranges::any_of(m_buffer_barriers, waits) ||
+           std::ranges::any_of(m_image_barriers, waits);
+  }
+
   VkCommandBuffer m_command_buffer;
+  std::vector<VkMemoryBarrier2> m_memory_barriers;
+  std::vector<VkBufferMemoryBarrier2> m_buffer_barriers;
+  std::vector<VkImageMemoryBarrier2> m_image_barriers;
+};
+
+constexpr VkAccessFlags2 write_access_flags =
+    VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT |
+    VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_VIDEO_DECODE_WRITE_BIT_KHR;
+inline bool is_write_access(VkAccessFlags2 access) {
+  return (access & write_access_flags) != 0;
+}
+
+struct image_use {
+  VkPipelineStageFlags2 stages;
+  VkAccessFlags2 access;
+  VkImageLayout layout;
+  uint32_t queue_family_index = VK_QUEUE_FAMILY_IGNORED;
+};
+
+// Tracks layout, last writer, readers since the last write and queue family
+// ownership of every (mip level, array layer) of registered images. use()
+// returns only the barriers the declared use needs: reads after an already
+// visible write and repeated reads in the same layout need none.
+// For a queue family ownership transfer, the returned barrier has to be
+// recorded on both the releasing and the acquiring queue.
+class image_state_tracker {
+public:
+  void add_image(VkImage image, VkImageAspectFlags aspect_mask,
+                 uint32_t mip_levels, uint32_t array_layers,
+                 VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+                 uint32_t queue_family_index = VK_QUEUE_FAMILY_IGNORED) {
+    auto state = subresource_state{};
+    state.layout = initial_layout;
+    state.queue_family_index = queue_family_index;
+    m_images[image] = tracked_image{
+        aspect_mask, mip_levels, array_layers,
+        std::vector<subresource_state>(mip_levels * array_layers, state)};
+  }
+  void remove_image(VkImage image) { m_images.erase(image); }
+  bool contains(VkImage image) const { return m_images.contains(image); }
+
+  VkImageLayout get_layout(VkImage image, uint32_t mip_level,
+                           uint32_t array_layer) const {
+    auto &tracked = get_tracked_image(image);
+    return tracked.states[mip_level * tracked.array_layers + array_layer]
+        .layout;
+  }
+  // Record a layout change done outside of the tracker, for example by a
+  // render pass finalLayout.
+  void set_layout(VkImage image, const VkImageSubresourceRange &range,
+                  const image_use &use) {
+    auto &tracked = get_tracked_image(image);
+    for_each_subresource(tracked, range, [&use](subresource_state &state) {
+      state = subresource_state{};
+      state.layout = use.layout;
+      state.queue_family_index = use.queue_family_index;
+      state.write_stages = use.stages;
+      state.write_access = use.access & write_access_mask(use.access);
+      state.visible.emplace_back(use.stages, use.access);
+    });
+  }
+
+  // Record a layout change made on another queue, which a semaphore already
+  // orders before the next use here. The accesses tracked here are kept, and
+  // wait_stages, the destination stages of the semaphore wait, count as a
+  // read, so the next barrier chains with the wait.
+  void set_layout(VkImage image, const VkImageSubresourceRange &range,
+                  VkImageLayout layout, VkPipelineStageFlags2 wait_stages) {
+    auto &tracked = get_tracked_image(image);
+    for_each_subresource(tracked, range,
+                         [layout, wait_stages](subresource_state &state) {
+                           state.layout = layout;
+                           state.read_stages |= wait_stages;
+                         });
+  }
+
+  // discard: the previous contents are not needed, so a layout transition
+  // may start from VK_IMAGE_LAYOUT_UNDEFINED.
+  std::vector<VkImageMemoryBarrier2> use(VkImage image,
+                                         const VkImageSubresourceRange &range,
+                                         const image_use &use,
+                                         bool discard = false) {
+    auto &tracked = get_tracked_image(image);
+    auto resolved = resolve_range(tracked, range);
+    std::vector<VkImageMemoryBarrier2> barriers;
+    for (uint32_t mip = resolved.baseMipLevel;
+         mip < resolved.baseMipLevel + resolved.levelCount; mip++) {
+      std::optional<VkImageMemoryBarrier2> run;
+      for (uint32_t layer = resolved.baseArrayLayer;
+           layer < resolved.baseArrayLayer + resolved.layerCount; layer++) {
+        auto &state = tracked.states[mip * tracked.array_layers + layer];
+        auto barrier = transit(state, use, discard);
+        if (run && barrier && same_barrier(*run, *barrier) &&
+            run->subresourceRange.baseArrayLayer +
+                    run->subresourceRange.layerCount ==
+                layer) {
+          run->subresourceRange.layerCount++;
+          continue;
+        }
+        if (run) {
+          append_barrier(barriers, *run);
+        }
+        run.reset();
+        if (barrier) {
+          barrier->image = image;
+          barrier->subresourceRange = VkImageSubresourceRange{
+              resolved.aspectMask, mip, 1, layer, 1};
+          run = barrier;
+        }
+      }
+      if (run) {
+        append_barrier(barriers, *run);
+      }
+    }
+    return barriers;
+  }
+  template <class CommandBuffer>
+  void use(CommandBuffer &command_buffer, VkImage image,
+           const VkImageSubresourceRange &range, const image_use &image_use,
+           bool discard = false) {
+    for (auto &barrier : use(image, range, image_use, discard)) {
+      command_buffer.image_barrier(barrier);
+    }
+  }
+
+private:
+  struct stage_access {
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    bool operator==(const stage_access &) const = default;
+  };
+  struct subresource_state {
+    VkImageLayout layout;
+    uint32_t queue_family_index;
+    VkPipelineStageFlags2 write_stages;
+    VkAccessFlags2 write_access;
+    VkPipelineStageFlags2 read_stages;
+    // stage and access pairs the last write is already visible to.
+    std::vector<stage_access> visible;
+  };
+  struct tracked_image {
+    VkImageAspectFlags aspect_mask;
+    uint32_t mip_levels;
+    uint32_t array_layers;
+    std::vector<subresource_state> states;
+  };
+
+  static VkAccessFlags2 write_access_mask(VkAccessFlags2 access) {
+    return access & write_access_flags;
+  }
+  static std::optional<VkImageMemoryBarrier2>
+  transit(subresource_state &state, const image_use &use, bool discard) {
+    bool write = is_write_access(use.access);
+    bool layout_change = state.layout != use.layout;
+    bool queue_family_change =
+        state.queue_family_index != VK_QUEUE_FAMILY_IGNORED &&
+        use.queue_family_index != VK_QUEUE_FAMILY_IGNORED &&
+        state.queue_family_index != use.queue_family_index;
+
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.oldLayout = state.layout;
+    barrier.newLayout = state.layout;
+    barrier.dstStageMask = use.stages;
+    barrier.dstAccessMask = use.access;
+
+    if (layout_change || queue_family_change) {
+      barrier.srcStageMask = state.write_stages | state.read_stages;
+      barrier.srcAccessMask = state.write_access;
+      barrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+      barrier.newLayout = use.layout;
+      if (queue_family_change) {
+        barrier.srcQueueFamilyIndex = state.queue_family_index;
+        barrier.dstQueueFamilyIndex = use.queue_family_index;
+      }
+      // the transition itself is a write that later uses must wait for.
+      state.layout = use.layout;
+      if (use.queue_family_index != VK_QUEUE_FAMILY_IGNORED) {
+        state.queue_family_index = use.queue_family_index;
+      }
+      state.write_stages = use.stages;
+      state.write_access = write_access_mask(use.access);
+      state.read_stages = write ? 0 : use.stages;
+      state.visible.assign(1, stage_access{use.stages, use.access});
+      return barrier;
+    }
+    if (write) {
+      auto src_stages = state.write_stages | state.read_stages;
+      auto src_access = state.write_access;
+      state.write_stages = use.stages;
+      state.write_access = write_access_mask(use.access);
+      state.read_stages = 0;
+      state.visible.assign(1, stage_access{use.stages, use.access});
+      if (src_stages == 0) {
+        return std::nullopt;
+      }
+      barrier.srcStageMask = src_stages;
+      barrier.srcAccessMask = src_access;
+      return barrier;
+    }
+    state.read_stages |= use.stages;
+    if (state.write_stages == 0) {
+      return std::nullopt;
+    }
+    bool visible = std::ranges::any_of(
+        state.visible, [&use](const stage_access &visible) {
+          return (use.stages & ~visible.stages) == 0 &&
+                 (use.access & ~visible.access) == 0;
+        });
+    if (visible) {
+      return std::nullopt;
+    }
+    state.visible.emplace_back(use.stages, use.access);
+    barrier.srcStageMask = state.write_stages;
+    barrier.srcAccessMask = state.write_access;
+    return barrier;
+  }
+  static bool same_barrier(const VkImageMemoryBarrier2 &lhs,
+                           const VkImageMemoryBarrier2 &rhs) {
+    return lhs.srcStageMask == rhs.srcStageMask &&
+           lhs.srcAccessMask == rhs.srcAccessMask &&
+           lhs.dstStageMask == rhs.dstStageMask &&
+           lhs.dstAccessMask == rhs.dstAccessMask &&
+           lhs.oldLayout == rhs.oldLayout && lhs.newLayout == rhs.newLayout &&
+           lhs.srcQueueFamilyIndex == rhs.srcQueueFamilyIndex &&
+           lhs.dstQueueFamilyIndex == rhs.dstQueueFamilyIndex;
+  }
+  // merge with the barrier of the previous mip level if it covers the same
+  // layers.
+  static void append_barrier(std::vector<VkImageMemoryBarrier2> &barriers,
+                             const VkImageMemoryBarrier2 &barrier) {
+    for (auto &previous : barriers) {
+      auto &range = previous.subresourceRange;
+      auto &next = barrier.subresourceRange;
+      if (same_barrier(previous, barrier) &&
+          range.baseArrayLayer == next.baseArrayLayer &&
+          range.layerCount == next.layerCount &&
+          range.baseMipLevel + range.levelCount == next.baseMipLevel) {
+        range.levelCount++;
+        return;
+      }
+    }
+    barriers.push_back(barrier);
+  }
+  static VkImageSubresourceRange
+  resolve_range(const tracked_image &tracked,
+                const VkImageSubresourceRange &range) {
+    auto resolved = range;
+    if (resolved.levelCount == VK_REMAINING_MIP_LEVELS) {
+      resolved.levelCount = tracked.mip_levels - range.baseMipLevel;
+    }
+    if (resolved.layerCount == VK_REMAINING_ARRAY_LAYERS) {
+      resolved.layerCount = tracked.array_layers - range.baseArrayLayer;
+    }
+    if (resolved.baseMipLevel + resolved.levelCount > tracked.mip_levels ||
+        resolved.baseArrayLayer + resolved.layerCount > tracked.array_layers) {
+      throw std::runtime_error{"subresource range out of tracked image"};
+    }
+    return resolved;
+  }
+  static void for_each_subresource(tracked_image &tracked,
+                                   const VkImageSubresourceRange &range,
+                                   auto &&fun) {
+    auto resolved = resolve_range(tracked, range);
+    for (uint32_t mip = resolved.baseMipLevel;
+         mip < resolved.baseMipLevel + resolved.levelCount; mip++) {
+      for (uint32_t layer = resolved.baseArrayLayer;
+           layer < resolved.baseArrayLayer + resolved.layerCount; layer++) {
+        fun(tracked.states[mip * tracked.array_layers + layer]);
+      }
+    }
+  }
+  tracked_image &get_tracked_image(VkImage image) {
+    auto it = m_images.find(image);
+    if (it == m_images.end()) {
+      throw std::runtime_error{"image is not tracked"};
+    }
+    return it->second;
+  }
+  const tracked_image &get_tracked_image(VkImage image) const {
+    auto it = m_images.find(image);
+    if (it == m_images.end()) {
+      throw std::runtime_error{"image is not tracked"};
+    }
+    return it->second;
+  }
+
+  std::map<VkImage, tracked_image> m_images;
 };
 
 template <class D> class add_storage_buffer : public D {
@@ -2955,6 +7176,38 @@ private:
   VkBuffer m_storage_buffer;
 };
 
+template <indirect_command Command, class D>
+class add_indirect_buffer : public D {
+public:
+  using indirect_command_type = Command;
+  add_indirect_buffer()
+      : m_indirect_buffer{D::create_buffer(
+            D::get_queue_family_index(),
+            indirect_arguments_layout<Command>::size(
+                D::get_max_indirect_command_count()),
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT)} {}
+  ~add_indirect_buffer() { D::destroy_buffer(m_indirect_buffer); }
+  auto get_indirect_buffer() const { return m_indirect_buffer; }
+
+private:
+  VkBuffer m_indirect_buffer;
+};
+
+template <class D> class add_indirect_memory : public D {
+public:
+  add_indirect_memory()
+      : m_indirect_memory{D::alloc_device_memory(
+            D::get_memory_properties(), D::get_indirect_buffer(),
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)} {}
+  ~add_indirect_memory() { D::free_device_memory(m_indirect_memory); }
+  auto get_indirect_memory() const { return m_indirect_memory; }
+
+private:
+  VkDeviceMemory m_indirect_memory;
+};
+
 template <class D> class add_storage_memory : public D {
 public:
   add_storage_memory()
@@ -2980,6 +7233,221 @@ public:
 private:
   void *m_storage_memory_ptr;
 };
+
+// Copies a file or host data of any size into a buffer through a ring of
+// staging slots, so that the staging memory stays at slot_count * slot_size.
+// A chunk is read into a free slot, copied into the destination by its own
+// command buffer, and the slot is reused once the fence of that copy is
+// signaled. Reads of the next chunks overlap the copies of the previous ones.
+// The copies end with a barrier, so later submissions to the same queue,
+// queue_index of get_queue_family_index(), see the data.
+template <class D> class streaming_uploader : public D {
+public:
+  streaming_uploader(uint32_t slot_count = 4, VkDeviceSize slot_size = 4 << 20,
+                     uint32_t queue_index = 0)
+      : m_queue{D::get_device_queue(D::get_queue_family_index(), queue_index)},
+        m_slot_size{slot_size},
+        m_staging_buffer{D::create_buffer(D::get_queue_family_index(),
+                                          get_staging_size(slot_count,
+                                                           slot_size),
+                                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT)},
+        m_staging_memory{D::alloc_device_memory(
+            D::get_memory_properties(), m_staging_buffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)},
+        m_staging_ptr{static_cast<std::byte *>(
+            D::map_device_memory(m_staging_memory, 0, VK_WHOLE_SIZE))},
+        m_next_slot{0},
+        m_loader{async_file_loader_options{
+            .chunk_size = slot_size,
+            .max_bytes_in_flight = slot_count * slot_size,
+            .queue_depth = slot_count,
+        }} {
+    m_slots.resize(slot_count);
+    for (auto &slot : m_slots) {
+      slot.command_pool = D::create_command_pool(D::get_queue_family_index());
+      slot.command_buffer = D::allocate_command_buffer(slot.command_pool);
+      slot.fence = D::create_fence();
+    }
+  }
+  streaming_uploader(const streaming_uploader &) = delete;
+  streaming_uploader(streaming_uploader &&) = delete;
+  ~streaming_uploader() {
+    wait_idle();
+    for (auto &slot : m_slots) {
+      D::destroy_fence(slot.fence);
+      D::destroy_command_pool(slot.command_pool);
+    }
+    D::unmap_device_memory(m_staging_memory);
+    D::free_device_memory(m_staging_memory);
+    D::destroy_buffer(m_staging_buffer);
+  }
+  streaming_uploader &operator=(const streaming_uploader &) = delete;
+  streaming_uploader &operator=(streaming_uploader &&) = delete;
+
+  // Returns once every chunk is submitted, the copies may still run. dst
+  // needs VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+  uint64_t upload(const std::filesystem::path &path, VkBuffer dst,
+                  VkDeviceSize dst_offset = 0) {
+    // opened once, every chunk is a load from the same file.
+    auto file = async_file_loader::open_file(path);
+    uint64_t size = file->size();
+    for (uint64_t offset = 0; offset < size; offset += m_slot_size) {
+      uint32_t index = acquire_slot();
+      auto chunk_size = std::min(m_slot_size, size - offset);
+      auto &slot = m_slots[index];
+      slot.state = slot_state::reading;
+      slot.load = m_loader.load(
+          file, get_slot_memory(index).first(chunk_size),
+          [this, index, dst, chunk_offset = dst_offset + offset](
+              std::span<std::byte> data) {
+            submit_copy(index, dst, chunk_offset, data.size());
+          },
+          offset);
+    }
+    finish_reads();
+    return size;
+  }
+  // For data already in memory, e.g. a mapped_file.
+  uint64_t upload(std::span<const std::byte> data, VkBuffer dst,
+                  VkDeviceSize dst_offset = 0) {
+    for (uint64_t offset = 0; offset < data.size(); offset += m_slot_size) {
+      uint32_t index = acquire_slot();
+      auto chunk_size = std::min<uint64_t>(m_slot_size, data.size() - offset);
+      std::memcpy(get_slot_memory(index).data(), data.data() + offset,
+                  chunk_size);
+      submit_copy(index, dst, dst_offset + offset, chunk_size);
+    }
+    return data.size();
+  }
+  // Waits for every read and copy.
+  void wait_idle() {
+    m_loader.wait_idle();
+    for (auto &slot : m_slots) {
+      if (slot.state == slot_state::copying) {
+        D::wait_for_fence(slot.fence);
+        D::reset_fence(slot.fence);
+      }
+      slot.state = slot_state::free;
+    }
+  }
+
+  uint32_t get_slot_count() const { return m_slots.size(); }
+  VkDeviceSize get_slot_size() const { return m_slot_size; }
+
+private:
+  enum class slot_state {
+    free,
+    reading,
+    copying,
+  };
+  struct slot {
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    slot_state state = slot_state::free;
+    async_file_load load;
+  };
+
+  // checked before any member is created.
+  static VkDeviceSize get_staging_size(uint32_t slot_count,
+                                       VkDeviceSize slot_size) {
+    if (slot_count == 0 || slot_size == 0) {
+      throw std::runtime_error{"streaming uploader needs at least one slot"};
+    }
+    return slot_count * slot_size;
+  }
+  std::span<std::byte> get_slot_memory(uint32_t index) {
+    return {m_staging_ptr + index * m_slot_size,
+            static_cast<size_t>(m_slot_size)};
+  }
+  // takes the slots in ring order, they are reused in the order they were
+  // filled.
+  uint32_t acquire_slot() {
+    while (true) {
+      m_loader.poll();
+      auto &slot = m_slots[m_next_slot];
+      check_read(slot);
+      if (slot.state == slot_state::copying &&
+          D::is_fence_signaled(slot.fence)) {
+        D::reset_fence(slot.fence);
+        slot.state = slot_state::free;
+      }
+      if (slot.state == slot_state::free) {
+        uint32_t index = m_next_slot;
+        m_next_slot = (m_next_slot + 1) % m_slots.size();
+        return index;
+      }
+      if (slot.state == slot_state::copying) {
+        D::wait_for_fence(slot.fence);
+      } else {
+        m_loader.wait_for_completion();
+      }
+    }
+  }
+  // the completion callback moves a slot on to copying, a slot still
+  // reading after its load completed has failed.
+  void check_read(slot &slot) {
+    if (slot.state == slot_state::reading && slot.load.is_ready()) {
+      slot.state = slot_state::free;
+      slot.load.wait();
+    }
+  }
+  void finish_reads() {
+    m_loader.wait_idle();
+    for (auto &slot : m_slots) {
+      check_read(slot);
+    }
+  }
+  void submit_copy(uint32_t index, VkBuffer dst, VkDeviceSize dst_offset,
+                   VkDeviceSize size) {
+    auto &slot = m_slots[index];
+    D::reset_command_pool(slot.command_pool);
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(slot.command_buffer, &begin_info) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to begin command buffer"};
+    }
+    VkBufferCopy region{};
+    region.srcOffset = index * m_slot_size;
+    region.dstOffset = dst_offset;
+    region.size = size;
+    vkCmdCopyBuffer(slot.command_buffer, m_staging_buffer, dst, 1, &region);
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+    VkDependencyInfo dependency_info{};
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.memoryBarrierCount = 1;
+    dependency_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(slot.command_buffer, &dependency_info);
+    if (vkEndCommandBuffer(slot.command_buffer) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to end command buffer"};
+    }
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &slot.command_buffer;
+    if (vkQueueSubmit(m_queue, 1, &submit_info, slot.fence) != VK_SUCCESS) {
+      throw std::runtime_error{"failed to submit to queue"};
+    }
+    slot.state = slot_state::copying;
+  }
+
+  VkQueue m_queue;
+  VkDeviceSize m_slot_size;
+  VkBuffer m_staging_buffer;
+  VkDeviceMemory m_staging_memory;
+  std::byte *m_staging_ptr;
+  uint32_t m_next_slot;
+  std::vector<slot> m_slots;
+  async_file_loader m_loader;
+};
 }; // namespace vulkan_helper
 
 #include "platform.hpp"